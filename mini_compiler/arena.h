@@ -0,0 +1,104 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Fixed-size array living inside an AstArena.
+template <typename T>
+struct ArenaList {
+    T* items = nullptr;
+    uint32_t count = 0;
+
+    T* begin() const { return items; }
+    T* end() const { return items + count; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    T& operator[](size_t i) const { return items[i]; }
+};
+
+//
+// Bump allocator owning every node of one compilation unit.
+// Nodes are never destroyed individually: dropping (or reset()ing)
+// the arena releases the whole tree by freeing its slabs, so node
+// types must not own heap memory of their own.
+//
+class AstArena {
+public:
+    AstArena() = default;
+
+    // Smaller slabs for trees known to be small, which would otherwise
+    // each hold a mostly empty 64 KB slab.
+    explicit AstArena(size_t slabSize) : slabSize(slabSize) {}
+    AstArena(const AstArena&) = delete;
+    AstArena& operator=(const AstArena&) = delete;
+
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        static_assert(is_trivially_destructible<T>::value,
+                      "arena nodes are never destroyed");
+        nodes++;
+        return new (allocate(sizeof(T), alignof(T)))
+            T(std::forward<Args>(args)...);
+    }
+
+    // Copy v[from..] into arena storage and truncate v back to `from`,
+    // so one scratch vector can serve as a stack for nested lists.
+    template <typename T>
+    ArenaList<T> list(vector<T>& v, size_t from = 0) {
+        ArenaList<T> out;
+        size_t n = v.size() - from;
+        if (n == 0) return out;
+        out.items = static_cast<T*>(
+            allocate(sizeof(T) * n, alignof(T)));
+        for (size_t i = 0; i < n; ++i)
+            new (&out.items[i]) T(v[from + i]);
+        out.count = static_cast<uint32_t>(n);
+        v.resize(from);
+        return out;
+    }
+
+    void reset() {
+        slabs.clear();
+        cur = end = nullptr;
+        nodes = used = 0;
+    }
+
+    size_t nodeCount() const { return nodes; }
+    size_t bytesUsed() const { return used; }
+
+private:
+    static constexpr size_t SLAB_SIZE = 64 * 1024;
+
+    vector<unique_ptr<char[]>> slabs;
+    char* cur = nullptr;
+    char* end = nullptr;
+    size_t slabSize = SLAB_SIZE;
+    size_t nodes = 0;
+    size_t used = 0;
+
+    void* allocate(size_t size, size_t align) {
+        uintptr_t p = (reinterpret_cast<uintptr_t>(cur) + align - 1)
+                      & ~(uintptr_t)(align - 1);
+        if (!cur || p + size > reinterpret_cast<uintptr_t>(end)) {
+            size_t n = size + align > slabSize ? size + align : slabSize;
+            slabs.emplace_back(new char[n]);
+            cur = slabs.back().get();
+            end = cur + n;
+            p = (reinterpret_cast<uintptr_t>(cur) + align - 1)
+                & ~(uintptr_t)(align - 1);
+        }
+        used += size;
+        cur = reinterpret_cast<char*>(p + size);
+        return reinterpret_cast<void*>(p);
+    }
+};
+
+#endif
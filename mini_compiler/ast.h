@@ -1,10 +1,14 @@
-
 #ifndef AST_H
 #define AST_H
 
-#include <string>
-#include <vector>
-#include <memory>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include "arena.h"
+#include "interner.h"
+#include "lexer.h"
+#include "types.h"
+#include "value.h"
 
 // Forward declarations
 struct Expr;
@@ -12,108 +16,167 @@ struct Stmt;
 
 using namespace std;
 
-using ExprPtr = shared_ptr<Expr>;
-using StmtPtr = shared_ptr<Stmt>;
+// Nodes are allocated in an AstArena and referenced by raw pointer;
+// the arena owns them. Identifiers are interned Symbols; number
+// literals are parsed once, by the parser. Every node records the
+// source span it was parsed from, for diagnostics.
+using ExprPtr = Expr*;
+using StmtPtr = Stmt*;
+
+// Deepest nesting of expressions, and of statements, that --run and
+// --emit-module accept, and that a module may contain. The parser and
+// checker keep their stacks on the heap, but the module encoder and
+// decoder, the optimizer and the backends recurse once per level; the
+// register compiler overflows an 8 MB stack at about 20000.
+constexpr size_t MAX_COMPILED_DEPTH = 10000;
+
+// Every node carries its kind, so passes dispatch with a switch
+// (see visitor.h) instead of RTTI. Nodes have no virtual functions.
+enum class ExprKind : uint8_t {
+    NUMBER, BOOL, VAR, ASSIGN, BINARY, UNARY, CALL, ERROR
+};
+
+enum class StmtKind : uint8_t {
+    VAR_DECL, EXPR, RETURN, BLOCK, FUNCTION
+};
+
+// Number of kinds, for tables indexed by kind.
+constexpr size_t EXPR_KINDS = static_cast<size_t>(ExprKind::ERROR) + 1;
+constexpr size_t STMT_KINDS = static_cast<size_t>(StmtKind::FUNCTION) + 1;
 
 //
 // -------- EXPRESSIONS --------
 //
 struct Expr {
-    virtual ~Expr() = default;
+    ExprKind kind;
+    SourceLoc loc;
+    explicit Expr(ExprKind k) : kind(k) {}
 };
 
 struct NumberExpr : Expr {
-    string value;
-    explicit NumberExpr(string v) : value(move(v)) {}
+    static constexpr ExprKind KIND = ExprKind::NUMBER;
+    Value value;
+    explicit NumberExpr(Value v) : Expr(KIND), value(v) {}
 };
 
 struct BoolExpr : Expr {
+    static constexpr ExprKind KIND = ExprKind::BOOL;
     bool value;
-    explicit BoolExpr(bool v) : value(v) {}
+    explicit BoolExpr(bool v) : Expr(KIND), value(v) {}
 };
 
 struct VarExpr : Expr {
-    string name;
-    explicit VarExpr(string n) : name(move(n)) {}
+    static constexpr ExprKind KIND = ExprKind::VAR;
+    Symbol name;
+    explicit VarExpr(Symbol n) : Expr(KIND), name(n) {}
 };
 
 struct AssignExpr : Expr {
-    string name;
+    static constexpr ExprKind KIND = ExprKind::ASSIGN;
+    Symbol name;
     ExprPtr value;
 
-    AssignExpr(string n, ExprPtr v)
-        : name(move(n)), value(move(v)) {}
+    AssignExpr(Symbol n, ExprPtr v)
+        : Expr(KIND), name(n), value(v) {}
 };
 
 
 
 struct BinaryExpr : Expr {
-    string op;
+    static constexpr ExprKind KIND = ExprKind::BINARY;
+    TokenType op;
     ExprPtr left;
     ExprPtr right;
 
-    BinaryExpr(string o, ExprPtr l, ExprPtr r)
-        : op(move(o)), left(move(l)), right(move(r)) {}
+    BinaryExpr(TokenType o, ExprPtr l, ExprPtr r)
+        : Expr(KIND), op(o), left(l), right(r) {}
 };
 
 struct UnaryExpr : Expr {
-    string op;
+    static constexpr ExprKind KIND = ExprKind::UNARY;
+    TokenType op;
     ExprPtr expr;
 
-    UnaryExpr(string o, ExprPtr e)
-        : op(move(o)), expr(move(e)) {}
+    UnaryExpr(TokenType o, ExprPtr e)
+        : Expr(KIND), op(o), expr(e) {}
 };
 
 struct CallExpr : Expr {
-    string callee;
-    vector<ExprPtr> args;
+    static constexpr ExprKind KIND = ExprKind::CALL;
+    Symbol callee;
+    ArenaList<ExprPtr> args;
 
-    CallExpr(string c, vector<ExprPtr> a)
-        : callee(move(c)), args(move(a)) {}
+    CallExpr(Symbol c, ArenaList<ExprPtr> a)
+        : Expr(KIND), callee(c), args(a) {}
+};
+
+// Stands in for an expression that failed to parse. Its type is the
+// error type, so it never triggers further diagnostics; a program
+// containing one never reaches a backend.
+struct ErrorExpr : Expr {
+    static constexpr ExprKind KIND = ExprKind::ERROR;
+    ErrorExpr() : Expr(KIND) {}
 };
 
 //
 // -------- STATEMENTS --------
 //
 struct Stmt {
-    virtual ~Stmt() = default;
+    StmtKind kind;
+    SourceLoc loc;
+    explicit Stmt(StmtKind k) : kind(k) {}
 };
 
 struct VarDecl : Stmt {
-    string type;
-    string name;
+    static constexpr StmtKind KIND = StmtKind::VAR_DECL;
+    TypeId type;
+    Symbol name;
 
-    VarDecl(string t, string n)
-        : type(move(t)), name(move(n)) {}
+    VarDecl(TypeId t, Symbol n)
+        : Stmt(KIND), type(t), name(n) {}
 };
 
 struct ExprStmt : Stmt {
+    static constexpr StmtKind KIND = StmtKind::EXPR;
     ExprPtr expr;
-    explicit ExprStmt(ExprPtr e) : expr(move(e)) {}
+    explicit ExprStmt(ExprPtr e) : Stmt(KIND), expr(e) {}
 };
 
 struct ReturnStmt : Stmt {
+    static constexpr StmtKind KIND = StmtKind::RETURN;
     ExprPtr expr;   // may be null for void return
 
     explicit ReturnStmt(ExprPtr e)
-        : expr(move(e)) {}
+        : Stmt(KIND), expr(e) {}
 };
 
 struct BlockStmt : Stmt {
-    vector<StmtPtr> statements;
+    static constexpr StmtKind KIND = StmtKind::BLOCK;
+    ArenaList<StmtPtr> statements;
+
+    BlockStmt() : Stmt(KIND) {}
 };
 
 struct FunctionDecl : Stmt {
-    string returnType;
-    string name;
+    static constexpr StmtKind KIND = StmtKind::FUNCTION;
+    TypeId returnType = TypeTable::VOID;
+    Symbol name = 0;
 
     struct Param {
-        string type;
-        string name;
+        TypeId type;
+        Symbol name;
     };
 
-    vector<Param> params;
-    shared_ptr<BlockStmt> body;
+    ArenaList<Param> params;
+    BlockStmt* body = nullptr;
+
+    FunctionDecl() : Stmt(KIND) {}
 };
 
+// Checked downcast: returns null when the node is of another kind.
+template <typename T, typename Node>
+T* nodeAs(Node* n) {
+    return n->kind == T::KIND ? static_cast<T*>(n) : nullptr;
+}
+
 #endif
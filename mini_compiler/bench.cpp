@@ -0,0 +1,1785 @@
+/*
+Phase micro-benchmarks.
+
+Built as its own executable from every source except main.cpp
+(Code::Blocks target "Bench"), e.g.
+    g++ -std=c++17 -O2 -pthread bench.cpp bytecode.cpp cache.cpp \
+        diagnostics.cpp driver.cpp incremental.cpp interner.cpp interp.cpp \
+        jit.cpp lexer.cpp mappedfile.cpp module.cpp optimizer.cpp parser.cpp \
+        protocol.cpp regcode.cpp regvm.cpp scan.cpp semantic.cpp server.cpp \
+        stats.cpp symbol.cpp synth.cpp threadpool.cpp types.cpp vm.cpp -o bench
+
+Usage: bench <case> [size-in-KB]
+    lex     tokenize a generated program, report MB/s, allocations and
+            token buffer bytes per token
+    scan    tokenize a whitespace- and comment-heavy program and the
+            plain one with the scalar, SSE2 and AVX2 scan kernels
+    keywords
+            classify the words of an identifier-dense program with the
+            perfect-hash keyword table and with an unordered_map, and
+            lex the program
+    parse   parse pre-lexed tokens into the AST arena, report parse and
+            teardown time, node count and bytes per node
+    sema    type-check a parsed program, report MB/s of source
+    sema2   type-check the same program in one pass and in two-phase mode
+            on 1, 2, 4, ... 32 threads
+    nest    type-check functions whose bodies nest blocks 128 deep
+    deep    parse and type-check expressions nested 10^4, 10^5 and 10^6
+            deep (prefix minus, parentheses, calls, + and = chains) on
+            the default stack; report time per nesting level
+    operators
+            parse a program of long expressions over every operator with
+            the precedence-table parser and with a recursive descent
+            cascade of one function per precedence level (kept here as
+            the baseline); report ns/token, MB/s and the speedup
+    fold    constant-fold a program full of foldable arithmetic, report
+            nodes removed, pass time and bytecode size before and after
+    vm      run a binary call tree (2^21 - 1 calls, fib(30)-sized) on
+            the stack and register VMs, report dispatches and time
+    jit     run the same call tree through the AST interpreter, the stack
+            VM and native code, report time and speedup over AST walking
+    batch   write 256 generated files to a temp directory and check them
+            with the batch driver on 1, 2, 4, ... 32 threads; prints a
+            scaling chart
+    walk    visit every node of a parsed tree through the kind-tag
+            dispatch in visitor.h
+    rss     write a generated file and check it in a child process with
+            the eager and the streaming (--stream) front end, report
+            time and peak resident memory of each
+    stats   compile a generated file with the phase report (--time-report)
+            off and on, report the overhead and print the report
+    cache   check and run 64 generated files without the compile cache,
+            into an empty cache and from a filled one; report times and
+            hit rate
+    incremental
+            load a generated 100k-line program into an IncrementalDocument
+            and time random small edits (each undone again) and a
+            signature change many callers depend on; the diagnostics are
+            compared with a full check as it goes
+    server  run a compile server on a temp socket and check 16 small
+            files, one changed byte before each request: in a fresh
+            compiler process, through a client process, over one open
+            connection and over 8 at once; report requests/s, median
+            and p99 latency. Both processes are this executable
+            (`bench check FILE`, `bench call SOCKET FILE`); default 2 KB
+    module  save a generated library (default 1 MB) as a precompiled
+            module, then check its main() as a file of its own: against
+            the library's source and against the module; report the
+            time to lex and parse the library, to open the module and
+            to rebuild its AST for --run
+    suite   generate programs of several shapes (synth.h: deep nesting,
+            deep expressions, dense calls, many names, many parameters)
+            and time every phase and backend on each: 2 warmup and 11
+            measured runs, median and p10/p90/p99 per phase. Default
+            size 1 MB; `bench suite <KB> <file>` also names the JSON
+            results file (default bench_results.json)
+    gen     print a generated program, e.g.
+            bench gen kb=64 nesting=8 expr=6 calls=0.3 > big.mc
+*/
+
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "cache.h"
+#include "driver.h"
+#include "incremental.h"
+#include "interp.h"
+#include "jit.h"
+#include "lexer.h"
+#include "module.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "protocol.h"
+#include "regvm.h"
+#include "semantic.h"
+#include "server.h"
+#include "stats.h"
+#include "synth.h"
+#include "vm.h"
+#include "visitor.h"
+
+using namespace std;
+
+// ---------------- allocation counting ----------------
+// Counted by the operator new in stats.cpp; main() turns it on.
+static size_t allocCount() { return threadHeap().allocations; }
+static size_t allocBytes() { return threadHeap().bytes; }
+
+
+// ---------------- input generation ----------------
+static void appendFunction(string& src, int i) {
+    string f = "generated_function_" + to_string(i);
+    src += "// helper number " + to_string(i) + "\n";
+    src += "int " + f + "(int alpha, int beta) {\n";
+    src += "    int gamma;\n";
+    src += "    gamma = alpha * 2 + beta - 17 / (alpha + 1);\n";
+    src += "    return gamma;\n";
+    src += "}\n\n";
+}
+
+static string generateProgram(size_t targetBytes) {
+    string src;
+    src.reserve(targetBytes + 256);
+
+    for (int i = 0; src.size() < targetBytes; ++i)
+        appendFunction(src, i);
+    return src;
+}
+
+// Deeply indented, long comments and names, blank lines: most bytes
+// are skipped rather than turned into tokens.
+static string generateSpacious(size_t targetBytes) {
+    string src;
+    src.reserve(targetBytes + 1024);
+
+    string indent(24, ' ');
+    for (int i = 0; src.size() < targetBytes; ++i) {
+        string n = to_string(i);
+        src += "// ---------------------------------------------------------------\n"
+               "//  Function " + n + ": computes a weighted difference of its two\n"
+               "//  arguments; kept deliberately verbose for the scanner benchmark.\n"
+               "// ---------------------------------------------------------------\n\n";
+        src += "int spacious_generated_function_number_" + n +
+               "(int first_argument_value,    int second_argument_value) {\n\n";
+        src += indent + "int intermediate_accumulated_result;      // running total\n\n";
+        src += indent + "intermediate_accumulated_result    =    first_argument_value"
+               "   *   1234567890   +   second_argument_value;\n\n\n";
+        src += indent + "return   intermediate_accumulated_result;\t\t// done\n}\n\n\n";
+    }
+    return src;
+}
+
+// Nearly every token is a name: keywords, and identifiers that look
+// like them (same length, first or last letter) or are short.
+static string generateWordy(size_t targetBytes) {
+    static const char* words[] = {
+        "int", "in", "integer", "bool", "boolean", "void", "vid", "return",
+        "retain", "if", "of", "while", "whale", "true", "tree", "false",
+        "falsy", "x", "y1", "count", "fix", "ifx", "voids", "wh",
+    };
+    const size_t n = sizeof(words) / sizeof(words[0]);
+
+    string src;
+    src.reserve(targetBytes + 64);
+    for (size_t i = 0; src.size() < targetBytes; ++i) {
+        src += words[(i * 7 + i / n) % n];
+        src += (i % 12 == 11) ? '\n' : ' ';
+    }
+    return src;
+}
+
+// Like generateProgram, but the arithmetic is mostly constant
+// subexpressions and identities.
+static string generateFoldable(size_t targetBytes) {
+    string src;
+    src.reserve(targetBytes + 256);
+
+    for (int i = 0; src.size() < targetBytes; ++i) {
+        src += "int folded_function_" + to_string(i) + "(int alpha, int beta) {\n";
+        src += "    int gamma;\n";
+        src += "    gamma = alpha * (2 * 3 + 4) + beta * 1 - (8 / 2 - 4) * beta;\n";
+        src += "    gamma = gamma + 0 - -(-(" + to_string(i % 97) + ")) / 1;\n";
+        src += "    return gamma * (60 * 60 * 24) + alpha * 0;\n";
+        src += "}\n\n";
+    }
+    return src;
+}
+
+// Each function opens `depth` nested blocks; every level declares a
+// local and reads the parameter and the outermost local.
+static string generateNested(size_t targetBytes, int depth) {
+    string src;
+    src.reserve(targetBytes + 256);
+
+    for (int i = 0; src.size() < targetBytes; ++i) {
+        src += "int nested_" + to_string(i) + "(int p) {\n";
+        for (int d = 0; d < depth; ++d) {
+            string v = "v" + to_string(d);
+            src += "int " + v + "; " + v + " = v0 + p; {\n";
+        }
+        src += string(depth, '}') + "\nreturn p;\n}\n";
+    }
+    return src;
+}
+
+// main() with one expression nested `depth` deep: prefix minus,
+// parentheses, calls, a left-associative + chain or a right-associative
+// chain of assignments.
+static string generateDeep(const string& shape, size_t depth) {
+    string e;
+    if (shape == "minus") e = string(depth, '-') + "1";
+    else if (shape == "parens") e = string(depth, '(') + "1" + string(depth, ')');
+    else if (shape == "calls") {
+        for (size_t i = 0; i < depth; ++i) e += "f(";
+        e += "1" + string(depth, ')');
+    } else if (shape == "plus") {
+        e = "1";
+        for (size_t i = 0; i < depth; ++i) e += " + 1";
+    } else {
+        for (size_t i = 0; i < depth; ++i) e += "x = ";
+        e += "1";
+    }
+    return "int f(int p) { return p; }\n"
+           "int main() { int x; x = " + e + "; return x; }\n";
+}
+
+// Globals and a main() of assignments of random, well-typed
+// expressions over every operator, parenthesized only where the
+// precedence requires, so parsing is mostly operator chains.
+class OperatorProgram {
+public:
+    static string generate(size_t targetBytes) {
+        OperatorProgram g;
+        string src = "int a; int b; int c; int d; int e; int f; int g; int h;\n"
+                     "bool p; bool q; bool r; bool s;\n"
+                     "int main() {\n";
+        src.reserve(targetBytes + 256);
+        while (src.size() < targetBytes) {
+            if (g.next(2)) src += "    " + string(1, "pqrs"[g.next(4)]) + " = " + g.boolean(6).text;
+            else src += "    " + string(1, "abcdefgh"[g.next(8)]) + " = " + g.integer(6).text;
+            src += ";\n";
+        }
+        return src + "    return a;\n}\n";
+    }
+
+private:
+    struct Text {
+        string text;
+        int prec;                   // of the outermost operator; 7 for operands
+    };
+
+    uint64_t seed = 12345;
+
+    size_t next(size_t n) {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        return (seed >> 33) % n;
+    }
+
+    static string operand(const Text& e, int prec) {
+        return e.prec >= prec ? e.text : "(" + e.text + ")";
+    }
+
+    Text binary(const char* op, int prec, const Text& l, const Text& r) {
+        return { operand(l, prec) + " " + op + " " + operand(r, prec + 1), prec };
+    }
+
+    Text integer(int depth) {
+        size_t pick = depth ? next(8) : 0;
+        if (pick < 2) {
+            if (next(3)) return { string(1, "abcdefgh"[next(8)]), 7 };
+            return { to_string(next(1000)), 7 };
+        }
+        if (pick == 2) return { "-" + operand(integer(depth - 1), 7), 7 };
+        const char* ops[] = { "+", "-", "*", "/" };
+        size_t op = next(4);
+        return binary(ops[op], op < 2 ? 5 : 6, integer(depth - 1), integer(depth - 1));
+    }
+
+    Text boolean(int depth) {
+        size_t pick = depth ? next(8) : 0;
+        if (pick < 2) {
+            if (next(4)) return { string(1, "pqrs"[next(4)]), 7 };
+            return { next(2) ? "true" : "false", 7 };
+        }
+        if (pick == 2) return { "!" + operand(boolean(depth - 1), 7), 7 };
+        if (pick == 3) {
+            const char* ops[] = { "<", ">", "<=", ">=" };
+            return binary(ops[next(4)], 4, integer(depth - 1), integer(depth - 1));
+        }
+        if (pick == 4) {
+            const char* op = next(2) ? "==" : "!=";
+            if (next(2)) return binary(op, 3, integer(depth - 1), integer(depth - 1));
+            return binary(op, 3, boolean(depth - 1), boolean(depth - 1));
+        }
+        if (pick < 7) return binary("&&", 2, boolean(depth - 1), boolean(depth - 1));
+        return binary("||", 1, boolean(depth - 1), boolean(depth - 1));
+    }
+};
+
+// main() -> t0 -> 2x t1 -> ... -> 2^depth calls of t<depth>. The
+// language has no conditionals yet, so a fixed-depth call tree
+// stands in for a recursive fib(30).
+static string generateCallTree(int depth) {
+    string src = "int t" + to_string(depth) + "(int n) { return n; }\n";
+    for (int d = depth - 1; d >= 0; --d) {
+        string next = "t" + to_string(d + 1);
+        src += "int t" + to_string(d) + "(int n) { return " +
+               next + "(n) + " + next + "(n + 1); }\n";
+    }
+    src += "int main() { return t0(0); }\n";
+    return src;
+}
+
+static double secondsSince(chrono::steady_clock::time_point t0) {
+    return chrono::duration<double>(
+        chrono::steady_clock::now() - t0).count();
+}
+
+
+// ---------------- cases ----------------
+static void benchLex(size_t kb) {
+    string src = generateProgram(kb * 1024);
+    const int runs = 10;
+
+    size_t allocs0 = allocCount(), bytes0 = allocBytes();
+    size_t tokenCount = 0, tokenBytes = 0;
+
+    auto t0 = chrono::steady_clock::now();
+    for (int r = 0; r < runs; ++r) {
+        Interner names;
+        Lexer lexer(src, names);
+        TokenBuffer tokens = lexer.tokenize();
+        tokenCount = tokens.size();
+        tokenBytes = tokens.memoryBytes();
+    }
+    double secs = secondsSince(t0);
+
+    double mb = double(src.size()) * runs / (1024 * 1024);
+    cout << "lex: " << src.size() << " bytes, "
+         << tokenCount << " tokens\n"
+         << "  throughput   " << mb / secs << " MB/s\n"
+         << "  allocations  " << (allocCount() - allocs0) / runs
+         << " per run (" << (allocBytes() - bytes0) / runs << " bytes)\n"
+         << "  token memory " << double(tokenBytes) / tokenCount
+         << " bytes/token (sizeof(Token) is " << sizeof(Token) << ")\n";
+}
+
+static void benchScan(size_t kb) {
+    const int runs = 10;
+    struct Input { const char* name; string src; };
+    Input inputs[] = {
+        { "spacious", generateSpacious(kb * 1024) },
+        { "plain", generateProgram(kb * 1024) },
+    };
+
+    ScanLevel saved = scanLevel();
+    cout << "scan: best level " << scanLevelName(bestScanLevel()) << "\n"
+         << "  input      level      MB/s  speedup\n";
+
+    for (auto& in : inputs) {
+        double base = 0;
+        size_t tokens = 0;
+        for (auto level : { ScanLevel::SCALAR, ScanLevel::SSE2, ScanLevel::AVX2 }) {
+            if (level > bestScanLevel()) break;
+            setScanLevel(level);
+
+            vector<double> times;
+            for (int r = 0; r < runs; ++r) {
+                Interner names;
+                Lexer lexer(in.src, names);
+                auto t0 = chrono::steady_clock::now();
+                size_t n = lexer.tokenize().size();
+                times.push_back(secondsSince(t0));
+                if (tokens && n != tokens) cerr << "token count differs!\n";
+                tokens = n;
+            }
+            sort(times.begin(), times.end());
+            double mbs = in.src.size() / times[runs / 2] / (1024 * 1024);
+            if (level == ScanLevel::SCALAR) base = mbs;
+            printf("  %-9s  %-6s  %8.1f  %6.2fx\n", in.name,
+                   scanLevelName(level), mbs, mbs / base);
+        }
+    }
+    setScanLevel(saved);
+}
+
+static void benchKeywords(size_t kb) {
+    string src = generateWordy(kb * 1024);
+    vector<string_view> words;
+    for (size_t i = 0; i < src.size();) {
+        size_t j = src.find_first_of(" \n", i);
+        if (j == string::npos) j = src.size();
+        words.push_back(string_view(src).substr(i, j - i));
+        i = j + 1;
+    }
+
+    // The table the lexer used before keywordType().
+    const unordered_map<string_view, TokenType> map = {
+        {"int", TokenType::INT}, {"bool", TokenType::BOOL},
+        {"void", TokenType::VOID}, {"return", TokenType::RETURN},
+        {"if", TokenType::IF}, {"while", TokenType::WHILE},
+        {"true", TokenType::TRUE}, {"false", TokenType::FALSE},
+    };
+
+    const int runs = 10;
+    size_t hits = 0, mapHits = 0;
+    auto t0 = chrono::steady_clock::now();
+    for (int r = 0; r < runs; ++r)
+        for (string_view w : words)
+            hits += keywordType(w) != TokenType::IDENT;
+    double hashSecs = secondsSince(t0);
+
+    t0 = chrono::steady_clock::now();
+    for (int r = 0; r < runs; ++r)
+        for (string_view w : words)
+            mapHits += map.find(w) != map.end();
+    double mapSecs = secondsSince(t0);
+
+    if (hits != mapHits) cerr << "keyword counts differ!\n";
+
+    size_t allocs0 = allocCount();
+    t0 = chrono::steady_clock::now();
+    for (int r = 0; r < runs; ++r) {
+        Interner names;
+        Lexer lexer(src, names);
+        lexer.tokenize();
+    }
+    double lexSecs = secondsSince(t0);
+
+    double lookups = double(words.size()) * runs;
+    cout << "keywords: " << words.size() << " words, "
+         << hits / runs << " keywords\n";
+    printf("  perfect hash    %6.2f ns/word\n", hashSecs / lookups * 1e9);
+    printf("  unordered_map   %6.2f ns/word\n", mapSecs / lookups * 1e9);
+    printf("  lex             %6.1f MB/s, %zu allocations per run\n",
+           src.size() * runs / lexSecs / (1024 * 1024),
+           (allocCount() - allocs0) / runs);
+}
+
+static void benchParse(size_t kb) {
+    string src = generateProgram(kb * 1024);
+    Interner names;
+    Lexer lexer(src, names);
+    auto tokens = lexer.tokenize();
+    const int runs = 10;
+
+    size_t allocs0 = allocCount();
+    size_t nodes = 0, bytes = 0;
+    double parseSecs = 0, freeSecs = 0;
+
+    Diagnostics diags;
+    for (int r = 0; r < runs; ++r) {
+        optional<AstArena> arena;
+        arena.emplace();
+        auto t0 = chrono::steady_clock::now();
+        {
+            Parser parser(tokens, *arena, diags);
+            parser.parse();
+        }
+        parseSecs += secondsSince(t0);
+        nodes = arena->nodeCount();
+        bytes = arena->bytesUsed();
+
+        t0 = chrono::steady_clock::now();
+        arena.reset();
+        freeSecs += secondsSince(t0);
+    }
+
+    cout << "parse: " << tokens.size() << " tokens, "
+         << nodes << " nodes\n"
+         << "  parse        " << parseSecs / runs * 1000 << " ms\n"
+         << "  teardown     " << freeSecs / runs * 1000 << " ms\n"
+         << "  bytes/node   " << double(bytes) / nodes << "\n"
+         << "  allocations  " << (allocCount() - allocs0) / runs
+         << " per run\n";
+}
+
+static void benchSema(size_t kb) {
+    string src = generateProgram(kb * 1024);
+    Interner names;
+    Lexer lexer(src, names);
+    auto tokens = lexer.tokenize();
+    Diagnostics diags;
+    AstArena arena;
+    Parser parser(tokens, arena, diags);
+    auto program = parser.parse();
+    const int runs = 10;
+
+    auto t0 = chrono::steady_clock::now();
+    for (int r = 0; r < runs; ++r) {
+        SemanticAnalyzer semantic(names, diags);
+        semantic.analyze(program);
+    }
+    double secs = secondsSince(t0) / runs;
+
+    cout << "sema: " << arena.nodeCount() << " nodes\n"
+         << "  per run      " << secs * 1000 << " ms\n"
+         << "  throughput   " << src.size() / secs / (1024 * 1024)
+         << " MB/s\n";
+}
+
+static void benchSemaTwoPhase(size_t kb) {
+    string src = generateProgram(kb * 1024);
+    Interner names;
+    Lexer lexer(src, names);
+    auto tokens = lexer.tokenize();
+    Diagnostics diags;
+    AstArena arena;
+    Parser parser(tokens, arena, diags);
+    auto program = parser.parse();
+    const int runs = 5;
+
+    auto median = [&](auto&& analyzeOnce) {
+        vector<double> times;
+        for (int r = 0; r < runs; ++r) {
+            auto t0 = chrono::steady_clock::now();
+            analyzeOnce();
+            times.push_back(secondsSince(t0));
+        }
+        sort(times.begin(), times.end());
+        return times[runs / 2];
+    };
+
+    double onePass = median([&] { SemanticAnalyzer(names, diags).analyze(program); });
+
+    cout << "sema2: " << program.size() << " functions, "
+         << thread::hardware_concurrency() << " hardware threads\n"
+         << "  one pass     " << onePass * 1000 << " ms\n";
+
+    for (size_t threads = 1; threads <= 32; threads *= 2) {
+        double secs = median([&] {
+            SemanticAnalyzer(names, diags).analyzeTwoPhase(program, threads);
+        });
+        cout << "  two-phase x" << threads << string(threads < 10 ? 2 : 1, ' ')
+             << secs * 1000 << " ms  (" << onePass / secs << "x)\n";
+    }
+}
+
+static void benchNest(size_t kb) {
+    const int depth = 128;
+    string src = generateNested(kb * 1024, depth);
+    Interner names;
+    Lexer lexer(src, names);
+    auto tokens = lexer.tokenize();
+    Diagnostics diags;
+    AstArena arena;
+    Parser parser(tokens, arena, diags);
+    auto program = parser.parse();
+    const int runs = 10;
+
+    auto t0 = chrono::steady_clock::now();
+    for (int r = 0; r < runs; ++r) {
+        SemanticAnalyzer semantic(names, diags);
+        semantic.analyze(program);
+    }
+    double secs = secondsSince(t0) / runs;
+
+    cout << "nest: depth " << depth << ", " << program.size()
+         << " functions, " << arena.nodeCount() << " nodes\n"
+         << "  per run      " << secs * 1000 << " ms\n"
+         << "  per function " << secs * 1e6 / program.size() << " us\n";
+}
+
+static void benchDeep() {
+    const char* const shapes[] = { "minus", "parens", "calls", "plus", "assign" };
+    cout << "deep: ns per nesting level (parse, check), which stay flat\n"
+            "      while the parser and checker keep their stacks on the heap\n";
+    printf("  %-8s %10s %10s %10s %10s\n", "shape", "depth", "parse ms",
+           "check ms", "ns/level");
+
+    for (const char* shape : shapes) {
+        for (size_t depth : { size_t(10000), size_t(100000), size_t(1000000) }) {
+            string src = generateDeep(shape, depth);
+            Interner names;
+            Lexer lexer(src, names);
+            auto tokens = lexer.tokenize();
+            Diagnostics diags;
+            AstArena arena;
+
+            auto t0 = chrono::steady_clock::now();
+            Parser parser(tokens, arena, diags);
+            auto program = parser.parse();
+            double parseSecs = secondsSince(t0);
+
+            t0 = chrono::steady_clock::now();
+            SemanticAnalyzer(names, diags).analyze(program);
+            double checkSecs = secondsSince(t0);
+
+            if (diags.hasErrors()) {
+                cerr << "deep: " << shape << " did not check:\n"
+                     << diags.render(src);
+                exit(1);
+            }
+            printf("  %-8s %10zu %10.2f %10.2f %10.1f\n", shape, depth,
+                   parseSecs * 1000, checkSecs * 1000,
+                   (parseSecs + checkSecs) * 1e9 / depth);
+        }
+    }
+}
+
+// ---------------- operators ----------------
+//
+// The expression parser before the precedence table: one function per
+// level, each calling the next tighter one, so every operand passes
+// through all eight. Parses just the `name = expr;` statements of
+// OperatorProgram's main() into the same nodes Parser builds.
+//
+class CascadeParser {
+public:
+    CascadeParser(const TokenBuffer& tokens, AstArena& arena)
+        : stream(tokens), arena(arena) {}
+
+    vector<StmtPtr> parse() {
+        vector<StmtPtr> statements;
+        while (!match(TokenType::LBRACE)) stream.advance();
+        while (stream.peekType() != TokenType::RETURN) {
+            SourceLoc at = stream.peekLocation();
+            statements.push_back(node<ExprStmt>(at, assignment()));
+            match(TokenType::SEMI);
+        }
+        return statements;
+    }
+
+private:
+    TokenStream stream;
+    AstArena& arena;
+
+    bool match(TokenType t) {
+        if (stream.peekType() != t) return false;
+        stream.advance();
+        return true;
+    }
+
+    template <typename T, typename... Args>
+    T* node(SourceLoc at, Args&&... args) {
+        T* n = arena.make<T>(forward<Args>(args)...);
+        n->loc = at;
+        return n;
+    }
+
+    // One left-associative level: `operators` over `next` operands.
+    template <typename Next>
+    ExprPtr level(Next next, initializer_list<TokenType> operators) {
+        ExprPtr expr = (this->*next)();
+        for (;;) {
+            TokenType op = stream.peekType();
+            if (find(operators.begin(), operators.end(), op) == operators.end())
+                return expr;
+            stream.advance();
+            SourceLoc at = stream.previousLocation();
+            expr = node<BinaryExpr>(at, op, expr, (this->*next)());
+        }
+    }
+
+    ExprPtr assignment() {
+        ExprPtr target = logicOr();
+        if (!match(TokenType::ASSIGN)) return target;
+        ExprPtr value = assignment();
+        auto var = nodeAs<VarExpr>(target);
+        return node<AssignExpr>(var->loc, var->name, value);
+    }
+
+    ExprPtr logicOr() { return level(&CascadeParser::logicAnd, { TokenType::OR }); }
+    ExprPtr logicAnd() { return level(&CascadeParser::equality, { TokenType::AND }); }
+    ExprPtr equality() {
+        return level(&CascadeParser::comparison, { TokenType::EQ, TokenType::NEQ });
+    }
+    ExprPtr comparison() {
+        return level(&CascadeParser::term, { TokenType::LT, TokenType::GT,
+                                             TokenType::LE, TokenType::GE });
+    }
+    ExprPtr term() {
+        return level(&CascadeParser::factor, { TokenType::PLUS, TokenType::MINUS });
+    }
+    ExprPtr factor() {
+        return level(&CascadeParser::unary, { TokenType::STAR, TokenType::SLASH });
+    }
+
+    ExprPtr unary() {
+        TokenType op = stream.peekType();
+        if (op != TokenType::MINUS && op != TokenType::NOT) return primary();
+        stream.advance();
+        SourceLoc at = stream.previousLocation();
+        return node<UnaryExpr>(at, op, unary());
+    }
+
+    ExprPtr primary() {
+        if (match(TokenType::TRUE)) return node<BoolExpr>(stream.previousLocation(), true);
+        if (match(TokenType::FALSE)) return node<BoolExpr>(stream.previousLocation(), false);
+        if (match(TokenType::NUMBER)) {
+            Token literal = stream.previous();
+            Value v = 0;
+            from_chars(literal.lexeme.data(), literal.lexeme.data() + literal.lexeme.size(), v);
+            return node<NumberExpr>(literal.location(), v);
+        }
+        if (match(TokenType::LPAREN)) {
+            ExprPtr inner = assignment();
+            match(TokenType::RPAREN);
+            return inner;
+        }
+        match(TokenType::IDENT);
+        return node<VarExpr>(stream.previousLocation(), stream.previousSymbol());
+    }
+};
+
+static void benchOperators(size_t kb) {
+    string src = OperatorProgram::generate(kb * 1024);
+    Interner names;
+    Lexer lexer(src, names);
+    auto tokens = lexer.tokenize();
+    const int runs = 10;
+
+    // The program checks, and both parsers build the same expressions
+    // (main()'s `return a` aside).
+    {
+        Diagnostics diags;
+        AstArena arena, cascadeArena;
+        auto program = Parser(tokens, arena, diags).parse();
+        SemanticAnalyzer(names, diags).analyze(program);
+        CompileStats table, cascade;
+        table.countNodes(program);
+        cascade.countNodes(CascadeParser(tokens, cascadeArena).parse());
+        table.exprNodes[size_t(ExprKind::VAR)]--;
+
+        if (diags.hasErrors() || !equal(begin(table.exprNodes), end(table.exprNodes),
+                                        begin(cascade.exprNodes))) {
+            cerr << "operators: the parsers disagree, or the program does not check\n"
+                 << diags.render(src);
+            exit(1);
+        }
+    }
+
+    auto best = [&](auto&& parseOnce) {
+        double fastest = 1e30;
+        for (int r = 0; r < runs; ++r) {
+            AstArena arena;
+            auto t0 = chrono::steady_clock::now();
+            parseOnce(arena);
+            fastest = min(fastest, secondsSince(t0));
+        }
+        return fastest;
+    };
+
+    Diagnostics diags;
+    double table = best([&](AstArena& arena) { Parser(tokens, arena, diags).parse(); });
+    double cascade = best([&](AstArena& arena) { CascadeParser(tokens, arena).parse(); });
+
+    cout << "operators: " << tokens.size() << " tokens, best of " << runs << "\n";
+    printf("  precedence table  %8.2f ms  %6.2f ns/token  %7.1f MB/s\n",
+           table * 1000, table * 1e9 / tokens.size(),
+           src.size() / table / (1024 * 1024));
+    printf("  recursive cascade %8.2f ms  %6.2f ns/token  %7.1f MB/s\n",
+           cascade * 1000, cascade * 1e9 / tokens.size(),
+           src.size() / cascade / (1024 * 1024));
+    printf("  speedup           %8.2fx\n", cascade / table);
+}
+
+static void benchFold(size_t kb) {
+    string src = generateFoldable(kb * 1024);
+    Interner names;
+    Lexer lexer(src, names);
+    auto tokens = lexer.tokenize();
+    Diagnostics diags;
+    AstArena arena;
+    Parser parser(tokens, arena, diags);
+    auto program = parser.parse();
+    SemanticAnalyzer(names, diags).analyze(program);
+
+    size_t nodes = arena.nodeCount();
+    size_t before = BytecodeCompiler(names).compile(program).code.size();
+
+    Optimizer optimizer(arena);
+    auto t0 = chrono::steady_clock::now();
+    optimizer.optimize(program);
+    double secs = secondsSince(t0);
+
+    size_t after = BytecodeCompiler(names).compile(program).code.size();
+
+    cout << "fold: " << src.size() << " bytes, " << nodes << " nodes\n"
+         << "  removed      " << optimizer.removedNodes() << " nodes ("
+         << 100.0 * optimizer.removedNodes() / nodes << "%)\n"
+         << "  pass         " << secs * 1000 << " ms\n"
+         << "  bytecode     " << before << " -> " << after << " bytes\n";
+}
+
+static void benchVm() {
+    const int depth = 20;
+    string src = generateCallTree(depth);
+    Interner names;
+    Lexer lexer(src, names);
+    auto tokens = lexer.tokenize();
+    Diagnostics diags;
+    AstArena arena;
+    Parser parser(tokens, arena, diags);
+    auto program = parser.parse();
+    SemanticAnalyzer(names, diags).analyze(program);
+
+    Symbol mainName = names.intern("main");
+    double calls = double((1u << (depth + 1)) - 1);
+    const int runs = 5;
+
+    auto report = [&](const char* engine, Value result,
+                      uint64_t dispatches, double secs) {
+        cout << engine << " vm: call tree depth " << depth
+             << ", result " << result << "\n"
+             << "  per run      " << secs * 1000 << " ms\n"
+             << "  dispatches   " << dispatches << "\n"
+             << "  ops/sec      " << dispatches / secs / 1e6 << " M\n"
+             << "  calls/sec    " << calls / secs / 1e6 << " M\n";
+    };
+
+    {
+        BytecodeModule module = BytecodeCompiler(names).compile(program);
+        VM vm(module);
+        uint16_t entry = static_cast<uint16_t>(module.findFunction(mainName));
+
+        Value result = 0;
+        auto t0 = chrono::steady_clock::now();
+        for (int r = 0; r < runs; ++r)
+            result = vm.run(entry);
+        report("stack", result, vm.dispatchCount(), secondsSince(t0) / runs);
+    }
+    {
+        RegModule module = RegCompiler(names).compile(program);
+        RegVM vm(module);
+        uint16_t entry = static_cast<uint16_t>(module.findFunction(mainName));
+
+        Value result = 0;
+        auto t0 = chrono::steady_clock::now();
+        for (int r = 0; r < runs; ++r)
+            result = vm.run(entry);
+        report("register", result, vm.dispatchCount(), secondsSince(t0) / runs);
+    }
+}
+
+static void benchJit() {
+    const int depth = 20;
+    string src = generateCallTree(depth);
+    Interner names;
+    Lexer lexer(src, names);
+    auto tokens = lexer.tokenize();
+    Diagnostics diags;
+    AstArena arena;
+    Parser parser(tokens, arena, diags);
+    auto program = parser.parse();
+    SemanticAnalyzer(names, diags).analyze(program);
+
+    Symbol mainName = names.intern("main");
+    double calls = double((1u << (depth + 1)) - 1);
+    const int runs = 5;
+
+    auto time = [&](auto&& runOnce) {
+        Value result = runOnce();     // warm up
+        auto t0 = chrono::steady_clock::now();
+        for (int r = 0; r < runs; ++r)
+            result = runOnce();
+        return make_pair(result, secondsSince(t0) / runs);
+    };
+
+    AstInterpreter interp(program, names);
+    auto ast = time([&] { return interp.run(mainName); });
+
+    BytecodeModule module = BytecodeCompiler(names).compile(program);
+    VM vm(module);
+    uint16_t vmEntry = static_cast<uint16_t>(module.findFunction(mainName));
+    auto stack = time([&] { return vm.run(vmEntry); });
+
+    auto t0 = chrono::steady_clock::now();
+    auto native = JitCompiler(names).compile(program);
+    double compileSecs = secondsSince(t0);
+    uint16_t jitEntry = static_cast<uint16_t>(native->findFunction(mainName));
+    auto jit = time([&] { return native->run(jitEntry); });
+
+    cout << "jit: call tree depth " << depth << ", "
+         << (1u << (depth + 1)) - 1 << " calls\n"
+         << "  code         " << native->codeSize() << " bytes, compiled in "
+         << compileSecs * 1e6 << " us\n";
+    auto report = [&](const char* engine, pair<Value, double> r) {
+        cout << "  " << engine << string(9 - strlen(engine), ' ')
+             << r.second * 1000 << " ms  (" << calls / r.second / 1e6
+             << " M calls/s, " << ast.second / r.second
+             << "x vs ast, result " << r.first << ")\n";
+    };
+    report("ast", ast);
+    report("stack", stack);
+    report("jit", jit);
+
+    if (ast.first != stack.first || ast.first != jit.first)
+        cout << "  RESULTS DIFFER\n";
+}
+
+static void benchBatch(size_t kb) {
+    namespace fs = std::filesystem;
+    const size_t fileCount = 256;
+    const int runs = 3;
+
+    fs::path dir = fs::temp_directory_path() / "mini_compiler_batch";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+
+    vector<string> files;
+    size_t bytes = 0;
+    for (size_t i = 0; i < fileCount; ++i) {
+        string src = generateProgram(max<size_t>(1, kb * 1024 / fileCount));
+        fs::path p = dir / ("file_" + to_string(i) + ".mc");
+        ofstream(p, ios::binary) << src;
+        files.push_back(p.string());
+        bytes += src.size();
+    }
+
+    size_t cores = max(1u, thread::hardware_concurrency());
+    cout << "batch: " << fileCount << " files, " << bytes / 1024
+         << " KB, " << cores << " hardware threads\n"
+         << "  threads       ms   files/s  speedup\n";
+
+    double base = 0;
+    for (size_t threads = 1; threads <= 32; threads *= 2) {
+        Options opts;
+        opts.jobs = threads;
+
+        vector<double> times;
+        for (int r = 0; r < runs; ++r) {
+            auto t0 = chrono::steady_clock::now();
+            for (auto& res : compileBatch(files, opts))
+                if (!res.ok) cerr << res.diagnostics;
+            times.push_back(secondsSince(t0));
+        }
+        sort(times.begin(), times.end());
+        double secs = times[runs / 2];
+        if (threads == 1) base = secs;
+
+        double speedup = base / secs;
+        printf("  %7zu %8.1f %9.0f %7.2fx  %s%s\n", threads, secs * 1000,
+               fileCount / secs, speedup,
+               string(static_cast<size_t>(speedup * 4 + 0.5), '#').c_str(),
+               threads > cores ? "  (oversubscribed)" : "");
+    }
+
+    fs::remove_all(dir);
+}
+
+// Touches every node once; the per-node work is deliberately tiny
+// so the dispatch itself dominates.
+struct NodeCounter
+    : StmtVisitor<NodeCounter>, ExprVisitor<NodeCounter> {
+    size_t count = 0;
+
+    void visitVarDecl(const VarDecl*) { count++; }
+    void visitExprStmt(const ExprStmt* e) { count++; visitExpr(e->expr); }
+    void visitReturn(const ReturnStmt* r) {
+        count++;
+        if (r->expr) visitExpr(r->expr);
+    }
+    void visitBlock(const BlockStmt* b) {
+        count++;
+        for (auto s : b->statements) visitStmt(s);
+    }
+    void visitFunction(const FunctionDecl* f) { count++; visitBlock(f->body); }
+
+    void visitNumber(const NumberExpr*) { count++; }
+    void visitBool(const BoolExpr*) { count++; }
+    void visitError(const ErrorExpr*) { count++; }
+    void visitVar(const VarExpr*) { count++; }
+    void visitAssign(const AssignExpr* a) { count++; visitExpr(a->value); }
+    void visitBinary(const BinaryExpr* b) {
+        count++;
+        visitExpr(b->left);
+        visitExpr(b->right);
+    }
+    void visitUnary(const UnaryExpr* u) { count++; visitExpr(u->expr); }
+    void visitCall(const CallExpr* c) {
+        count++;
+        for (auto a : c->args) visitExpr(a);
+    }
+};
+
+static void benchWalk(size_t kb) {
+    string src = generateProgram(kb * 1024);
+    Interner names;
+    Lexer lexer(src, names);
+    auto tokens = lexer.tokenize();
+    Diagnostics diags;
+    AstArena arena;
+    Parser parser(tokens, arena, diags);
+    auto program = parser.parse();
+    const int runs = 20;
+
+    size_t visited = 0;
+    auto t0 = chrono::steady_clock::now();
+    for (int r = 0; r < runs; ++r) {
+        NodeCounter counter;
+        for (auto s : program) counter.visitStmt(s);
+        visited = counter.count;
+    }
+    double secs = secondsSince(t0) / runs;
+
+    cout << "walk: " << visited << " nodes\n"
+         << "  per walk     " << secs * 1000 << " ms\n"
+         << "  per node     " << secs * 1e9 / visited << " ns\n";
+}
+
+// Peak resident set of a child process running `work`, in KB, and
+// its wall time. The child starts as a copy of this (small) process,
+// so its peak is measured from a common baseline.
+static long childPeakRss(void (*work)(const string&), const string& path,
+                         double& secs) {
+    cout.flush();
+    auto t0 = chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid == 0) {
+        work(path);
+        _exit(0);
+    }
+
+    int status = 0;
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+    secs = secondsSince(t0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        cerr << "child failed\n";
+    return usage.ru_maxrss;
+}
+
+static void checkFile(const string& path, bool stream) {
+    Options opts;
+    opts.optimize = false;
+    opts.stream = stream;
+    FileResult res = compileFile(path, opts);
+    if (!res.ok) {
+        cerr << res.diagnostics;
+        _exit(1);
+    }
+}
+
+// Whole-file compiles with --time-report off and on, interleaved so
+// both see the same machine state.
+static void benchStats(size_t kb) {
+    namespace fs = std::filesystem;
+    fs::path path = fs::temp_directory_path() / "mini_compiler_stats.mc";
+    ofstream(path, ios::binary) << generateProgram(kb * 1024);
+    const int runs = 9;
+
+    Options off;
+    off.optimize = false;
+    Options on = off;
+    on.stats = true;
+
+    vector<double> offTimes, onTimes;
+    FileResult last;
+    for (int r = 0; r < runs; ++r) {
+        auto t0 = chrono::steady_clock::now();
+        compileFile(path.string(), off);
+        offTimes.push_back(secondsSince(t0));
+
+        t0 = chrono::steady_clock::now();
+        last = compileFile(path.string(), on);
+        onTimes.push_back(secondsSince(t0));
+    }
+    sort(offTimes.begin(), offTimes.end());
+    sort(onTimes.begin(), onTimes.end());
+    double a = offTimes[runs / 2], b = onTimes[runs / 2];
+
+    cout << "stats: " << kb << " KB source, median of " << runs << "\n";
+    printf("  report off   %8.2f ms\n", a * 1000);
+    printf("  report on    %8.2f ms  (%+.1f%%)\n", b * 1000, 100 * (b - a) / a);
+    cout << last.stats->text(path.string());
+
+    fs::remove(path);
+}
+
+static void benchRss(size_t kb) {
+    namespace fs = std::filesystem;
+    fs::path path = fs::temp_directory_path() / "mini_compiler_rss.mc";
+
+    // Written a chunk at a time so this process stays small.
+    size_t bytes = 0;
+    {
+        ofstream out(path, ios::binary);
+        string chunk;
+        for (int i = 0; bytes < kb * 1024; ++i) {
+            appendFunction(chunk, i);
+            if (chunk.size() >= (1 << 20)) {
+                out << chunk;
+                bytes += chunk.size();
+                chunk.clear();
+            }
+        }
+        out << chunk;
+        bytes += chunk.size();
+    }
+
+    double secs;
+    long idle = childPeakRss([](const string&) {}, path.string(), secs);
+    long eager = childPeakRss([](const string& p) { checkFile(p, false); },
+                              path.string(), secs);
+    double eagerSecs = secs;
+    long stream = childPeakRss([](const string& p) { checkFile(p, true); },
+                               path.string(), secs);
+
+    cout << "rss: " << bytes / (1024 * 1024) << " MB source\n"
+         << "  mode         time (s)   peak RSS (MB)\n";
+    printf("  baseline     %8s   %13.1f\n", "-", idle / 1024.0);
+    printf("  eager        %8.2f   %13.1f\n", eagerSecs, eager / 1024.0);
+    printf("  streaming    %8.2f   %13.1f\n", secs, stream / 1024.0);
+
+    fs::remove(path);
+}
+
+// ---------------- suite ----------------
+// Every phase of the pipeline, timed separately on each run.
+enum SuitePhase {
+    LEX, PARSE, SEMANTIC, OPTIMIZE, BYTECODE, REGCODE, JIT_COMPILE,
+    RUN_AST, RUN_STACK, RUN_REG, RUN_JIT, SUITE_PHASES
+};
+
+static const char* const SUITE_PHASE_NAMES[SUITE_PHASES] = {
+    "lex", "parse", "semantic", "optimize", "bytecode", "regcode", "jit",
+    "run-ast", "run-stack", "run-reg", "run-jit",
+};
+
+struct SuiteRun {
+    double seconds[SUITE_PHASES] = {};
+    size_t tokens = 0, nodes = 0, functions = 0;
+    Value result = 0;
+    bool agree = true;              // every engine returned `result`
+};
+
+static SuiteRun suiteRun(const string& src) {
+    SuiteRun run;
+    auto timed = [&](SuitePhase phase, auto&& work) {
+        auto t0 = chrono::steady_clock::now();
+        work();
+        run.seconds[phase] = secondsSince(t0);
+    };
+
+    Interner names;
+    Lexer lexer(src, names);
+    optional<TokenBuffer> tokens;
+    timed(LEX, [&] { tokens.emplace(lexer.tokenize()); });
+
+    Diagnostics diags;
+    AstArena arena;
+    vector<StmtPtr> program;
+    timed(PARSE, [&] { program = Parser(*tokens, arena, diags).parse(); });
+    timed(SEMANTIC, [&] { SemanticAnalyzer(names, diags).analyze(program); });
+    if (diags.hasErrors()) {
+        cerr << diags.render(src);
+        exit(1);
+    }
+    run.tokens = tokens->size();
+    run.nodes = arena.nodeCount();
+    run.functions = program.size() - 1;     // all but main()
+
+    timed(OPTIMIZE, [&] { Optimizer(arena).optimize(program); });
+
+    BytecodeModule module;
+    RegModule regModule;
+    unique_ptr<JitProgram> native;
+    timed(BYTECODE, [&] { module = BytecodeCompiler(names).compile(program); });
+    timed(REGCODE, [&] { regModule = RegCompiler(names).compile(program); });
+    if (JIT_SUPPORTED)
+        timed(JIT_COMPILE, [&] { native = JitCompiler(names).compile(program); });
+
+    Symbol mainName = names.intern("main");
+    auto check = [&](Value v) {
+        if (v != run.result) run.agree = false;
+    };
+    timed(RUN_AST, [&] { run.result = AstInterpreter(program, names).run(mainName); });
+
+    VM vm(module);
+    timed(RUN_STACK, [&] {
+        check(vm.run(static_cast<uint16_t>(module.findFunction(mainName))));
+    });
+    RegVM regVm(regModule);
+    timed(RUN_REG, [&] {
+        check(regVm.run(static_cast<uint16_t>(regModule.findFunction(mainName))));
+    });
+    if (native)
+        timed(RUN_JIT, [&] {
+            check(native->run(static_cast<uint16_t>(native->findFunction(mainName))));
+        });
+    return run;
+}
+
+// Nearest-rank percentile of sorted samples.
+static double percentile(const vector<double>& sorted, double p) {
+    size_t rank = static_cast<size_t>(ceil(p / 100 * sorted.size()));
+    return sorted[min(max<size_t>(rank, 1), sorted.size()) - 1];
+}
+
+static void benchSuite(size_t kb, const string& outPath) {
+    const int warmup = 2, runs = 11;
+
+    struct Config { const char* name; vector<const char*> fields; };
+    const Config configs[] = {
+        { "base",        {} },
+        { "nested",      { "nesting=24" } },
+        { "deep-expr",   { "expr=24" } },
+        { "call-heavy",  { "calls=0.5" } },
+        { "many-names",  { "idents=4000", "statements=12" } },
+        { "many-params", { "params=8" } },
+    };
+
+    FILE* json = fopen(outPath.c_str(), "w");
+    if (!json) {
+        cerr << "cannot write " << outPath << "\n";
+        exit(1);
+    }
+    fprintf(json, "{\"benchmark\":\"suite\",\"source_kb\":%zu,\"warmup\":%d,"
+            "\"runs\":%d,\"scan_level\":\"%s\",\"configs\":[",
+            kb, warmup, runs, scanLevelName(scanLevel()));
+
+    cout << "suite: " << kb << " KB per program, " << warmup
+         << " warmup + " << runs << " measured runs\n";
+
+    for (size_t c = 0; c < size(configs); ++c) {
+        SynthShape shape;
+        for (const char* field : configs[c].fields)
+            setShapeField(shape, field);
+        string src = synthesize(shape, kb * 1024);
+
+        vector<double> samples[SUITE_PHASES];
+        SuiteRun last;
+        for (int r = 0; r < warmup + runs; ++r) {
+            last = suiteRun(src);
+            if (r < warmup) continue;
+            for (size_t p = 0; p < SUITE_PHASES; ++p)
+                samples[p].push_back(last.seconds[p]);
+        }
+        shape.functions = last.functions;
+
+        cout << "\n" << configs[c].name << ": " << describeShape(shape) << "\n"
+             << "  " << src.size() << " bytes, " << last.tokens << " tokens, "
+             << last.nodes << " nodes, main() = " << last.result
+             << (last.agree ? "" : "  RESULTS DIFFER") << "\n";
+        printf("  %-10s %10s %10s %10s %10s %9s\n",
+               "phase", "median ms", "p10", "p90", "p99", "src MB/s");
+
+        fprintf(json, "%s{\"name\":\"%s\",\"shape\":\"%s\",\"source_bytes\":%zu,"
+                "\"tokens\":%zu,\"nodes\":%zu,\"result\":%lld,\"phases\":[",
+                c ? "," : "", configs[c].name, describeShape(shape).c_str(),
+                src.size(), last.tokens, last.nodes,
+                static_cast<long long>(last.result));
+
+        bool first = true;
+        for (size_t p = 0; p < SUITE_PHASES; ++p) {
+            if (!JIT_SUPPORTED && (p == JIT_COMPILE || p == RUN_JIT)) continue;
+            vector<double>& s = samples[p];
+            sort(s.begin(), s.end());
+            double median = percentile(s, 50);
+            printf("  %-10s %10.3f %10.3f %10.3f %10.3f %9.1f\n",
+                   SUITE_PHASE_NAMES[p], median * 1000,
+                   percentile(s, 10) * 1000, percentile(s, 90) * 1000,
+                   percentile(s, 99) * 1000,
+                   src.size() / median / (1024 * 1024));
+
+            fprintf(json, "%s{\"name\":\"%s\",\"median_ms\":%.6f,"
+                    "\"p10_ms\":%.6f,\"p90_ms\":%.6f,\"p99_ms\":%.6f,"
+                    "\"min_ms\":%.6f,\"max_ms\":%.6f,\"samples_ms\":[",
+                    first ? "" : ",", SUITE_PHASE_NAMES[p], median * 1000,
+                    percentile(s, 10) * 1000, percentile(s, 90) * 1000,
+                    percentile(s, 99) * 1000, s.front() * 1000,
+                    s.back() * 1000);
+            for (size_t i = 0; i < s.size(); ++i)
+                fprintf(json, "%s%.6f", i ? "," : "", s[i] * 1000);
+            fprintf(json, "]}");
+            first = false;
+        }
+        fprintf(json, "]}");
+    }
+
+    fprintf(json, "]}\n");
+    fclose(json);
+    cout << "\nresults written to " << outPath << "\n";
+}
+
+// A batch compiled without the cache, into an empty one and again
+// from the filled one: the miss overhead and what a hit saves.
+static void benchCache(size_t kb) {
+    namespace fs = std::filesystem;
+    const size_t fileCount = 64;
+    const int runs = 5;
+
+    fs::path dir = fs::temp_directory_path() / "mini_compiler_cache_src";
+    fs::path cacheDir = fs::temp_directory_path() / "mini_compiler_cache";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+
+    vector<string> files;
+    size_t bytes = 0;
+    for (size_t i = 0; i < fileCount; ++i) {
+        SynthShape shape;
+        shape.seed = i + 1;
+        string src = synthesize(shape, max<size_t>(1, kb * 1024 / fileCount));
+        fs::path p = dir / ("file_" + to_string(i) + ".mc");
+        ofstream(p, ios::binary) << src;
+        files.push_back(p.string());
+        bytes += src.size();
+    }
+
+    Options opts;
+    opts.run = true;
+    auto batch = [&](CompileCache* cache) {
+        opts.cache = cache;
+        auto t0 = chrono::steady_clock::now();
+        for (auto& res : compileBatch(files, opts))
+            if (!res.ok) cerr << res.diagnostics;
+        return secondsSince(t0);
+    };
+    auto median = [](vector<double> times) {
+        sort(times.begin(), times.end());
+        return times[times.size() / 2];
+    };
+
+    vector<double> noneTimes, coldTimes, hitTimes;
+    for (int r = 0; r < runs; ++r)
+        noneTimes.push_back(batch(nullptr));
+    for (int r = 0; r < runs; ++r) {
+        fs::remove_all(cacheDir);
+        CompileCache cold(cacheDir.string(), 1ull << 30);
+        coldTimes.push_back(batch(&cold));
+    }
+    CompileCache warm(cacheDir.string(), 1ull << 30);
+    for (int r = 0; r < runs; ++r)
+        hitTimes.push_back(batch(&warm));
+    double none = median(noneTimes), cold = median(coldTimes),
+           hit = median(hitTimes);
+
+    cout << "cache: " << fileCount << " files, " << bytes / 1024
+         << " KB, compiled and run\n";
+    printf("  no cache     %8.2f ms\n", none * 1000);
+    printf("  cold (miss)  %8.2f ms  (%+.1f%%)\n", cold * 1000,
+           100 * (cold - none) / none);
+    printf("  warm (hit)   %8.2f ms  (%.1fx faster)\n", hit * 1000, none / hit);
+    cout << "  " << warm.report();
+
+    fs::remove_all(dir);
+    fs::remove_all(cacheDir);
+}
+
+// Parse and analyze() diagnostics of `text` checked from scratch.
+static vector<Diagnostic> checkFromScratch(const string& text) {
+    Interner names;
+    Lexer lexer(text, names);
+    TokenBuffer tokens = lexer.tokenize();
+    AstArena arena;
+    Diagnostics diags;
+    auto ast = Parser(tokens, arena, diags).parse();
+    SemanticAnalyzer(names, diags).analyze(ast);
+    return diags.all();
+}
+
+static bool sameDiagnostics(const vector<Diagnostic>& a,
+                            const vector<Diagnostic>& b) {
+    return equal(a.begin(), a.end(), b.begin(), b.end(),
+        [](const Diagnostic& x, const Diagnostic& y) {
+            return x.severity == y.severity && x.loc.line == y.loc.line &&
+                   x.loc.column == y.loc.column &&
+                   x.loc.length == y.loc.length && x.message == y.message;
+        });
+}
+
+static void benchIncremental() {
+    const size_t targetLines = 100000;
+    const int edits = 4000;
+    const int verifyEvery = 250;
+
+    // Without the generated main(): one function calling all the
+    // others would make every edit inside it a 250 KB reparse.
+    SynthShape shape;
+    string src = synthesize(shape, targetLines * 32);
+    src.resize(src.rfind("int main()"));
+    size_t lines = count(src.begin(), src.end(), '\n');
+
+    auto t0 = chrono::steady_clock::now();
+    checkFromScratch(src);
+    double full = secondsSince(t0);
+    t0 = chrono::steady_clock::now();
+    IncrementalDocument doc(src);
+    double load = secondsSince(t0);
+
+    cout << "incremental: " << lines << " lines, " << src.size() / 1024
+         << " KB, " << doc.unitCount() << " units\n";
+    printf("  full check   %8.2f ms\n", full * 1000);
+    printf("  first load   %8.2f ms\n", load * 1000);
+
+    // Typing: insert or delete a few bytes somewhere, then undo it,
+    // each timed as an edit. Often a syntax or type error meanwhile.
+    const char* typed[] = { "x", "1", ";", "{", "}", "(", " + ", "\n",
+                            "int q;\n", "return 0;" };
+    uint64_t seed = 12345;
+    auto rand = [&](uint64_t n) {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        return (seed >> 33) % n;
+    };
+
+    vector<double> times;
+    size_t relexed = 0, rechecked = 0, mismatches = 0;
+    auto timed = [&](size_t offset, size_t removed, string_view inserted) {
+        auto t = chrono::steady_clock::now();
+        doc.edit(offset, removed, inserted);
+        times.push_back(secondsSince(t));
+        relexed += doc.lastEdit().relexedBytes;
+        rechecked += doc.lastEdit().recheckedUnits;
+    };
+
+    for (int i = 0; i < edits; ++i) {
+        size_t at = rand(doc.size());
+        if (rand(2)) {
+            string_view text = typed[rand(size(typed))];
+            timed(at, 0, text);
+            timed(at, text.size(), {});
+        }
+        else {
+            size_t n = min<size_t>(1 + rand(8), doc.size() - at);
+            string gone = doc.text().substr(at, n);
+            timed(at, n, {});
+            timed(at, 0, gone);
+        }
+        if ((i + 1) % verifyEvery == 0 &&
+            !sameDiagnostics(doc.diagnostics(), checkFromScratch(doc.text())))
+            mismatches++;
+    }
+
+    // Changing a signature that many functions call: every caller
+    // after it is checked again.
+    size_t sig = src.find("int f0(");
+    vector<double> sigTimes;
+    size_t sigChecked = 0;
+    for (int i = 0; i < 20; ++i) {
+        auto t = chrono::steady_clock::now();
+        doc.edit(sig, i % 2 ? 4 : 3, i % 2 ? "int" : "bool");
+        sigTimes.push_back(secondsSince(t));
+        sigChecked += doc.lastEdit().recheckedUnits;
+        if (!sameDiagnostics(doc.diagnostics(), checkFromScratch(doc.text())))
+            mismatches++;
+        sig = doc.text().find(i % 2 ? "int f0(" : "bool f0(");
+    }
+
+    sort(times.begin(), times.end());
+    sort(sigTimes.begin(), sigTimes.end());
+    size_t n = times.size();
+    printf("  edits        %8zu   %.1f KB relexed, %.1f units checked each\n",
+           n, relexed / 1024.0 / n, double(rechecked) / n);
+    printf("  latency      median %.3f ms, p90 %.3f ms, p99 %.3f ms, "
+           "max %.3f ms\n", times[n / 2] * 1000, times[n * 9 / 10] * 1000,
+           times[n * 99 / 100] * 1000, times.back() * 1000);
+    // An unmatched brace makes every later function nest in the
+    // edited one, which reparses the rest of the text.
+    printf("  under 1 ms   %.1f%% of edits\n",
+           100.0 * (lower_bound(times.begin(), times.end(), 1e-3) -
+                    times.begin()) / n);
+    printf("  signature    median %.3f ms, %zu units checked each\n",
+           sigTimes[sigTimes.size() / 2] * 1000, sigChecked / sigTimes.size());
+    printf("  verified against a full check: %s\n",
+           mismatches ? "MISMATCH" : "identical");
+}
+
+// Starts `bench <args>` (this executable) and waits for it; false if
+// it did not exit with status 0.
+static bool runSelf(const vector<string>& args) {
+    vector<char*> argv{ const_cast<char*>("bench") };
+    for (auto& a : args)
+        argv.push_back(const_cast<char*>(a.c_str()));
+    argv.push_back(nullptr);
+
+    cout.flush();
+    pid_t pid = fork();
+    if (pid == 0) {
+        execv("/proc/self/exe", argv.data());
+        _exit(127);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// `bench check FILE` and `bench call SOCKET FILE`: one check as a
+// fresh compiler process and as a thin client process.
+static int benchCheckOne(const string& path) {
+    FileResult r = compileFile(path, Options{});
+    cerr << r.diagnostics;
+    return r.ok ? 0 : 1;
+}
+
+static int benchCallOne(const string& socketPath, const string& path) {
+    ServerRequest request;
+    request.paths.push_back(path);
+    ServerResponse response;
+    string error;
+    if (!callServer(socketPath, request, response, error)) {
+        cerr << error << "\n";
+        return 1;
+    }
+    return response.results.size() == 1 && response.results[0].ok ? 0 : 1;
+}
+
+static void benchServer(size_t kb) {
+    namespace fs = std::filesystem;
+    const size_t fileCount = 16;
+    const int requests = 200;
+    const int clients = 8;
+
+    fs::path dir = fs::temp_directory_path() / "mini_compiler_server_src";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    string socketPath = (dir / "server.sock").string();
+
+    // Every request checks a file that changed by one byte since the
+    // last one, as after an editor's save.
+    vector<string> paths, sources;
+    for (size_t i = 0; i < fileCount; ++i) {
+        SynthShape shape;
+        shape.seed = i + 1;
+        sources.push_back(synthesize(shape, max<size_t>(1, kb * 1024)));
+        paths.push_back((dir / ("file_" + to_string(i) + ".mc")).string());
+        ofstream(paths.back(), ios::binary) << sources.back();
+    }
+    vector<size_t> edits(fileCount);
+    auto touch = [&](size_t i) {
+        // Flip one digit of a literal, keeping the program valid.
+        string& src = sources[i];
+        auto literal = [&](size_t from) {
+            for (size_t at = from; at < src.size(); ++at)
+                if (src[at] >= '1' && src[at] <= '9' &&
+                    !isalnum((unsigned char)src[at - 1]) && src[at - 1] != '_')
+                    return at;
+            return string::npos;
+        };
+        size_t at = literal((edits[i]++ * 977) % src.size() + 1);
+        if (at == string::npos) at = literal(1);
+        src[at] = src[at] == '9' ? '1' : src[at] + 1;
+        ofstream(paths[i], ios::binary) << src;
+    };
+
+    CompileServer server(socketPath, 0, nullptr);
+    thread serving([&] { server.serve(); });
+
+    struct Mode { const char* name; vector<double> times; double wall = 0; };
+    vector<Mode> modes;
+    auto measure = [&](const char* name, auto request) {
+        Mode m{ name, {} };
+        auto t0 = chrono::steady_clock::now();
+        for (int r = 0; r < requests; ++r) {
+            size_t i = r % fileCount;
+            touch(i);
+            auto t = chrono::steady_clock::now();
+            if (!request(i)) cerr << name << ": request failed\n";
+            m.times.push_back(secondsSince(t));
+        }
+        m.wall = secondsSince(t0);
+        modes.push_back(move(m));
+    };
+
+    measure("fresh process", [&](size_t i) {
+        return runSelf({ "check", paths[i] });
+    });
+    measure("mcc process", [&](size_t i) {
+        return runSelf({ "call", socketPath, paths[i] });
+    });
+    int fd = connectTo(socketPath);
+    measure("connection", [&](size_t i) {
+        ServerRequest request;
+        request.paths.push_back(paths[i]);
+        ServerResponse response;
+        return exchange(fd, request, response) && response.results.size() == 1 &&
+               response.results[0].ok;
+    });
+    close(fd);
+
+    // Several clients at once, each on its own files.
+    Mode together{ "8 connections", {} };
+    vector<vector<double>> perClient(clients);
+    auto t0 = chrono::steady_clock::now();
+    vector<thread> threads;
+    for (int c = 0; c < clients; ++c) {
+        threads.emplace_back([&, c] {
+            int conn = connectTo(socketPath);
+            for (int r = 0; r < requests; ++r) {
+                size_t i = c + (r % 2) * clients;
+                touch(i);
+                ServerRequest request;
+                request.paths.push_back(paths[i]);
+                ServerResponse response;
+                auto t = chrono::steady_clock::now();
+                exchange(conn, request, response);
+                perClient[c].push_back(secondsSince(t));
+            }
+            close(conn);
+        });
+    }
+    for (auto& t : threads) t.join();
+    together.wall = secondsSince(t0);
+    for (auto& times : perClient)
+        together.times.insert(together.times.end(), times.begin(), times.end());
+    modes.push_back(move(together));
+
+    server.stop();
+    serving.join();
+
+    cout << "server: " << fileCount << " files of " << kb
+         << " KB, each request checks one after a one-byte change\n"
+         << "  mode              requests/s   median ms    p99 ms\n";
+    for (auto& m : modes) {
+        sort(m.times.begin(), m.times.end());
+        printf("  %-16s %11.0f %11.3f %9.3f\n", m.name,
+               m.times.size() / m.wall, m.times[m.times.size() / 2] * 1000,
+               m.times[m.times.size() * 99 / 100] * 1000);
+    }
+    cout << "  " << server.status();
+    fs::remove_all(dir);
+}
+
+// A generated library without its main(), which is checked as a file
+// of its own: from the library's source, and against the library's
+// precompiled module.
+static void benchModule(size_t kb) {
+    namespace fs = std::filesystem;
+    const int runs = 11;
+
+    SynthShape shape;
+    string src = synthesize(shape, kb * 1024);
+    size_t split = src.rfind("int main()");
+    string library = src.substr(0, split), user = src.substr(split);
+
+    fs::path dir = fs::temp_directory_path() / "mini_compiler_module";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    string libraryPath = (dir / "library.mc").string();
+    string userPath = (dir / "user.mc").string();
+    string wholePath = (dir / "whole.mc").string();
+    string modulePath = (dir / "library.mcm").string();
+    ofstream(libraryPath, ios::binary) << library;
+    ofstream(userPath, ios::binary) << user;
+    ofstream(wholePath, ios::binary) << src;
+
+    Options emit;
+    emit.emitModule = modulePath;
+    FileResult emitted = compileFile(libraryPath, emit);
+    if (!emitted.ok) {
+        cerr << emitted.diagnostics;
+        return;
+    }
+
+    auto median = [&](auto work) {
+        vector<double> times;
+        for (int r = 0; r < runs; ++r) {
+            auto t0 = chrono::steady_clock::now();
+            work();
+            times.push_back(secondsSince(t0));
+        }
+        sort(times.begin(), times.end());
+        return times[times.size() / 2];
+    };
+
+    double parse = median([&] {
+        Interner names;
+        Lexer lexer(library, names);
+        TokenBuffer tokens = lexer.tokenize();
+        AstArena arena;
+        Diagnostics diags;
+        Parser(tokens, arena, diags).parse();
+    });
+    double whole = median([&] { checkFromScratch(src); });
+    size_t functions = 0;
+    double open = median([&] {
+        Module m(modulePath);
+        functions = m.functionCount();
+    });
+    vector<Diagnostic> withModule;
+    double check = median([&] {
+        vector<shared_ptr<const Module>> modules{ make_shared<const Module>(modulePath) };
+        Interner names;
+        Lexer lexer(user, names);
+        TokenBuffer tokens = lexer.tokenize();
+        AstArena arena;
+        Diagnostics diags;
+        auto ast = Parser(tokens, arena, diags).parse();
+        SemanticAnalyzer(names, diags).analyze(ast, ModuleEnvironment(modules, names));
+        withModule = diags.all();
+    });
+    Module m(modulePath);
+    size_t nodes = 0;
+    double materialize = median([&] {
+        Interner names;
+        AstArena arena;
+        m.materialize(arena, names);
+        nodes = arena.nodeCount();
+    });
+
+    // End to end, through the driver: the same result either way.
+    Options run;
+    run.run = true;
+    FileResult fromSource = compileFile(wholePath, run);
+    run.modules.push_back(make_shared<const Module>(modulePath));
+    FileResult fromModule = compileFile(userPath, run);
+    bool agree = fromSource.ok && fromModule.ok && withModule.empty() &&
+                 fromSource.output == fromModule.output;
+
+    cout << "module: " << library.size() / 1024 << " KB library, " << functions
+         << " functions, " << nodes << " nodes; module "
+         << m.bytes() / 1024 << " KB; median of " << runs << "\n";
+    printf("  lex and parse the library     %9.3f ms\n", parse * 1000);
+    printf("  check library and file        %9.3f ms\n", whole * 1000);
+    printf("  open the module               %9.3f ms  (%.0fx less than parsing)\n",
+           open * 1000, parse / open);
+    printf("  check the file with it        %9.3f ms  (%.0fx faster)\n",
+           check * 1000, whole / check);
+    printf("  materialize for --run         %9.3f ms\n", materialize * 1000);
+    cout << "  --run from source and with the module "
+         << (agree ? "agree" : "DISAGREE") << " (" << fromModule.output.substr(
+                0, fromModule.output.size() - 1) << ")\n";
+
+    fs::remove_all(dir);
+}
+
+// Writes one generated program to stdout, e.g.
+//     bench gen kb=64 nesting=8 calls=0.3 > big.mc
+static int benchGen(int argc, char** argv) {
+    SynthShape shape;
+    size_t kb = 0;
+    for (int i = 2; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg.compare(0, 3, "kb=") == 0)
+            kb = strtoul(arg.c_str() + 3, nullptr, 10);
+        else if (!setShapeField(shape, arg)) {
+            cerr << "bad shape field: " << arg << "\n";
+            return 1;
+        }
+    }
+    cout << synthesize(shape, kb * 1024);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    setHeapCounting(true);
+    string which = argc > 1 ? argv[1] : "lex";
+    size_t kb = argc > 2 ? strtoul(argv[2], nullptr, 10) : 4096;
+
+    if (which == "lex") benchLex(kb);
+    else if (which == "scan") benchScan(kb);
+    else if (which == "keywords") benchKeywords(kb);
+    else if (which == "parse") benchParse(kb);
+    else if (which == "sema") benchSema(kb);
+    else if (which == "sema2") benchSemaTwoPhase(kb);
+    else if (which == "nest") benchNest(kb);
+    else if (which == "deep") benchDeep();
+    else if (which == "operators") benchOperators(kb);
+    else if (which == "fold") benchFold(kb);
+    else if (which == "vm") benchVm();
+    else if (which == "jit") benchJit();
+    else if (which == "batch") benchBatch(kb);
+    else if (which == "walk") benchWalk(kb);
+    else if (which == "rss") benchRss(kb);
+    else if (which == "stats") benchStats(kb);
+    else if (which == "cache") benchCache(kb);
+    else if (which == "incremental") benchIncremental();
+    else if (which == "server") benchServer(argc > 2 ? kb : 2);
+    else if (which == "module") benchModule(argc > 2 ? kb : 1024);
+    else if (which == "check" && argc > 2) return benchCheckOne(argv[2]);
+    else if (which == "call" && argc > 3) return benchCallOne(argv[2], argv[3]);
+    else if (which == "suite")
+        benchSuite(argc > 2 ? kb : 1024, argc > 3 ? argv[3] : "bench_results.json");
+    else if (which == "gen") return benchGen(argc, argv);
+    else {
+        cerr << "unknown benchmark: " << which << "\n";
+        return 1;
+    }
+    return 0;
+}
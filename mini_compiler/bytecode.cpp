@@ -0,0 +1,296 @@
+#include "bytecode.h"
+#include <stdexcept>
+
+using namespace std;
+
+int BytecodeModule::findFunction(Symbol name) const {
+    for (size_t i = 1; i < functions.size(); ++i)
+        if (functions[i].name == name) return static_cast<int>(i);
+    return -1;
+}
+
+
+// ---------------- driver ----------------
+BytecodeCompiler::BytecodeCompiler(const Interner& names)
+    : names(names) {}
+
+string BytecodeCompiler::nameOf(Symbol sym) const {
+    return string(names.name(sym));
+}
+
+BytecodeModule BytecodeCompiler::compile(
+    const vector<StmtPtr>& program) {
+
+    module = BytecodeModule();
+    functionIndex.clear();
+    globals.clear();
+    constantIndex.clear();
+    pending.clear();
+
+    // Function 0 is the initializer; every FunctionDecl (nested ones
+    // included) gets its index up front so calls can be emitted
+    // before the callee's body is compiled.
+    module.functions.emplace_back();
+
+    for (auto& stmt : program) {
+        declareFunctions(stmt);
+
+        if (auto v = nodeAs<const VarDecl>(stmt)) {
+            if (module.globalCount == UINT16_MAX)
+                throw runtime_error("Too many global variables");
+            globals[v->name] = module.globalCount++;
+        }
+    }
+
+    // Top-level statements
+    current = &module.functions[BytecodeModule::INIT];
+    current->entry = 0;
+    locals.clear();
+    scopeStart.clear();
+    depth = 0;
+    topLevel = true;
+
+    for (auto& stmt : program)
+        visitStmt(stmt);
+    finishFunction();
+
+    // Function bodies
+    topLevel = false;
+    for (size_t i = 0; i < pending.size(); ++i)
+        compileFunction(functionIndex.at(pending[i]->name), pending[i]);
+
+    return move(module);
+}
+
+void BytecodeCompiler::declareFunctions(const Stmt* stmt) {
+    if (auto f = nodeAs<const FunctionDecl>(stmt)) {
+        if (module.functions.size() > UINT16_MAX)
+            throw runtime_error("Too many functions");
+
+        FunctionCode fn;
+        fn.name = f->name;
+        fn.arity = static_cast<uint16_t>(f->params.size());
+
+        functionIndex[f->name] =
+            static_cast<uint16_t>(module.functions.size());
+        module.functions.push_back(fn);
+        pending.push_back(f);
+
+        declareFunctions(f->body);
+    }
+    else if (auto b = nodeAs<const BlockStmt>(stmt)) {
+        for (auto s : b->statements)
+            declareFunctions(s);
+    }
+}
+
+void BytecodeCompiler::compileFunction(uint16_t index,
+                                       const FunctionDecl* f) {
+    current = &module.functions[index];
+    current->entry = static_cast<uint32_t>(module.code.size());
+    locals.clear();
+    scopeStart.clear();
+    depth = 0;
+
+    for (auto& p : f->params)
+        declareLocal(p.name);
+
+    visitBlock(f->body);
+    finishFunction();
+}
+
+void BytecodeCompiler::finishFunction() {
+    // Falling off the end returns 0 (void functions, initializer).
+    emit(Op::RET_VOID, 0);
+}
+
+
+// ---------------- helpers ----------------
+uint16_t BytecodeCompiler::declareLocal(Symbol name) {
+    if (current->localCount == UINT16_MAX)
+        throw runtime_error(
+            "Too many local variables in '" + nameOf(current->name) + "'");
+
+    uint16_t slot = current->localCount++;
+    locals.emplace_back(name, slot);
+    return slot;
+}
+
+int BytecodeCompiler::resolveLocal(Symbol name) const {
+    for (auto it = locals.rbegin(); it != locals.rend(); ++it)
+        if (it->first == name) return it->second;
+    return -1;
+}
+
+uint16_t BytecodeCompiler::constant(Value v) {
+    auto found = constantIndex.find(v);
+    if (found != constantIndex.end()) return found->second;
+
+    if (module.constants.size() > UINT16_MAX)
+        throw runtime_error("Too many constants");
+
+    auto k = static_cast<uint16_t>(module.constants.size());
+    module.constants.push_back(v);
+    constantIndex.emplace(v, k);
+    return k;
+}
+
+void BytecodeCompiler::emit(Op op, int stackEffect) {
+    module.code.push_back(static_cast<uint8_t>(op));
+
+    depth += stackEffect;
+    if (static_cast<uint32_t>(depth) > current->maxStack)
+        current->maxStack = static_cast<uint32_t>(depth);
+}
+
+void BytecodeCompiler::emit(Op op, uint16_t operand, int stackEffect) {
+    emit(op, stackEffect);
+    module.code.push_back(static_cast<uint8_t>(operand & 0xff));
+    module.code.push_back(static_cast<uint8_t>(operand >> 8));
+}
+
+
+void BytecodeCompiler::patchJump(size_t at) {
+    size_t distance = module.code.size() - (at + 3);
+    if (distance > UINT16_MAX)
+        throw runtime_error(
+            "Expression too large in '" + nameOf(current->name) + "'");
+    module.code[at + 1] = static_cast<uint8_t>(distance & 0xff);
+    module.code[at + 2] = static_cast<uint8_t>(distance >> 8);
+}
+
+
+// ---------------- statements ----------------
+void BytecodeCompiler::visitVarDecl(const VarDecl* v) {
+    // Globals were assigned their slots up front.
+    if (topLevel && scopeStart.empty()) return;
+    declareLocal(v->name);
+}
+
+void BytecodeCompiler::visitExprStmt(const ExprStmt* e) {
+    visitExpr(e->expr);
+    emit(Op::POP, -1);
+}
+
+void BytecodeCompiler::visitReturn(const ReturnStmt* r) {
+    if (r->expr) {
+        visitExpr(r->expr);
+        emit(Op::RET, -1);
+    }
+    else {
+        emit(Op::RET_VOID, 0);
+    }
+}
+
+void BytecodeCompiler::visitBlock(const BlockStmt* b) {
+    scopeStart.push_back(locals.size());
+    for (auto s : b->statements)
+        visitStmt(s);
+    locals.resize(scopeStart.back());
+    scopeStart.pop_back();
+}
+
+void BytecodeCompiler::visitFunction(const FunctionDecl*) {
+    // Compiled separately (see compile()).
+}
+
+
+// ---------------- expressions ----------------
+void BytecodeCompiler::visitNumber(const NumberExpr* n) {
+    emit(Op::CONST, constant(n->value), 1);
+}
+
+void BytecodeCompiler::visitBool(const BoolExpr* b) {
+    emit(Op::CONST, constant(b->value ? 1 : 0), 1);
+}
+
+void BytecodeCompiler::visitError(const ErrorExpr*) {
+    throw runtime_error("Cannot compile a program with errors");
+}
+
+void BytecodeCompiler::visitVar(const VarExpr* v) {
+    int slot = resolveLocal(v->name);
+    if (slot >= 0) {
+        emit(Op::LOAD, static_cast<uint16_t>(slot), 1);
+        return;
+    }
+
+    auto g = globals.find(v->name);
+    if (g == globals.end())
+        throw runtime_error(
+            "Cannot compile '" + nameOf(v->name) +
+            "': nested functions cannot use enclosing locals");
+
+    emit(Op::GLOAD, g->second, 1);
+}
+
+void BytecodeCompiler::visitAssign(const AssignExpr* a) {
+    visitExpr(a->value);
+
+    int slot = resolveLocal(a->name);
+    if (slot >= 0) {
+        emit(Op::STORE, static_cast<uint16_t>(slot), 0);
+        return;
+    }
+
+    auto g = globals.find(a->name);
+    if (g == globals.end())
+        throw runtime_error(
+            "Cannot compile '" + nameOf(a->name) +
+            "': nested functions cannot use enclosing locals");
+
+    emit(Op::GSTORE, g->second, 0);
+}
+
+void BytecodeCompiler::visitBinary(const BinaryExpr* b) {
+    visitExpr(b->left);
+
+    // Short-circuit: the left operand is the result unless the right
+    // one is needed.
+    if (b->op == TokenType::AND || b->op == TokenType::OR) {
+        size_t jump = module.code.size();
+        emit(b->op == TokenType::AND ? Op::JUMP_FALSE_OR_POP
+                                     : Op::JUMP_TRUE_OR_POP, 0, -1);
+        visitExpr(b->right);
+        patchJump(jump);
+        return;
+    }
+
+    visitExpr(b->right);
+
+    switch (b->op) {
+    case TokenType::PLUS:  emit(Op::ADD, -1); break;
+    case TokenType::MINUS: emit(Op::SUB, -1); break;
+    case TokenType::STAR:  emit(Op::MUL, -1); break;
+    case TokenType::SLASH: emit(Op::DIV, -1); break;
+    case TokenType::EQ:    emit(Op::EQ, -1); break;
+    case TokenType::NEQ:   emit(Op::NE, -1); break;
+    case TokenType::LT:    emit(Op::LT, -1); break;
+    case TokenType::LE:    emit(Op::LE, -1); break;
+    case TokenType::GT:    emit(Op::GT, -1); break;
+    case TokenType::GE:    emit(Op::GE, -1); break;
+    default:
+        throw runtime_error(
+            string("Unsupported binary operator ") + tokenSpelling(b->op));
+    }
+}
+
+void BytecodeCompiler::visitUnary(const UnaryExpr* u) {
+    visitExpr(u->expr);
+
+    switch (u->op) {
+    case TokenType::MINUS: emit(Op::NEG, 0); break;
+    case TokenType::NOT:   emit(Op::NOT, 0); break;
+    default:
+        throw runtime_error(
+            string("Unsupported unary operator ") + tokenSpelling(u->op));
+    }
+}
+
+void BytecodeCompiler::visitCall(const CallExpr* call) {
+    for (auto arg : call->args)
+        visitExpr(arg);
+
+    emit(Op::CALL, functionIndex.at(call->callee),
+         1 - static_cast<int>(call->args.size()));
+}
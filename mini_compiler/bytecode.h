@@ -0,0 +1,126 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ast.h"
+#include "value.h"
+#include "visitor.h"
+
+using namespace std;
+
+//
+// Stack-machine bytecode. Each instruction is a one-byte opcode
+// followed by its operands; all operands are little-endian u16.
+// Jumps only go forward, by `d` bytes past the end of the jump.
+//
+enum class Op : uint8_t {
+    CONST,      // k      push constants[k]
+    LOAD,       // slot   push locals[slot]
+    STORE,      // slot   locals[slot] = top (value stays on the stack)
+    GLOAD,      // g      push globals[g]
+    GSTORE,     // g      globals[g] = top (value stays on the stack)
+    POP,        //        drop top
+    ADD, SUB, MUL, DIV,
+    NEG,
+    EQ, NE, LT, LE, GT, GE,     //  compare the top two; push 1 or 0
+    NOT,        //        top = !top
+    JUMP_FALSE_OR_POP,  // d  if top is 0 jump, else drop top (&&)
+    JUMP_TRUE_OR_POP,   // d  if top is not 0 jump, else drop top (||)
+    CALL,       // f      call functions[f]; its arguments are on the stack
+    RET,        //        return top
+    RET_VOID,   //        return 0
+    COUNT
+};
+
+struct FunctionCode {
+    Symbol name;
+    uint32_t entry = 0;         // offset of the first instruction
+    uint16_t arity = 0;
+    uint16_t localCount = 0;    // parameters first, then locals
+    uint32_t maxStack = 0;      // operand stack high-water mark
+};
+
+struct BytecodeModule {
+    // Index of the top-level initializer in `functions`.
+    static constexpr uint16_t INIT = 0;
+
+    vector<uint8_t> code;
+    vector<Value> constants;
+    vector<FunctionCode> functions;
+    uint16_t globalCount = 0;
+
+    // Index into `functions`, or -1.
+    int findFunction(Symbol name) const;
+};
+
+//
+// Lowers a semantically checked program to a BytecodeModule.
+//
+// Top-level variables become globals; every other statement at top
+// level runs in the initializer, function 0. Each VarDecl inside a
+// function gets its own zero-initialized slot. Functions may be
+// nested in blocks, but may not refer to an enclosing function's
+// locals.
+//
+class BytecodeCompiler
+    : private StmtVisitor<BytecodeCompiler>,
+      private ExprVisitor<BytecodeCompiler> {
+public:
+    explicit BytecodeCompiler(const Interner& names);
+
+    BytecodeModule compile(const vector<StmtPtr>& program);
+
+private:
+    friend class StmtVisitor<BytecodeCompiler>;
+    friend class ExprVisitor<BytecodeCompiler>;
+
+    const Interner& names;
+    BytecodeModule module;
+
+    unordered_map<Symbol, uint16_t> functionIndex;
+    unordered_map<Symbol, uint16_t> globals;
+    unordered_map<Value, uint16_t> constantIndex;   // into module.constants
+    vector<const FunctionDecl*> pending;    // bodies still to compile
+
+    // Current function
+    FunctionCode* current = nullptr;
+    vector<pair<Symbol, uint16_t>> locals;  // innermost last
+    vector<size_t> scopeStart;
+    int depth = 0;
+    bool topLevel = false;
+
+    void declareFunctions(const Stmt* stmt);
+    void compileFunction(uint16_t index, const FunctionDecl* f);
+    void finishFunction();
+
+    uint16_t declareLocal(Symbol name);
+    int resolveLocal(Symbol name) const;
+    uint16_t constant(Value v);
+
+    void emit(Op op, int stackEffect);
+    void emit(Op op, uint16_t operand, int stackEffect);
+    void patchJump(size_t at);          // to the end of the code so far
+    string nameOf(Symbol sym) const;
+
+    // Statements
+    void visitVarDecl(const VarDecl* v);
+    void visitExprStmt(const ExprStmt* e);
+    void visitReturn(const ReturnStmt* r);
+    void visitBlock(const BlockStmt* b);
+    void visitFunction(const FunctionDecl* f);
+
+    // Expressions (leave exactly one value on the stack)
+    void visitNumber(const NumberExpr* n);
+    void visitBool(const BoolExpr* b);
+    void visitError(const ErrorExpr* e);
+    void visitVar(const VarExpr* v);
+    void visitAssign(const AssignExpr* a);
+    void visitBinary(const BinaryExpr* b);
+    void visitUnary(const UnaryExpr* u);
+    void visitCall(const CallExpr* call);
+};
+
+#endif
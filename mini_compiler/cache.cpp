@@ -0,0 +1,395 @@
+#include "cache.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include "wire.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define LOCK_SUPPORTED 1
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#else
+#define LOCK_SUPPORTED 0
+#endif
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// ---------------- xxHash64 ----------------
+static constexpr uint64_t P1 = 0x9e3779b185ebca87ull;
+static constexpr uint64_t P2 = 0xc2b2ae3d27d4eb4full;
+static constexpr uint64_t P3 = 0x165667b19e3779f9ull;
+static constexpr uint64_t P4 = 0x85ebca77c2b2ae63ull;
+static constexpr uint64_t P5 = 0x27d4eb2f165667c5ull;
+
+static inline uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+static inline uint64_t read64(const unsigned char* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof v);
+    return v;
+}
+
+static inline uint32_t read32(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof v);
+    return v;
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t input) {
+    return rotl(acc + input * P2, 31) * P1;
+}
+
+static inline uint64_t merge(uint64_t h, uint64_t v) {
+    return (h ^ round64(0, v)) * P1 + P4;
+}
+
+// Little-endian reads, as on every platform the compiler targets.
+uint64_t xxhash64(const void* data, size_t size, uint64_t seed) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    const unsigned char* end = p + size;
+    uint64_t h;
+
+    if (size >= 32) {
+        uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+        for (; p + 32 <= end; p += 32) {
+            v1 = round64(v1, read64(p));
+            v2 = round64(v2, read64(p + 8));
+            v3 = round64(v3, read64(p + 16));
+            v4 = round64(v4, read64(p + 24));
+        }
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge(merge(merge(merge(h, v1), v2), v3), v4);
+    }
+    else h = seed + P5;
+
+    h += size;
+    for (; p + 8 <= end; p += 8)
+        h = rotl(h ^ round64(0, read64(p)), 27) * P1 + P4;
+    if (p + 4 <= end) {
+        h = rotl(h ^ (read32(p) * P1), 23) * P2 + P3;
+        p += 4;
+    }
+    for (; p < end; ++p)
+        h = rotl(h ^ (*p * P5), 11) * P1;
+
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+
+// ---------------- entry encoding ----------------
+namespace {
+
+constexpr uint32_t MAGIC = 0x3143434d;      // "MCC1"
+
+// Exclusive lock on the cache directory's lock file, held for the
+// lifetime of the object; a no-op where flock is unavailable.
+class DirLock {
+public:
+    explicit DirLock(const string& dir) {
+#if LOCK_SUPPORTED
+        fd = ::open((dir + "/lock").c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd >= 0) flock(fd, LOCK_EX);
+#endif
+    }
+    ~DirLock() {
+#if LOCK_SUPPORTED
+        if (fd >= 0) close(fd);         // releases the lock
+#endif
+    }
+    DirLock(const DirLock&) = delete;
+    DirLock& operator=(const DirLock&) = delete;
+
+private:
+    int fd = -1;
+};
+
+uint64_t processId() {
+#if LOCK_SUPPORTED
+    return static_cast<uint64_t>(getpid());
+#else
+    return 0;
+#endif
+}
+
+bool readAll(const string& path, string& out) {
+    ifstream in(path, ios::binary);
+    if (!in) return false;
+    ostringstream ss;
+    ss << in.rdbuf();
+    out = ss.str();
+    return true;
+}
+
+// Writes `data` beside `path` and renames it into place, so other
+// processes never see a partial file.
+bool writeAtomically(const string& path, const string& temp, const string& data) {
+    {
+        ofstream out(temp, ios::binary | ios::trunc);
+        if (!out.write(data.data(), data.size())) {
+            error_code ec;
+            fs::remove(temp, ec);
+            return false;
+        }
+    }
+    error_code ec;
+    fs::rename(temp, path, ec);
+    if (ec) fs::remove(temp, ec);
+    return !ec;
+}
+
+}
+
+
+// ---------------- cache ----------------
+CompileCache::CompileCache(string dir, uint64_t limitBytes)
+    : dir(move(dir)), limit(limitBytes) {
+    error_code ec;
+    fs::create_directories(this->dir, ec);
+    if (!fs::is_directory(this->dir, ec))
+        throw runtime_error("cannot create cache directory " + this->dir);
+    scan();
+    if (usage > limit) evict();
+}
+
+CompileCache::~CompileCache() {
+    try {
+        saveCounters();
+    }
+    catch (...) {
+        // Losing the lifetime totals must not take the compiler down.
+    }
+}
+
+uint64_t CompileCache::key(string_view source, uint64_t salt) {
+    uint64_t version = uint64_t(COMPILER_VERSION) << 32 | FORMAT;
+    return xxhash64(source.data(), source.size(), salt ^ version);
+}
+
+string CompileCache::entryPath(uint64_t key) const {
+    char name[32];
+    snprintf(name, sizeof name, "/%016llx.mce", static_cast<unsigned long long>(key));
+    return dir + name;
+}
+
+optional<CachedResult> CompileCache::load(uint64_t key, size_t sourceSize) {
+    string path = entryPath(key), data;
+    if (!readAll(path, data) || data.size() < sizeof(uint64_t)) {
+        misses++;
+        return nullopt;
+    }
+
+    size_t body = data.size() - sizeof(uint64_t);
+    uint64_t checksum;
+    memcpy(&checksum, data.data() + body, sizeof checksum);
+
+    ByteReader in{ string_view(data).substr(0, body) };
+    bool valid = checksum == xxhash64(data.data(), body) &&
+                 in.u32() == MAGIC && in.u32() == FORMAT &&
+                 in.u64() == key && in.u64() == sourceSize;
+
+    CachedResult result;
+    if (valid) {
+        result.ok = in.u8() != 0;
+        result.output = in.str();
+        result.failure = in.str();
+        uint32_t count = in.u32();
+        for (uint32_t i = 0; i < count && !in.failed; ++i) {
+            Diagnostic d;
+            d.severity = static_cast<Severity>(in.u8());
+            d.loc.line = in.u32();
+            d.loc.column = in.u32();
+            d.loc.length = in.u32();
+            d.message = in.str();
+            result.diagnostics.push_back(move(d));
+        }
+        valid = !in.failed && in.pos == body;
+    }
+
+    error_code ec;
+    if (!valid) {
+        fs::remove(path, ec);       // damaged or from another format
+        misses++;
+        return nullopt;
+    }
+
+    // The modification time doubles as the last-use time for LRU.
+    fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+    hits++;
+    return result;
+}
+
+void CompileCache::store(uint64_t key, size_t sourceSize, const CachedResult& result) {
+    ByteWriter out;
+    out.u32(MAGIC);
+    out.u32(FORMAT);
+    out.u64(key);
+    out.u64(sourceSize);
+    out.u8(result.ok);
+    out.str(result.output);
+    out.str(result.failure);
+    out.u32(static_cast<uint32_t>(result.diagnostics.size()));
+    for (auto& d : result.diagnostics) {
+        out.u8(static_cast<uint8_t>(d.severity));
+        out.u32(d.loc.line);
+        out.u32(d.loc.column);
+        out.u32(d.loc.length);
+        out.str(d.message);
+    }
+    out.u64(xxhash64(out.out.data(), out.out.size()));
+
+    string path = entryPath(key);
+    string temp = path + "." + to_string(processId()) + "-" +
+                  to_string(tempCount++) + ".tmp";
+    if (!writeAtomically(path, temp, out.out)) return;
+
+    stores++;
+    entries++;
+    if ((usage += out.out.size()) > limit)
+        evict();
+}
+
+// Sizes up the directory; other processes may change it at any time,
+// so the figures are estimates refreshed by each eviction.
+void CompileCache::scan() {
+    uint64_t bytes = 0, count = 0;
+    error_code ec;
+    for (auto& e : fs::directory_iterator(dir, ec)) {
+        if (e.path().extension() != ".mce") continue;
+        bytes += e.file_size(ec);
+        count++;
+    }
+    usage = bytes;
+    entries = count;
+}
+
+// Removes the least recently used entries until the directory is
+// down to three quarters of its limit, so evictions come in batches
+// rather than on every store. Temporary files left behind by a
+// crashed writer are swept once they are an hour old.
+void CompileCache::evict() {
+    lock_guard<mutex> guard(evictLock);
+    DirLock lock(dir);
+
+    struct Entry {
+        fs::path path;
+        uint64_t size;
+        fs::file_time_type used;
+    };
+    vector<Entry> list;
+    uint64_t total = 0;
+    auto now = fs::file_time_type::clock::now();
+
+    error_code ec;
+    for (auto& e : fs::directory_iterator(dir, ec)) {
+        auto ext = e.path().extension();
+        auto used = e.last_write_time(ec);
+        if (ec) continue;
+        if (ext == ".tmp") {
+            if (now - used > chrono::hours(1)) fs::remove(e.path(), ec);
+            continue;
+        }
+        if (ext != ".mce") continue;
+        uint64_t size = e.file_size(ec);
+        if (ec) continue;
+        list.push_back({ e.path(), size, used });
+        total += size;
+    }
+
+    uint64_t count = list.size();
+    if (total > limit) {
+        sort(list.begin(), list.end(),
+             [](const Entry& a, const Entry& b) { return a.used < b.used; });
+        for (auto& e : list) {
+            if (total <= limit / 4 * 3) break;
+            if (fs::remove(e.path, ec)) {
+                total -= e.size;
+                count--;
+                evictions++;
+            }
+        }
+    }
+    usage = total;
+    entries = count;
+}
+
+CompileCache::Counters CompileCache::counters() const {
+    return { hits.load(), misses.load(), stores.load(), evictions.load() };
+}
+
+CompileCache::Counters CompileCache::readLifetime() const {
+    Counters c;
+    ifstream in(dir + "/stats");
+    string name;
+    uint64_t value;
+    while (in >> name >> value) {
+        if (name == "hits") c.hits = value;
+        else if (name == "misses") c.misses = value;
+        else if (name == "stores") c.stores = value;
+        else if (name == "evictions") c.evictions = value;
+    }
+    return c;
+}
+
+void CompileCache::saveCounters() {
+    lock_guard<mutex> guard(evictLock);
+    Counters now = counters();
+    if (now.hits == saved.hits && now.misses == saved.misses &&
+        now.stores == saved.stores && now.evictions == saved.evictions)
+        return;
+
+    DirLock lock(dir);
+    Counters total = readLifetime();
+    total.hits += now.hits - saved.hits;
+    total.misses += now.misses - saved.misses;
+    total.stores += now.stores - saved.stores;
+    total.evictions += now.evictions - saved.evictions;
+
+    string text = "hits " + to_string(total.hits) +
+                  "\nmisses " + to_string(total.misses) +
+                  "\nstores " + to_string(total.stores) +
+                  "\nevictions " + to_string(total.evictions) + "\n";
+    string temp = dir + "/stats." + to_string(processId()) + ".tmp";
+    if (writeAtomically(dir + "/stats", temp, text))
+        saved = now;
+}
+
+CompileCache::Counters CompileCache::lifetime() {
+    saveCounters();
+    DirLock lock(dir);
+    return readLifetime();
+}
+
+static string describe(const CompileCache::Counters& c) {
+    uint64_t lookups = c.hits + c.misses;
+    char buf[160];
+    snprintf(buf, sizeof buf,
+             "%llu hits, %llu misses (%.1f%% hit rate), %llu stored, %llu evicted",
+             static_cast<unsigned long long>(c.hits),
+             static_cast<unsigned long long>(c.misses),
+             lookups ? 100.0 * c.hits / lookups : 0.0,
+             static_cast<unsigned long long>(c.stores),
+             static_cast<unsigned long long>(c.evictions));
+    return buf;
+}
+
+string CompileCache::report() {
+    char size[128];
+    snprintf(size, sizeof size, "%llu entries, %.1f KB of %llu MB",
+             static_cast<unsigned long long>(entries.load()), usage / 1024.0,
+             static_cast<unsigned long long>(limit >> 20));
+
+    return "cache: " + describe(counters()) + "\n" +
+           "  lifetime:  " + describe(lifetime()) + "\n" +
+           "  directory: " + dir + ", " + size + "\n";
+}
@@ -0,0 +1,102 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "diagnostics.h"
+
+using namespace std;
+
+// XXH64 of `size` bytes: fast, well distributed, not cryptographic.
+uint64_t xxhash64(const void* data, size_t size, uint64_t seed = 0);
+
+// What compiling a file produced, minus anything that depends on its
+// path: diagnostics are kept unrendered and rendered again on a hit.
+struct CachedResult {
+    bool ok = true;
+    string output;                  // what --run printed
+    string failure;                 // message of a fatal error, if any
+    vector<Diagnostic> diagnostics;
+};
+
+//
+// On-disk cache of compile results, keyed by a hash of the source
+// bytes and of the options that change the result. One file per
+// entry in the cache directory, shared by every process using it:
+//
+//   - entries are written to a temporary file and renamed into place,
+//     so a reader sees a whole entry or none; each also carries a
+//     checksum, and one that fails to verify counts as a miss
+//   - a hit refreshes the entry's modification time, and eviction
+//     drops the least recently used entries once the directory
+//     outgrows its limit; evictions and the lifetime hit counters
+//     are serialized between processes with a lock file
+//
+class CompileCache {
+public:
+    struct Counters {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t stores = 0;
+        uint64_t evictions = 0;
+    };
+
+    // Creates `dir` if needed; throws runtime_error if it cannot.
+    CompileCache(string dir, uint64_t limitBytes);
+
+    // Adds this process's counters to the lifetime totals.
+    ~CompileCache();
+
+    CompileCache(const CompileCache&) = delete;
+    CompileCache& operator=(const CompileCache&) = delete;
+
+    // Version of what the compiler produces for a given source: its
+    // diagnostics, --run output and fatal errors. Part of every key,
+    // so it must be bumped with any change to the lexer, parser,
+    // checker, optimizer or backends that can change a result, or old
+    // entries keep being served.
+    static constexpr uint32_t COMPILER_VERSION = 5;
+
+    // `salt` distinguishes option sets that compile the same source
+    // differently.
+    static uint64_t key(string_view source, uint64_t salt);
+
+    optional<CachedResult> load(uint64_t key, size_t sourceSize);
+    void store(uint64_t key, size_t sourceSize, const CachedResult& result);
+
+    // Counted by this process, and by every process that used the
+    // directory (this one included).
+    Counters counters() const;
+    Counters lifetime();
+
+    // "cache: N hits, M misses (x% hit rate), ..." for this process,
+    // the lifetime totals and the directory's size.
+    string report();
+
+private:
+    static constexpr uint32_t FORMAT = 2;     // of the entry files
+
+    string dir;
+    uint64_t limit;
+    atomic<uint64_t> usage{ 0 };    // bytes, approximate across processes
+    atomic<uint64_t> entries{ 0 };
+    atomic<uint64_t> tempCount{ 0 };
+
+    atomic<uint64_t> hits{ 0 }, misses{ 0 }, stores{ 0 }, evictions{ 0 };
+    Counters saved;                 // already added to the lifetime file
+    mutex evictLock;
+
+    string entryPath(uint64_t key) const;
+    void scan();
+    void evict();
+    void saveCounters();
+    Counters readLifetime() const;
+};
+
+#endif
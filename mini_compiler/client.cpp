@@ -0,0 +1,84 @@
+/*
+mcc: thin client of the compile server (mini_compiler --server).
+
+Takes the same file arguments and compile options as mini_compiler,
+has the server do the work and prints what mini_compiler would have
+printed, with the same exit status. Built on its own (Code::Blocks
+target "Client"), e.g.
+    g++ -std=c++17 -O2 client.cpp protocol.cpp -o mcc
+*/
+
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include "protocol.h"
+
+using namespace std;
+
+static int usage() {
+    cerr << "usage: mcc [options] <path>...   check files on the compile server\n"
+            "       mcc --status | --stop     ask the server for its counters,\n"
+            "                                 or to shut down\n"
+            "\n"
+            "options:\n"
+            "  --socket=PATH      server socket (default: $MINI_COMPILER_SOCKET,\n"
+            "                     else /tmp/mini_compiler-<uid>.sock)\n"
+            "  --run, --no-opt, --two-phase, --stream, --vm=ENGINE\n"
+            "                     as for mini_compiler\n";
+    return 2;
+}
+
+int main(int argc, char** argv) {
+    ServerRequest request;
+    Options& opts = request.options;
+    string socketPath = defaultSocketPath();
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--run") opts.run = true;
+        else if (arg == "--no-opt") opts.optimize = false;
+        else if (arg == "--two-phase") opts.twoPhase = true;
+        else if (arg == "--stream") opts.stream = true;
+        else if (arg == "--vm=ast") opts.engine = Engine::AST;
+        else if (arg == "--vm=stack") opts.engine = Engine::STACK;
+        else if (arg == "--vm=reg") opts.engine = Engine::REG;
+        else if (arg == "--vm=jit") opts.engine = Engine::JIT;
+        else if (arg == "--status") request.kind = RequestKind::STATUS;
+        else if (arg == "--stop") request.kind = RequestKind::STOP;
+        else if (arg.rfind("--socket=", 0) == 0) socketPath = arg.substr(9);
+        else if (arg[0] == '-') return usage();
+        else request.paths.push_back(arg);
+    }
+    if (request.kind == RequestKind::COMPILE && request.paths.empty())
+        return usage();
+
+    // The server has a working directory of its own.
+    error_code ec;
+    request.directory = filesystem::current_path(ec).string();
+
+    ServerResponse response;
+    string error;
+    if (!callServer(socketPath, request, response, error)) {
+        cerr << "mcc: " << error << "\n";
+        return 1;
+    }
+    if (!response.error.empty()) {
+        cerr << response.error << "\n";
+        return 1;
+    }
+    cout << response.status;
+
+    size_t failed = 0;
+    for (auto& r : response.results) {
+        if (!r.output.empty()) {
+            if (response.results.size() > 1) cout << r.path << ": ";
+            cout << r.output;
+        }
+        cerr << r.diagnostics;
+        if (!r.ok) failed++;
+    }
+    if (response.results.size() > 1)
+        cerr << response.results.size() << " files, " << failed << " failed\n";
+    return failed ? 1 : 0;
+}
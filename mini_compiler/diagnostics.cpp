@@ -0,0 +1,92 @@
+#include "diagnostics.h"
+#include <algorithm>
+
+using namespace std;
+
+static const char* severityName(Severity s) {
+    switch (s) {
+    case Severity::NOTE:    return "note";
+    case Severity::WARNING: return "warning";
+    case Severity::ERROR:   return "error";
+    }
+    return "";
+}
+
+// Offsets at which each line of `source` starts, up to the one after
+// `lastLine`; the rest of a large file is never scanned.
+static vector<size_t> lineStarts(string_view source, uint32_t lastLine) {
+    vector<size_t> starts{ 0 };
+    for (size_t i = 0; i < source.size() && starts.size() <= lastLine; ++i)
+        if (source[i] == '\n') starts.push_back(i + 1);
+    return starts;
+}
+
+// Text of 1-based line `line`, without its line break.
+static string_view lineText(string_view source,
+                            const vector<size_t>& starts, uint32_t line) {
+    if (line == 0 || line > starts.size()) return {};
+
+    size_t start = starts[line - 1];
+    size_t end = line < starts.size() ? starts[line] - 1 : source.size();
+    string_view text = source.substr(start, end - start);
+    if (!text.empty() && text.back() == '\r') text.remove_suffix(1);
+    return text;
+}
+
+Diagnostics::Diagnostics(string file)
+    : fileName(move(file)) {}
+
+void Diagnostics::report(Severity severity, SourceLoc loc, string message) {
+    if (severity == Severity::ERROR) errors++;
+    items.push_back({ severity, loc, move(message) });
+}
+
+void Diagnostics::append(const Diagnostics& other) {
+    items.insert(items.end(), other.items.begin(), other.items.end());
+    errors += other.errors;
+}
+
+string Diagnostics::render(const Diagnostic& d, string_view source) const {
+    vector<size_t> starts;
+    if (!source.empty()) starts = lineStarts(source, d.loc.line);
+    return renderOne(d, lineText(source, starts, d.loc.line));
+}
+
+string Diagnostics::render(string_view source) const {
+    uint32_t lastLine = 0;
+    for (auto& d : items)
+        lastLine = max(lastLine, d.loc.line);
+
+    vector<size_t> starts;
+    if (!source.empty()) starts = lineStarts(source, lastLine);
+
+    string out;
+    for (auto& d : items)
+        out += renderOne(d, lineText(source, starts, d.loc.line));
+    return out;
+}
+
+string Diagnostics::renderOne(const Diagnostic& d, string_view text) const {
+    string out = fileName;
+    if (d.loc.line > 0) {
+        if (!out.empty()) out += ':';
+        out += to_string(d.loc.line) + ':' + to_string(d.loc.column);
+    }
+    if (!out.empty()) out += ": ";
+    out += severityName(d.severity);
+    out += ": ";
+    out += d.message;
+    out += '\n';
+
+    if (text.empty()) return out;
+
+    out += "    ";
+    out += text;
+    out += "\n    ";
+    for (uint32_t c = 1; c < d.loc.column && c <= text.size(); ++c)
+        out += text[c - 1] == '\t' ? '\t' : ' ';
+    out += '^';
+    if (d.loc.length > 1) out.append(d.loc.length - 1, '~');
+    out += '\n';
+    return out;
+}
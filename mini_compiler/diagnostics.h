@@ -0,0 +1,65 @@
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+// Span of a token or node in its source file. Line and column are
+// 1-based; line 0 means unknown.
+struct SourceLoc {
+    uint32_t line = 0;
+    uint32_t column = 0;
+    uint32_t length = 0;
+};
+
+enum class Severity : uint8_t { NOTE, WARNING, ERROR };
+
+struct Diagnostic {
+    Severity severity;
+    SourceLoc loc;
+    string message;
+};
+
+//
+// Collects the diagnostics of one source file. Passes report here and
+// carry on, so a single run finds every error; exceptions are left
+// for conditions that make going on pointless.
+//
+class Diagnostics {
+public:
+    explicit Diagnostics(string file = "");
+
+    void report(Severity severity, SourceLoc loc, string message);
+    void error(SourceLoc loc, string message) {
+        report(Severity::ERROR, loc, move(message));
+    }
+    void warning(SourceLoc loc, string message) {
+        report(Severity::WARNING, loc, move(message));
+    }
+
+    // Appends `other`'s diagnostics after this one's.
+    void append(const Diagnostics& other);
+
+    bool hasErrors() const { return errors > 0; }
+    size_t errorCount() const { return errors; }
+    const vector<Diagnostic>& all() const { return items; }
+    const string& file() const { return fileName; }
+
+    // "file:line:col: error: message", one per line. Given the source
+    // text, each is followed by its line with the span underlined.
+    string render(string_view source = {}) const;
+    string render(const Diagnostic& d, string_view source = {}) const;
+
+private:
+    string fileName;
+    vector<Diagnostic> items;
+    size_t errors = 0;
+
+    string renderOne(const Diagnostic& d, string_view lineText) const;
+};
+
+#endif
@@ -0,0 +1,395 @@
+#include "driver.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include "bytecode.h"
+#include "cache.h"
+#include "interp.h"
+#include "jit.h"
+#include "lexer.h"
+#include "mappedfile.h"
+#include "module.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "regvm.h"
+#include "semantic.h"
+#include "threadpool.h"
+#include "vm.h"
+
+using namespace std;
+
+static bool readFile(const string& path, string& out) {
+    ifstream in(path, ios::binary);
+    if (!in) return false;
+    ostringstream ss;
+    ss << in.rdbuf();
+    out = ss.str();
+    return true;
+}
+
+static Value runMain(const vector<StmtPtr>& ast, Interner& names,
+                     Engine engine) {
+    Symbol mainName = names.intern("main");
+
+    if (engine == Engine::AST)
+        return AstInterpreter(ast, names).run(mainName);
+
+    if (engine == Engine::JIT) {
+        auto program = JitCompiler(names).compile(ast);
+        int entry = program->findFunction(mainName);
+        if (entry < 0)
+            throw runtime_error("No 'main' function to run");
+
+        return program->run(entry);
+    }
+
+    if (engine == Engine::REG) {
+        RegModule module = RegCompiler(names).compile(ast);
+        int entry = module.findFunction(mainName);
+        if (entry < 0)
+            throw runtime_error("No 'main' function to run");
+
+        RegVM vm(module);
+        return vm.run(entry);
+    }
+
+    BytecodeModule module = BytecodeCompiler(names).compile(ast);
+    int entry = module.findFunction(mainName);
+    if (entry < 0)
+        throw runtime_error("No 'main' function to run");
+
+    VM vm(module);
+    return vm.run(entry);
+}
+
+// What in `program` nests more than `limit` levels deep, "Expression"
+// or "Block", with `at` set to its outermost node; null if nothing
+// does. Walks the tree on explicit stacks.
+static const char* nestedTooDeep(const vector<StmtPtr>& program, size_t limit,
+                                 SourceLoc& at) {
+    vector<pair<const Stmt*, size_t>> stmts;
+    vector<pair<const Expr*, size_t>> exprs;
+    for (size_t i = program.size(); i-- > 0;) stmts.push_back({ program[i], 1 });
+
+    while (!stmts.empty()) {
+        auto [s, nesting] = stmts.back();
+        stmts.pop_back();
+        if (nesting > limit) {
+            at = s->loc;
+            return "Block";
+        }
+
+        const Expr* root = nullptr;
+        switch (s->kind) {
+        case StmtKind::EXPR:
+            root = static_cast<const ExprStmt*>(s)->expr;
+            break;
+        case StmtKind::RETURN:
+            root = static_cast<const ReturnStmt*>(s)->expr;
+            break;
+        case StmtKind::BLOCK: {
+            auto& body = static_cast<const BlockStmt*>(s)->statements;
+            for (size_t i = body.size(); i-- > 0;)
+                stmts.push_back({ body[i], nesting + 1 });
+            break;
+        }
+        case StmtKind::FUNCTION:
+            stmts.push_back({ static_cast<const FunctionDecl*>(s)->body, nesting + 1 });
+            break;
+        case StmtKind::VAR_DECL:
+            break;
+        }
+        if (!root) continue;
+
+        exprs.push_back({ root, 1 });
+        while (!exprs.empty()) {
+            auto [e, depth] = exprs.back();
+            exprs.pop_back();
+            if (depth > limit) {
+                at = root->loc;
+                return "Expression";
+            }
+
+            switch (e->kind) {
+            case ExprKind::ASSIGN:
+                exprs.push_back({ static_cast<const AssignExpr*>(e)->value, depth + 1 });
+                break;
+            case ExprKind::BINARY:
+                exprs.push_back({ static_cast<const BinaryExpr*>(e)->left, depth + 1 });
+                exprs.push_back({ static_cast<const BinaryExpr*>(e)->right, depth + 1 });
+                break;
+            case ExprKind::UNARY:
+                exprs.push_back({ static_cast<const UnaryExpr*>(e)->expr, depth + 1 });
+                break;
+            case ExprKind::CALL:
+                for (auto a : static_cast<const CallExpr*>(e)->args)
+                    exprs.push_back({ a, depth + 1 });
+                break;
+            default:
+                break;
+            }
+        }
+    }
+    return nullptr;
+}
+
+// Lex, parse, check and (with --run) execute `source`. Errors go to
+// `diags`; fatal ones are thrown.
+static void build(string_view source, MappedFile& file, const Options& opts,
+                  FileResult& result, Diagnostics& diags, CompileStats* stats) {
+    Interner names;
+    Lexer lexer(source, names);
+    optional<TokenBuffer> tokens;
+    if (!opts.stream) {
+        PhaseTimer timer(stats, "lex");
+        tokens = lexer.tokenize();
+    }
+
+    // The analyzer runs on whatever the parser recovered, so one
+    // run reports syntax and type errors together.
+    AstArena arena;
+    Parser parser = opts.stream ? Parser(lexer, arena, diags)
+                                : Parser(*tokens, arena, diags);
+    SemanticAnalyzer semantic(names, diags);
+    semantic.setStats(stats);
+
+    bool modules = !opts.modules.empty() || !opts.emitModule.empty();
+    if (opts.stream && !opts.run && !opts.twoPhase && !modules) {
+        // Check-only: memory stays flat however long the file.
+        semantic.begin();
+        for (;;) {
+            StmtPtr stmt;
+            {
+                PhaseTimer timer(stats, "parse");
+                stmt = parser.next();
+            }
+            if (!stmt) break;
+            {
+                PhaseTimer timer(stats, "semantic");
+                semantic.analyzeNext(stmt);
+            }
+            if (stats) {
+                stats->countNodes(stmt);
+                stats->astBytes += arena.bytesUsed();
+            }
+            arena.reset();
+            file.release(lexer.offset());
+        }
+        semantic.end();
+        if (stats) stats->tokens = lexer.tokenCount();
+
+        if (diags.hasErrors()) {
+            result.diagnostics = diags.render(source);
+            result.ok = false;
+        }
+        return;
+    }
+
+    vector<StmtPtr> ast;
+    {
+        PhaseTimer timer(stats, "parse");
+        ast = parser.parse();
+    }
+    if (stats) {
+        stats->tokens = lexer.tokenCount();
+        stats->countNodes(ast);
+        stats->astBytes = arena.bytesUsed();
+    }
+
+    {
+        PhaseTimer timer(stats, "semantic");
+        if (opts.twoPhase)
+            semantic.analyzeTwoPhase(ast, opts.semaThreads);
+        else if (!opts.modules.empty())
+            semantic.analyze(ast, ModuleEnvironment(opts.modules, names));
+        else
+            semantic.analyze(ast);
+    }
+
+    if (opts.run || !opts.emitModule.empty()) {
+        SourceLoc at;
+        if (const char* what = nestedTooDeep(ast, MAX_COMPILED_DEPTH, at))
+            diags.error(at, string(what) + " nested too deeply to compile "
+                        "(more than " + to_string(MAX_COMPILED_DEPTH) + " levels)");
+    }
+
+    if (diags.hasErrors()) {
+        result.diagnostics = diags.render(source);
+        result.ok = false;
+        return;
+    }
+
+    if (!opts.emitModule.empty()) {
+        PhaseTimer timer(stats, "emit module");
+        Module::write(opts.emitModule, ast, names);
+    }
+
+    // The modules' declarations come first, as if their sources did.
+    if (opts.run && !opts.modules.empty()) {
+        PhaseTimer timer(stats, "modules");
+        vector<StmtPtr> program;
+        for (auto& m : opts.modules) {
+            vector<StmtPtr> decls = m->materialize(arena, names);
+            SourceLoc at;
+            if (nestedTooDeep(decls, MAX_COMPILED_DEPTH, at))
+                throw runtime_error("module '" + m->path() +
+                                    "' nests too deeply to compile");
+            program.insert(program.end(), decls.begin(), decls.end());
+        }
+        program.insert(program.end(), ast.begin(), ast.end());
+        ast = move(program);
+    }
+
+    if (!opts.run) return;
+
+    if (opts.optimize) {
+        PhaseTimer timer(stats, "optimize");
+        Optimizer(arena).optimize(ast);
+    }
+
+    {
+        PhaseTimer timer(stats, "run");
+        result.output = to_string(runMain(ast, names, opts.engine)) + "\n";
+    }
+}
+
+// Options that change what a file compiles to, as a cache key salt.
+static uint64_t cacheSalt(const Options& opts) {
+    uint64_t salt = opts.optimize | opts.twoPhase << 1 | opts.run << 2;
+    if (opts.run) salt |= uint64_t(static_cast<int>(opts.engine) + 1) << 3;
+    return salt;
+}
+
+// The pipeline behind compileFile(): reads `path`, names it
+// result.path in diagnostics. Phases are timed into `stats` when it
+// is set.
+static void compile(const string& path, const Options& opts,
+                    FileResult& result, CompileStats* stats) {
+    string buffer;
+    MappedFile file;
+    bool opened;
+    {
+        PhaseTimer timer(stats, "read");
+        opened = opts.stream ? file.open(path) : readFile(path, buffer);
+    }
+    if (!opened) {
+        result.diagnostics = result.path + ": cannot open file\n";
+        result.ok = false;
+        return;
+    }
+    string_view source = opts.stream ? file.text() : string_view(buffer);
+    if (stats) stats->sourceBytes = source.size();
+
+    // A hit skips every phase; the diagnostics are rendered afresh so
+    // they name this path. The key covers the source only, so files
+    // built with modules bypass the cache.
+    Diagnostics diags(result.path);
+    uint64_t key = 0;
+    CompileCache* cache =
+        opts.modules.empty() && opts.emitModule.empty() ? opts.cache : nullptr;
+    if (cache) {
+        PhaseTimer timer(stats, "cache");
+        key = CompileCache::key(source, cacheSalt(opts));
+        if (auto hit = cache->load(key, source.size())) {
+            for (auto& d : hit->diagnostics)
+                diags.report(d.severity, d.loc, d.message);
+            result.ok = hit->ok;
+            result.output = hit->output;
+            if (diags.hasErrors()) result.diagnostics = diags.render(source);
+            if (!hit->failure.empty())
+                result.diagnostics =
+                    result.path + ": error: " + hit->failure + "\n";
+            return;
+        }
+    }
+
+    // Only the program's own traps are results worth keeping; any
+    // other failure may depend on this machine or this moment (out of
+    // memory, JIT pages refused) and is left out of the cache.
+    string failure;
+    bool cacheable = true;
+    try {
+        build(source, file, opts, result, diags, stats);
+    }
+    catch (const RuntimeTrap& e) {
+        failure = e.what();
+    }
+    catch (const exception& e) {
+        failure = e.what();
+        cacheable = false;
+    }
+    if (!failure.empty()) {
+        result.diagnostics = result.path + ": error: " + failure + "\n";
+        result.ok = false;
+    }
+
+    if (cache && cacheable) {
+        PhaseTimer timer(stats, "cache");
+        CachedResult entry;
+        entry.ok = result.ok;
+        entry.output = result.output;
+        entry.failure = failure;
+        if (!result.ok && failure.empty())
+            entry.diagnostics = diags.all();
+        cache->store(key, source.size(), entry);
+    }
+}
+
+FileResult compileFile(const string& path, const Options& opts) {
+    return compileFile(path, opts, path);
+}
+
+FileResult compileFile(const string& path, const Options& opts,
+                       const string& shownAs) {
+    FileResult result;
+    result.path = shownAs;
+
+    CompileStats* stats = opts.stats ? &result.stats.emplace() : nullptr;
+    {
+        PhaseTimer timer(stats, "compile");
+        compile(path, opts, result, stats);
+    }
+    return result;
+}
+
+vector<string> collectSources(const vector<string>& paths) {
+    namespace fs = std::filesystem;
+    vector<string> files;
+
+    for (auto& p : paths) {
+        error_code ec;
+        if (!fs::is_directory(p, ec)) {
+            files.push_back(p);
+            continue;
+        }
+
+        size_t first = files.size();
+        for (auto& entry : fs::recursive_directory_iterator(p, ec)) {
+            if (entry.is_regular_file(ec) && entry.path().extension() == ".mc")
+                files.push_back(entry.path().string());
+        }
+        sort(files.begin() + first, files.end());
+    }
+    return files;
+}
+
+vector<FileResult> compileBatch(const vector<string>& paths, const Options& opts) {
+    vector<FileResult> results(paths.size());
+    if (paths.size() == 1) {
+        // The threads go to the one file's function bodies instead.
+        Options single = opts;
+        single.semaThreads = opts.jobs;
+        results[0] = compileFile(paths[0], single);
+        return results;
+    }
+
+    ThreadPool pool(opts.jobs);
+    for (size_t i = 0; i < paths.size(); ++i)
+        pool.submit([&, i] { results[i] = compileFile(paths[i], opts); });
+    pool.wait();
+
+    return results;
+}
@@ -0,0 +1,73 @@
+#ifndef DRIVER_H
+#define DRIVER_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <optional>
+#include <vector>
+#include "stats.h"
+
+using namespace std;
+
+class CompileCache;
+class Module;
+
+enum class Engine { AST, STACK, REG, JIT };
+
+struct Options {
+    bool run = false;
+    bool optimize = true;           // --no-opt clears; with --run only
+    Engine engine = Engine::STACK;  // --vm=
+    size_t jobs = 0;                // --jobs=; 0 means one per core
+    bool twoPhase = false;          // --two-phase
+    size_t semaThreads = 1;         // threads checking function bodies
+                                    // in two-phase mode
+    bool stream = false;            // --stream: mmap the file and lex on
+                                    // demand; without --run or
+                                    // --two-phase, each declaration's
+                                    // AST is dropped once checked
+    bool stats = false;             // --time-report: fill FileResult::stats
+    CompileCache* cache = nullptr;  // --cache=DIR: reuse the results of
+                                    // identical inputs; shared by every
+                                    // file of a batch
+    vector<shared_ptr<const Module>> modules;
+                                    // --module=FILE: precompiled
+                                    // declarations the file is checked
+                                    // against and, with --run, linked
+                                    // with; not with --two-phase.
+                                    // Results are not cached
+    string emitModule;              // --emit-module=FILE: save the file,
+                                    // once checked, as a module
+};
+
+// Outcome of one file. Nothing is printed while compiling, so files
+// can be processed concurrently and reported in a fixed order.
+struct FileResult {
+    string path;
+    string output;          // what --run printed
+    string diagnostics;     // "path: error: ..." lines
+    bool ok = true;
+    optional<CompileStats> stats;   // with Options::stats
+};
+
+// Lex, parse and check one file; with --run, also execute its main()
+// on the selected engine.
+FileResult compileFile(const string& path, const Options& opts);
+
+// The same, but naming the file `shownAs` in the result and its
+// diagnostics (the compile server opens files by absolute path and
+// reports them as its client named them).
+FileResult compileFile(const string& path, const Options& opts,
+                       const string& shownAs);
+
+// Expands directories (recursively) into their *.mc files, sorted by
+// path; other arguments are kept as given.
+vector<string> collectSources(const vector<string>& paths);
+
+// Compiles every file on a work-stealing pool of opts.jobs threads.
+// Each file gets its own Interner, arena, parser and analyzer; the
+// results come back in the order of `paths`.
+vector<FileResult> compileBatch(const vector<string>& paths, const Options& opts);
+
+#endif
@@ -0,0 +1,405 @@
+#include "incremental.h"
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <unordered_map>
+#include "lexer.h"
+#include "parser.h"
+#include "semantic.h"
+
+using namespace std;
+
+struct IncrementalDocument::Unit {
+    string text;
+    size_t pos = 0;             // index in `units`
+    size_t start = 0;           // offset of text[0] in the document
+    uint32_t line = 1;          // line of text[0] in the document
+    uint32_t newlines = 0;      // in `text`
+
+    // The AST and diagnostics have lines of the text parsed with this
+    // unit, on which its first line was `baseLine`; an edit before the
+    // unit moves `line` without touching them. Units split from one
+    // parse share its arena.
+    uint32_t baseLine = 1;
+    shared_ptr<AstArena> arena;
+    vector<StmtPtr> stmts;
+    vector<Diagnostic> parseDiags;
+    vector<Diagnostic> semanticDiags;
+
+    // First declaration of each function (nested ones included) and
+    // top-level variable.
+    vector<pair<Symbol, FunctionInfo>> functions;
+    vector<pair<Symbol, TypeId>> globals;
+
+    // Names looked up in the Lookup during the last check.
+    vector<Symbol> usedFunctions, usedGlobals;
+    uint64_t queued = 0;        // epoch it was last queued for checking
+};
+
+// ---------------- Lookup ----------------
+
+//
+// The declarations of every unit before `unit`, as analyze() of the
+// whole text would have them when it reaches `unit`: the first of
+// each name wins. Every query is recorded in the unit's uses.
+//
+class IncrementalDocument::Lookup : public Environment {
+public:
+    Lookup(const IncrementalDocument& doc, Unit& unit)
+        : doc(doc), unit(unit) {}
+
+    const FunctionInfo* function(Symbol name) const override {
+        unit.usedFunctions.push_back(name);
+        const Unit* def = earliest(doc.functionDefs, name);
+        if (!def) return nullptr;
+        for (auto& f : def->functions)
+            if (f.first == name) return &f.second;
+        return nullptr;
+    }
+
+    optional<TypeId> global(Symbol name) const override {
+        unit.usedGlobals.push_back(name);
+        const Unit* def = earliest(doc.globalDefs, name);
+        if (!def) return nullopt;
+        for (auto& g : def->globals)
+            if (g.first == name) return g.second;
+        return nullopt;
+    }
+
+private:
+    const IncrementalDocument& doc;
+    Unit& unit;
+
+    const Unit* earliest(const vector<vector<Unit*>>& defs, Symbol name) const {
+        if (name >= defs.size()) return nullptr;
+        const Unit* best = nullptr;
+        for (const Unit* u : defs[name])
+            if (u->pos < unit.pos && (!best || u->pos < best->pos))
+                best = u;
+        return best;
+    }
+};
+
+// ---------------- Indexes ----------------
+namespace {
+
+template <typename UnitT>
+void addTo(vector<vector<UnitT*>>& index, Symbol name, UnitT* unit,
+           size_t symbols) {
+    if (name >= index.size()) index.resize(symbols);
+    index[name].push_back(unit);
+}
+
+template <typename UnitT>
+void removeFrom(vector<vector<UnitT*>>& index, Symbol name, UnitT* unit) {
+    auto& list = index[name];
+    auto it = find(list.begin(), list.end(), unit);
+    if (it == list.end()) return;
+    *it = list.back();
+    list.pop_back();
+}
+
+}
+
+void IncrementalDocument::addDefs(Unit& unit) {
+    for (auto& f : unit.functions)
+        addTo(functionDefs, f.first, &unit, names.size());
+    for (auto& g : unit.globals)
+        addTo(globalDefs, g.first, &unit, names.size());
+}
+
+void IncrementalDocument::removeDefs(Unit& unit) {
+    for (auto& f : unit.functions) removeFrom(functionDefs, f.first, &unit);
+    for (auto& g : unit.globals) removeFrom(globalDefs, g.first, &unit);
+}
+
+void IncrementalDocument::addUses(Unit& unit) {
+    for (Symbol s : unit.usedFunctions)
+        addTo(functionUsers, s, &unit, names.size());
+    for (Symbol s : unit.usedGlobals)
+        addTo(globalUsers, s, &unit, names.size());
+}
+
+void IncrementalDocument::removeUses(Unit& unit) {
+    for (Symbol s : unit.usedFunctions) removeFrom(functionUsers, s, &unit);
+    for (Symbol s : unit.usedGlobals) removeFrom(globalUsers, s, &unit);
+}
+
+// Adds the first declaration of each function in `stmt`, nested ones
+// included, and at the top level of each variable, in the order
+// analyze() declares them.
+static void collect(const Stmt* stmt, bool topLevel,
+                    vector<pair<Symbol, FunctionInfo>>& functions,
+                    vector<pair<Symbol, TypeId>>& globals) {
+    auto declared = [](const auto& list, Symbol name) {
+        return any_of(list.begin(), list.end(),
+                      [&](const auto& d) { return d.first == name; });
+    };
+
+    if (auto v = nodeAs<const VarDecl>(stmt)) {
+        if (topLevel && !declared(globals, v->name))
+            globals.push_back({ v->name, v->type });
+    }
+    else if (auto f = nodeAs<const FunctionDecl>(stmt)) {
+        if (!declared(functions, f->name)) {
+            FunctionInfo info{ f->returnType, {} };
+            for (auto& p : f->params)
+                info.paramTypes.push_back(p.type);
+            functions.push_back({ f->name, move(info) });
+        }
+        collect(f->body, false, functions, globals);
+    }
+    else if (auto b = nodeAs<const BlockStmt>(stmt)) {
+        for (auto s : b->statements)
+            collect(s, false, functions, globals);
+    }
+}
+
+// ---------------- IncrementalDocument ----------------
+IncrementalDocument::IncrementalDocument(string_view text) {
+    edit(0, 0, text);
+}
+
+IncrementalDocument::~IncrementalDocument() = default;
+
+string IncrementalDocument::text() const {
+    string out;
+    out.reserve(length);
+    for (auto& u : units)
+        out += u->text;
+    return out;
+}
+
+vector<Diagnostic> IncrementalDocument::diagnostics() const {
+    vector<Diagnostic> out;
+    auto place = [&](const Unit& u, const vector<Diagnostic>& from) {
+        for (Diagnostic d : from) {
+            if (d.loc.line != 0)
+                d.loc.line = d.loc.line - u.baseLine + u.line;
+            out.push_back(move(d));
+        }
+    };
+
+    for (auto& u : units) place(*u, u->parseDiags);
+    for (auto& u : units) place(*u, u->semanticDiags);
+    return out;
+}
+
+// The unit holding byte `offset`; the last one for the end of the
+// text.
+size_t IncrementalDocument::unitAt(size_t offset) const {
+    auto it = partition_point(units.begin(), units.end(),
+        [&](const unique_ptr<Unit>& u) { return u->start <= offset; });
+    return static_cast<size_t>(it - units.begin()) - 1;
+}
+
+void IncrementalDocument::renumber(size_t from) {
+    for (size_t i = from; i < units.size(); ++i) {
+        Unit& u = *units[i];
+        u.pos = i;
+        if (i == 0) {
+            u.start = 0;
+            u.line = 1;
+        }
+        else {
+            const Unit& before = *units[i - 1];
+            u.start = before.start + before.text.size();
+            u.line = before.line + before.newlines;
+        }
+    }
+}
+
+// Parses `text`, which starts where a unit starts, into units. Fails
+// if the text stops short of the end of the document (`toEnd` false)
+// and its last declaration is in error or unfinished: what follows
+// could change how that parses.
+bool IncrementalDocument::parse(string_view text, bool toEnd,
+                                vector<unique_ptr<Unit>>& out) {
+    auto arena = make_shared<AstArena>(
+        clamp<size_t>(text.size() * 4, 1024, 64 * 1024));
+    Lexer lexer(text, names);
+    TokenBuffer tokens = lexer.tokenize();
+    Diagnostics diags;
+    Parser parser(tokens, *arena, diags);
+
+    auto unit = make_unique<Unit>();
+    size_t unitStart = 0;
+    uint32_t line = 1;
+    bool settled = true;        // the last declaration parsed cleanly
+
+    auto finish = [&](size_t end) {
+        unit->text.assign(text.substr(unitStart, end - unitStart));
+        unit->newlines = static_cast<uint32_t>(
+            count(unit->text.begin(), unit->text.end(), '\n'));
+        unit->baseLine = line;
+        unit->arena = arena;
+        for (auto s : unit->stmts)
+            collect(s, true, unit->functions, unit->globals);
+
+        line += unit->newlines;
+        unitStart = end;
+        out.push_back(move(unit));
+        unit = make_unique<Unit>();
+    };
+
+    for (;;) {
+        bool fresh = !parser.recovering();
+        size_t reported = diags.all().size();
+        StmtPtr stmt = parser.next();
+
+        auto& all = diags.all();
+        unit->parseDiags.insert(unit->parseDiags.end(),
+                                all.begin() + reported, all.end());
+        bool clean = fresh && all.size() == reported;
+        if (!stmt) {
+            settled = settled && clean;
+            break;
+        }
+        unit->stmts.push_back(stmt);
+        settled = clean;
+
+        // Cut at the start of the line after a clean declaration,
+        // unless the next token is on that line too.
+        size_t next = parser.position();
+        if (!clean || tokens.kind(next) == TokenType::END_OF_FILE)
+            continue;
+        size_t cut = text.find('\n', tokens.offset(next - 1));
+        if (cut != string_view::npos && tokens.offset(next) > cut)
+            finish(cut + 1);
+    }
+
+    if (!settled && !toEnd)
+        return false;
+    if (unitStart < text.size() || !unit->stmts.empty() ||
+        !unit->parseDiags.empty())
+        finish(text.size());
+    return true;
+}
+
+void IncrementalDocument::check(Unit& unit) {
+    removeUses(unit);
+    unit.usedFunctions.clear();
+    unit.usedGlobals.clear();
+
+    Diagnostics diags;
+    Lookup lookup(*this, unit);
+    SemanticAnalyzer(names, diags).analyze(unit.stmts, lookup);
+    unit.semanticDiags = diags.all();
+
+    for (auto used : { &unit.usedFunctions, &unit.usedGlobals }) {
+        sort(used->begin(), used->end());
+        used->erase(unique(used->begin(), used->end()), used->end());
+    }
+    addUses(unit);
+}
+
+void IncrementalDocument::edit(size_t offset, size_t removed,
+                               string_view inserted) {
+    if (offset > length || removed > length - offset)
+        throw out_of_range("IncrementalDocument::edit: range outside the text");
+    stats = EditStats{};
+    ++epoch;
+
+    // The units the edit touches, as one text.
+    size_t first = 0, end = 0;
+    if (!units.empty()) {
+        first = unitAt(offset);
+        end = unitAt(removed ? offset + removed - 1 : offset) + 1;
+    }
+    size_t regionStart = first < units.size() ? units[first]->start : 0;
+    string region;
+    for (size_t i = first; i < end; ++i)
+        region += units[i]->text;
+    region.replace(offset - regionStart, removed, inserted);
+    length = length - removed + inserted.size();
+
+    // Units start lines: one whose line now begins inside the region
+    // is part of it.
+    while (end < units.size() && !region.empty() && region.back() != '\n')
+        region += units[end++]->text;
+
+    // While the last declaration could still change, take in the
+    // units after it, at least doubling the text each time.
+    vector<unique_ptr<Unit>> parsed;
+    for (;;) {
+        stats.relexedBytes += region.size();
+        if (parse(region, end == units.size(), parsed)) break;
+
+        parsed.clear();
+        size_t grow = region.size();
+        for (size_t added = 0; end < units.size() && added < grow; ++end) {
+            region += units[end]->text;
+            added += units[end]->text.size();
+        }
+    }
+
+    // Swap the new units in; the old ones stay alive until compared.
+    vector<unique_ptr<Unit>> old(make_move_iterator(units.begin() + first),
+                                 make_move_iterator(units.begin() + end));
+    for (auto& u : old) {
+        removeDefs(*u);
+        removeUses(*u);
+    }
+    units.erase(units.begin() + first, units.begin() + end);
+    units.insert(units.begin() + first, make_move_iterator(parsed.begin()),
+                 make_move_iterator(parsed.end()));
+    size_t after = first + parsed.size();
+    renumber(first);
+    for (size_t i = first; i < after; ++i)
+        addDefs(*units[i]);
+    stats.reparsedUnits = after - first;
+
+    // Names whose first declaration in the region is gone, new or
+    // different; units after the region that looked one up see it
+    // differently now.
+    unordered_map<Symbol, pair<const FunctionInfo*, const FunctionInfo*>> functions;
+    unordered_map<Symbol, pair<optional<TypeId>, optional<TypeId>>> globals;
+    for (auto& u : old) {
+        for (auto& f : u->functions) {
+            auto& e = functions[f.first];
+            if (!e.first) e.first = &f.second;
+        }
+        for (auto& g : u->globals) {
+            auto& e = globals[g.first];
+            if (!e.first) e.first = g.second;
+        }
+    }
+    for (size_t i = first; i < after; ++i) {
+        for (auto& f : units[i]->functions) {
+            auto& e = functions[f.first];
+            if (!e.second) e.second = &f.second;
+        }
+        for (auto& g : units[i]->globals) {
+            auto& e = globals[g.first];
+            if (!e.second) e.second = g.second;
+        }
+    }
+
+    vector<Unit*> work;
+    auto queue = [&](Unit* u) {
+        if (u->queued == epoch) return;
+        u->queued = epoch;
+        work.push_back(u);
+    };
+    auto queueUsers = [&](const vector<vector<Unit*>>& users, Symbol name) {
+        if (name >= users.size()) return;
+        for (Unit* u : users[name])
+            if (u->pos >= after) queue(u);
+    };
+
+    for (size_t i = first; i < after; ++i)
+        queue(units[i].get());
+    for (auto& [name, e] : functions) {
+        const FunctionInfo *a = e.first, *b = e.second;
+        bool same = a && b ? a->returnType == b->returnType &&
+                             a->paramTypes == b->paramTypes
+                           : a == b;
+        if (!same) queueUsers(functionUsers, name);
+    }
+    for (auto& [name, e] : globals)
+        if (e.first != e.second) queueUsers(globalUsers, name);
+
+    for (Unit* u : work)
+        check(*u);
+    stats.recheckedUnits = work.size();
+}
@@ -0,0 +1,87 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "arena.h"
+#include "ast.h"
+#include "diagnostics.h"
+#include "interner.h"
+#include "symbol.h"
+
+using namespace std;
+
+//
+// A source text kept parsed and checked across edits, for editors and
+// other long-lived callers that re-check after every keystroke.
+//
+// The text is split into units: runs of whole lines holding one or
+// more top-level declarations, cut only where the parser ends a
+// declaration cleanly. Each unit keeps its own AST and diagnostics.
+// An edit re-lexes and reparses just the units it touches (plus the
+// following ones while the last declaration is unfinished), then
+// re-checks the new units and every later unit whose lookups of
+// functions and globals declared elsewhere now resolve differently.
+// diagnostics() is always what parsing and analyze()ing the whole
+// text would report, in the same order.
+//
+class IncrementalDocument {
+public:
+    // What the last edit() redid.
+    struct EditStats {
+        size_t relexedBytes = 0;    // over every reparse attempt
+        size_t reparsedUnits = 0;   // units the edit produced
+        size_t recheckedUnits = 0;
+    };
+
+    explicit IncrementalDocument(string_view text = {});
+    ~IncrementalDocument();
+
+    IncrementalDocument(const IncrementalDocument&) = delete;
+    IncrementalDocument& operator=(const IncrementalDocument&) = delete;
+
+    // Replaces the `removed` bytes at `offset` with `inserted`; throws
+    // out_of_range if they are not all inside the text.
+    void edit(size_t offset, size_t removed, string_view inserted);
+
+    string text() const;
+    size_t size() const { return length; }
+
+    // Parse errors first, then semantic ones, at lines of the whole
+    // text.
+    vector<Diagnostic> diagnostics() const;
+
+    const EditStats& lastEdit() const { return stats; }
+    size_t unitCount() const { return units.size(); }
+
+private:
+    struct Unit;
+    class Lookup;
+
+    Interner names;
+    vector<unique_ptr<Unit>> units;
+    size_t length = 0;
+    EditStats stats;
+    uint64_t epoch = 0;                     // bumped by every edit()
+
+    // Indexed by Symbol: units declaring it, and units whose last
+    // check looked it up outside themselves.
+    vector<vector<Unit*>> functionDefs, globalDefs;
+    vector<vector<Unit*>> functionUsers, globalUsers;
+
+    size_t unitAt(size_t offset) const;
+    bool parse(string_view text, bool toEnd, vector<unique_ptr<Unit>>& out);
+    void check(Unit& unit);
+    void renumber(size_t from);
+
+    void addDefs(Unit& unit);
+    void removeDefs(Unit& unit);
+    void addUses(Unit& unit);
+    void removeUses(Unit& unit);
+};
+
+#endif
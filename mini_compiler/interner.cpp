@@ -0,0 +1,29 @@
+#include "interner.h"
+#include <cstring>
+
+using namespace std;
+
+Symbol Interner::intern(string_view text) {
+    auto it = ids.find(text);
+    if (it != ids.end())
+        return it->second;
+
+    Symbol sym = static_cast<Symbol>(names.size());
+    string_view owned = store(text);
+    names.push_back(owned);
+    ids.emplace(owned, sym);
+    return sym;
+}
+
+string_view Interner::store(string_view text) {
+    if (chunks.empty() || text.size() > chunkCap - chunkUsed) {
+        chunkCap = text.size() > CHUNK_SIZE ? text.size() : CHUNK_SIZE;
+        chunks.emplace_back(new char[chunkCap]);
+        chunkUsed = 0;
+    }
+
+    char* dst = chunks.back().get() + chunkUsed;
+    memcpy(dst, text.data(), text.size());
+    chunkUsed += text.size();
+    return string_view(dst, text.size());
+}
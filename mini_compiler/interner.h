@@ -0,0 +1,46 @@
+#ifndef INTERNER_H
+#define INTERNER_H
+
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+// Dense id of an interned identifier: 0, 1, 2, ... in first-seen order.
+using Symbol = uint32_t;
+
+//
+// Identifier pool shared by the lexer, the AST and the symbol table.
+// Each distinct spelling is stored once and mapped to a Symbol, so
+// later phases compare and hash 4-byte ids instead of strings.
+// The pool owns its text: views returned by name() stay valid for the
+// pool's lifetime, independent of the source buffer.
+//
+class Interner {
+public:
+    Interner() = default;
+    Interner(const Interner&) = delete;
+    Interner& operator=(const Interner&) = delete;
+
+    Symbol intern(string_view text);
+    string_view name(Symbol sym) const { return names[sym]; }
+    size_t size() const { return names.size(); }
+
+private:
+    static constexpr size_t CHUNK_SIZE = 16 * 1024;
+
+    vector<string_view> names;
+    unordered_map<string_view, Symbol> ids;
+
+    // Backing storage for `names`, bump-allocated in chunks.
+    vector<unique_ptr<char[]>> chunks;
+    size_t chunkUsed = 0;
+    size_t chunkCap = 0;
+
+    string_view store(string_view text);
+};
+
+#endif
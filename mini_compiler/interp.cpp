@@ -0,0 +1,202 @@
+#include "interp.h"
+#include <stdexcept>
+
+using namespace std;
+
+AstInterpreter::AstInterpreter(const vector<StmtPtr>& program,
+                               const Interner& names, size_t maxDepth)
+    : program(program), names(names), maxDepth(maxDepth) {
+    for (auto& stmt : program)
+        collectFunctions(stmt);
+}
+
+void AstInterpreter::collectFunctions(const Stmt* stmt) {
+    if (auto f = nodeAs<const FunctionDecl>(stmt)) {
+        functions[f->name] = f;
+        collectFunctions(f->body);
+    }
+    else if (auto b = nodeAs<const BlockStmt>(stmt)) {
+        for (auto s : b->statements)
+            collectFunctions(s);
+    }
+}
+
+Value AstInterpreter::run(Symbol entry) {
+    auto it = functions.find(entry);
+    if (it == functions.end())
+        throw runtime_error("No '" + string(names.name(entry)) + "' function to run");
+    if (!it->second->params.empty())
+        throw runtime_error("Entry function must take no arguments");
+
+    // Every top-level variable exists from the start, as in the
+    // compiled engines, even if a top-level return skips its
+    // declaration.
+    globals.clear();
+    for (auto& stmt : program)
+        if (auto v = nodeAs<const VarDecl>(stmt))
+            globals[v->name] = 0;
+    locals.clear();
+    scopeStart.clear();
+    frameStart = 0;
+    depth = 0;
+    returning = false;
+
+    // Top-level statements
+    topLevel = true;
+    for (auto& stmt : program) {
+        visitStmt(stmt);
+        if (returning) break;
+    }
+    topLevel = false;
+    returning = false;
+
+    return call(it->second, {});
+}
+
+Value* AstInterpreter::lookup(Symbol name) {
+    for (size_t i = locals.size(); i > frameStart; --i)
+        if (locals[i - 1].first == name) return &locals[i - 1].second;
+
+    auto g = globals.find(name);
+    if (g != globals.end()) return &g->second;
+
+    // Checked programs only get here from a nested function reading
+    // a local of the function around it.
+    throw runtime_error(
+        "Cannot run '" + string(names.name(name)) +
+        "': not a local of the running function or a global");
+}
+
+Value AstInterpreter::call(const FunctionDecl* f, const vector<Value>& args) {
+    if (depth == maxDepth)
+        throw RuntimeTrap("Stack overflow");
+
+    // New frame: the callee sees only its own locals and the globals.
+    size_t savedFrame = frameStart;
+    size_t savedScopes = scopeStart.size();
+    bool savedTop = topLevel;
+    frameStart = locals.size();
+    topLevel = false;
+    depth++;
+
+    for (size_t i = 0; i < f->params.size(); ++i)
+        locals.emplace_back(f->params[i].name, args[i]);
+
+    visitBlock(f->body);
+    Value result = returning ? returnValue : 0;
+    returning = false;
+
+    depth--;
+    locals.resize(frameStart);
+    scopeStart.resize(savedScopes);
+    frameStart = savedFrame;
+    topLevel = savedTop;
+    return result;
+}
+
+
+// ---------------- statements ----------------
+void AstInterpreter::visitVarDecl(const VarDecl* v) {
+    // Globals were created up front.
+    if (topLevel && scopeStart.empty()) return;
+    locals.emplace_back(v->name, 0);
+}
+
+void AstInterpreter::visitExprStmt(const ExprStmt* e) {
+    visitExpr(e->expr);
+}
+
+void AstInterpreter::visitReturn(const ReturnStmt* r) {
+    returnValue = r->expr ? visitExpr(r->expr) : 0;
+    returning = true;
+}
+
+void AstInterpreter::visitBlock(const BlockStmt* b) {
+    scopeStart.push_back(locals.size());
+    for (auto s : b->statements) {
+        visitStmt(s);
+        if (returning) break;
+    }
+    locals.resize(scopeStart.back());
+    scopeStart.pop_back();
+}
+
+void AstInterpreter::visitFunction(const FunctionDecl*) {
+    // Functions were collected up front.
+}
+
+
+// ---------------- expressions ----------------
+Value AstInterpreter::visitNumber(const NumberExpr* n) {
+    return n->value;
+}
+
+Value AstInterpreter::visitBool(const BoolExpr* b) {
+    return b->value ? 1 : 0;
+}
+
+Value AstInterpreter::visitError(const ErrorExpr*) {
+    throw runtime_error("Cannot run a program with errors");
+}
+
+Value AstInterpreter::visitVar(const VarExpr* v) {
+    return *lookup(v->name);
+}
+
+Value AstInterpreter::visitAssign(const AssignExpr* a) {
+    Value value = visitExpr(a->value);
+    *lookup(a->name) = value;
+    return value;
+}
+
+Value AstInterpreter::visitBinary(const BinaryExpr* b) {
+    Value left = visitExpr(b->left);
+
+    // The right operand of && and || runs only if it decides the result.
+    if (b->op == TokenType::AND)
+        return left ? visitExpr(b->right) : 0;
+    if (b->op == TokenType::OR)
+        return left ? 1 : visitExpr(b->right);
+
+    Value right = visitExpr(b->right);
+
+    switch (b->op) {
+    case TokenType::PLUS:  return valueAdd(left, right);
+    case TokenType::MINUS: return valueSub(left, right);
+    case TokenType::STAR:  return valueMul(left, right);
+    case TokenType::SLASH:
+        if (right == 0)
+            throw RuntimeTrap("Division by zero");
+        return valueDiv(left, right);
+    case TokenType::EQ:    return left == right;
+    case TokenType::NEQ:   return left != right;
+    case TokenType::LT:    return left < right;
+    case TokenType::GT:    return left > right;
+    case TokenType::LE:    return left <= right;
+    case TokenType::GE:    return left >= right;
+    default:
+        throw runtime_error(
+            string("Unsupported binary operator ") + tokenSpelling(b->op));
+    }
+}
+
+Value AstInterpreter::visitUnary(const UnaryExpr* u) {
+    Value v = visitExpr(u->expr);
+
+    switch (u->op) {
+    case TokenType::MINUS: return valueNeg(v);
+    case TokenType::NOT:   return !v;
+    default:
+        throw runtime_error(
+            string("Unsupported unary operator ") + tokenSpelling(u->op));
+    }
+}
+
+Value AstInterpreter::visitCall(const CallExpr* c) {
+    vector<Value> args;
+    args.reserve(c->args.size());
+    for (auto a : c->args)
+        args.push_back(visitExpr(a));
+
+    return call(functions.at(c->callee), args);
+}
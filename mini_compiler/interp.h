@@ -0,0 +1,75 @@
+#ifndef INTERP_H
+#define INTERP_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "ast.h"
+#include "value.h"
+#include "visitor.h"
+
+using namespace std;
+
+//
+// Reference tree-walking interpreter: evaluates the checked AST
+// directly, with the same semantics as the bytecode backends
+// (zeroed locals, wrapping arithmetic, globals for top-level
+// variables). It is the baseline the compiled engines are measured
+// against, not a fast path.
+//
+class AstInterpreter
+    : private StmtVisitor<AstInterpreter>,
+      private ExprVisitor<AstInterpreter, Value> {
+public:
+    AstInterpreter(const vector<StmtPtr>& program, const Interner& names,
+                   size_t maxDepth = 1 << 14);
+
+    // Runs the top-level statements, then calls `entry` (which must
+    // take no arguments) and returns its result.
+    Value run(Symbol entry);
+
+private:
+    friend class StmtVisitor<AstInterpreter>;
+    friend class ExprVisitor<AstInterpreter, Value>;
+
+    const vector<StmtPtr>& program;
+    const Interner& names;
+    size_t maxDepth;
+
+    unordered_map<Symbol, const FunctionDecl*> functions;
+    unordered_map<Symbol, Value> globals;
+
+    // Variables of the active call, innermost last.
+    vector<pair<Symbol, Value>> locals;
+    vector<size_t> scopeStart;
+    size_t frameStart = 0;
+    size_t depth = 0;
+    bool topLevel = false;
+
+    // Set by a return statement until the enclosing call unwinds.
+    bool returning = false;
+    Value returnValue = 0;
+
+    void collectFunctions(const Stmt* stmt);
+    Value* lookup(Symbol name);
+    Value call(const FunctionDecl* f, const vector<Value>& args);
+
+    // Statements
+    void visitVarDecl(const VarDecl* v);
+    void visitExprStmt(const ExprStmt* e);
+    void visitReturn(const ReturnStmt* r);
+    void visitBlock(const BlockStmt* b);
+    void visitFunction(const FunctionDecl* f);
+
+    // Expressions
+    Value visitNumber(const NumberExpr* n);
+    Value visitBool(const BoolExpr* b);
+    Value visitError(const ErrorExpr* e);
+    Value visitVar(const VarExpr* v);
+    Value visitAssign(const AssignExpr* a);
+    Value visitBinary(const BinaryExpr* b);
+    Value visitUnary(const UnaryExpr* u);
+    Value visitCall(const CallExpr* call);
+};
+
+#endif
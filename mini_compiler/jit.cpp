@@ -0,0 +1,578 @@
+#include "jit.h"
+#include <cstring>
+#include <stdexcept>
+
+#if JIT_SUPPORTED
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+int JitProgram::findFunction(Symbol name) const {
+    for (size_t i = 1; i < functions.size(); ++i)
+        if (functions[i].name == name) return static_cast<int>(i);
+    return -1;
+}
+
+JitCompiler::JitCompiler(const Interner& names)
+    : names(names) {}
+
+string JitCompiler::nameOf(Symbol sym) const {
+    return string(names.name(sym));
+}
+
+#if !JIT_SUPPORTED
+
+JitProgram::~JitProgram() {}
+
+Value JitProgram::run(uint16_t) {
+    throw runtime_error("JIT is not supported on this platform");
+}
+
+unique_ptr<JitProgram> JitCompiler::compile(const vector<StmtPtr>&) {
+    throw runtime_error("JIT is not supported on this platform");
+}
+
+#else
+
+// Size of the private stack generated code runs on, and the part of
+// it kept free below the limit for expression temporaries.
+static constexpr size_t JIT_STACK_BYTES = size_t(64) << 20;
+static constexpr size_t JIT_STACK_RESERVE = size_t(1) << 20;
+
+// Register numbers as used in ModRM/REX encodings.
+enum Reg : uint8_t { RAX = 0, RCX = 1, RDX = 2, RSI = 6, RDI = 7, R8 = 8, R9 = 9 };
+static const uint8_t argRegs[6] = { RDI, RSI, RDX, RCX, R8, R9 };
+
+static size_t pageRound(size_t n) {
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return (n + page - 1) / page * page;
+}
+
+
+// ---------------- program ----------------
+JitProgram::~JitProgram() {
+    if (code) munmap(code, codeMapped);
+    if (stack) munmap(stack, stackMapped);
+}
+
+Value JitProgram::enter(uint32_t offset) {
+    using Trampoline = Value (*)(const void* function, void* stackTop);
+    auto trampoline = reinterpret_cast<Trampoline>(code);
+
+    rt.status = OK;
+    Value result = trampoline(code + offset, stack + stackMapped);
+
+    switch (rt.status) {
+    case OK: return result;
+    case DIVISION_BY_ZERO: throw RuntimeTrap("Division by zero");
+    case STACK_OVERFLOW: throw RuntimeTrap("Stack overflow");
+    }
+    throw runtime_error("Invalid JIT status");
+}
+
+Value JitProgram::run(uint16_t entry) {
+    if (entry >= functions.size() || entry == INIT)
+        throw runtime_error("Invalid entry function");
+    if (functions[entry].arity != 0)
+        throw runtime_error("Entry function must take no arguments");
+
+    if (!stack) {
+        // Pages are only committed as the stack actually grows.
+        stackMapped = JIT_STACK_BYTES;
+        void* p = mmap(nullptr, stackMapped, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED)
+            throw runtime_error("Cannot allocate JIT stack");
+        stack = static_cast<uint8_t*>(p);
+        rt.stackLimit = reinterpret_cast<uint64_t>(stack + JIT_STACK_RESERVE);
+    }
+
+    fill(globals.get(), globals.get() + globalCount, 0);
+    enter(functions[INIT].offset);
+    return enter(functions[entry].offset);
+}
+
+
+// ---------------- driver ----------------
+unique_ptr<JitProgram> JitCompiler::compile(const vector<StmtPtr>& program) {
+    unique_ptr<JitProgram> result(new JitProgram());
+    out = result.get();
+    code.clear();
+    functionIndex.clear();
+    globals.clear();
+    pending.clear();
+    callSites.clear();
+
+    // Same numbering as BytecodeCompiler: function 0 runs the
+    // top-level statements, top-level variables are globals.
+    out->functions.emplace_back();
+    for (auto& stmt : program) {
+        declareFunctions(stmt);
+
+        if (auto v = nodeAs<const VarDecl>(stmt))
+            globals[v->name] = out->globalCount++;
+    }
+    out->globals.reset(new Value[out->globalCount]());
+
+    emitStubs();
+
+    // Top-level statements
+    topLevel = true;
+    prologue(JitProgram::INIT);
+    for (auto& stmt : program)
+        visitStmt(stmt);
+    epilogue();
+
+    // Function bodies
+    topLevel = false;
+    for (size_t i = 0; i < pending.size(); ++i)
+        compileFunction(functionIndex.at(pending[i]->name), pending[i]);
+
+    for (auto& site : callSites) {
+        uint32_t target = out->functions[site.second].offset;
+        patch32(site.first, target - (site.first + 4));
+    }
+
+    // Copy into a fresh mapping, then flip it to read+execute.
+    out->codeBytes = code.size();
+    out->codeMapped = pageRound(code.size());
+    void* p = mmap(nullptr, out->codeMapped, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        throw runtime_error("Cannot allocate JIT code memory");
+    out->code = static_cast<uint8_t*>(p);
+    memcpy(out->code, code.data(), code.size());
+    if (mprotect(p, out->codeMapped, PROT_READ | PROT_EXEC) != 0)
+        throw runtime_error("Cannot make JIT code executable");
+
+    out = nullptr;
+    return result;
+}
+
+void JitCompiler::declareFunctions(const Stmt* stmt) {
+    if (auto f = nodeAs<const FunctionDecl>(stmt)) {
+        if (out->functions.size() > UINT16_MAX)
+            throw runtime_error("Too many functions");
+
+        JitProgram::Function fn;
+        fn.name = f->name;
+        fn.arity = static_cast<uint16_t>(f->params.size());
+
+        functionIndex[f->name] =
+            static_cast<uint16_t>(out->functions.size());
+        out->functions.push_back(fn);
+        pending.push_back(f);
+
+        declareFunctions(f->body);
+    }
+    else if (auto b = nodeAs<const BlockStmt>(stmt)) {
+        for (auto s : b->statements)
+            declareFunctions(s);
+    }
+}
+
+// Offset 0: Value enter(const void* function, void* stackTop).
+// Saves the callee-saved registers and the host rsp, switches to the
+// JIT stack and calls `function`. The traps jump to `restore` with
+// arbitrary JIT frames live; reloading the saved rsp drops them all.
+void JitCompiler::emitStubs() {
+    auto savedRsp = &out->rt.savedRsp;
+
+    bytes({ 0x55, 0x53, 0x41, 0x54, 0x41, 0x55,     // push rbp, rbx, r12,
+            0x41, 0x56, 0x41, 0x57 });              //      r13, r14, r15
+    bytes({ 0x48, 0xb8 }); imm64(reinterpret_cast<uint64_t>(savedRsp));
+    bytes({ 0x48, 0x89, 0x20 });                    // mov [rax], rsp
+    bytes({ 0x48, 0x89, 0xf4 });                    // mov rsp, rsi
+    bytes({ 0xff, 0xd7 });                          // call rdi
+
+    uint32_t restore = static_cast<uint32_t>(code.size());
+    loadAddress(savedRsp);
+    bytes({ 0x48, 0x8b, 0x21 });                    // mov rsp, [rcx]
+    bytes({ 0x41, 0x5f, 0x41, 0x5e, 0x41, 0x5d,     // pop r15, r14, r13,
+            0x41, 0x5c, 0x5b, 0x5d });              //     r12, rbx, rbp
+    byte(0xc3);                                     // ret
+
+    auto trap = [&](JitProgram::Trap status) {
+        uint32_t at = static_cast<uint32_t>(code.size());
+        bytes({ 0x48, 0xb8 }); imm64(reinterpret_cast<uint64_t>(&out->rt.status));
+        bytes({ 0x48, 0xc7, 0x00 }); imm32(status); // mov qword [rax], status
+        byte(0xe9); imm32(0); jumpTo(restore);      // jmp restore
+        return at;
+    };
+    divTrap = trap(JitProgram::DIVISION_BY_ZERO);
+    overflowTrap = trap(JitProgram::STACK_OVERFLOW);
+}
+
+void JitCompiler::compileFunction(uint16_t index, const FunctionDecl* f) {
+    prologue(index);
+
+    // Spill the parameters into their slots.
+    for (size_t i = 0; i < f->params.size(); ++i) {
+        uint32_t slot = declareLocal(f->params[i].name);
+
+        uint8_t reg = RAX;
+        if (i < 6) {
+            reg = argRegs[i];
+        }
+        else {
+            // mov rax, [rbp + 16 + 8 * (i - 6)]
+            bytes({ 0x48, 0x8b, 0x85 });
+            imm32(static_cast<uint32_t>(16 + 8 * (i - 6)));
+        }
+        // mov [rbp + slot], reg
+        byte(reg >= 8 ? 0x4c : 0x48);
+        byte(0x89);
+        byte(static_cast<uint8_t>(0x85 | (reg & 7) << 3));
+        imm32(static_cast<uint32_t>(slotOffset(slot)));
+    }
+
+    visitBlock(f->body);
+    epilogue();
+}
+
+// push rbp; mov rbp, rsp; sub rsp, frame; then the stack check. The
+// frame size is patched in by epilogue() once the slot count is known.
+void JitCompiler::prologue(uint16_t index) {
+    out->functions[index].offset = static_cast<uint32_t>(code.size());
+    locals.clear();
+    scopeStart.clear();
+    slotCount = 0;
+    pushed = 0;
+
+    bytes({ 0x55, 0x48, 0x89, 0xe5 });
+    bytes({ 0x48, 0x81, 0xec });
+    frameSizeAt = static_cast<uint32_t>(code.size());
+    imm32(0);
+
+    // rax, not rcx: the fourth argument is still in rcx here.
+    bytes({ 0x48, 0xb8 });                          // mov rax, &stackLimit
+    imm64(reinterpret_cast<uint64_t>(&out->rt.stackLimit));
+    bytes({ 0x48, 0x3b, 0x20 });                    // cmp rsp, [rax]
+    bytes({ 0x0f, 0x82 }); imm32(0);                // jb overflowTrap
+    jumpTo(overflowTrap);
+}
+
+void JitCompiler::epilogue() {
+    // Falling off the end returns 0 (void functions, initializer).
+    bytes({ 0x31, 0xc0, 0xc9, 0xc3 });              // xor eax, eax; leave; ret
+
+    // Keeps rsp 16-byte aligned at pushed == 0.
+    patch32(frameSizeAt, (slotCount * 8 + 15) & ~15u);
+}
+
+
+// ---------------- helpers ----------------
+uint32_t JitCompiler::declareLocal(Symbol name) {
+    uint32_t slot = slotCount++;
+    locals.emplace_back(name, slot);
+    return slot;
+}
+
+int JitCompiler::resolveLocal(Symbol name) const {
+    for (auto it = locals.rbegin(); it != locals.rend(); ++it)
+        if (it->first == name) return static_cast<int>(it->second);
+    return -1;
+}
+
+uint32_t JitCompiler::resolveGlobal(Symbol name) const {
+    auto g = globals.find(name);
+    if (g == globals.end())
+        throw runtime_error(
+            "Cannot compile '" + nameOf(name) +
+            "': nested functions cannot use enclosing locals");
+    return g->second;
+}
+
+int32_t JitCompiler::slotOffset(uint32_t slot) const {
+    return -8 * static_cast<int32_t>(slot + 1);
+}
+
+void JitCompiler::imm32(uint32_t v) {
+    for (int i = 0; i < 4; ++i)
+        code.push_back(static_cast<uint8_t>(v >> (8 * i)));
+}
+
+void JitCompiler::imm64(uint64_t v) {
+    for (int i = 0; i < 8; ++i)
+        code.push_back(static_cast<uint8_t>(v >> (8 * i)));
+}
+
+void JitCompiler::patch32(uint32_t at, uint32_t v) {
+    for (int i = 0; i < 4; ++i)
+        code[at + i] = static_cast<uint8_t>(v >> (8 * i));
+}
+
+void JitCompiler::jumpTo(uint32_t target) {
+    uint32_t end = static_cast<uint32_t>(code.size());
+    patch32(end - 4, target - end);
+}
+
+void JitCompiler::loadImmediate(Value v) {
+    if (v == 0) {
+        bytes({ 0x31, 0xc0 });                      // xor eax, eax
+    }
+    else if (v >= INT32_MIN && v <= INT32_MAX) {
+        bytes({ 0x48, 0xc7, 0xc0 });                // mov rax, simm32
+        imm32(static_cast<uint32_t>(v));
+    }
+    else {
+        bytes({ 0x48, 0xb8 });                      // mov rax, imm64
+        imm64(static_cast<uint64_t>(v));
+    }
+}
+
+void JitCompiler::loadAddress(const void* p) {
+    bytes({ 0x48, 0xb9 });                          // mov rcx, imm64
+    imm64(reinterpret_cast<uint64_t>(p));
+}
+
+void JitCompiler::push() {
+    byte(0x50);
+    pushed++;
+}
+
+void JitCompiler::pop(uint8_t reg) {
+    byte(static_cast<uint8_t>(0x58 + reg));
+    pushed--;
+}
+
+// Loads a leaf operand straight into rcx, leaving rax alone. Returns
+// false (emitting nothing) for anything that needs evaluating.
+bool JitCompiler::loadOperand(const Expr* e) {
+    if (auto n = nodeAs<const NumberExpr>(e)) {
+        Value v = n->value;
+        if (v < INT32_MIN || v > INT32_MAX) return false;
+        bytes({ 0x48, 0xc7, 0xc1 });                // mov rcx, simm32
+        imm32(static_cast<uint32_t>(v));
+        return true;
+    }
+    if (auto b = nodeAs<const BoolExpr>(e)) {
+        bytes({ 0x48, 0xc7, 0xc1 });
+        imm32(b->value ? 1 : 0);
+        return true;
+    }
+    if (auto v = nodeAs<const VarExpr>(e)) {
+        int slot = resolveLocal(v->name);
+        if (slot >= 0) {
+            bytes({ 0x48, 0x8b, 0x8d });            // mov rcx, [rbp + slot]
+            imm32(static_cast<uint32_t>(slotOffset(static_cast<uint32_t>(slot))));
+        }
+        else {
+            loadAddress(&out->globals[resolveGlobal(v->name)]);
+            bytes({ 0x48, 0x8b, 0x09 });            // mov rcx, [rcx]
+        }
+        return true;
+    }
+    return false;
+}
+
+
+// ---------------- statements ----------------
+void JitCompiler::visitVarDecl(const VarDecl* v) {
+    // Globals were assigned their slots up front.
+    if (topLevel && scopeStart.empty()) return;
+
+    // Each declaration has its own slot and runs at most once per
+    // call, so zeroing it here matches zeroing the frame on entry.
+    uint32_t slot = declareLocal(v->name);
+    bytes({ 0x48, 0xc7, 0x85 });                    // mov qword [rbp + slot], 0
+    imm32(static_cast<uint32_t>(slotOffset(slot)));
+    imm32(0);
+}
+
+void JitCompiler::visitExprStmt(const ExprStmt* e) {
+    visitExpr(e->expr);
+}
+
+void JitCompiler::visitReturn(const ReturnStmt* r) {
+    if (r->expr)
+        visitExpr(r->expr);
+    else
+        loadImmediate(0);
+    bytes({ 0xc9, 0xc3 });                          // leave; ret
+}
+
+void JitCompiler::visitBlock(const BlockStmt* b) {
+    scopeStart.push_back(locals.size());
+    for (auto s : b->statements)
+        visitStmt(s);
+    locals.resize(scopeStart.back());
+    scopeStart.pop_back();
+}
+
+void JitCompiler::visitFunction(const FunctionDecl*) {
+    // Compiled separately (see compile()).
+}
+
+
+// ---------------- expressions ----------------
+void JitCompiler::visitNumber(const NumberExpr* n) {
+    loadImmediate(n->value);
+}
+
+void JitCompiler::visitBool(const BoolExpr* b) {
+    loadImmediate(b->value ? 1 : 0);
+}
+
+void JitCompiler::visitError(const ErrorExpr*) {
+    throw runtime_error("Cannot compile a program with errors");
+}
+
+void JitCompiler::visitVar(const VarExpr* v) {
+    int slot = resolveLocal(v->name);
+    if (slot >= 0) {
+        bytes({ 0x48, 0x8b, 0x85 });                // mov rax, [rbp + slot]
+        imm32(static_cast<uint32_t>(slotOffset(static_cast<uint32_t>(slot))));
+        return;
+    }
+
+    loadAddress(&out->globals[resolveGlobal(v->name)]);
+    bytes({ 0x48, 0x8b, 0x01 });                    // mov rax, [rcx]
+}
+
+void JitCompiler::visitAssign(const AssignExpr* a) {
+    visitExpr(a->value);
+
+    int slot = resolveLocal(a->name);
+    if (slot >= 0) {
+        bytes({ 0x48, 0x89, 0x85 });                // mov [rbp + slot], rax
+        imm32(static_cast<uint32_t>(slotOffset(static_cast<uint32_t>(slot))));
+        return;
+    }
+
+    loadAddress(&out->globals[resolveGlobal(a->name)]);
+    bytes({ 0x48, 0x89, 0x01 });                    // mov [rcx], rax
+}
+
+void JitCompiler::visitBinary(const BinaryExpr* b) {
+    // rax = left, rcx = right
+    visitExpr(b->left);
+
+    // Short-circuit: rax already holds the result unless the right
+    // operand is needed.
+    if (b->op == TokenType::AND || b->op == TokenType::OR) {
+        bytes({ 0x48, 0x85, 0xc0 });                // test rax, rax
+        bytes({ 0x0f, uint8_t(b->op == TokenType::AND ? 0x84 : 0x85) });
+        imm32(0);                                   // jz/jnz .done
+        uint32_t skip = static_cast<uint32_t>(code.size());
+        visitExpr(b->right);
+        patch32(skip - 4, static_cast<uint32_t>(code.size()) - skip);
+        return;                                     // .done:
+    }
+
+    if (!loadOperand(b->right)) {
+        push();
+        visitExpr(b->right);
+        bytes({ 0x48, 0x89, 0xc1 });                // mov rcx, rax
+        pop(RAX);
+    }
+
+    switch (b->op) {
+    case TokenType::PLUS:
+        bytes({ 0x48, 0x01, 0xc8 });                // add rax, rcx
+        break;
+    case TokenType::MINUS:
+        bytes({ 0x48, 0x29, 0xc8 });                // sub rax, rcx
+        break;
+    case TokenType::STAR:
+        bytes({ 0x48, 0x0f, 0xaf, 0xc1 });          // imul rax, rcx
+        break;
+    case TokenType::SLASH:
+        bytes({ 0x48, 0x85, 0xc9 });                // test rcx, rcx
+        bytes({ 0x0f, 0x84 }); imm32(0);            // jz divTrap
+        jumpTo(divTrap);
+        // INT64_MIN / -1 faults in idiv, so x / -1 is negated instead.
+        bytes({ 0x48, 0x83, 0xf9, 0xff,             // cmp rcx, -1
+                0x75, 0x05,                         // jne .div
+                0x48, 0xf7, 0xd8,                   // neg rax
+                0xeb, 0x05,                         // jmp .done
+                0x48, 0x99,                         // .div: cqo
+                0x48, 0xf7, 0xf9 });                // idiv rcx
+        break;                                      // .done:
+    case TokenType::EQ:  compare(0x94); break;      // sete
+    case TokenType::NEQ: compare(0x95); break;      // setne
+    case TokenType::LT:  compare(0x9c); break;      // setl
+    case TokenType::GE:  compare(0x9d); break;      // setge
+    case TokenType::LE:  compare(0x9e); break;      // setle
+    case TokenType::GT:  compare(0x9f); break;      // setg
+    default:
+        throw runtime_error(
+            string("Unsupported binary operator ") + tokenSpelling(b->op));
+    }
+}
+
+// rax = (rax <cc> rcx) ? 1 : 0, for the setcc opcode `setcc`.
+void JitCompiler::compare(uint8_t setcc) {
+    bytes({ 0x48, 0x39, 0xc8 });                    // cmp rax, rcx
+    bytes({ 0x0f, setcc, 0xc0 });                   // setcc al
+    bytes({ 0x0f, 0xb6, 0xc0 });                    // movzx eax, al
+}
+
+void JitCompiler::visitUnary(const UnaryExpr* u) {
+    visitExpr(u->expr);
+
+    switch (u->op) {
+    case TokenType::MINUS:
+        bytes({ 0x48, 0xf7, 0xd8 });                // neg rax
+        break;
+    case TokenType::NOT:
+        bytes({ 0x48, 0x83, 0xf0, 0x01 });          // xor rax, 1 (bools are 0/1)
+        break;
+    default:
+        throw runtime_error(
+            string("Unsupported unary operator ") + tokenSpelling(u->op));
+    }
+}
+
+// Arguments are evaluated left to right onto the machine stack, then
+// the first six are loaded into registers and the rest re-pushed in
+// reverse so the 7th ends up at [rsp] on the call.
+void JitCompiler::visitCall(const CallExpr* call) {
+    uint32_t n = call->args.size();
+    uint32_t onStack = n > 6 ? n - 6 : 0;
+
+    for (auto arg : call->args) {
+        visitExpr(arg);
+        push();
+    }
+
+    // rsp must be 16-byte aligned at the call instruction.
+    uint32_t pad = (pushed + onStack) % 2;
+    if (pad) {
+        bytes({ 0x48, 0x83, 0xec, 0x08 });          // sub rsp, 8
+        pushed++;
+    }
+
+    // Argument i sits at [rsp + 8 * (n - 1 - i)] before any re-push.
+    for (uint32_t k = n; k-- > 6;) {
+        uint32_t repushed = n - 1 - k;
+        bytes({ 0xff, 0xb4, 0x24 });                // push qword [rsp + d]
+        imm32(8 * (2 * repushed + pad));
+        pushed++;
+    }
+
+    for (uint32_t i = 0; i < n && i < 6; ++i) {
+        uint8_t reg = argRegs[i];
+        byte(reg >= 8 ? 0x4c : 0x48);               // mov reg, [rsp + d]
+        byte(0x8b);
+        byte(static_cast<uint8_t>(0x84 | (reg & 7) << 3));
+        byte(0x24);
+        imm32(8 * ((n - 1 - i) + pad + onStack));
+    }
+
+    byte(0xe8);                                     // call rel32
+    callSites.emplace_back(static_cast<uint32_t>(code.size()),
+                           functionIndex.at(call->callee));
+    imm32(0);
+
+    uint32_t drop = n + pad + onStack;
+    if (drop) {
+        bytes({ 0x48, 0x81, 0xc4 });                // add rsp, 8 * drop
+        imm32(8 * drop);
+        pushed -= drop;
+    }
+}
+
+#endif
@@ -0,0 +1,172 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ast.h"
+#include "value.h"
+#include "visitor.h"
+
+using namespace std;
+
+// Native code generation targets x86-64 with the System V calling
+// convention and needs mmap/mprotect; elsewhere JitCompiler::compile
+// throws.
+#if defined(__x86_64__) && defined(__unix__)
+#define JIT_SUPPORTED 1
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+//
+// A program compiled to x86-64 machine code. The code lives in its
+// own mapping, which is made read+execute (and never writable again)
+// once generation is done.
+//
+// Generated functions follow the System V ABI: the first six
+// arguments arrive in rdi, rsi, rdx, rcx, r8, r9, the rest on the
+// stack, and the result is returned in rax. They run on a private
+// stack entered through a small trampoline, so runtime errors
+// (division by zero, stack overflow) can unwind straight back to
+// run() instead of through C++ frames.
+//
+class JitProgram {
+public:
+    ~JitProgram();
+
+    JitProgram(const JitProgram&) = delete;
+    JitProgram& operator=(const JitProgram&) = delete;
+
+    // Index of the named function, or -1.
+    int findFunction(Symbol name) const;
+
+    // Runs the initializer, then function `entry` (which must take no
+    // arguments) and returns its result.
+    Value run(uint16_t entry);
+
+    size_t codeSize() const { return codeBytes; }
+
+private:
+    friend class JitCompiler;
+
+    static constexpr uint16_t INIT = 0;
+
+    struct Function {
+        Symbol name = 0;
+        uint32_t offset = 0;
+        uint16_t arity = 0;
+    };
+
+    // Read and written by the generated code via absolute addresses,
+    // which is why a JitProgram never moves.
+    struct Runtime {
+        uint64_t savedRsp = 0;      // host stack while generated code runs
+        uint64_t stackLimit = 0;    // lowest usable address of the JIT stack
+        uint64_t status = 0;        // Trap, set when generated code bails out
+    };
+
+    enum Trap : uint64_t { OK, DIVISION_BY_ZERO, STACK_OVERFLOW };
+
+    Runtime rt;
+    unique_ptr<Value[]> globals;
+    uint32_t globalCount = 0;
+    vector<Function> functions;
+
+    uint8_t* code = nullptr;        // enter trampoline at offset 0
+    size_t codeBytes = 0;
+    size_t codeMapped = 0;
+    uint8_t* stack = nullptr;
+    size_t stackMapped = 0;
+
+    JitProgram() = default;
+    Value enter(uint32_t offset);
+};
+
+//
+// Compiles a semantically checked program straight from the AST to
+// machine code: one pass per function, expression results in rax,
+// temporaries on the machine stack, every local in its own
+// rbp-relative slot. Accepts the same programs as BytecodeCompiler.
+//
+class JitCompiler
+    : private StmtVisitor<JitCompiler>,
+      private ExprVisitor<JitCompiler> {
+public:
+    explicit JitCompiler(const Interner& names);
+
+    unique_ptr<JitProgram> compile(const vector<StmtPtr>& program);
+
+private:
+    friend class StmtVisitor<JitCompiler>;
+    friend class ExprVisitor<JitCompiler>;
+
+    const Interner& names;
+    JitProgram* out = nullptr;
+    vector<uint8_t> code;
+
+    unordered_map<Symbol, uint16_t> functionIndex;
+    unordered_map<Symbol, uint32_t> globals;
+    vector<const FunctionDecl*> pending;
+
+    // Fixups applied once every function has an address.
+    vector<pair<uint32_t, uint16_t>> callSites;     // rel32 position, callee
+    uint32_t divTrap = 0;
+    uint32_t overflowTrap = 0;
+
+    // Current function
+    vector<pair<Symbol, uint32_t>> locals;          // innermost last
+    vector<size_t> scopeStart;
+    uint32_t slotCount = 0;
+    uint32_t frameSizeAt = 0;   // imm32 of the prologue's sub rsp
+    uint32_t pushed = 0;        // 8-byte pushes since the prologue
+    bool topLevel = false;
+
+    void declareFunctions(const Stmt* stmt);
+    void compileFunction(uint16_t index, const FunctionDecl* f);
+    void prologue(uint16_t index);
+    void epilogue();
+    void emitStubs();
+
+    uint32_t declareLocal(Symbol name);
+    int resolveLocal(Symbol name) const;
+    uint32_t resolveGlobal(Symbol name) const;
+    bool loadOperand(const Expr* e);
+
+    // Encoding
+    void byte(uint8_t b) { code.push_back(b); }
+    void bytes(initializer_list<uint8_t> bs) { code.insert(code.end(), bs); }
+    void imm32(uint32_t v);
+    void imm64(uint64_t v);
+    void patch32(uint32_t at, uint32_t v);
+    void jumpTo(uint32_t target);       // rel32 of the preceding jump
+    void loadImmediate(Value v);        // rax = v
+    void loadAddress(const void* p);    // rcx = p
+    int32_t slotOffset(uint32_t slot) const;
+    void push();                        // push rax
+    void pop(uint8_t reg);              // pop rax/rcx
+    void compare(uint8_t setcc);        // rax = rax <cc> rcx
+
+    // Statements
+    void visitVarDecl(const VarDecl* v);
+    void visitExprStmt(const ExprStmt* e);
+    void visitReturn(const ReturnStmt* r);
+    void visitBlock(const BlockStmt* b);
+    void visitFunction(const FunctionDecl* f);
+
+    // Expressions (result in rax)
+    void visitNumber(const NumberExpr* n);
+    void visitBool(const BoolExpr* b);
+    void visitError(const ErrorExpr* e);
+    void visitVar(const VarExpr* v);
+    void visitAssign(const AssignExpr* a);
+    void visitBinary(const BinaryExpr* b);
+    void visitUnary(const UnaryExpr* u);
+    void visitCall(const CallExpr* call);
+
+    string nameOf(Symbol sym) const;
+};
+
+#endif
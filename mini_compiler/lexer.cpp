@@ -1,21 +1,119 @@
 
 #include "lexer.h"
-#include <cctype>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
 
 using namespace std;
 
-unordered_map<string, TokenType> Lexer::keywords = {
-    {"int", TokenType::INT},
-    {"bool", TokenType::BOOL},
-    {"void", TokenType::VOID},
-    {"return", TokenType::RETURN},
-    {"if", TokenType::IF},
-    {"while", TokenType::WHILE},
-    {"true", TokenType::TRUE},
-    {"false", TokenType::FALSE}
+// ---------------- keywords ----------------
+//
+// Keywords sit in a 32-slot table indexed by their first and last
+// characters. The table is built at compile time and the
+// static_assert below rejects any keyword that would share a slot, so
+// a lookup is one hash and at most one string compare. The hash stays
+// collision-free with "else", "for", "do", "break" and "continue"
+// added, so those can be given tokens without changing it.
+//
+namespace {
+
+struct Keyword {
+    string_view text;
+    TokenType type = TokenType::IDENT;
+};
+
+constexpr Keyword KEYWORDS[] = {
+    { "int",    TokenType::INT },
+    { "bool",   TokenType::BOOL },
+    { "void",   TokenType::VOID },
+    { "return", TokenType::RETURN },
+    { "if",     TokenType::IF },
+    { "while",  TokenType::WHILE },
+    { "true",   TokenType::TRUE },
+    { "false",  TokenType::FALSE },
 };
 
-Lexer::Lexer(const string& src) : source(src) {}
+constexpr size_t KEYWORD_SLOTS = 32;
+
+constexpr size_t keywordSlot(string_view s) {
+    return (static_cast<unsigned char>(s.front()) +
+            static_cast<unsigned char>(s.back())) & (KEYWORD_SLOTS - 1);
+}
+
+struct KeywordTable {
+    Keyword slots[KEYWORD_SLOTS] = {};
+    size_t minLength = SIZE_MAX, maxLength = 0;
+    bool perfect = true;
+};
+
+constexpr KeywordTable makeKeywordTable() {
+    KeywordTable t;
+    for (const Keyword& kw : KEYWORDS) {
+        Keyword& slot = t.slots[keywordSlot(kw.text)];
+        if (!slot.text.empty()) t.perfect = false;
+        slot = kw;
+        t.minLength = min(t.minLength, kw.text.size());
+        t.maxLength = max(t.maxLength, kw.text.size());
+    }
+    return t;
+}
+
+constexpr KeywordTable keywordTable = makeKeywordTable();
+static_assert(keywordTable.perfect, "two keywords share a slot; change keywordSlot");
+
+}
+
+TokenType keywordType(string_view text) {
+    if (text.size() - keywordTable.minLength >
+        keywordTable.maxLength - keywordTable.minLength)
+        return TokenType::IDENT;
+    const Keyword& slot = keywordTable.slots[keywordSlot(text)];
+    return slot.text == text ? slot.type : TokenType::IDENT;
+}
+
+const char* tokenSpelling(TokenType type) {
+    switch (type) {
+    case TokenType::INT:    return "int";
+    case TokenType::BOOL:   return "bool";
+    case TokenType::VOID:   return "void";
+    case TokenType::RETURN: return "return";
+    case TokenType::IF:     return "if";
+    case TokenType::WHILE:  return "while";
+    case TokenType::TRUE:   return "true";
+    case TokenType::FALSE:  return "false";
+    case TokenType::PLUS:   return "+";
+    case TokenType::MINUS:  return "-";
+    case TokenType::STAR:   return "*";
+    case TokenType::SLASH:  return "/";
+    case TokenType::ASSIGN: return "=";
+    case TokenType::EQ:     return "==";
+    case TokenType::NEQ:    return "!=";
+    case TokenType::LT:     return "<";
+    case TokenType::GT:     return ">";
+    case TokenType::LE:     return "<=";
+    case TokenType::GE:     return ">=";
+    case TokenType::AND:    return "&&";
+    case TokenType::OR:     return "||";
+    case TokenType::NOT:    return "!";
+    case TokenType::SEMI:   return ";";
+    case TokenType::COMMA:  return ",";
+    case TokenType::LPAREN: return "(";
+    case TokenType::RPAREN: return ")";
+    case TokenType::LBRACE: return "{";
+    case TokenType::RBRACE: return "}";
+    default:                return "";
+    }
+}
+
+SourceLoc Token::location() const {
+    size_t length = lexeme.empty() ? strlen(tokenSpelling(type)) : lexeme.size();
+    return { static_cast<uint32_t>(line), static_cast<uint32_t>(column),
+             static_cast<uint32_t>(length) };
+}
+
+Lexer::Lexer(string_view src, Interner& names)
+    : source(src), names(names), scan(scanKernels()) {}
 
 bool Lexer::isAtEnd() const {
     return pos >= source.length();
@@ -30,109 +128,268 @@ char Lexer::advance() {
     return source[pos++];
 }
 
-Token Lexer::makeToken(TokenType type, const string& lexeme) {
-    return Token(type, lexeme, line);
+int Lexer::column() const {
+    return static_cast<int>(tokenStart - lineStart) + 1;
 }
 
+Token Lexer::makeToken(TokenType type) {
+    return Token(type, string_view(), line, column());
+}
+
+Token Lexer::makeToken(TokenType type, size_t start) {
+    return Token(type, source.substr(start, pos - start), line, column());
+}
+
+// Runs of blanks, identifier characters and digits are skipped by
+// the scan kernels, a vector at a time where the CPU allows.
 void Lexer::skipWhitespace() {
-    while (!isAtEnd()) {
-        char c = peek();
-        if (c == ' ' || c == '\r' || c == '\t')
-            advance();
-        else if (c == '\n') {
-            line++;
-            advance();
+    const char* base = source.data();
+    const char* end = base + source.size();
+
+    for (;;) {
+        const char* p = base + pos;
+        if (p == end) return;
+
+        if (*p == ' ' && end - p >= 2 && !hasClass(p[1], CC_SPACE | CC_NEWLINE)) {
+            // a lone separating blank, by far the commonest run
+            pos = static_cast<size_t>(++p - base);
         }
-        else if (c == '/' && pos + 1 < source.length() && source[pos+1] == '/') {
+        else if (hasClass(*p, CC_SPACE | CC_NEWLINE)) {
+            LineSkip lines;
+            p = scan.space(p, end, lines);
+            if (lines.count) {
+                line += static_cast<int>(lines.count);
+                lineStart = static_cast<size_t>(lines.last + 1 - base);
+            }
+            pos = static_cast<size_t>(p - base);
+        }
+
+        if (end - p >= 2 && p[0] == '/' && p[1] == '/') {
             // comment until end of line
-            while (!isAtEnd() && peek() != '\n') advance();
+            pos = static_cast<size_t>(scan.lineEnd(p + 2, end) - base);
+            continue;
         }
-        else break;
+        return;
     }
 }
 
 Token Lexer::identifier() {
     size_t start = pos - 1;
-    while (!isAtEnd() && (isalnum(peek()) || peek() == '_'))
-        advance();
+    const char* base = source.data();
+    pos = static_cast<size_t>(
+        scan.ident(base + pos, base + source.size()) - base);
 
-    string text = source.substr(start, pos - start);
+    string_view text = source.substr(start, pos - start);
 
-    if (keywords.count(text))
-        return makeToken(keywords[text], text);
+    TokenType kw = keywordType(text);
+    if (kw != TokenType::IDENT)
+        return makeToken(kw);
 
-    return makeToken(TokenType::IDENT, text);
+    return Token(TokenType::IDENT, text, line, column(), names.intern(text));
 }
 
 Token Lexer::number() {
     size_t start = pos - 1;
-    while (!isAtEnd() && isdigit(peek()))
-        advance();
-
-    string text = source.substr(start, pos - start);
-    return makeToken(TokenType::NUMBER, text);
-}
-
-vector<Token> Lexer::tokenize() {
-    vector<Token> tokens;
-
-    while (!isAtEnd()) {
-        skipWhitespace();
-        if (isAtEnd()) break;
-
-        char c = advance();
-
-        switch (c) {
-
-        case '+': tokens.push_back(makeToken(TokenType::PLUS, "+")); break;
-        case '-': tokens.push_back(makeToken(TokenType::MINUS, "-")); break;
-        case '*': tokens.push_back(makeToken(TokenType::STAR, "*")); break;
-        case '/': tokens.push_back(makeToken(TokenType::SLASH, "/")); break;
-        case ';': tokens.push_back(makeToken(TokenType::SEMI, ";")); break;
-        case ',': tokens.push_back(makeToken(TokenType::COMMA, ",")); break;
-        case '(': tokens.push_back(makeToken(TokenType::LPAREN, "(")); break;
-        case ')': tokens.push_back(makeToken(TokenType::RPAREN, ")")); break;
-        case '{': tokens.push_back(makeToken(TokenType::LBRACE, "{")); break;
-        case '}': tokens.push_back(makeToken(TokenType::RBRACE, "}")); break;
-
-        case '!':
-            if (peek() == '=') { advance(); tokens.push_back(makeToken(TokenType::NEQ, "!=")); }
-            else tokens.push_back(makeToken(TokenType::NOT, "!"));
-            break;
-
-        case '=':
-            if (peek() == '=') { advance(); tokens.push_back(makeToken(TokenType::EQ, "==")); }
-            else tokens.push_back(makeToken(TokenType::ASSIGN, "="));
-            break;
-
-        case '<':
-            if (peek() == '=') { advance(); tokens.push_back(makeToken(TokenType::LE, "<=")); }
-            else tokens.push_back(makeToken(TokenType::LT, "<"));
-            break;
-
-        case '>':
-            if (peek() == '=') { advance(); tokens.push_back(makeToken(TokenType::GE, ">=")); }
-            else tokens.push_back(makeToken(TokenType::GT, ">"));
-            break;
-
-        case '&':
-            if (peek() == '&') { advance(); tokens.push_back(makeToken(TokenType::AND, "&&")); }
-            break;
-
-        case '|':
-            if (peek() == '|') { advance(); tokens.push_back(makeToken(TokenType::OR, "||")); }
-            break;
-
-        default:
-            if (isalpha(c) || c == '_')
-                tokens.push_back(identifier());
-            else if (isdigit(c))
-                tokens.push_back(number());
-            else
-                tokens.push_back(makeToken(TokenType::UNKNOWN, string(1, c)));
-        }
+    const char* base = source.data();
+    pos = static_cast<size_t>(
+        scan.digits(base + pos, base + source.size()) - base);
+
+    return makeToken(TokenType::NUMBER, start);
+}
+
+TokenBuffer Lexer::tokenize() {
+    if (source.size() >= UINT32_MAX)
+        throw runtime_error("source too large to lex up front");
+
+    TokenBuffer tokens(source, names);
+    for (;;) {
+        Token t = next();
+        tokens.push(t, tokenStart, lineStart);
+        if (t.type == TokenType::END_OF_FILE) break;
     }
 
-    tokens.push_back(makeToken(TokenType::END_OF_FILE, ""));
+    // The buffer lives through parsing; drop the growth slack.
+    tokens.kinds.shrink_to_fit();
+    tokens.offsets.shrink_to_fit();
+    tokens.payload.shrink_to_fit();
+    tokens.lineStarts.shrink_to_fit();
     return tokens;
 }
+
+Token Lexer::next() {
+    lexed++;
+    skipWhitespace();
+
+    tokenStart = pos;
+    if (isAtEnd())
+        return makeToken(TokenType::END_OF_FILE);
+
+    char c = advance();
+
+    switch (c) {
+
+    case '+': return makeToken(TokenType::PLUS);
+    case '-': return makeToken(TokenType::MINUS);
+    case '*': return makeToken(TokenType::STAR);
+    case '/': return makeToken(TokenType::SLASH);
+    case ';': return makeToken(TokenType::SEMI);
+    case ',': return makeToken(TokenType::COMMA);
+    case '(': return makeToken(TokenType::LPAREN);
+    case ')': return makeToken(TokenType::RPAREN);
+    case '{': return makeToken(TokenType::LBRACE);
+    case '}': return makeToken(TokenType::RBRACE);
+
+    case '!':
+        if (peek() == '=') { advance(); return makeToken(TokenType::NEQ); }
+        return makeToken(TokenType::NOT);
+
+    case '=':
+        if (peek() == '=') { advance(); return makeToken(TokenType::EQ); }
+        return makeToken(TokenType::ASSIGN);
+
+    case '<':
+        if (peek() == '=') { advance(); return makeToken(TokenType::LE); }
+        return makeToken(TokenType::LT);
+
+    case '>':
+        if (peek() == '=') { advance(); return makeToken(TokenType::GE); }
+        return makeToken(TokenType::GT);
+
+    case '&':
+        if (peek() == '&') { advance(); return makeToken(TokenType::AND); }
+        return makeToken(TokenType::UNKNOWN, pos - 1);
+
+    case '|':
+        if (peek() == '|') { advance(); return makeToken(TokenType::OR); }
+        return makeToken(TokenType::UNKNOWN, pos - 1);
+
+    default:
+        if (hasClass(c, CC_ALPHA))
+            return identifier();
+        if (hasClass(c, CC_DIGIT))
+            return number();
+        return makeToken(TokenType::UNKNOWN, pos - 1);
+    }
+}
+
+
+// ---------------- token buffer ----------------
+static_assert(static_cast<int>(TokenType::UNKNOWN) <= UINT8_MAX,
+              "TokenType must fit the kind byte");
+
+void TokenBuffer::push(const Token& token, size_t offset, size_t lineStart) {
+    kinds.push_back(static_cast<uint8_t>(token.type));
+    offsets.push_back(static_cast<uint32_t>(offset));
+    payload.push_back(token.type == TokenType::IDENT
+                          ? token.sym
+                          : static_cast<uint32_t>(token.lexeme.size()));
+
+    // Lines skipped since the last token (blank or comment only) are
+    // found by searching for their newlines.
+    size_t line = static_cast<size_t>(token.line);
+    if (lineStarts.size() >= line) return;
+    while (lineStarts.size() + 1 < line) {
+        const char* from = source.data() + lineStarts.back();
+        auto nl = static_cast<const char*>(
+            memchr(from, '\n', source.size() - lineStarts.back()));
+        lineStarts.push_back(static_cast<uint32_t>(nl + 1 - source.data()));
+    }
+    lineStarts.push_back(static_cast<uint32_t>(lineStart));
+}
+
+// The parser only looks at the current token and the one before it,
+// so the line wanted is nearly always within a few of the hint; a
+// short walk finds it before falling back to a binary search.
+size_t TokenBuffer::lineOf(uint32_t offset, size_t& hint) const {
+    const size_t lines = lineStarts.size();
+    size_t l = hint < lines ? hint : lines - 1;
+
+    for (int steps = 0; steps < 8; ++steps) {
+        if (offset < lineStarts[l]) {
+            --l;
+        }
+        else if (l + 1 < lines && offset >= lineStarts[l + 1]) {
+            ++l;
+        }
+        else {
+            return hint = l;
+        }
+    }
+
+    auto it = upper_bound(lineStarts.begin(), lineStarts.end(), offset);
+    return hint = static_cast<size_t>(it - lineStarts.begin()) - 1;
+}
+
+Token TokenBuffer::at(size_t i, size_t& hint) const {
+    TokenType type = kind(i);
+    uint32_t offset = offsets[i];
+    size_t l = lineOf(offset, hint);
+    int line = static_cast<int>(l) + 1;
+    int column = static_cast<int>(offset - lineStarts[l]) + 1;
+
+    if (type == TokenType::IDENT) {
+        Symbol sym = payload[i];
+        return Token(type, source.substr(offset, names->name(sym).size()),
+                     line, column, sym);
+    }
+    return Token(type, source.substr(offset, payload[i]), line, column);
+}
+
+SourceLoc TokenBuffer::location(size_t i, size_t& hint) const {
+    TokenType type = kind(i);
+    uint32_t offset = offsets[i];
+    size_t l = lineOf(offset, hint);
+
+    size_t length;
+    if (type == TokenType::IDENT)
+        length = names->name(payload[i]).size();
+    else if (type == TokenType::NUMBER || type == TokenType::UNKNOWN)
+        length = payload[i];
+    else
+        length = strlen(tokenSpelling(type));
+
+    return { static_cast<uint32_t>(l + 1), offset - lineStarts[l] + 1,
+             static_cast<uint32_t>(length) };
+}
+
+size_t TokenBuffer::memoryBytes() const {
+    return kinds.capacity() * sizeof(uint8_t) +
+           (offsets.capacity() + payload.capacity() +
+            lineStarts.capacity()) * sizeof(uint32_t);
+}
+
+
+// ---------------- token stream ----------------
+TokenStream::TokenStream(const TokenBuffer& tokens)
+    : tokens(&tokens), kinds(tokens.kindData()), count(tokens.size()) {}
+
+TokenStream::TokenStream(Lexer& lexer)
+    : lexer(&lexer), ring(WINDOW, Token(TokenType::END_OF_FILE, {}, 0, 0)) {
+    ring[0] = lexer.next();
+    count = 1;
+}
+
+TokenType TokenStream::lookahead(size_t ahead) {
+    if (tokens)
+        return tokens->kind(min(pos + ahead, count - 1));
+
+    // The slot behind the current token holds previous().
+    if (ahead > WINDOW - 2)
+        throw logic_error("TokenStream lookahead beyond its window");
+
+    while (count <= pos + ahead && ring[(count - 1) & MASK].type !=
+                                       TokenType::END_OF_FILE) {
+        ring[count & MASK] = lexer->next();
+        count++;
+    }
+    return ring[min(pos + ahead, count - 1) & MASK].type;
+}
+
+void TokenStream::advance() {
+    if (peekType() == TokenType::END_OF_FILE) return;
+    pos++;
+    if (!tokens && pos == count) {
+        ring[count & MASK] = lexer->next();
+        count++;
+    }
+}
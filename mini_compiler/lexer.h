@@ -1,10 +1,13 @@
-
 #ifndef LEXER_H
 #define LEXER_H
 
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
-#include <unordered_map>
+#include "diagnostics.h"
+#include "interner.h"
+#include "scan.h"
 
 using namespace std;
 
@@ -30,25 +33,105 @@ enum class TokenType {
     UNKNOWN
 };
 
+// Fixed spelling of keywords, operators and punctuation ("" for
+// IDENT, NUMBER and UNKNOWN, whose text lives in Token::lexeme).
+const char* tokenSpelling(TokenType type);
+
+// The keyword spelled `text`, or IDENT if it is not one. Allocation
+// free: a compile-time perfect hash and a single compare.
+TokenType keywordType(string_view text);
+
+// A token is a slice of the source buffer handed to the Lexer.
+// Only IDENT, NUMBER and UNKNOWN carry text; every other token is
+// fully described by its type, so its lexeme is empty. IDENT tokens
+// also carry their interned Symbol.
 struct Token {
     TokenType type;
-    string lexeme;
     int line;
+    int column;
+    string_view lexeme;
+    Symbol sym;
 
-    Token(TokenType t, string l, int ln)
-        : type(t), lexeme(move(l)), line(ln) {}
+    Token(TokenType t, string_view l, int ln, int col, Symbol s = 0)
+        : type(t), line(ln), column(col), lexeme(l), sym(s) {}
+
+    SourceLoc location() const;
+};
+
+//
+// The tokens of a whole input in structure-of-arrays form: one byte of
+// kind, a 4-byte source offset and a 4-byte payload per token, about
+// a quarter of a Token. The parser's lookahead checks read only the
+// kind array. Full Tokens are rebuilt on demand; their line and column
+// come from an index of line start offsets.
+//
+class TokenBuffer {
+public:
+    size_t size() const { return kinds.size(); }
+    TokenType kind(size_t i) const { return static_cast<TokenType>(kinds[i]); }
+    const uint8_t* kindData() const { return kinds.data(); }
+
+    // Token `i`. `hint` is a line index kept by the caller (start at
+    // 0); walking the tokens in order then finds each line in O(1).
+    Token at(size_t i, size_t& hint) const;
+    Token operator[](size_t i) const { size_t hint = 0; return at(i, hint); }
+
+    // Parts of token `i`, without building the whole Token.
+    SourceLoc location(size_t i, size_t& hint) const;
+    Symbol symbol(size_t i) const { return payload[i]; }     // IDENT only
+    size_t offset(size_t i) const { return offsets[i]; }     // first byte
+
+    // Heap bytes held by the arrays.
+    size_t memoryBytes() const;
+
+private:
+    friend class Lexer;
+
+    TokenBuffer(string_view source, const Interner& names)
+        : source(source), names(&names), lineStarts{ 0 } {}
+
+    void push(const Token& token, size_t offset, size_t lineStart);
+    size_t lineOf(uint32_t offset, size_t& hint) const;
+
+    string_view source;
+    const Interner* names;
+
+    vector<uint8_t> kinds;          // TokenType
+    vector<uint32_t> offsets;       // first byte of the token
+    vector<uint32_t> payload;       // IDENT: Symbol (its name gives the
+                                    // length); NUMBER, UNKNOWN: length
+    vector<uint32_t> lineStarts;    // line l + 1 starts at lineStarts[l]
 };
 
 class Lexer {
 public:
-    explicit Lexer(const string& src);
+    // The caller owns `src`; it must outlive every Token (and every
+    // Parser reading them) produced by this Lexer. Identifiers are
+    // interned into `names`.
+    Lexer(string_view src, Interner& names);
+
+    // Lexes the whole input up front; the last token is END_OF_FILE.
+    // Sources of 4 GB and more can only be streamed.
+    TokenBuffer tokenize();
+
+    // Lexes one token; END_OF_FILE at (and after) the end of input.
+    Token next();
 
-    vector<Token> tokenize();
+    // Offset of the first byte not yet consumed.
+    size_t offset() const { return pos; }
+
+    // Tokens returned by next() so far.
+    size_t tokenCount() const { return lexed; }
 
 private:
-    string source;
+    string_view source;
+    Interner& names;
+    const ScanKernels& scan;    // scanKernels() at construction
     size_t pos = 0;
     int line = 1;
+    size_t lineStart = 0;       // offset of the current line
+    size_t tokenStart = 0;      // offset of the token being scanned
+    size_t lexed = 0;
 
     bool isAtEnd() const;
     char peek() const;
@@ -57,9 +140,65 @@ private:
 
     Token identifier();
     Token number();
-    Token makeToken(TokenType type, const string& lexeme);
+    Token makeToken(TokenType type);
+    Token makeToken(TokenType type, size_t start);
+    int column() const;
+};
 
-    static unordered_map<string, TokenType> keywords;
+//
+// The Parser's view of the token sequence: the current token, the
+// one before it and a bounded window ahead. It either walks a
+// TokenBuffer from tokenize() or pulls tokens from a Lexer on demand,
+// in which case only WINDOW tokens exist at any time however long the
+// input. Kind checks never build a Token.
+//
+class TokenStream {
+public:
+    static constexpr size_t WINDOW = 4;     // previous + current + 2 ahead
+
+    explicit TokenStream(const TokenBuffer& tokens);
+    explicit TokenStream(Lexer& lexer);
+
+    TokenType peekType() const {
+        return kinds ? static_cast<TokenType>(kinds[pos]) : ring[pos & MASK].type;
+    }
+    Token peek() const {
+        return tokens ? tokens->at(pos, lineHint) : ring[pos & MASK];
+    }
+    Token previous() const {
+        return tokens ? tokens->at(pos - 1, lineHint) : ring[(pos - 1) & MASK];
+    }
+    SourceLoc peekLocation() const {
+        return tokens ? tokens->location(pos, lineHint) : ring[pos & MASK].location();
+    }
+    SourceLoc previousLocation() const {
+        return tokens ? tokens->location(pos - 1, lineHint)
+                      : ring[(pos - 1) & MASK].location();
+    }
+    Symbol previousSymbol() const {
+        return tokens ? tokens->symbol(pos - 1) : ring[(pos - 1) & MASK].sym;
+    }
+
+    // The type of the token `ahead` places past the current one (0 is
+    // peekType()), at most WINDOW - 2; END_OF_FILE past the end.
+    TokenType lookahead(size_t ahead);
+
+    // Moves to the next token; stays put on END_OF_FILE.
+    void advance();
+
+    // Index of the current token.
+    size_t position() const { return pos; }
+
+private:
+    static constexpr size_t MASK = WINDOW - 1;
+
+    const TokenBuffer* tokens = nullptr;    // eager: the whole sequence
+    const uint8_t* kinds = nullptr;         // eager: tokens->kindData()
+    mutable size_t lineHint = 0;            // eager: for TokenBuffer::at
+    Lexer* lexer = nullptr;         // streaming: the source of tokens
+    vector<Token> ring;             // streaming: token i is ring[i & MASK]
+    size_t count = 0;               // tokens available (eager) or lexed so far
+    size_t pos = 0;                 // index of the current token
 };
 
 #endif
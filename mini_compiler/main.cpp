@@ -7,11 +7,22 @@ argument matching during calls, and correct return type usage. The goal is to de
 
  */
 
+#include <csignal>
+#include <cstdlib>
 #include <iostream>
+#include <optional>
 #include <string>
+#include "bytecode.h"
+#include "cache.h"
+#include "driver.h"
 #include "lexer.h"
+#include "module.h"
+#include "optimizer.h"
 #include "parser.h"
 #include "semantic.h"
+#include "server.h"
+#include "stats.h"
+#include "vm.h"
 
 using namespace std;
 
@@ -24,26 +35,269 @@ void runTest(const string& title, const string& source) {
 
     try {
         // LEXER
-        Lexer lexer(source);
+        Interner names;
+        Lexer lexer(source, names);
         auto tokens = lexer.tokenize();
         cout << "Lexer: PASSED\n";
 
         // PARSER
-        Parser parser(tokens);
+        Diagnostics diags;
+        AstArena arena;
+        Parser parser(tokens, arena, diags);
         auto ast = parser.parse();
-        cout << "Parser: PASSED\n";
+        cout << "Parser: " << (diags.hasErrors() ? "FAILED" : "PASSED") << "\n";
 
         // SEMANTIC
-        SemanticAnalyzer semantic;
+        size_t syntaxErrors = diags.errorCount();
+        SemanticAnalyzer semantic(names, diags);
         semantic.analyze(ast);
-        cout << "Semantic: PASSED\n";
+        cout << "Semantic: "
+             << (diags.errorCount() > syntaxErrors ? "FAILED" : "PASSED") << "\n";
+
+        if (diags.hasErrors()) {
+            for (auto& d : diags.all())
+                cout << "❌ " << diags.render(d, source);
+            return;
+        }
+
+        // OPTIMIZER
+        Optimizer optimizer(arena);
+        optimizer.optimize(ast);
+        cout << "Optimizer: removed " << optimizer.removedNodes() << " nodes\n";
+
+        // EXECUTION
+        BytecodeModule module = BytecodeCompiler(names).compile(ast);
+        int entry = module.findFunction(names.intern("main"));
+        if (entry >= 0) {
+            VM vm(module);
+            cout << "Run: main() returned " << vm.run(entry) << "\n";
+        }
     }
     catch (const exception& e) {
         cout << "❌ ERROR: " << e.what() << "\n";
     }
 }
 
-int main() {
+enum class TimeReport { NONE, TEXT, JSON };
+
+// Prints each file's results in input order. With several files,
+// --run output is prefixed by the file name. Time reports go to
+// stderr after the diagnostics: one per file, or a single JSON
+// document covering every file.
+static int report(const vector<FileResult>& results, TimeReport timeReport) {
+    size_t failed = 0;
+    for (auto& r : results) {
+        if (!r.output.empty()) {
+            if (results.size() > 1) cout << r.path << ": ";
+            cout << r.output;
+        }
+        cerr << r.diagnostics;
+        if (timeReport == TimeReport::TEXT && r.stats)
+            cerr << r.stats->text(r.path);
+        if (!r.ok) failed++;
+    }
+
+    if (timeReport == TimeReport::JSON) {
+        cerr << "{\"files\":[";
+        for (size_t i = 0; i < results.size(); ++i)
+            cerr << (i ? "," : "") << results[i].stats->json(results[i].path);
+        cerr << "],\"peak_rss_bytes\":" << peakRssBytes() << "}\n";
+    }
+
+    if (results.size() > 1)
+        cerr << results.size() << " files, " << failed << " failed\n";
+    return failed ? 1 : 0;
+}
+
+static CompileServer* runningServer = nullptr;
+
+static void stopServer(int) {
+    if (runningServer) runningServer->stop();
+}
+
+// Serves until SIGINT, SIGTERM or a client's --stop.
+static int serve(const string& socketPath, size_t jobs, CompileCache* cache) {
+    try {
+        CompileServer server(socketPath, jobs, cache);
+        runningServer = &server;
+        signal(SIGINT, stopServer);
+        signal(SIGTERM, stopServer);
+        cerr << "serving on " << socketPath << "\n";
+        server.serve();
+        runningServer = nullptr;
+        cerr << server.status();
+    }
+    catch (const exception& e) {
+        cerr << e.what() << "\n";
+        return 1;
+    }
+    if (cache) cerr << cache->report();
+    return 0;
+}
+
+// Maps the --module files into `out`. A name may be declared by one
+// of them only.
+static int loadModules(const vector<string>& paths,
+                       vector<shared_ptr<const Module>>& out) {
+    try {
+        for (auto& path : paths) {
+            auto m = make_shared<const Module>(path);
+            for (auto& earlier : out) {
+                for (size_t i = 0; i < m->functionCount(); ++i) {
+                    if (earlier->function(m->functionName(i)))
+                        throw runtime_error(
+                            "function '" + string(m->functionName(i)) +
+                            "' is declared by both '" + earlier->path() +
+                            "' and '" + path + "'");
+                }
+                for (size_t i = 0; i < m->globalCount(); ++i) {
+                    if (earlier->global(m->globalName(i)))
+                        throw runtime_error(
+                            "variable '" + string(m->globalName(i)) +
+                            "' is declared by both '" + earlier->path() +
+                            "' and '" + path + "'");
+                }
+            }
+            out.push_back(move(m));
+        }
+    }
+    catch (const exception& e) {
+        cerr << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+static int usage() {
+    cerr << "usage: mini_compiler                     run the built-in tests\n"
+            "       mini_compiler [options] <path>... check files; directories\n"
+            "                                         are searched for *.mc\n"
+            "\n"
+            "options:\n"
+            "  --jobs=N           compile N files at a time (default: one\n"
+            "                     per core)\n"
+            "  --run              also execute main() and print its result\n"
+            "  --no-opt           skip constant folding\n"
+            "  --two-phase        collect all signatures before checking\n"
+            "                     bodies (allows calls to functions declared\n"
+            "                     later); with a single file, bodies are\n"
+            "                     checked on --jobs threads\n"
+            "  --stream           map files into memory and lex them on\n"
+            "                     demand; when only checking, memory use\n"
+            "                     stays flat however large the file\n"
+            "  --cache=DIR        reuse results of files compiled before\n"
+            "                     with the same options (on-disk cache\n"
+            "                     keyed by a hash of the source)\n"
+            "  --cache-size=MB    evict least recently used entries beyond\n"
+            "                     this size (default 256)\n"
+            "  --cache-stats      print hit and miss counts (stderr)\n"
+            "  --emit-module=FILE save the (one) file, if it checks, as a\n"
+            "                     precompiled module\n"
+            "  --module=FILE      check and run files after the declarations\n"
+            "                     of a precompiled module, without parsing\n"
+            "                     its source again; may be repeated\n"
+            "  --server[=SOCKET]  serve mcc clients on a Unix socket instead\n"
+            "                     (default $MINI_COMPILER_SOCKET, else\n"
+            "                     /tmp/mini_compiler-<uid>.sock); --jobs and\n"
+            "                     --cache apply to their requests\n"
+            "  --time-report[=json]\n"
+            "                     print time, allocations and counts per\n"
+            "                     compiler phase for each file (stderr)\n"
+            "  --vm=ENGINE        engine used by --run (default: stack):\n"
+            "                       ast    tree-walking interpreter\n"
+            "                       stack  stack bytecode VM\n"
+            "                       reg    register bytecode VM\n"
+            "                       jit    native x86-64 code\n";
+    return 2;
+}
+
+int main(int argc, char** argv) {
+
+    if (argc > 1) {
+        Options opts;
+        TimeReport timeReport = TimeReport::NONE;
+        string cacheDir;
+        uint64_t cacheMegabytes = 256;
+        bool cacheStats = false;
+        bool server = false;
+        string socketPath;
+        vector<string> modulePaths;
+        vector<string> paths;
+
+        for (int i = 1; i < argc; ++i) {
+            string arg = argv[i];
+            if (arg == "--run") opts.run = true;
+            else if (arg == "--no-opt") opts.optimize = false;
+            else if (arg == "--two-phase") opts.twoPhase = true;
+            else if (arg == "--stream") opts.stream = true;
+            else if (arg == "--time-report") timeReport = TimeReport::TEXT;
+            else if (arg == "--time-report=json") timeReport = TimeReport::JSON;
+            else if (arg == "--vm=ast") opts.engine = Engine::AST;
+            else if (arg == "--vm=stack") opts.engine = Engine::STACK;
+            else if (arg == "--vm=reg") opts.engine = Engine::REG;
+            else if (arg == "--vm=jit") opts.engine = Engine::JIT;
+            else if (arg.rfind("--jobs=", 0) == 0)
+                opts.jobs = strtoul(arg.c_str() + 7, nullptr, 10);
+            else if (arg.rfind("--cache=", 0) == 0) cacheDir = arg.substr(8);
+            else if (arg.rfind("--cache-size=", 0) == 0)
+                cacheMegabytes = strtoull(arg.c_str() + 13, nullptr, 10);
+            else if (arg == "--cache-stats") cacheStats = true;
+            else if (arg.rfind("--module=", 0) == 0)
+                modulePaths.push_back(arg.substr(9));
+            else if (arg.rfind("--emit-module=", 0) == 0)
+                opts.emitModule = arg.substr(14);
+            else if (arg == "--server") server = true;
+            else if (arg.rfind("--server=", 0) == 0) {
+                server = true;
+                socketPath = arg.substr(9);
+            }
+            else if (arg[0] == '-') return usage();
+            else paths.push_back(arg);
+        }
+
+        if (paths.empty() && !server) return usage();
+        if (!modulePaths.empty() && opts.twoPhase) {
+            cerr << "--module cannot be combined with --two-phase\n";
+            return 2;
+        }
+        if (int status = loadModules(modulePaths, opts.modules))
+            return status;
+
+        optional<CompileCache> cache;
+        if (!cacheDir.empty()) {
+            try {
+                cache.emplace(cacheDir, cacheMegabytes << 20);
+            }
+            catch (const exception& e) {
+                cerr << e.what() << "\n";
+                return 1;
+            }
+            opts.cache = &*cache;
+        }
+
+        if (server) {
+            if (socketPath.empty()) socketPath = defaultSocketPath();
+            return serve(socketPath, opts.jobs, opts.cache);
+        }
+
+        vector<string> files = collectSources(paths);
+        if (files.empty()) {
+            cerr << "no *.mc files found\n";
+            return 1;
+        }
+        if (!opts.emitModule.empty() && files.size() != 1) {
+            cerr << "--emit-module takes exactly one source file\n";
+            return 2;
+        }
+        if (timeReport != TimeReport::NONE) {
+            opts.stats = true;
+            setHeapCounting(true);
+        }
+
+        int status = report(compileBatch(files, opts), timeReport);
+        if (cache && cacheStats) cerr << cache->report();
+        return status;
+    }
 
     // =====================================================
     // VALID PROGRAM
@@ -149,5 +403,85 @@ int main() {
         }
     )");
 
+    // =====================================================
+    // CONSTANT FOLDING
+    // =====================================================
+    runTest("CONSTANT FOLDING",
+        R"(
+        int main() {
+            int x;
+            x = 2 * 3 + 4;
+            x = x * 1 + 0 - (8 / 2 - 4) * x;
+            return x;
+        }
+    )");
+
+    // =====================================================
+    // LOGICAL AND COMPARISON OPERATORS
+    // =====================================================
+    runTest("LOGICAL AND COMPARISON OPERATORS",
+        R"(
+        int calls;
+        int count(int v) {
+            calls = calls + 1;
+            return v;
+        }
+        int main() {
+            int x;
+            bool p;
+            x = 3;
+            p = x < 4 && !(x == 2) || count(1) > 0;
+            p = p && x >= 3 != false;
+            p = !p || count(2) == 2;
+            p = false && (x = 9) > 0;
+            return calls * 10 + x;
+        }
+    )");
+
+    // =====================================================
+    // OPERATOR TYPE ERRORS
+    // =====================================================
+    runTest("OPERATOR TYPE ERRORS",
+        R"(
+        int main() {
+            int x;
+            bool p;
+            p = x && p;
+            p = !x;
+            p = x == p;
+            p = p < true;
+            return x;
+        }
+    )");
+
+    // =====================================================
+    // ERROR RECOVERY
+    // =====================================================
+    runTest("ERROR RECOVERY",
+        R"(
+        int f(int a) {
+            int b;
+            b = a + ;
+            return b + c;
+        }
+        int main() {
+            int x
+            x = f(1, 2);
+            return x + undefinedFn(x);
+        }
+    )");
+
+    // =====================================================
+    // RECOVERY OVER A NESTED BLOCK
+    // =====================================================
+    runTest("RECOVERY OVER A NESTED BLOCK",
+        R"(
+        int main() {
+            int x;
+            if (x) { x = 1; }
+            return x;
+        }
+    )");
+
     return 0;
 }
@@ -0,0 +1,74 @@
+#include "mappedfile.h"
+#include <fstream>
+#include <sstream>
+
+#if MMAP_SUPPORTED
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+MappedFile::~MappedFile() {
+#if MMAP_SUPPORTED
+    if (mapped)
+        munmap(const_cast<char*>(data), size);
+#endif
+}
+
+bool MappedFile::open(const string& path) {
+#if MMAP_SUPPORTED
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return false;
+    }
+
+    size = static_cast<size_t>(st.st_size);
+    if (size == 0) {
+        // mmap rejects empty mappings; an empty view will do.
+        close(fd);
+        data = "";
+        return true;
+    }
+
+    void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        size = 0;
+        return false;
+    }
+
+    madvise(p, size, MADV_SEQUENTIAL);
+    data = static_cast<const char*>(p);
+    mapped = true;
+    return true;
+#else
+    ifstream in(path, ios::binary);
+    if (!in) return false;
+    stringstream buffer;
+    buffer << in.rdbuf();
+    copy = buffer.str();
+    data = copy.data();
+    size = copy.size();
+    return true;
+#endif
+}
+
+void MappedFile::release(size_t offset) {
+#if MMAP_SUPPORTED
+    if (!mapped || offset < released + RELEASE_STEP) return;
+
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t end = offset / page * page;
+    madvise(const_cast<char*>(data) + released, end - released, MADV_DONTNEED);
+    released = end;
+#else
+    (void)offset;
+#endif
+}
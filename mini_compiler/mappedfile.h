@@ -0,0 +1,53 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MMAP_SUPPORTED 1
+#else
+#define MMAP_SUPPORTED 0
+#endif
+
+//
+// Read-only view of a whole file, mapped into memory rather than
+// copied, so opening a multi-gigabyte source costs address space, not
+// RAM. Pages are read in as the lexer touches them; release() hands
+// the ones behind it back to the kernel, keeping the resident size
+// flat during a single front-to-back pass. Released pages stay
+// readable (they are fetched from the file again on access), so
+// tokens and diagnostics may still refer to them.
+//
+// Where mmap is not available the file is read into memory instead.
+//
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // False if the file cannot be opened or mapped.
+    bool open(const string& path);
+
+    string_view text() const { return { data, size }; }
+
+    // Drops resident pages below `offset`. Cheap to call often: it
+    // only acts once RELEASE_STEP more bytes have been consumed.
+    void release(size_t offset);
+
+private:
+    static constexpr size_t RELEASE_STEP = 16 * 1024 * 1024;
+
+    const char* data = nullptr;
+    size_t size = 0;
+    size_t released = 0;
+    bool mapped = false;
+    string copy;                // fallback storage
+};
+
+#endif
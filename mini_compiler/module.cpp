@@ -0,0 +1,642 @@
+#include "module.h"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <initializer_list>
+#include <stdexcept>
+#include "cache.h"
+#include "visitor.h"
+
+using namespace std;
+
+// ---------------- records ----------------
+namespace {
+
+constexpr uint32_t MAGIC = 0x314d434d;      // "MCM1"
+constexpr uint32_t NONE = UINT32_MAX;
+
+// Node tags: ExprKind values, then StmtKind values after them; an
+// operator's TokenType goes in the second byte.
+constexpr uint32_t stmtTag(StmtKind k) {
+    return static_cast<uint32_t>(EXPR_KINDS) + static_cast<uint32_t>(k);
+}
+
+uint64_t hashName(string_view name) {
+    return xxhash64(name.data(), name.size());
+}
+
+} // namespace
+
+struct Module::Header {
+    uint32_t magic, format;
+    uint32_t nameCount, namesOffset;
+    uint32_t slotCount, slotsOffset;
+    uint32_t functionCount, functionsOffset;
+    uint32_t paramCount, paramsOffset;
+    uint32_t globalCount, globalsOffset;
+    uint32_t statementCount, statementsOffset;
+    uint32_t nodeWords, nodesOffset;
+    uint32_t textSize, textOffset;
+};
+
+struct Module::NameRecord {
+    uint32_t offset, length;
+    uint32_t function, global;          // index + 1; 0 if not declared
+};
+
+struct Module::FunctionRecord {
+    uint32_t name, returnType, paramCount, params, node;
+};
+
+struct Module::GlobalRecord {
+    uint32_t name, type;
+};
+
+//
+// A node is its tag and line, then per kind:
+//   NUMBER     low and high half of the value
+//   BOOL       value
+//   VAR        name
+//   ASSIGN     name, value
+//   BINARY     left, right
+//   UNARY      operand
+//   CALL       callee, argument count, arguments
+//   VAR_DECL   type, name
+//   EXPR       expression
+//   RETURN     expression, or 0 for none
+//   BLOCK      statement count, statements
+//   FUNCTION   name, return type, body, parameter count, then the
+//              type and name of each parameter
+// Children are referenced by their distance back from the node, in
+// words; being written first, they are always behind it.
+//
+
+// ---------------- encoding ----------------
+namespace {
+
+template <typename T>
+void put(vector<uint32_t>& out, const T& record) {
+    static_assert(sizeof(T) % sizeof(uint32_t) == 0, "records are 4-byte fields");
+    size_t at = out.size();
+    out.resize(at + sizeof(T) / sizeof(uint32_t));
+    memcpy(&out[at], &record, sizeof(T));
+}
+
+} // namespace
+
+// Builds the sections while walking the checked tree; each visit
+// returns the offset of the node it appended.
+class Module::Encoder
+    : public ExprVisitor<Module::Encoder, uint32_t>,
+      public StmtVisitor<Module::Encoder, uint32_t> {
+public:
+    explicit Encoder(const Interner& names)
+        : names(names), ids(names.size(), NONE) {}
+
+    vector<NameRecord> nameList;
+    string text;
+    vector<FunctionRecord> functions;
+    vector<TypeId> params;
+    vector<GlobalRecord> globals;
+    vector<uint32_t> statements;
+    vector<uint32_t> nodes;
+
+    uint32_t nameId(Symbol sym) {
+        if (ids[sym] == NONE) {
+            string_view s = names.name(sym);
+            ids[sym] = static_cast<uint32_t>(nameList.size());
+            nameList.push_back({ static_cast<uint32_t>(text.size()),
+                                 static_cast<uint32_t>(s.size()), 0, 0 });
+            text += s;
+        }
+        return ids[sym];
+    }
+
+    uint32_t global(const VarDecl* v) {
+        uint32_t name = nameId(v->name);
+        globals.push_back({ name, v->type });
+        nameList[name].global = static_cast<uint32_t>(globals.size());
+        return visitStmt(v);
+    }
+
+    uint32_t visitExpr(const Expr* e) {
+        return ExprVisitor<Encoder, uint32_t>::visitExpr(e);
+    }
+    uint32_t visitStmt(const Stmt* s) {
+        return StmtVisitor<Encoder, uint32_t>::visitStmt(s);
+    }
+
+    uint32_t visitNumber(const NumberExpr* n) {
+        uint64_t v = static_cast<uint64_t>(n->value);
+        return node(n, tagOf(n), { static_cast<uint32_t>(v),
+                                   static_cast<uint32_t>(v >> 32) });
+    }
+    uint32_t visitBool(const BoolExpr* b) { return node(b, tagOf(b), { b->value }); }
+    uint32_t visitVar(const VarExpr* v) { return node(v, tagOf(v), { nameId(v->name) }); }
+    uint32_t visitAssign(const AssignExpr* a) {
+        uint32_t value = visitExpr(a->value);
+        return node(a, tagOf(a), { nameId(a->name), back(value) });
+    }
+    uint32_t visitBinary(const BinaryExpr* b) {
+        uint32_t left = visitExpr(b->left);
+        uint32_t right = visitExpr(b->right);
+        return node(b, tagOf(b, b->op), { back(left), back(right) });
+    }
+    uint32_t visitUnary(const UnaryExpr* u) {
+        uint32_t operand = visitExpr(u->expr);
+        return node(u, tagOf(u, u->op), { back(operand) });
+    }
+    uint32_t visitCall(const CallExpr* call) {
+        vector<uint32_t> args;
+        for (auto arg : call->args)
+            args.push_back(visitExpr(arg));
+        for (auto& arg : args) arg = back(arg);
+        return node(call, tagOf(call), { nameId(call->callee), call->args.count }, &args);
+    }
+    uint32_t visitError(const ErrorExpr*) {
+        throw runtime_error("a module cannot be made of a file with errors");
+    }
+
+    uint32_t visitVarDecl(const VarDecl* v) {
+        return node(v, stmtTag(v->kind), { v->type, nameId(v->name) });
+    }
+    uint32_t visitExprStmt(const ExprStmt* e) {
+        uint32_t expr = visitExpr(e->expr);
+        return node(e, stmtTag(e->kind), { back(expr) });
+    }
+    uint32_t visitReturn(const ReturnStmt* r) {
+        uint32_t expr = r->expr ? back(visitExpr(r->expr)) : 0;
+        return node(r, stmtTag(r->kind), { expr });
+    }
+    uint32_t visitBlock(const BlockStmt* b) {
+        vector<uint32_t> list;
+        for (auto s : b->statements)
+            list.push_back(visitStmt(s));
+        for (auto& s : list) s = back(s);
+        return node(b, stmtTag(b->kind), { b->statements.count }, &list);
+    }
+    uint32_t visitFunction(const FunctionDecl* f) {
+        // Registered before the body, as the checker declares it.
+        uint32_t name = nameId(f->name);
+        size_t index = functions.size();
+        functions.push_back({ name, f->returnType, f->params.count,
+                              static_cast<uint32_t>(params.size()), NONE });
+        nameList[name].function = static_cast<uint32_t>(index + 1);
+
+        vector<uint32_t> list;
+        for (auto& p : f->params) {
+            params.push_back(p.type);
+            list.push_back(p.type);
+            list.push_back(nameId(p.name));
+        }
+        uint32_t body = visitBlock(f->body);
+        uint32_t at = node(f, stmtTag(f->kind),
+                           { name, f->returnType, back(body), f->params.count },
+                           &list);
+        functions[index].node = at;
+        return at;
+    }
+
+private:
+    const Interner& names;
+    vector<uint32_t> ids;           // Symbol -> name id
+
+    static uint32_t tagOf(const Expr* e) { return static_cast<uint32_t>(e->kind); }
+    static uint32_t tagOf(const Expr* e, TokenType op) {
+        return tagOf(e) | static_cast<uint32_t>(op) << 8;
+    }
+
+    // Distance from the node about to be appended back to `child`.
+    uint32_t back(uint32_t child) const {
+        return static_cast<uint32_t>(nodes.size()) - child;
+    }
+
+    // Appends a node; returns its index.
+    template <typename N>
+    uint32_t node(const N* n, uint32_t tag, initializer_list<uint32_t> fields,
+                  const vector<uint32_t>* list = nullptr) {
+        uint32_t at = static_cast<uint32_t>(nodes.size());
+        nodes.push_back(tag);
+        nodes.push_back(n->loc.line);
+        nodes.insert(nodes.end(), fields);
+        if (list) nodes.insert(nodes.end(), list->begin(), list->end());
+        return at;
+    }
+};
+
+string Module::encode(const vector<StmtPtr>& program, const Interner& names) {
+    Encoder enc(names);
+    for (auto stmt : program) {
+        auto v = nodeAs<const VarDecl>(stmt);
+        enc.statements.push_back(v ? enc.global(v) : enc.visitStmt(stmt));
+    }
+
+    // Hash table over the declared names, at most half full.
+    uint32_t declared = 0;
+    for (auto& n : enc.nameList)
+        declared += (n.function || n.global);
+    uint32_t slotCount = declared ? 1 : 0;
+    while (slotCount && slotCount < declared * 2) slotCount *= 2;
+    vector<uint32_t> slots(slotCount);
+    for (uint32_t i = 0; i < enc.nameList.size(); ++i) {
+        auto& n = enc.nameList[i];
+        if (!n.function && !n.global) continue;
+        uint64_t h = hashName(string_view(enc.text).substr(n.offset, n.length));
+        uint32_t s = static_cast<uint32_t>(h) & (slotCount - 1);
+        while (slots[s]) s = (s + 1) & (slotCount - 1);
+        slots[s] = i + 1;
+    }
+
+    vector<uint32_t> out(sizeof(Header) / sizeof(uint32_t));
+    Header h{};
+    h.magic = MAGIC;
+    h.format = FORMAT;
+    auto offset = [&] { return static_cast<uint32_t>(out.size() * sizeof(uint32_t)); };
+    auto words = [&](const vector<uint32_t>& v) { out.insert(out.end(), v.begin(), v.end()); };
+
+    h.nameCount = static_cast<uint32_t>(enc.nameList.size());
+    h.namesOffset = offset();
+    for (auto& n : enc.nameList) put(out, n);
+    h.slotCount = slotCount;
+    h.slotsOffset = offset();
+    words(slots);
+    h.functionCount = static_cast<uint32_t>(enc.functions.size());
+    h.functionsOffset = offset();
+    for (auto& f : enc.functions) put(out, f);
+    h.paramCount = static_cast<uint32_t>(enc.params.size());
+    h.paramsOffset = offset();
+    words(enc.params);
+    h.globalCount = static_cast<uint32_t>(enc.globals.size());
+    h.globalsOffset = offset();
+    for (auto& g : enc.globals) put(out, g);
+    h.statementCount = static_cast<uint32_t>(enc.statements.size());
+    h.statementsOffset = offset();
+    words(enc.statements);
+    h.nodeWords = static_cast<uint32_t>(enc.nodes.size());
+    h.nodesOffset = offset();
+    words(enc.nodes);
+    h.textSize = static_cast<uint32_t>(enc.text.size());
+    h.textOffset = offset();
+    memcpy(out.data(), &h, sizeof h);
+
+    string bytes(reinterpret_cast<const char*>(out.data()),
+                 out.size() * sizeof(uint32_t));
+    bytes += enc.text;
+    if (bytes.size() > UINT32_MAX)
+        throw runtime_error("module too large");
+    return bytes;
+}
+
+void Module::write(const string& path, const vector<StmtPtr>& program,
+                   const Interner& names) {
+    string bytes = encode(program, names);
+    string temp = path + ".tmp";
+    {
+        ofstream out(temp, ios::binary | ios::trunc);
+        if (out.write(bytes.data(), bytes.size()) && out.flush()) {
+            out.close();
+            error_code ec;
+            filesystem::rename(temp, path, ec);
+            if (!ec) return;
+        }
+    }
+    error_code ec;
+    filesystem::remove(temp, ec);
+    throw runtime_error("cannot write module '" + path + "'");
+}
+
+// ---------------- loading ----------------
+Module::Module(const string& path) : filePath(path) {
+    if (!file.open(path))
+        throw runtime_error("cannot open module '" + path + "'");
+
+    string_view data = file.text();
+    Header h;
+    if (data.size() < sizeof h)
+        throw runtime_error("'" + path + "' is not a module");
+    memcpy(&h, data.data(), sizeof h);
+    if (h.magic != MAGIC)
+        throw runtime_error("'" + path + "' is not a module");
+    if (h.format != FORMAT)
+        throw runtime_error("module '" + path + "' has format " +
+                            to_string(h.format) + ", expected " +
+                            to_string(FORMAT));
+    if (reinterpret_cast<uintptr_t>(data.data()) % alignof(uint32_t))
+        corrupt();
+
+    nameRecords = section<NameRecord>(h.namesOffset, h.nameCount);
+    slots = section<uint32_t>(h.slotsOffset, h.slotCount);
+    functionRecords = section<FunctionRecord>(h.functionsOffset, h.functionCount);
+    params = section<TypeId>(h.paramsOffset, h.paramCount);
+    globalRecords = section<GlobalRecord>(h.globalsOffset, h.globalCount);
+    statements = section<uint32_t>(h.statementsOffset, h.statementCount);
+    nodes = section<uint32_t>(h.nodesOffset, h.nodeWords);
+    nameText = section<char>(h.textOffset, h.textSize);
+    if (h.slotCount & (h.slotCount - 1)) corrupt();
+
+    nameCount = h.nameCount;
+    slotCount = h.slotCount;
+    functionTotal = h.functionCount;
+    paramTotal = h.paramCount;
+    globalTotal = h.globalCount;
+    statementCount = h.statementCount;
+    nodeWords = h.nodeWords;
+    textSize = h.textSize;
+}
+
+void Module::corrupt() const {
+    throw runtime_error("module '" + filePath + "' is damaged");
+}
+
+template <typename T>
+const T* Module::section(uint32_t offset, uint32_t count) const {
+    string_view data = file.text();
+    if (offset % alignof(uint32_t) || offset > data.size() ||
+        uint64_t(count) * sizeof(T) > data.size() - offset)
+        corrupt();
+    return reinterpret_cast<const T*>(data.data() + offset);
+}
+
+string_view Module::text(const NameRecord& name) const {
+    if (name.offset > textSize || name.length > textSize - name.offset)
+        corrupt();
+    return { nameText + name.offset, name.length };
+}
+
+const Module::NameRecord* Module::find(string_view name) const {
+    if (slotCount == 0) return nullptr;
+
+    uint32_t mask = slotCount - 1;
+    uint32_t s = static_cast<uint32_t>(hashName(name)) & mask;
+    for (uint32_t probes = 0; probes < slotCount; ++probes, s = (s + 1) & mask) {
+        uint32_t slot = slots[s];
+        if (slot == 0) return nullptr;
+        if (slot > nameCount) corrupt();
+        const NameRecord& r = nameRecords[slot - 1];
+        if (text(r) == name) return &r;
+    }
+    return nullptr;
+}
+
+const Module::FunctionRecord& Module::functionAt(size_t i) const {
+    const FunctionRecord& f = functionRecords[i];
+    if (f.name >= nameCount || f.params > paramTotal ||
+        f.paramCount > paramTotal - f.params)
+        corrupt();
+    return f;
+}
+
+const Module::GlobalRecord& Module::globalAt(size_t i) const {
+    const GlobalRecord& g = globalRecords[i];
+    if (g.name >= nameCount) corrupt();
+    return g;
+}
+
+optional<Module::Signature> Module::function(string_view name) const {
+    const NameRecord* r = find(name);
+    if (!r || r->function == 0) return nullopt;
+    if (r->function > functionTotal) corrupt();
+
+    const FunctionRecord& f = functionAt(r->function - 1);
+    if (f.returnType >= TypeTable::ERROR) corrupt();
+    for (uint32_t i = 0; i < f.paramCount; ++i)
+        if (params[f.params + i] >= TypeTable::VOID) corrupt();
+    return Signature{ f.returnType, params + f.params, f.paramCount };
+}
+
+optional<TypeId> Module::global(string_view name) const {
+    const NameRecord* r = find(name);
+    if (!r || r->global == 0) return nullopt;
+    if (r->global > globalTotal) corrupt();
+
+    TypeId type = globalAt(r->global - 1).type;
+    if (type >= TypeTable::VOID) corrupt();
+    return type;
+}
+
+size_t Module::functionCount() const { return functionTotal; }
+size_t Module::globalCount() const { return globalTotal; }
+
+string_view Module::functionName(size_t i) const {
+    return text(nameRecords[functionAt(i).name]);
+}
+
+string_view Module::globalName(size_t i) const {
+    return text(nameRecords[globalAt(i).name]);
+}
+
+// ---------------- materializing ----------------
+//
+// Rebuilds arena nodes from the node section. Children are checked to
+// lie behind their parent and every node to be used once, so a damaged
+// file can neither send the decoder round in a cycle nor make it build
+// a tree exponentially larger than itself by sharing subtrees; nesting
+// beyond MAX_COMPILED_DEPTH, which the encoder never writes, is
+// refused before the recursion gets deep.
+//
+class Module::Decoder {
+public:
+    Decoder(const Module& m, AstArena& arena, Interner& names)
+        : m(m), arena(arena), names(names), symbols(m.nameCount, NONE),
+          claimed(m.nodeWords) {}
+
+    // A top-level statement, or a child, the first and only time it is
+    // reached.
+    StmtPtr stmt(uint32_t at) {
+        claim(at);
+        if (++stmtDepth > MAX_COMPILED_DEPTH) m.corrupt();
+        const uint32_t* w = fields(at, 0);
+        uint32_t kind = w[-2] & 0xff;
+        if (kind < EXPR_KINDS || kind >= EXPR_KINDS + STMT_KINDS) m.corrupt();
+
+        Stmt* s = nullptr;
+        switch (static_cast<StmtKind>(kind - EXPR_KINDS)) {
+        case StmtKind::VAR_DECL:
+            w = fields(at, 2);
+            s = arena.make<VarDecl>(type(w[0], TypeTable::VOID), symbol(w[1]));
+            break;
+        case StmtKind::EXPR:
+            w = fields(at, 1);
+            s = arena.make<ExprStmt>(expr(child(at, w[0])));
+            break;
+        case StmtKind::RETURN:
+            w = fields(at, 1);
+            s = arena.make<ReturnStmt>(w[0] ? expr(child(at, w[0])) : nullptr);
+            break;
+        case StmtKind::BLOCK:
+            s = block(at);
+            break;
+        case StmtKind::FUNCTION: {
+            w = fields(at, 4);
+            auto f = arena.make<FunctionDecl>();
+            f->name = symbol(w[0]);
+            f->returnType = type(w[1], TypeTable::ERROR);
+            uint32_t body = child(at, w[2]);
+            const uint32_t* list = fields(at, 4 + uint64_t(w[3]) * 2) + 4;
+            size_t from = params.size();
+            for (uint32_t i = 0; i < w[3]; ++i)
+                params.push_back({ type(list[2 * i], TypeTable::VOID),
+                                   symbol(list[2 * i + 1]) });
+            f->params = arena.list(params, from);
+            if ((fields(body, 0)[-2] & 0xff) != stmtTag(StmtKind::BLOCK))
+                m.corrupt();
+            claim(body);
+            f->body = block(body);
+            s = f;
+            break;
+        }
+        }
+        s->loc.line = m.nodes[at + 1];
+        --stmtDepth;
+        return s;
+    }
+
+private:
+    const Module& m;
+    AstArena& arena;
+    Interner& names;
+    vector<Symbol> symbols;         // name id -> Symbol, once interned
+    vector<bool> claimed;           // node start word -> already used
+    size_t stmtDepth = 0, exprDepth = 0;
+
+    // Scratch stacks for the lists being built, nested ones on top.
+    vector<ExprPtr> exprs;
+    vector<StmtPtr> stmts;
+    vector<FunctionDecl::Param> params;
+
+    // The first `count` words after the tag and line of node `at`.
+    const uint32_t* fields(uint32_t at, uint64_t count) const {
+        if (at > m.nodeWords || 2 + count > m.nodeWords - at) m.corrupt();
+        return m.nodes + at + 2;
+    }
+
+    uint32_t child(uint32_t at, uint32_t distance) const {
+        if (distance == 0 || distance > at) m.corrupt();
+        return at - distance;
+    }
+
+    void claim(uint32_t at) {
+        if (at >= m.nodeWords || claimed[at]) m.corrupt();
+        claimed[at] = true;
+    }
+
+    Symbol symbol(uint32_t name) {
+        if (name >= m.nameCount) m.corrupt();
+        if (symbols[name] == NONE)
+            symbols[name] = names.intern(m.text(m.nameRecords[name]));
+        return symbols[name];
+    }
+
+    TypeId type(uint32_t t, TypeId limit) const {
+        if (t >= limit) m.corrupt();
+        return t;
+    }
+
+    TokenType op(uint32_t tag) const {
+        uint32_t o = tag >> 8;
+        if (o < static_cast<uint32_t>(TokenType::PLUS) ||
+            o > static_cast<uint32_t>(TokenType::NOT))
+            m.corrupt();
+        return static_cast<TokenType>(o);
+    }
+
+    BlockStmt* block(uint32_t at) {
+        auto b = arena.make<BlockStmt>();
+        uint32_t count = fields(at, 1)[0];
+        const uint32_t* list = fields(at, 1 + uint64_t(count)) + 1;
+        size_t from = stmts.size();
+        for (uint32_t i = 0; i < count; ++i)
+            stmts.push_back(stmt(child(at, list[i])));
+        b->statements = arena.list(stmts, from);
+        b->loc.line = m.nodes[at + 1];
+        return b;
+    }
+
+    ExprPtr expr(uint32_t at) {
+        claim(at);
+        if (++exprDepth > MAX_COMPILED_DEPTH) m.corrupt();
+        const uint32_t* w = fields(at, 0);
+        uint32_t tag = w[-2];
+        uint32_t kind = tag & 0xff;
+        if (kind >= static_cast<uint32_t>(ExprKind::ERROR)) m.corrupt();
+
+        Expr* e = nullptr;
+        switch (static_cast<ExprKind>(kind)) {
+        case ExprKind::NUMBER:
+            w = fields(at, 2);
+            e = arena.make<NumberExpr>(static_cast<Value>(uint64_t(w[1]) << 32 | w[0]));
+            break;
+        case ExprKind::BOOL:
+            w = fields(at, 1);
+            e = arena.make<BoolExpr>(w[0] != 0);
+            break;
+        case ExprKind::VAR:
+            w = fields(at, 1);
+            e = arena.make<VarExpr>(symbol(w[0]));
+            break;
+        case ExprKind::ASSIGN:
+            w = fields(at, 2);
+            e = arena.make<AssignExpr>(symbol(w[0]), expr(child(at, w[1])));
+            break;
+        case ExprKind::BINARY: {
+            w = fields(at, 2);
+            ExprPtr left = expr(child(at, w[0]));
+            e = arena.make<BinaryExpr>(op(tag), left, expr(child(at, w[1])));
+            break;
+        }
+        case ExprKind::UNARY:
+            w = fields(at, 1);
+            e = arena.make<UnaryExpr>(op(tag), expr(child(at, w[0])));
+            break;
+        case ExprKind::CALL: {
+            w = fields(at, 2);
+            const uint32_t* list = fields(at, 2 + uint64_t(w[1])) + 2;
+            size_t from = exprs.size();
+            for (uint32_t i = 0; i < w[1]; ++i)
+                exprs.push_back(expr(child(at, list[i])));
+            e = arena.make<CallExpr>(symbol(w[0]), arena.list(exprs, from));
+            break;
+        }
+        case ExprKind::ERROR:
+            m.corrupt();
+        }
+        e->loc.line = m.nodes[at + 1];
+        --exprDepth;
+        return e;
+    }
+};
+
+vector<StmtPtr> Module::materialize(AstArena& arena, Interner& names) const {
+    Decoder decoder(*this, arena, names);
+    vector<StmtPtr> program;
+    program.reserve(statementCount);
+    for (uint32_t i = 0; i < statementCount; ++i)
+        program.push_back(decoder.stmt(statements[i]));
+    return program;
+}
+
+// ---------------- environment ----------------
+ModuleEnvironment::ModuleEnvironment(
+    const vector<shared_ptr<const Module>>& modules, const Interner& names)
+    : modules(modules), names(names) {}
+
+const FunctionInfo* ModuleEnvironment::function(Symbol name) const {
+    auto [it, added] = functions.try_emplace(name);
+    if (added) {
+        for (auto& m : modules) {
+            if (auto sig = m->function(names.name(name))) {
+                it->second = FunctionInfo{ sig->returnType,
+                    vector<TypeId>(sig->params, sig->params + sig->paramCount) };
+                break;
+            }
+        }
+    }
+    return it->second ? &*it->second : nullptr;
+}
+
+optional<TypeId> ModuleEnvironment::global(Symbol name) const {
+    for (auto& m : modules)
+        if (auto type = m->global(names.name(name)))
+            return type;
+    return nullopt;
+}
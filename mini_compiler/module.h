@@ -0,0 +1,152 @@
+#ifndef MODULE_H
+#define MODULE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "arena.h"
+#include "ast.h"
+#include "interner.h"
+#include "mappedfile.h"
+#include "semantic.h"
+#include "symbol.h"
+
+using namespace std;
+
+//
+// Precompiled module: the checked AST of one source file and its
+// table of function signatures and top-level variables, saved so that
+// other files can be checked (and run) against its declarations
+// without lexing and parsing it again (`--emit-module`, `--module`).
+//
+// The file is used in place from a read-only mapping. Everything in
+// it is an array of 4-byte fields, and every reference is an offset:
+// sections from the start of the file, names into the name text, AST
+// nodes from the start of the node section. Nothing is fixed up on
+// load; opening a module checks its header and section bounds, and
+// individual records are bounds-checked as they are read, so a
+// damaged file is reported as such instead of being trusted.
+//
+//   header      magic "MCM1", format version, section offsets
+//   names       {text offset, length, function + 1, global + 1} per
+//               identifier the module uses
+//   slots       open-addressed hash table (xxHash64 of the text) of
+//               name + 1, over the names the module declares
+//   functions   {name, return type, parameter count, first parameter,
+//               node index} for every function, nested ones included, in
+//               declaration order; parameter types follow
+//   globals     {name, type} of each top-level variable
+//   statements  node indices of the top-level statements
+//   nodes       the AST in post-order, each node a run of words: its
+//               kind, its line, then its fields, children referenced
+//               by their distance back from the node
+//   text        identifier bytes
+//
+// Type ids are those of the builtins, which every TypeTable shares.
+// Nodes keep their line but not their column: nothing reports on a
+// module's code once it has been checked.
+//
+class Module {
+public:
+    static constexpr uint32_t FORMAT = 1;
+
+    // A function's signature, read in place.
+    struct Signature {
+        TypeId returnType;
+        const TypeId* params;       // inside the mapping
+        size_t paramCount;
+    };
+
+    // Maps `path`; throws runtime_error if it is missing or not a
+    // module of this format.
+    explicit Module(const string& path);
+
+    Module(const Module&) = delete;
+    Module& operator=(const Module&) = delete;
+
+    // The module for `program`, which must have checked without
+    // errors.
+    static string encode(const vector<StmtPtr>& program, const Interner& names);
+
+    // encode()s `program` to a temporary file renamed over `path`, so
+    // processes mapping the old module keep a whole file; throws
+    // runtime_error if it cannot.
+    static void write(const string& path, const vector<StmtPtr>& program,
+                      const Interner& names);
+
+    const string& path() const { return filePath; }
+    size_t bytes() const { return file.text().size(); }
+
+    // Declarations, by name. These throw runtime_error on a damaged
+    // record.
+    optional<Signature> function(string_view name) const;
+    optional<TypeId> global(string_view name) const;
+
+    size_t functionCount() const;
+    size_t globalCount() const;
+    string_view functionName(size_t i) const;
+    string_view globalName(size_t i) const;
+
+    // Builds the module's top-level statements in `arena`, naming them
+    // through `names`, for the passes that need whole trees (the
+    // optimizer and the backends).
+    vector<StmtPtr> materialize(AstArena& arena, Interner& names) const;
+
+private:
+    struct Header;
+    struct NameRecord;
+    struct FunctionRecord;
+    struct GlobalRecord;
+    class Encoder;
+    class Decoder;
+
+    string filePath;
+    MappedFile file;
+
+    // Sections, inside the mapping.
+    const NameRecord* nameRecords = nullptr;
+    const uint32_t* slots = nullptr;
+    const FunctionRecord* functionRecords = nullptr;
+    const TypeId* params = nullptr;
+    const GlobalRecord* globalRecords = nullptr;
+    const uint32_t* statements = nullptr;
+    const uint32_t* nodes = nullptr;
+    const char* nameText = nullptr;
+    uint32_t nameCount = 0, slotCount = 0, functionTotal = 0, paramTotal = 0,
+             globalTotal = 0, statementCount = 0, nodeWords = 0, textSize = 0;
+
+    [[noreturn]] void corrupt() const;
+    template <typename T>
+    const T* section(uint32_t offset, uint32_t count) const;
+    const NameRecord* find(string_view name) const;
+    string_view text(const NameRecord& name) const;
+    const FunctionRecord& functionAt(size_t i) const;
+    const GlobalRecord& globalAt(size_t i) const;
+};
+
+//
+// The declarations of precompiled modules, for checking a file that
+// follows them (SemanticAnalyzer::analyze(program, env)). A name two
+// modules declare resolves to the first. Lookups read the modules in
+// place; a function's FunctionInfo is built on its first use.
+//
+class ModuleEnvironment final : public Environment {
+public:
+    ModuleEnvironment(const vector<shared_ptr<const Module>>& modules,
+                      const Interner& names);
+
+    const FunctionInfo* function(Symbol name) const override;
+    optional<TypeId> global(Symbol name) const override;
+
+private:
+    const vector<shared_ptr<const Module>>& modules;
+    const Interner& names;
+    mutable unordered_map<Symbol, optional<FunctionInfo>> functions;
+};
+
+#endif
@@ -0,0 +1,301 @@
+#include "optimizer.h"
+
+using namespace std;
+
+Optimizer::Optimizer(AstArena& arena)
+    : arena(arena) {}
+
+void Optimizer::optimize(vector<StmtPtr>& program) {
+    removed = 0;
+    for (auto stmt : program)
+        optimizeStmt(stmt);
+}
+
+
+// ---------------- statements ----------------
+void Optimizer::optimizeStmt(Stmt* stmt) {
+    switch (stmt->kind) {
+    case StmtKind::VAR_DECL:
+        return;
+
+    case StmtKind::EXPR: {
+        auto e = static_cast<ExprStmt*>(stmt);
+        e->expr = fold(e->expr);
+        return;
+    }
+
+    case StmtKind::RETURN: {
+        auto r = static_cast<ReturnStmt*>(stmt);
+        if (r->expr) r->expr = fold(r->expr);
+        return;
+    }
+
+    case StmtKind::BLOCK:
+        for (auto s : static_cast<BlockStmt*>(stmt)->statements)
+            optimizeStmt(s);
+        return;
+
+    case StmtKind::FUNCTION:
+        optimizeStmt(static_cast<FunctionDecl*>(stmt)->body);
+        return;
+    }
+}
+
+
+// ---------------- expressions ----------------
+static bool isConstant(const Expr* e, Value& out) {
+    if (auto n = nodeAs<const NumberExpr>(e)) {
+        out = n->value;
+        return true;
+    }
+    return false;
+}
+
+static bool isBoolConstant(const Expr* e, bool& out) {
+    if (auto b = nodeAs<const BoolExpr>(e)) {
+        out = b->value;
+        return true;
+    }
+    return false;
+}
+
+ExprPtr Optimizer::fold(ExprPtr expr) {
+    switch (expr->kind) {
+    case ExprKind::ASSIGN: {
+        auto a = static_cast<AssignExpr*>(expr);
+        a->value = fold(a->value);
+        return a;
+    }
+
+    case ExprKind::BINARY:
+        return foldBinary(static_cast<BinaryExpr*>(expr));
+
+    case ExprKind::UNARY:
+        return foldUnary(static_cast<UnaryExpr*>(expr));
+
+    case ExprKind::CALL:
+        for (auto& arg : static_cast<CallExpr*>(expr)->args)
+            arg = fold(arg);
+        return expr;
+
+    default:
+        return expr;
+    }
+}
+
+ExprPtr Optimizer::foldBinary(BinaryExpr* b) {
+    b->left = fold(b->left);
+    b->right = fold(b->right);
+
+    if (b->op == TokenType::AND || b->op == TokenType::OR)
+        return foldLogical(b);
+
+    Value l = 0, r = 0;
+    bool lc = isConstant(b->left, l);
+    bool rc = isConstant(b->right, r);
+
+    bool lb = false, rb = false;
+    if (isBoolConstant(b->left, lb) && isBoolConstant(b->right, rb)) {
+        lc = rc = true;
+        l = lb;
+        r = rb;
+    }
+
+    if (lc && rc) {
+        Value v;
+        switch (b->op) {
+        case TokenType::PLUS:  v = valueAdd(l, r); break;
+        case TokenType::MINUS: v = valueSub(l, r); break;
+        case TokenType::STAR:  v = valueMul(l, r); break;
+        case TokenType::SLASH:
+            if (r == 0) return b;       // must still fail at run time
+            v = valueDiv(l, r);
+            break;
+        case TokenType::EQ:  removed += 2; return arena.make<BoolExpr>(l == r);
+        case TokenType::NEQ: removed += 2; return arena.make<BoolExpr>(l != r);
+        case TokenType::LT:  removed += 2; return arena.make<BoolExpr>(l < r);
+        case TokenType::GT:  removed += 2; return arena.make<BoolExpr>(l > r);
+        case TokenType::LE:  removed += 2; return arena.make<BoolExpr>(l <= r);
+        case TokenType::GE:  removed += 2; return arena.make<BoolExpr>(l >= r);
+        default:
+            return b;
+        }
+        removed += 2;
+        return arena.make<NumberExpr>(v);
+    }
+
+    // Identities; `keep` is what survives, the rest is dropped.
+    auto keep = [&](ExprPtr e) {
+        removed += 2;
+        return e;
+    };
+
+    switch (b->op) {
+    case TokenType::PLUS:
+        if (rc && r == 0) return keep(b->left);
+        if (lc && l == 0) return keep(b->right);
+        break;
+
+    case TokenType::MINUS:
+        if (rc && r == 0) return keep(b->left);
+        if (lc && l == 0) {
+            removed += 1;
+            return negate(b->right, nullptr);
+        }
+        break;
+
+    case TokenType::STAR:
+        if (rc && r == 1) return keep(b->left);
+        if (lc && l == 1) return keep(b->right);
+        if (rc && r == 0 && isPure(b->left)) {
+            removed += countNodes(b->left) + 1;
+            return b->right;
+        }
+        if (lc && l == 0 && isPure(b->right)) {
+            removed += countNodes(b->right) + 1;
+            return b->left;
+        }
+        if (rc && r == -1) {
+            removed += 1;
+            return negate(b->left, nullptr);
+        }
+        if (lc && l == -1) {
+            removed += 1;
+            return negate(b->right, nullptr);
+        }
+        break;
+
+    case TokenType::SLASH:
+        if (rc && r == 1) return keep(b->left);
+        if (rc && r == -1) {
+            removed += 1;
+            return negate(b->left, nullptr);
+        }
+        break;
+
+    default:
+        break;
+    }
+    return b;
+}
+
+// && and ||, whose operands are already folded. A constant left
+// operand decides whether the right one runs at all, so dropping it
+// is safe even if it has effects; a constant right operand may only
+// go when the left one is kept.
+ExprPtr Optimizer::foldLogical(BinaryExpr* b) {
+    bool isAnd = b->op == TokenType::AND;
+    bool v;
+
+    if (isBoolConstant(b->left, v)) {
+        if (v == isAnd) {               // true && x, false || x
+            removed += 2;
+            return b->right;
+        }
+        removed += countNodes(b->right) + 1;
+        return b->left;                 // false && x, true || x
+    }
+
+    if (isBoolConstant(b->right, v)) {
+        if (v == isAnd) {               // x && true, x || false
+            removed += 2;
+            return b->left;
+        }
+        if (isPure(b->left)) {          // x && false, x || true
+            removed += countNodes(b->left) + 1;
+            return b->right;
+        }
+    }
+    return b;
+}
+
+ExprPtr Optimizer::foldUnary(UnaryExpr* u) {
+    u->expr = fold(u->expr);
+
+    if (u->op == TokenType::NOT) {
+        bool v;
+        if (isBoolConstant(u->expr, v)) {
+            removed += 1;
+            return arena.make<BoolExpr>(!v);
+        }
+        auto inner = nodeAs<UnaryExpr>(u->expr);
+        if (inner && inner->op == TokenType::NOT) {
+            removed += 2;
+            return inner->expr;
+        }
+        return u;
+    }
+
+    if (u->op != TokenType::MINUS) return u;
+    return negate(u->expr, u);
+}
+
+// -operand, for an already folded operand. Reuses `node` (if given)
+// when nothing simplifies; otherwise counts the nodes saved relative
+// to a plain negation.
+ExprPtr Optimizer::negate(ExprPtr operand, UnaryExpr* node) {
+    Value v;
+    if (isConstant(operand, v)) {
+        removed += 1;
+        return arena.make<NumberExpr>(valueNeg(v));
+    }
+
+    auto inner = nodeAs<UnaryExpr>(operand);
+    if (inner && inner->op == TokenType::MINUS) {
+        removed += 2;
+        return inner->expr;
+    }
+
+    return node ? node : arena.make<UnaryExpr>(TokenType::MINUS, operand);
+}
+
+bool Optimizer::isPure(const Expr* expr) {
+    switch (expr->kind) {
+    case ExprKind::NUMBER:
+    case ExprKind::BOOL:
+    case ExprKind::VAR:
+        return true;
+
+    case ExprKind::UNARY:
+        return isPure(static_cast<const UnaryExpr*>(expr)->expr);
+
+    case ExprKind::BINARY: {
+        auto b = static_cast<const BinaryExpr*>(expr);
+        if (b->op == TokenType::SLASH) {
+            // Folding already ran, so a constant divisor is nonzero
+            // only if it is still a literal.
+            Value r;
+            if (!isConstant(b->right, r) || r == 0) return false;
+        }
+        return isPure(b->left) && isPure(b->right);
+    }
+
+    default:
+        return false;
+    }
+}
+
+size_t Optimizer::countNodes(const Expr* expr) {
+    switch (expr->kind) {
+    case ExprKind::ASSIGN:
+        return 1 + countNodes(static_cast<const AssignExpr*>(expr)->value);
+
+    case ExprKind::BINARY: {
+        auto b = static_cast<const BinaryExpr*>(expr);
+        return 1 + countNodes(b->left) + countNodes(b->right);
+    }
+
+    case ExprKind::UNARY:
+        return 1 + countNodes(static_cast<const UnaryExpr*>(expr)->expr);
+
+    case ExprKind::CALL: {
+        size_t n = 1;
+        for (auto arg : static_cast<const CallExpr*>(expr)->args)
+            n += countNodes(arg);
+        return n;
+    }
+
+    default:
+        return 1;
+    }
+}
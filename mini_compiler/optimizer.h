@@ -0,0 +1,56 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include <cstddef>
+#include <vector>
+#include "ast.h"
+
+using namespace std;
+
+//
+// AST-level constant folding and algebraic simplification. Runs on a
+// semantically checked program and rewrites it in place, so every
+// later backend sees the smaller tree.
+//
+//   2 * 3 + 4      -> 10          -(5)          -> -5
+//   x + 0, 0 + x   -> x           x - 0         -> x
+//   x * 1, 1 * x   -> x           x / 1         -> x
+//   x * -1, x / -1 -> -x          0 - x         -> -x
+//   - -x           -> x           x * 0, 0 * x  -> 0   (x pure only)
+//   1 < 2          -> true        !true         -> false
+//   ! !p           -> p           true && p     -> p
+//   false && p     -> false       p || false    -> p
+//   p && false     -> false       (p pure only; likewise p || true)
+//
+// Nothing that can fail or has an effect is dropped: `x / 0` stays a
+// runtime division by zero, and `f() * 0` still calls f.
+//
+// Replacement nodes come from the same arena as the tree; the nodes
+// they replace are simply no longer referenced.
+//
+class Optimizer {
+public:
+    explicit Optimizer(AstArena& arena);
+
+    void optimize(vector<StmtPtr>& program);
+
+    // Expression nodes dropped from the tree by the last optimize().
+    size_t removedNodes() const { return removed; }
+
+private:
+    AstArena& arena;
+    size_t removed = 0;
+
+    void optimizeStmt(Stmt* stmt);
+    ExprPtr fold(ExprPtr expr);
+    ExprPtr foldBinary(BinaryExpr* b);
+    ExprPtr foldUnary(UnaryExpr* u);
+    ExprPtr foldLogical(BinaryExpr* b);
+    ExprPtr negate(ExprPtr operand, UnaryExpr* node);
+
+    // No assignment, call or possibly-failing division anywhere below.
+    static bool isPure(const Expr* expr);
+    static size_t countNodes(const Expr* expr);
+};
+
+#endif
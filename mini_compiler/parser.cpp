@@ -1,42 +1,105 @@
 #include "parser.h"
-#include <stdexcept>
+#include <array>
+#include <charconv>
 
 using namespace std;
 
 // ---------------- constructor ----------------
-Parser::Parser(const vector<Token>& tokens)
-    : tokens(tokens), pos(0) {}
+Parser::Parser(const TokenBuffer& tokens, AstArena& arena,
+               Diagnostics& diags)
+    : stream(tokens), arena(arena), diags(diags) {}
+
+Parser::Parser(Lexer& lexer, AstArena& arena, Diagnostics& diags)
+    : stream(lexer), arena(arena), diags(diags) {}
 
 
 // ---------------- utilities ----------------
 bool Parser::isAtEnd() const {
-    return peek().type == TokenType::END_OF_FILE;
+    return peekType() == TokenType::END_OF_FILE;
+}
+
+Token Parser::peek() const {
+    return stream.peek();
 }
 
-const Token& Parser::peek() const {
-    return tokens[pos];
+Token Parser::previous() const {
+    return stream.previous();
 }
 
-const Token& Parser::advance() {
-    if (!isAtEnd()) pos++;
-    return tokens[pos - 1];
+Token Parser::advance() {
+    stream.advance();
+    return stream.previous();
 }
 
 bool Parser::match(TokenType type) {
-    if (peek().type == type) {
-        advance();
+    if (peekType() == type) {
+        stream.advance();
         return true;
     }
     return false;
 }
 
-const Token& Parser::expect(TokenType type, const string& msg) {
-    if (peek().type == type)
-        return advance();
+bool Parser::expect(TokenType type, const char* msg) {
+    if (peekType() == type) {
+        stream.advance();
+        return true;
+    }
+
+    error(peek(), msg);
+    return false;
+}
 
-    throw runtime_error(
-        "Parser error at line " +
-        to_string(peek().line) + ": " + msg);
+// Literals that do not fit are reported and read as 0; parsing goes
+// on normally.
+Value Parser::number(const Token& literal) {
+    string_view text = literal.lexeme;
+    Value v = 0;
+    auto res = from_chars(text.data(), text.data() + text.size(), v);
+    if (res.ec != errc() || res.ptr != text.data() + text.size()) {
+        diags.error(literal.location(),
+                    "Integer literal out of range: " + string(text));
+        return 0;
+    }
+    return v;
+}
+
+
+// ---------------- error recovery ----------------
+void Parser::error(const Token& at, const string& msg) {
+    // Anything before the next synchronization point is most likely
+    // a consequence of this error.
+    if (panicking) return;
+    panicking = true;
+
+    if (at.type == TokenType::UNKNOWN)
+        diags.error(at.location(),
+                    "Unexpected character '" + string(at.lexeme) + "'");
+    else
+        diags.error(at.location(), msg);
+}
+
+// Skips past the next ';', or up to (not over) the next '}', so the
+// enclosing block can close normally. A block opened while skipping
+// (as in `if (x) { ... }`) is skipped whole, ending recovery: its
+// ';' and '}' belong to it, not to the statement in error.
+void Parser::synchronize() {
+    size_t depth = 0;
+    while (!isAtEnd()) {
+        TokenType t = peekType();
+        if (t == TokenType::LBRACE) {
+            ++depth;
+        } else if (t == TokenType::RBRACE) {
+            if (depth == 0) break;
+            stream.advance();
+            if (--depth == 0) break;
+            continue;
+        } else if (t == TokenType::SEMI && depth == 0) {
+            stream.advance();
+            break;
+        }
+        stream.advance();
+    }
+    panicking = false;
 }
 
 
@@ -44,11 +107,25 @@ const Token& Parser::expect(TokenType type, const string& msg) {
 vector<StmtPtr> Parser::parse() {
     vector<StmtPtr> program;
 
+    while (StmtPtr s = next())
+        program.push_back(s);
+
+    return program;
+}
+
+StmtPtr Parser::next() {
     while (!isAtEnd()) {
-        program.push_back(declaration());
+        if (peekType() == TokenType::RBRACE) {
+            error(advance(), "Unexpected '}'");
+            panicking = false;
+            continue;
+        }
+
+        if (StmtPtr s = declaration())
+            return s;
     }
 
-    return program;
+    return nullptr;
 }
 
 
@@ -59,21 +136,28 @@ StmtPtr Parser::declaration() {
         match(TokenType::BOOL) ||
         match(TokenType::VOID)) {
 
-        Token typeToken = tokens[pos - 1];
-        Token name = expect(TokenType::IDENT,
-            "Expected identifier after type");
+        Token typeToken = previous();
+        if (!expect(TokenType::IDENT, "Expected identifier after type")) {
+            synchronize();
+            return nullptr;
+        }
+        Token name = previous();
 
         // function declaration
-        if (peek().type == TokenType::LPAREN) {
+        if (peekType() == TokenType::LPAREN) {
             return functionDecl(typeToken, name);
         }
 
-        // variable declaration
-        expect(TokenType::SEMI,
-            "Expected ';' after variable declaration");
+        // variable declaration; kept even without its ';' so later
+        // uses of the name do not cascade
+        StmtPtr decl = node<VarDecl>(name,
+            builtinType(typeToken.type), name.sym);
 
-        return make_shared<VarDecl>(
-            typeToken.lexeme, name.lexeme);
+        if (!expect(TokenType::SEMI,
+                "Expected ';' after variable declaration"))
+            synchronize();
+
+        return decl;
     }
 
     return statement();
@@ -83,32 +167,49 @@ StmtPtr Parser::declaration() {
 // ---------------- function declaration ----------------
 StmtPtr Parser::functionDecl(Token returnType, Token name) {
 
-    auto func = make_shared<FunctionDecl>();
-    func->returnType = returnType.lexeme;
-    func->name = name.lexeme;
+    auto func = node<FunctionDecl>(name);
+    func->returnType = builtinType(returnType.type);
+    func->name = name.sym;
 
     expect(TokenType::LPAREN, "Expected '(' after function name");
 
     if (!match(TokenType::RPAREN)) {
         do {
-            Token t = expect(TokenType::INT,
-                "Only int parameters supported");
-
-            Token n = expect(TokenType::IDENT,
-                "Expected parameter name");
+            if (!expect(TokenType::INT, "Only int parameters supported") ||
+                !expect(TokenType::IDENT, "Expected parameter name"))
+                break;
 
-            func->params.push_back({ t.lexeme, n.lexeme });
+            Token n = previous();
+            paramStack.push_back({ TypeTable::INT, n.sym });
 
         } while (match(TokenType::COMMA));
 
-        expect(TokenType::RPAREN, "Expected ')'");
+        if (!panicking)
+            expect(TokenType::RPAREN, "Expected ')'");
+
+        // A bad parameter list: skip to the body and check that.
+        if (panicking) {
+            while (!isAtEnd() &&
+                   peekType() != TokenType::LBRACE &&
+                   peekType() != TokenType::SEMI &&
+                   peekType() != TokenType::RBRACE) {
+                if (match(TokenType::RPAREN)) break;
+                stream.advance();
+            }
+            panicking = false;
+        }
     }
+    func->params = arena.list(paramStack);
 
-    expect(TokenType::LBRACE,
-        "Expected '{' before function body");
+    if (!expect(TokenType::LBRACE,
+            "Expected '{' before function body")) {
+        synchronize();
+        func->body = node<BlockStmt>(previous());
+        return func;
+    }
 
     func->body =
-        dynamic_pointer_cast<BlockStmt>(block());
+        static_cast<BlockStmt*>(block());
 
     return func;
 }
@@ -123,130 +224,214 @@ StmtPtr Parser::statement() {
     if (match(TokenType::LBRACE))
         return block();
 
+    SourceLoc start = stream.peekLocation();
     ExprPtr expr = expression();
-    expect(TokenType::SEMI, "Expected ';' after expression");
 
-    return make_shared<ExprStmt>(expr);
+    if (panicking || !expect(TokenType::SEMI, "Expected ';' after expression"))
+        synchronize();
+
+    return node<ExprStmt>(start, expr);
 }
 
 StmtPtr Parser::returnStmt() {
+    SourceLoc keyword = previousLocation();
     ExprPtr value = nullptr;
 
     if (!match(TokenType::SEMI)) {
         value = expression();
-        expect(TokenType::SEMI,
-            "Expected ';' after return value");
+
+        if (panicking || !expect(TokenType::SEMI,
+                "Expected ';' after return value"))
+            synchronize();
     }
 
-    return make_shared<ReturnStmt>(value);
+    return node<ReturnStmt>(keyword, value);
 }
 
 StmtPtr Parser::block() {
-    auto blk = make_shared<BlockStmt>();
+    auto blk = node<BlockStmt>(previousLocation());
+    size_t first = stmtStack.size();
+
+    while (!match(TokenType::RBRACE)) {
+        if (isAtEnd()) {
+            error(peek(), "Expected '}' at end of block");
+            break;
+        }
 
-    while (!isAtEnd() && !match(TokenType::RBRACE)) {
-        blk->statements.push_back(declaration());
+        if (StmtPtr s = declaration())
+            stmtStack.push_back(s);
     }
 
+    blk->statements = arena.list(stmtStack, first);
     return blk;
 }
 
 
 // ---------------- expressions ----------------
-ExprPtr Parser::expression() {
-    return assignment();
+//
+// Operators and open brackets wait on opStack until the operand to
+// their right is complete, which the next operator of no higher
+// precedence (or the end of the operand list) shows. From loosest to
+// tightest:
+//
+//   =                right-associative; the target must be a variable
+//   ||
+//   &&
+//   == !=
+//   < > <= >=
+//   + -
+//   * /
+//   - !              prefix
+//
+// The binary operators are left-associative. Each one costs a table
+// lookup, however many levels there are. A '(' (grouping, or a call's
+// argument list) starts a new operand list, ended by ')' or, between
+// arguments, ','.
+//
+static constexpr auto BINARY_PRECEDENCE = [] {
+    array<uint8_t, static_cast<size_t>(TokenType::UNKNOWN) + 1> table{};
+    auto set = [&](TokenType op, uint8_t prec) {
+        table[static_cast<size_t>(op)] = prec;
+    };
+    set(TokenType::OR, 1);
+    set(TokenType::AND, 2);
+    set(TokenType::EQ, 3);    set(TokenType::NEQ, 3);
+    set(TokenType::LT, 4);    set(TokenType::GT, 4);
+    set(TokenType::LE, 4);    set(TokenType::GE, 4);
+    set(TokenType::PLUS, 5);  set(TokenType::MINUS, 5);
+    set(TokenType::STAR, 6);  set(TokenType::SLASH, 6);
+    return table;
+}();
+
+// 0 if `op` is not a binary operator.
+static int precedence(TokenType op) {
+    return BINARY_PRECEDENCE[static_cast<size_t>(op)];
 }
 
-ExprPtr Parser::assignment() {
-    ExprPtr expr = term();
-
-    if (match(TokenType::ASSIGN)) {
-        ExprPtr value = assignment();
+ExprPtr Parser::expression() {
+    size_t base = opStack.size();
+    ExprPtr expr = nullptr;
 
-        if (auto var = dynamic_pointer_cast<VarExpr>(expr)) {
-            return make_shared<AssignExpr>(var->name, value);
+    for (;;) {
+        if (!expr) {
+            expr = operand();
+            continue;
         }
 
-        throw runtime_error("Invalid assignment target");
-    }
-
-    return expr;
-}
-
+        TokenType op = peekType();
+        if (int prec = precedence(op)) {
+            expr = reduce(base, prec, expr);
+            stream.advance();
+            opStack.push_back({ PendingOp::BINARY, op, previousLocation(), expr });
+            expr = nullptr;
+            continue;
+        }
+        if (op == TokenType::ASSIGN) {
+            expr = reduce(base, 1, expr);
+            stream.advance();
+            opStack.push_back({ PendingOp::ASSIGN, op, previousLocation(), expr });
+            expr = nullptr;
+            continue;
+        }
 
-// ---------------- arithmetic ----------------
-ExprPtr Parser::term() {
-    ExprPtr expr = factor();
+        // End of an operand list: close the innermost bracket.
+        expr = reduce(base, 0, expr);
+        if (opStack.size() == base) return expr;
 
-    while (peek().type == TokenType::PLUS ||
-           peek().type == TokenType::MINUS) {
+        PendingOp open = opStack.back();
+        if (open.kind == PendingOp::GROUP) {
+            expect(TokenType::RPAREN, "Expected ')'");
+            opStack.pop_back();
+            continue;
+        }
 
-        string op = advance().lexeme;
-        ExprPtr right = factor();
-        expr = make_shared<BinaryExpr>(op, expr, right);
+        exprStack.push_back(expr);
+        if (match(TokenType::COMMA)) {
+            expr = nullptr;
+            continue;
+        }
+        expect(TokenType::RPAREN, "Expected ')'");
+        opStack.pop_back();
+        expr = node<CallExpr>(open.loc, open.callee, arena.list(exprStack, open.args));
     }
-
-    return expr;
 }
 
-ExprPtr Parser::factor() {
-    ExprPtr expr = unary();
-
-    while (peek().type == TokenType::STAR ||
-           peek().type == TokenType::SLASH) {
+// A literal, variable or argument-less call; for a prefix '-' or '!',
+// a '(' or a call's '(' with arguments to follow, pushes it and
+// returns null.
+ExprPtr Parser::operand() {
 
-        string op = advance().lexeme;
-        ExprPtr right = unary();
-        expr = make_shared<BinaryExpr>(op, expr, right);
+    TokenType prefix = peekType();
+    if (prefix == TokenType::MINUS || prefix == TokenType::NOT) {
+        stream.advance();
+        opStack.push_back({ PendingOp::UNARY, prefix, previousLocation() });
+        return nullptr;
     }
 
-    return expr;
-}
-
-ExprPtr Parser::unary() {
-    if (match(TokenType::MINUS)) {
-        return make_shared<UnaryExpr>("-", unary());
-    }
-
-    return primary();
-}
-
-
-// ---------------- primary & calls ----------------
-ExprPtr Parser::primary() {
-
     if (match(TokenType::TRUE))
-        return make_shared<BoolExpr>(true);
+        return node<BoolExpr>(previousLocation(), true);
 
     if (match(TokenType::FALSE))
-        return make_shared<BoolExpr>(false);
+        return node<BoolExpr>(previousLocation(), false);
 
-    if (peek().type == TokenType::NUMBER)
-        return make_shared<NumberExpr>(advance().lexeme);
+    if (match(TokenType::NUMBER)) {
+        Token literal = previous();
+        return node<NumberExpr>(literal, number(literal));
+    }
 
-    if (peek().type == TokenType::IDENT) {
-        Token name = advance();
+    if (match(TokenType::IDENT)) {
+        SourceLoc at = previousLocation();
+        Symbol name = previousSymbol();
 
         if (match(TokenType::LPAREN)) {
-            vector<ExprPtr> args;
-
-            if (!match(TokenType::RPAREN)) {
-                do {
-                    args.push_back(expression());
-                } while (match(TokenType::COMMA));
-
-                expect(TokenType::RPAREN, "Expected ')'");
-            }
+            if (match(TokenType::RPAREN))
+                return node<CallExpr>(at, name, ArenaList<ExprPtr>{});
 
-            return make_shared<CallExpr>(
-                name.lexeme, args);
+            opStack.push_back({ PendingOp::CALL, TokenType::LPAREN, at, nullptr,
+                                name, exprStack.size() });
+            return nullptr;
         }
 
-        return make_shared<VarExpr>(name.lexeme);
+        return node<VarExpr>(at, name);
     }
 
-    expect(TokenType::LPAREN, "Expected '('");
-    ExprPtr expr = expression();
-    expect(TokenType::RPAREN, "Expected ')'");
+    if (match(TokenType::LPAREN)) {
+        opStack.push_back({ PendingOp::GROUP, TokenType::LPAREN, previousLocation() });
+        return nullptr;
+    }
+
+    // Nothing consumed; the caller synchronizes.
+    error(peek(), "Expected expression");
+    return node<ErrorExpr>(peek());
+}
+
+// Applies the pending operators above `base` that bind at least as
+// tightly as a binary operator of precedence `prec` to `expr`, their
+// last operand; 0 applies every one up to the innermost open bracket.
+ExprPtr Parser::reduce(size_t base, int prec, ExprPtr expr) {
+    while (opStack.size() > base) {
+        const PendingOp& top = opStack.back();
+
+        if (top.kind == PendingOp::UNARY)
+            expr = node<UnaryExpr>(top.loc, top.op, expr);
+        else if (top.kind == PendingOp::BINARY && precedence(top.op) >= prec)
+            expr = node<BinaryExpr>(top.loc, top.op, top.left, expr);
+        else if (top.kind == PendingOp::ASSIGN && prec == 0)
+            expr = assignment(top, expr);
+        else
+            break;
+
+        opStack.pop_back();
+    }
     return expr;
 }
+
+ExprPtr Parser::assignment(const PendingOp& equals, ExprPtr value) {
+    if (auto var = nodeAs<VarExpr>(equals.left))
+        return node<AssignExpr>(var->loc, var->name, value);
+
+    // Not a syntax error: the statement itself is well formed.
+    if (equals.left->kind != ExprKind::ERROR)
+        diags.error(equals.loc, "Invalid assignment target");
+    return node<ErrorExpr>(equals.loc);
+}
@@ -1,27 +1,102 @@
-
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <utility>
 #include "lexer.h"
 #include "ast.h"
+#include "diagnostics.h"
 
 using namespace std;
 
+//
+// Recursive descent parser with panic-mode error recovery; expressions
+// are parsed by operator precedence on an explicit stack, so however
+// deeply they nest they never exhaust the native one. A syntax
+// error is reported to the Diagnostics sink and the parser skips to
+// the end of the statement (just past the next ';', or up to the
+// next '}'), so one run reports every independent error. Failed
+// expressions become ErrorExpr nodes; errors in between a mistake and
+// the next synchronization point are suppressed as follow-ons.
+//
 class Parser {
 public:
-    explicit Parser(const vector<Token>& tokens);
+    // Nodes are allocated in `arena`, which must outlive the result.
+    Parser(const TokenBuffer& tokens, AstArena& arena, Diagnostics& diags);
+
+    // Streaming form: tokens are pulled from `lexer` as needed, so
+    // only a few exist at a time.
+    Parser(Lexer& lexer, AstArena& arena, Diagnostics& diags);
 
     vector<StmtPtr> parse();
 
+    // Parses the next top-level declaration or statement; nullptr at
+    // the end of input. Lets the caller check and drop each one
+    // before reading the next.
+    StmtPtr next();
+
+    // Index of the next token to read. After a next() that was not
+    // called while recovering() and reported no error, the parser
+    // carries no other state, so parsing can resume there with a fresh
+    // Parser; incremental reparsing (incremental.h) splits the input
+    // only at such points.
+    size_t position() const { return stream.position(); }
+
+    // An error was reported and the parser has not synchronized yet;
+    // errors until it does are suppressed.
+    bool recovering() const { return panicking; }
+
 private:
-    const vector<Token>& tokens;
-    size_t pos = 0;
+    TokenStream stream;
+    AstArena& arena;
+    Diagnostics& diags;
+    bool panicking = false;     // an error was reported, not yet synchronized
+
+    // Scratch stacks for lists under construction; nested lists push
+    // above their parent's items and are moved into the arena on close.
+    vector<StmtPtr> stmtStack;
+    vector<ExprPtr> exprStack;
+    vector<FunctionDecl::Param> paramStack;
+
+    // An operator or open bracket of the expression being parsed,
+    // waiting for its right-hand operand.
+    struct PendingOp {
+        enum Kind : uint8_t { UNARY, BINARY, ASSIGN, GROUP, CALL };
+        Kind kind;
+        TokenType op = TokenType::UNKNOWN;
+        SourceLoc loc;
+        ExprPtr left = nullptr;     // BINARY, ASSIGN
+        Symbol callee = 0;          // CALL
+        size_t args = 0;            // CALL: its arguments' start on exprStack
+    };
+    vector<PendingOp> opStack;
 
     bool isAtEnd() const;
-    const Token& peek() const;
-    const Token& advance();
+    TokenType peekType() const { return stream.peekType(); }
+    Token peek() const;
+    Token previous() const;
+    Token advance();
+
+    // Location and symbol of previous() without building the Token.
+    SourceLoc previousLocation() const { return stream.previousLocation(); }
+    Symbol previousSymbol() const { return stream.previousSymbol(); }
     bool match(TokenType type);
-    const Token& expect(TokenType type, const string& msg);
+    bool expect(TokenType type, const char* msg);
+    Value number(const Token& literal);
+
+    void error(const Token& at, const string& msg);
+    void synchronize();
+
+    template <typename T, typename... Args>
+    T* node(SourceLoc at, Args&&... args) {
+        T* n = arena.make<T>(forward<Args>(args)...);
+        n->loc = at;
+        return n;
+    }
+
+    template <typename T, typename... Args>
+    T* node(const Token& at, Args&&... args) {
+        return node<T>(at.location(), forward<Args>(args)...);
+    }
 
     // declarations
     StmtPtr declaration();
@@ -35,15 +110,9 @@ private:
 
     // expressions
     ExprPtr expression();
-    ExprPtr assignment();
-    ExprPtr logicOr();
-    ExprPtr logicAnd();
-    ExprPtr equality();
-    ExprPtr comparison();
-    ExprPtr term();
-    ExprPtr factor();
-    ExprPtr unary();
-    ExprPtr primary();
+    ExprPtr operand();
+    ExprPtr reduce(size_t base, int precedence, ExprPtr operand);
+    ExprPtr assignment(const PendingOp& equals, ExprPtr value);
 };
 
 #endif
@@ -0,0 +1,223 @@
+#include "protocol.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include "wire.h"
+
+#if SOCKETS_SUPPORTED
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// ---------------- messages ----------------
+namespace {
+
+constexpr uint32_t REQUEST_MAGIC = 0x3152434d;     // "MCR1"
+constexpr uint32_t RESPONSE_MAGIC = 0x3153434d;    // "MCS1"
+
+}
+
+string encodeRequest(const ServerRequest& request) {
+    const Options& o = request.options;
+    ByteWriter out;
+    out.u32(REQUEST_MAGIC);
+    out.u8(static_cast<uint8_t>(request.kind));
+    out.u8(o.run | o.optimize << 1 | o.twoPhase << 2 | o.stream << 3);
+    out.u8(static_cast<uint8_t>(o.engine));
+    out.str(request.directory);
+    out.u32(static_cast<uint32_t>(request.paths.size()));
+    for (auto& p : request.paths)
+        out.str(p);
+    return out.out;
+}
+
+bool decodeRequest(string_view payload, ServerRequest& request) {
+    ByteReader in{ payload };
+    if (in.u32() != REQUEST_MAGIC) return false;
+
+    uint8_t kind = in.u8(), flags = in.u8(), engine = in.u8();
+    if (kind < 1 || kind > 3 || engine > static_cast<uint8_t>(Engine::JIT))
+        return false;
+    request.kind = static_cast<RequestKind>(kind);
+    request.options.run = flags & 1;
+    request.options.optimize = flags & 2;
+    request.options.twoPhase = flags & 4;
+    request.options.stream = flags & 8;
+    request.options.engine = static_cast<Engine>(engine);
+    request.directory = in.str();
+
+    uint32_t count = in.u32();
+    request.paths.clear();
+    for (uint32_t i = 0; i < count && !in.failed; ++i)
+        request.paths.push_back(in.str());
+    return in.done();
+}
+
+string encodeResponse(const ServerResponse& response) {
+    ByteWriter out;
+    out.u32(RESPONSE_MAGIC);
+    out.str(response.error);
+    out.str(response.status);
+    out.u32(static_cast<uint32_t>(response.results.size()));
+    for (auto& r : response.results) {
+        out.str(r.path);
+        out.u8(r.ok);
+        out.str(r.output);
+        out.str(r.diagnostics);
+    }
+    return out.out;
+}
+
+bool decodeResponse(string_view payload, ServerResponse& response) {
+    ByteReader in{ payload };
+    if (in.u32() != RESPONSE_MAGIC) return false;
+
+    response.error = in.str();
+    response.status = in.str();
+    uint32_t count = in.u32();
+    response.results.clear();
+    for (uint32_t i = 0; i < count && !in.failed; ++i) {
+        FileResult r;
+        r.path = in.str();
+        r.ok = in.u8() != 0;
+        r.output = in.str();
+        r.diagnostics = in.str();
+        response.results.push_back(move(r));
+    }
+    return in.done();
+}
+
+// ---------------- framing ----------------
+#if SOCKETS_SUPPORTED
+
+static bool writeAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        // MSG_NOSIGNAL: a peer that hung up is an error, not SIGPIPE.
+        ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+static bool readAll(int fd, char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = recv(fd, data, size, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool sendFrame(int fd, string_view payload) {
+    if (payload.size() > MAX_FRAME) return false;
+    uint32_t size = static_cast<uint32_t>(payload.size());
+    return writeAll(fd, reinterpret_cast<const char*>(&size), sizeof size) &&
+           writeAll(fd, payload.data(), payload.size());
+}
+
+bool receiveFrame(int fd, string& payload) {
+    uint32_t size;
+    if (!readAll(fd, reinterpret_cast<char*>(&size), sizeof size) ||
+        size > MAX_FRAME)
+        return false;
+    payload.resize(size);
+    return readAll(fd, payload.data(), size);
+}
+
+// ---------------- sockets ----------------
+static bool socketAddress(const string& path, sockaddr_un& addr) {
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof addr.sun_path) {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+int connectTo(const string& socketPath) {
+    sockaddr_un addr;
+    if (!socketAddress(socketPath, addr)) return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) < 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+int listenOn(const string& socketPath) {
+    sockaddr_un addr;
+    if (!socketAddress(socketPath, addr)) return -1;
+
+    // A socket file nobody accepts on is left over from a server that
+    // died; one that answers belongs to a live server.
+    int live = connectTo(socketPath);
+    if (live >= 0) {
+        close(live);
+        errno = EADDRINUSE;
+        return -1;
+    }
+    if (errno == ECONNREFUSED) unlink(socketPath.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) < 0 ||
+        listen(fd, SOMAXCONN) < 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+string defaultSocketPath() {
+    if (const char* env = getenv("MINI_COMPILER_SOCKET"))
+        return env;
+    return "/tmp/mini_compiler-" + to_string(getuid()) + ".sock";
+}
+
+#else
+
+bool sendFrame(int, string_view) { return false; }
+bool receiveFrame(int, string&) { return false; }
+int listenOn(const string&) { errno = ENOSYS; return -1; }
+int connectTo(const string&) { errno = ENOSYS; return -1; }
+string defaultSocketPath() { return "mini_compiler.sock"; }
+
+#endif
+
+bool exchange(int fd, const ServerRequest& request, ServerResponse& response) {
+    string payload;
+    return sendFrame(fd, encodeRequest(request)) &&
+           receiveFrame(fd, payload) && decodeResponse(payload, response);
+}
+
+bool callServer(const string& socketPath, const ServerRequest& request,
+                ServerResponse& response, string& error) {
+    int fd = connectTo(socketPath);
+    if (fd < 0) {
+        error = "cannot connect to " + socketPath + ": " + strerror(errno);
+        return false;
+    }
+    bool ok = exchange(fd, request, response);
+#if SOCKETS_SUPPORTED
+    close(fd);
+#endif
+    if (!ok) error = "no valid response from " + socketPath;
+    return ok;
+}
@@ -0,0 +1,69 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "driver.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SOCKETS_SUPPORTED 1
+#else
+#define SOCKETS_SUPPORTED 0
+#endif
+
+using namespace std;
+
+//
+// Messages between the compile server (server.h) and its clients over
+// a Unix domain socket. Every message is a frame: a 4-byte
+// little-endian payload length, then the payload (wire.h fields). A
+// connection carries requests and responses in turn until the client
+// closes it.
+//
+enum class RequestKind : uint8_t { COMPILE = 1, STATUS = 2, STOP = 3 };
+
+struct ServerRequest {
+    RequestKind kind = RequestKind::COMPILE;
+    Options options;            // run, optimize, engine, twoPhase, stream
+    string directory;           // the client's working directory
+    vector<string> paths;       // as given to the client; directories
+                                // are expanded
+};
+
+struct ServerResponse {
+    string error;               // why the request as a whole failed
+    vector<FileResult> results; // COMPILE, in the order of the files
+    string status;              // STATUS: the server's counters
+};
+
+string encodeRequest(const ServerRequest& request);
+bool decodeRequest(string_view payload, ServerRequest& request);
+string encodeResponse(const ServerResponse& response);
+bool decodeResponse(string_view payload, ServerResponse& response);
+
+// Frames larger than this are refused.
+constexpr size_t MAX_FRAME = 256u << 20;
+
+bool sendFrame(int fd, string_view payload);
+// False on a closed connection, a read error or an oversized frame.
+bool receiveFrame(int fd, string& payload);
+
+// Socket descriptors, or -1 with errno set. listenOn() replaces a
+// socket file that no server answers on any more.
+int listenOn(const string& socketPath);
+int connectTo(const string& socketPath);
+
+// $MINI_COMPILER_SOCKET, else /tmp/mini_compiler-<uid>.sock.
+string defaultSocketPath();
+
+// One request and its response on an open connection.
+bool exchange(int fd, const ServerRequest& request, ServerResponse& response);
+
+// Sends one request on a new connection and waits for the answer.
+// False if the server cannot be reached or hangs up; `error` says why.
+bool callServer(const string& socketPath, const ServerRequest& request,
+                ServerResponse& response, string& error);
+
+#endif
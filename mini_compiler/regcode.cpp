@@ -0,0 +1,563 @@
+#include "regcode.h"
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <stdexcept>
+#include "bytecode.h"
+
+using namespace std;
+
+int RegModule::findFunction(Symbol name) const {
+    for (size_t i = 1; i < functions.size(); ++i)
+        if (functions[i].name == name) return static_cast<int>(i);
+    return -1;
+}
+
+namespace {
+
+// Which operands of an instruction are registers.
+struct Operands {
+    bool defA, useA, useB, useC;
+};
+
+Operands operandsOf(RegOp op) {
+    switch (op) {
+    case RegOp::LOADK:
+    case RegOp::GETG:     return { true, false, false, false };
+    case RegOp::MOVE:
+    case RegOp::NEG:
+    case RegOp::NOT:
+    case RegOp::ADDK:
+    case RegOp::SUBK:
+    case RegOp::MULK:
+    case RegOp::DIVK:
+    case RegOp::CALL:     return { true, false, true, false };
+    case RegOp::SETG:     return { false, false, true, false };
+    case RegOp::ADD:
+    case RegOp::SUB:
+    case RegOp::MUL:
+    case RegOp::DIV:
+    case RegOp::EQ:
+    case RegOp::NE:
+    case RegOp::LT:
+    case RegOp::LE:       return { true, false, true, true };
+    case RegOp::RET:
+    case RegOp::JMPF:
+    case RegOp::JMPT:     return { false, true, false, false };
+    default:              return { false, false, false, false };
+    }
+}
+
+bool hasAssign(const Expr* e) {
+    switch (e->kind) {
+    case ExprKind::ASSIGN:
+        return true;
+    case ExprKind::BINARY: {
+        auto b = static_cast<const BinaryExpr*>(e);
+        return hasAssign(b->left) || hasAssign(b->right);
+    }
+    case ExprKind::UNARY:
+        return hasAssign(static_cast<const UnaryExpr*>(e)->expr);
+    case ExprKind::CALL:
+        for (auto a : static_cast<const CallExpr*>(e)->args)
+            if (hasAssign(a)) return true;
+        return false;
+    default:
+        return false;
+    }
+}
+
+} // namespace
+
+
+// ---------------- driver ----------------
+RegCompiler::RegCompiler(const Interner& names)
+    : names(names) {}
+
+string RegCompiler::nameOf(Symbol sym) const {
+    return string(names.name(sym));
+}
+
+RegModule RegCompiler::compile(const vector<StmtPtr>& program) {
+    module = RegModule();
+    functionIndex.clear();
+    globals.clear();
+    constantIndex.clear();
+    pending.clear();
+
+    module.functions.emplace_back();
+
+    for (auto& stmt : program) {
+        declareFunctions(stmt);
+
+        if (auto v = nodeAs<const VarDecl>(stmt)) {
+            if (module.globalCount == UINT16_MAX)
+                throw runtime_error("Too many global variables");
+            globals[v->name] = module.globalCount++;
+        }
+    }
+
+    // Top-level statements
+    RegFunction& init = module.functions[RegModule::INIT];
+    beginFunction(init);
+    topLevel = true;
+    for (auto& stmt : program)
+        compileStmt(stmt);
+    emit(RegOp::RET_VOID);
+    endFunction(init);
+    topLevel = false;
+
+    // Function bodies
+    for (const FunctionDecl* f : pending) {
+        RegFunction& fn = module.functions[functionIndex.at(f->name)];
+        beginFunction(fn);
+
+        for (uint32_t i = 0; i < f->params.size(); ++i) {
+            uint32_t r = newReg();
+            vregs[r].phys = static_cast<int32_t>(i);
+            vregs[r].local = true;
+            locals.emplace_back(f->params[i].name, r);
+        }
+
+        compileBlock(f->body);
+        emit(RegOp::RET_VOID);
+        endFunction(fn);
+    }
+
+    return move(module);
+}
+
+void RegCompiler::declareFunctions(const Stmt* stmt) {
+    if (auto f = nodeAs<const FunctionDecl>(stmt)) {
+        if (module.functions.size() > UINT16_MAX)
+            throw runtime_error("Too many functions");
+
+        RegFunction fn;
+        fn.name = f->name;
+        fn.arity = static_cast<uint16_t>(f->params.size());
+
+        functionIndex[f->name] =
+            static_cast<uint16_t>(module.functions.size());
+        module.functions.push_back(fn);
+        pending.push_back(f);
+
+        declareFunctions(f->body);
+    }
+    else if (auto b = nodeAs<const BlockStmt>(stmt)) {
+        for (auto s : b->statements)
+            declareFunctions(s);
+    }
+}
+
+void RegCompiler::beginFunction(RegFunction& fn) {
+    fn.entry = static_cast<uint32_t>(module.code.size());
+    body.clear();
+    vregs.clear();
+    locals.clear();
+    scopeStart.clear();
+    outWidth.clear();
+    outRegs.clear();
+    callLevel = 0;
+}
+
+void RegCompiler::endFunction(RegFunction& fn) {
+    allocate(fn);
+}
+
+
+// ---------------- register allocation ----------------
+void RegCompiler::allocate(RegFunction& fn) {
+    // Live intervals: first to last mention (branches only skip ahead).
+    for (size_t i = 0; i < body.size(); ++i) {
+        const VInstr& in = body[i];
+        Operands ops = operandsOf(in.op);
+        int32_t at = static_cast<int32_t>(i);
+
+        auto touch = [&](uint32_t r) {
+            vregs[r].start = min(vregs[r].start, at);
+            vregs[r].end = max(vregs[r].end, at);
+        };
+        if (ops.defA || ops.useA) touch(in.a);
+        if (ops.useB) touch(in.b);
+        if (ops.useC) touch(in.c);
+    }
+
+    // Linear scan. Parameters are pinned to R[0..arity) but release
+    // their register after their last use like everything else.
+    using Live = pair<int32_t, int32_t>;     // (end, phys)
+    priority_queue<Live, vector<Live>, greater<Live>> active;
+    priority_queue<int32_t, vector<int32_t>, greater<int32_t>> freeRegs;
+    vector<uint32_t> order;
+    int32_t next = fn.arity;
+
+    for (uint32_t r = 0; r < vregs.size(); ++r) {
+        const VReg& v = vregs[r];
+        if (v.outLevel >= 0) continue;
+        if (v.phys != NO_REG) {
+            if (v.end >= 0) active.push({ v.end, v.phys });
+            else freeRegs.push(v.phys);
+        }
+        else if (v.end >= 0) {
+            order.push_back(r);
+        }
+    }
+
+    stable_sort(order.begin(), order.end(), [&](uint32_t x, uint32_t y) {
+        return vregs[x].start < vregs[y].start;
+    });
+
+    for (uint32_t r : order) {
+        VReg& v = vregs[r];
+
+        // An operand read by the defining instruction may share its
+        // register: the VM reads all operands before writing R[a].
+        while (!active.empty() && active.top().first <= v.start) {
+            freeRegs.push(active.top().second);
+            active.pop();
+        }
+
+        if (freeRegs.empty()) {
+            v.phys = next++;
+        }
+        else {
+            v.phys = freeRegs.top();
+            freeRegs.pop();
+        }
+        active.push({ v.end, v.phys });
+    }
+
+    // Outgoing argument bands sit above the allocated registers.
+    vector<uint32_t> outBase(outWidth.size());
+    uint32_t top = static_cast<uint32_t>(next);
+    for (size_t level = 0; level < outWidth.size(); ++level) {
+        outBase[level] = top;
+        top += max<uint32_t>(outWidth[level], 1);
+    }
+
+    if (top > UINT16_MAX)
+        throw runtime_error(
+            "Too many registers in '" + nameOf(fn.name) + "'");
+    fn.frameSize = static_cast<uint16_t>(top);
+
+    auto phys = [&](uint32_t r) {
+        const VReg& v = vregs[r];
+        uint32_t p = v.outLevel >= 0 ? outBase[v.outLevel] + v.outIndex
+                                     : static_cast<uint32_t>(v.phys);
+        return static_cast<uint16_t>(p);
+    };
+
+    for (const VInstr& in : body) {
+        Operands ops = operandsOf(in.op);
+        RegInstr out;
+        out.op = in.op;
+        out.a = (ops.defA || ops.useA) ? phys(in.a) : static_cast<uint16_t>(in.a);
+        out.b = ops.useB ? phys(in.b) : static_cast<uint16_t>(in.b);
+        out.c = ops.useC ? phys(in.c) : static_cast<uint16_t>(in.c);
+        module.code.push_back(out);
+    }
+}
+
+
+// ---------------- helpers ----------------
+uint32_t RegCompiler::newReg() {
+    vregs.emplace_back();
+    return static_cast<uint32_t>(vregs.size() - 1);
+}
+
+uint32_t RegCompiler::outReg(uint32_t level, uint32_t index) {
+    auto& band = outRegs[level];
+    while (band.size() <= index) {
+        uint32_t r = newReg();
+        vregs[r].outLevel = static_cast<int32_t>(level);
+        vregs[r].outIndex = static_cast<uint32_t>(band.size());
+        band.push_back(r);
+    }
+    return band[index];
+}
+
+int32_t RegCompiler::resolveLocal(Symbol name) const {
+    for (auto it = locals.rbegin(); it != locals.rend(); ++it)
+        if (it->first == name) return static_cast<int32_t>(it->second);
+    return NO_REG;
+}
+
+// Locals start out as 0, like the stack VM's zeroed slots; the zero is
+// materialized only if the local is read before it is first written.
+uint32_t RegCompiler::readLocal(uint32_t vreg) {
+    if (!vregs[vreg].initialized) {
+        emit(RegOp::LOADK, vreg, constant(0));
+        vregs[vreg].initialized = true;
+    }
+    return vreg;
+}
+
+uint16_t RegCompiler::constant(Value v) {
+    auto found = constantIndex.find(v);
+    if (found != constantIndex.end()) return found->second;
+
+    if (module.constants.size() > UINT16_MAX)
+        throw runtime_error("Too many constants");
+
+    auto k = static_cast<uint16_t>(module.constants.size());
+    module.constants.push_back(v);
+    constantIndex.emplace(v, k);
+    return k;
+}
+
+void RegCompiler::emit(RegOp op, uint32_t a, uint32_t b, uint32_t c) {
+    body.push_back({ op, a, b, c });
+}
+
+bool RegCompiler::literal(const Expr* expr, Value& out) const {
+    if (auto n = nodeAs<const NumberExpr>(expr)) {
+        out = n->value;
+        return true;
+    }
+    if (auto b = nodeAs<const BoolExpr>(expr)) {
+        out = b->value ? 1 : 0;
+        return true;
+    }
+    return false;
+}
+
+
+// ---------------- statements ----------------
+void RegCompiler::compileStmt(const Stmt* stmt) {
+    switch (stmt->kind) {
+    case StmtKind::VAR_DECL: {
+        // Globals were assigned their slots up front.
+        if (topLevel && scopeStart.empty()) return;
+
+        auto v = static_cast<const VarDecl*>(stmt);
+        uint32_t r = newReg();
+        vregs[r].initialized = false;
+        vregs[r].local = true;
+        locals.emplace_back(v->name, r);
+        return;
+    }
+
+    case StmtKind::EXPR:
+        compileExpr(static_cast<const ExprStmt*>(stmt)->expr);
+        return;
+
+    case StmtKind::RETURN: {
+        auto r = static_cast<const ReturnStmt*>(stmt);
+        Value k;
+        if (!r->expr)
+            emit(RegOp::RET_VOID);
+        else if (literal(r->expr, k))
+            emit(RegOp::RETK, constant(k));
+        else
+            emit(RegOp::RET, compileExpr(r->expr));
+        return;
+    }
+
+    case StmtKind::BLOCK:
+        compileBlock(static_cast<const BlockStmt*>(stmt));
+        return;
+
+    case StmtKind::FUNCTION:
+        // Compiled separately (see compile()).
+        return;
+    }
+}
+
+void RegCompiler::compileBlock(const BlockStmt* b) {
+    scopeStart.push_back(locals.size());
+    for (auto s : b->statements)
+        compileStmt(s);
+    locals.resize(scopeStart.back());
+    scopeStart.pop_back();
+}
+
+
+// ---------------- expressions ----------------
+uint32_t RegCompiler::compileExpr(const Expr* expr, int64_t dest) {
+    auto target = [&]() {
+        return dest != NO_REG ? static_cast<uint32_t>(dest) : newReg();
+    };
+
+    switch (expr->kind) {
+    case ExprKind::NUMBER:
+    case ExprKind::BOOL: {
+        Value v = 0;
+        literal(expr, v);
+        uint32_t r = target();
+        emit(RegOp::LOADK, r, constant(v));
+        return r;
+    }
+
+    case ExprKind::VAR: {
+        auto v = static_cast<const VarExpr*>(expr);
+        int32_t local = resolveLocal(v->name);
+        if (local != NO_REG) {
+            uint32_t r = readLocal(static_cast<uint32_t>(local));
+            if (dest != NO_REG && dest != r) {
+                emit(RegOp::MOVE, static_cast<uint32_t>(dest), r);
+                return static_cast<uint32_t>(dest);
+            }
+            return r;
+        }
+
+        auto g = globals.find(v->name);
+        if (g == globals.end())
+            throw runtime_error(
+                "Cannot compile '" + nameOf(v->name) +
+                "': nested functions cannot use enclosing locals");
+
+        uint32_t r = target();
+        emit(RegOp::GETG, r, g->second);
+        return r;
+    }
+
+    case ExprKind::ASSIGN: {
+        auto a = static_cast<const AssignExpr*>(expr);
+        int32_t local = resolveLocal(a->name);
+        if (local != NO_REG) {
+            uint32_t r = static_cast<uint32_t>(local);
+            compileExpr(a->value, r);
+            vregs[r].initialized = true;
+            if (dest != NO_REG && dest != r) {
+                emit(RegOp::MOVE, static_cast<uint32_t>(dest), r);
+                return static_cast<uint32_t>(dest);
+            }
+            return r;
+        }
+
+        auto g = globals.find(a->name);
+        if (g == globals.end())
+            throw runtime_error(
+                "Cannot compile '" + nameOf(a->name) +
+                "': nested functions cannot use enclosing locals");
+
+        uint32_t r = compileExpr(a->value, dest);
+        emit(RegOp::SETG, g->second, r);
+        return r;
+    }
+
+    case ExprKind::BINARY: {
+        auto b = static_cast<const BinaryExpr*>(expr);
+        if (b->op == TokenType::AND || b->op == TokenType::OR)
+            return shortCircuit(b, dest);
+
+        RegOp op, opK = RegOp::COUNT;       // COUNT: no constant form
+        bool flip = false;                  // x > y is y < x
+        switch (b->op) {
+        case TokenType::PLUS:  op = RegOp::ADD; opK = RegOp::ADDK; break;
+        case TokenType::MINUS: op = RegOp::SUB; opK = RegOp::SUBK; break;
+        case TokenType::STAR:  op = RegOp::MUL; opK = RegOp::MULK; break;
+        case TokenType::SLASH: op = RegOp::DIV; opK = RegOp::DIVK; break;
+        case TokenType::EQ:    op = RegOp::EQ; break;
+        case TokenType::NEQ:   op = RegOp::NE; break;
+        case TokenType::LT:    op = RegOp::LT; break;
+        case TokenType::LE:    op = RegOp::LE; break;
+        case TokenType::GT:    op = RegOp::LT; flip = true; break;
+        case TokenType::GE:    op = RegOp::LE; flip = true; break;
+        default:
+            throw runtime_error(
+                string("Unsupported binary operator ") + tokenSpelling(b->op));
+        }
+
+        Value k;
+        if (opK != RegOp::COUNT && literal(b->right, k)) {
+            uint32_t left = compileExpr(b->left);
+            uint32_t r = target();
+            emit(opK, r, left, constant(k));
+            return r;
+        }
+        if ((op == RegOp::ADD || op == RegOp::MUL) && literal(b->left, k)) {
+            uint32_t right = compileExpr(b->right);
+            uint32_t r = target();
+            emit(opK, r, right, constant(k));
+            return r;
+        }
+
+        uint32_t left = compileExpr(b->left);
+
+        // Operands are evaluated left to right. A local used directly
+        // as the left operand must be copied if the right operand may
+        // assign to it.
+        if (vregs[left].local && hasAssign(b->right)) {
+            uint32_t copy = newReg();
+            emit(RegOp::MOVE, copy, left);
+            left = copy;
+        }
+
+        uint32_t right = compileExpr(b->right);
+        uint32_t r = target();
+        if (flip) swap(left, right);
+        emit(op, r, left, right);
+        return r;
+    }
+
+    case ExprKind::UNARY: {
+        auto u = static_cast<const UnaryExpr*>(expr);
+        RegOp op;
+        switch (u->op) {
+        case TokenType::MINUS: op = RegOp::NEG; break;
+        case TokenType::NOT:   op = RegOp::NOT; break;
+        default:
+            throw runtime_error(
+                string("Unsupported unary operator ") + tokenSpelling(u->op));
+        }
+
+        uint32_t v = compileExpr(u->expr);
+        uint32_t r = target();
+        emit(op, r, v);
+        return r;
+    }
+
+    case ExprKind::CALL: {
+        auto call = static_cast<const CallExpr*>(expr);
+        uint32_t level = callLevel++;
+        if (outWidth.size() <= level) {
+            outWidth.push_back(0);
+            outRegs.emplace_back();
+        }
+        outWidth[level] = max(outWidth[level],
+                              static_cast<uint32_t>(call->args.size()));
+
+        for (uint32_t i = 0; i < call->args.size(); ++i)
+            compileExpr(call->args[i], outReg(level, i));
+        callLevel--;
+
+        uint32_t base = outReg(level, 0);
+        uint32_t r = target();
+        emit(RegOp::CALL, r, base, functionIndex.at(call->callee));
+        return r;
+    }
+
+    case ExprKind::ERROR:
+        throw runtime_error("Cannot compile a program with errors");
+    }
+
+    throw runtime_error("Unknown expression kind");
+}
+
+// The left operand goes into a fresh register, which the right one
+// overwrites unless the jump skips it: `dest` itself may be a
+// variable the right operand reads.
+uint32_t RegCompiler::shortCircuit(const BinaryExpr* b, int64_t dest) {
+    // A local first written on the skipped path must still read as 0
+    // after it, so every local is given its zero before the branch.
+    for (auto& local : locals)
+        readLocal(local.second);
+
+    uint32_t r = newReg();
+    compileExpr(b->left, r);
+
+    size_t jump = body.size();
+    emit(b->op == TokenType::AND ? RegOp::JMPF : RegOp::JMPT, r);
+    compileExpr(b->right, r);
+
+    size_t distance = body.size() - (jump + 1);
+    if (distance > UINT16_MAX)
+        throw runtime_error("Expression too large to compile");
+    body[jump].b = static_cast<uint32_t>(distance);
+
+    if (dest != NO_REG) {
+        emit(RegOp::MOVE, static_cast<uint32_t>(dest), r);
+        return static_cast<uint32_t>(dest);
+    }
+    return r;
+}
@@ -0,0 +1,144 @@
+#ifndef REGCODE_H
+#define REGCODE_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ast.h"
+#include "value.h"
+
+using namespace std;
+
+//
+// Register-machine code (three-address, in the style of Lua 5).
+// Registers are slots of the current frame: R[0..arity) hold the
+// arguments, the rest are assigned by a linear-scan allocator.
+//
+enum class RegOp : uint8_t {
+    LOADK,      // a k      R[a] = K[k]
+    MOVE,       // a b      R[a] = R[b]
+    GETG,       // a g      R[a] = G[g]
+    SETG,       // g b      G[g] = R[b]
+    ADD, SUB, MUL, DIV,         // a b c   R[a] = R[b] op R[c]
+    ADDK, SUBK, MULK, DIVK,     // a b k   R[a] = R[b] op K[k]
+    NEG,        // a b      R[a] = -R[b]
+    EQ, NE, LT, LE,             // a b c   R[a] = R[b] op R[c] ? 1 : 0
+    NOT,        // a b      R[a] = !R[b]
+    JMPF,       // a d      if R[a] == 0, skip the next d instructions
+    JMPT,       // a d      if R[a] != 0, skip the next d instructions
+    CALL,       // a b f    R[a] = functions[f](R[b], R[b+1], ...)
+    RET,        // a        return R[a]
+    RETK,       // k        return K[k]
+    RET_VOID,   //          return 0
+    COUNT
+};
+
+struct RegInstr {
+    RegOp op;
+    uint16_t a = 0, b = 0, c = 0;
+};
+
+struct RegFunction {
+    Symbol name;
+    uint32_t entry = 0;         // index of the first instruction
+    uint16_t arity = 0;
+    uint16_t frameSize = 0;     // registers, including call arguments
+};
+
+struct RegModule {
+    // Index of the top-level initializer in `functions`.
+    static constexpr uint16_t INIT = 0;
+
+    vector<RegInstr> code;
+    vector<Value> constants;
+    vector<RegFunction> functions;
+    uint16_t globalCount = 0;
+
+    // Index into `functions`, or -1.
+    int findFunction(Symbol name) const;
+};
+
+//
+// Lowers a semantically checked program to a RegModule.
+//
+// Code is first generated over unlimited virtual registers: one per
+// local, one per temporary. Call arguments are evaluated straight
+// into "outgoing" registers above the allocated ones, one band per
+// call nesting level, so the callee's frame simply starts at its
+// first argument. A linear scan over the live intervals then maps
+// the remaining virtual registers onto as few frame slots as
+// possible. The only branches are the forward jumps of && and ||,
+// which skip code but never repeat it, so an interval is still just
+// first to last mention in instruction order.
+//
+// Top-level handling matches BytecodeCompiler: top-level variables
+// are globals and the rest of the top level runs in function 0.
+//
+class RegCompiler {
+public:
+    explicit RegCompiler(const Interner& names);
+
+    RegModule compile(const vector<StmtPtr>& program);
+
+private:
+    static constexpr int32_t NO_REG = -1;
+
+    // Virtual instruction: register operands are virtual registers.
+    struct VInstr {
+        RegOp op;
+        uint32_t a, b, c;
+    };
+
+    struct VReg {
+        int32_t start = INT32_MAX;
+        int32_t end = -1;
+        int32_t phys = NO_REG;      // fixed for parameters
+        int32_t outLevel = -1;      // >= 0 for outgoing argument slots
+        uint32_t outIndex = 0;
+        bool initialized = true;    // false for locals not yet written
+        bool local = false;         // names a parameter or variable
+    };
+
+    const Interner& names;
+    RegModule module;
+
+    unordered_map<Symbol, uint16_t> functionIndex;
+    unordered_map<Symbol, uint16_t> globals;
+    unordered_map<Value, uint16_t> constantIndex;   // into module.constants
+    vector<const FunctionDecl*> pending;
+
+    // Current function
+    vector<VInstr> body;
+    vector<VReg> vregs;
+    vector<pair<Symbol, uint32_t>> locals;  // innermost last
+    vector<size_t> scopeStart;
+    vector<uint32_t> outWidth;              // per call nesting level
+    vector<vector<uint32_t>> outRegs;       // [level][index] -> vreg
+    uint32_t callLevel = 0;
+    bool topLevel = false;
+
+    void declareFunctions(const Stmt* stmt);
+    void beginFunction(RegFunction& fn);
+    void endFunction(RegFunction& fn);
+    void allocate(RegFunction& fn);
+
+    uint32_t newReg();
+    uint32_t outReg(uint32_t level, uint32_t index);
+    int32_t resolveLocal(Symbol name) const;
+    uint32_t readLocal(uint32_t vreg);
+    uint16_t constant(Value v);
+    void emit(RegOp op, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0);
+    string nameOf(Symbol sym) const;
+
+    void compileStmt(const Stmt* stmt);
+    void compileBlock(const BlockStmt* b);
+
+    // Returns the virtual register holding the value; if `dest` is
+    // given the value is computed into it.
+    uint32_t compileExpr(const Expr* expr, int64_t dest = NO_REG);
+    uint32_t shortCircuit(const BinaryExpr* b, int64_t dest);
+    bool literal(const Expr* expr, Value& out) const;
+};
+
+#endif
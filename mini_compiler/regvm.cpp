@@ -0,0 +1,157 @@
+#include "regvm.h"
+#include <stdexcept>
+
+using namespace std;
+
+// Threaded dispatch (GCC/Clang "labels as values") when available,
+// a plain switch otherwise.
+#if defined(__GNUC__)
+#define VM_COMPUTED_GOTO 1
+#else
+#define VM_COMPUTED_GOTO 0
+#endif
+
+RegVM::RegVM(const RegModule& module, size_t registerSlots, size_t maxFrames)
+    : module(module), registers(registerSlots), maxFrames(maxFrames) {
+    frames.reserve(maxFrames);
+}
+
+Value RegVM::run(uint16_t entry) {
+    if (module.functions.at(entry).arity != 0)
+        throw runtime_error("Entry function must take no arguments");
+
+    globals.assign(module.globalCount, 0);
+    dispatches = 0;
+
+    execute(RegModule::INIT);
+    return execute(entry);
+}
+
+Value RegVM::execute(uint16_t function) {
+    const RegInstr* code = module.code.data();
+    const Value* K = module.constants.data();
+    const RegFunction* functions = module.functions.data();
+    Value* G = globals.data();
+    Value* regsEnd = registers.data() + registers.size();
+
+    const RegFunction& fn = functions[function];
+    if (fn.frameSize > registers.size())
+        throw RuntimeTrap("Stack overflow");
+
+    const RegInstr* ip = code + fn.entry;
+    const RegInstr* in;
+    Value* R = registers.data();
+    uint64_t count = 0;
+
+    frames.clear();
+    frames.push_back({ nullptr, R, 0 });
+
+#if VM_COMPUTED_GOTO
+    static void* const labels[] = {
+        &&L_LOADK, &&L_MOVE, &&L_GETG, &&L_SETG,
+        &&L_ADD, &&L_SUB, &&L_MUL, &&L_DIV,
+        &&L_ADDK, &&L_SUBK, &&L_MULK, &&L_DIVK,
+        &&L_NEG, &&L_EQ, &&L_NE, &&L_LT, &&L_LE, &&L_NOT,
+        &&L_JMPF, &&L_JMPT,
+        &&L_CALL, &&L_RET, &&L_RETK, &&L_RET_VOID
+    };
+    static_assert(sizeof(labels) / sizeof(labels[0]) ==
+                  static_cast<size_t>(RegOp::COUNT), "opcode table");
+
+#define VM_CASE(op)   L_##op:
+#define VM_NEXT()     do { ++count; in = ip++; goto *labels[static_cast<uint8_t>(in->op)]; } while (0)
+    VM_NEXT();
+#else
+#define VM_CASE(op)   case RegOp::op:
+#define VM_NEXT()     continue
+    for (;;) {
+    ++count;
+    in = ip++;
+    switch (in->op) {
+#endif
+
+    VM_CASE(LOADK) { R[in->a] = K[in->b]; VM_NEXT(); }
+    VM_CASE(MOVE)  { R[in->a] = R[in->b]; VM_NEXT(); }
+    VM_CASE(GETG)  { R[in->a] = G[in->b]; VM_NEXT(); }
+    VM_CASE(SETG)  { G[in->a] = R[in->b]; VM_NEXT(); }
+
+    VM_CASE(ADD)   { R[in->a] = valueAdd(R[in->b], R[in->c]); VM_NEXT(); }
+    VM_CASE(SUB)   { R[in->a] = valueSub(R[in->b], R[in->c]); VM_NEXT(); }
+    VM_CASE(MUL)   { R[in->a] = valueMul(R[in->b], R[in->c]); VM_NEXT(); }
+    VM_CASE(DIV) {
+        if (R[in->c] == 0) {
+            dispatches += count;
+            throw RuntimeTrap("Division by zero");
+        }
+        R[in->a] = valueDiv(R[in->b], R[in->c]);
+        VM_NEXT();
+    }
+
+    VM_CASE(ADDK)  { R[in->a] = valueAdd(R[in->b], K[in->c]); VM_NEXT(); }
+    VM_CASE(SUBK)  { R[in->a] = valueSub(R[in->b], K[in->c]); VM_NEXT(); }
+    VM_CASE(MULK)  { R[in->a] = valueMul(R[in->b], K[in->c]); VM_NEXT(); }
+    VM_CASE(DIVK) {
+        if (K[in->c] == 0) {
+            dispatches += count;
+            throw RuntimeTrap("Division by zero");
+        }
+        R[in->a] = valueDiv(R[in->b], K[in->c]);
+        VM_NEXT();
+    }
+
+    VM_CASE(NEG)   { R[in->a] = valueNeg(R[in->b]); VM_NEXT(); }
+
+    VM_CASE(EQ)    { R[in->a] = R[in->b] == R[in->c]; VM_NEXT(); }
+    VM_CASE(NE)    { R[in->a] = R[in->b] != R[in->c]; VM_NEXT(); }
+    VM_CASE(LT)    { R[in->a] = R[in->b] < R[in->c];  VM_NEXT(); }
+    VM_CASE(LE)    { R[in->a] = R[in->b] <= R[in->c]; VM_NEXT(); }
+    VM_CASE(NOT)   { R[in->a] = !R[in->b]; VM_NEXT(); }
+
+    VM_CASE(JMPF)  { if (R[in->a] == 0) ip += in->b; VM_NEXT(); }
+    VM_CASE(JMPT)  { if (R[in->a] != 0) ip += in->b; VM_NEXT(); }
+
+    VM_CASE(CALL) {
+        const RegFunction& callee = functions[in->c];
+        Value* base = R + in->b;
+
+        if (frames.size() == maxFrames || base + callee.frameSize > regsEnd) {
+            dispatches += count;
+            throw RuntimeTrap("Stack overflow");
+        }
+
+        frames.push_back({ ip, R, in->a });
+        R = base;
+        ip = code + callee.entry;
+        VM_NEXT();
+    }
+
+#define VM_RETURN(value)                            \
+    {                                               \
+        Value result = (value);                     \
+        Frame frame = frames.back();                \
+        frames.pop_back();                          \
+        if (!frame.returnIp) {                      \
+            dispatches += count;                    \
+            return result;                          \
+        }                                           \
+        R = frame.regs;                             \
+        R[frame.resultReg] = result;                \
+        ip = frame.returnIp;                        \
+        VM_NEXT();                                  \
+    }
+
+    VM_CASE(RET)      VM_RETURN(R[in->a])
+    VM_CASE(RETK)     VM_RETURN(K[in->a])
+    VM_CASE(RET_VOID) VM_RETURN(0)
+
+#if !VM_COMPUTED_GOTO
+    default:
+        throw runtime_error("Invalid opcode");
+    }
+    }
+#endif
+
+#undef VM_RETURN
+#undef VM_CASE
+#undef VM_NEXT
+}
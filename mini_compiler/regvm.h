@@ -0,0 +1,45 @@
+#ifndef REGVM_H
+#define REGVM_H
+
+#include <cstdint>
+#include <vector>
+#include "regcode.h"
+
+using namespace std;
+
+//
+// Interpreter for RegModule. Frames are windows onto one shared
+// register file; a callee's window starts at the caller's outgoing
+// argument registers.
+//
+class RegVM {
+public:
+    explicit RegVM(const RegModule& module,
+                   size_t registerSlots = 1 << 20,
+                   size_t maxFrames = 1 << 16);
+
+    // Runs the initializer, then function `entry` (which must take no
+    // arguments) and returns its result.
+    Value run(uint16_t entry);
+
+    // Instructions executed by the last run().
+    uint64_t dispatchCount() const { return dispatches; }
+
+private:
+    struct Frame {
+        const RegInstr* returnIp;   // null for the outermost frame
+        Value* regs;
+        uint16_t resultReg;
+    };
+
+    const RegModule& module;
+    vector<Value> registers;
+    vector<Value> globals;
+    vector<Frame> frames;
+    size_t maxFrames;
+    uint64_t dispatches = 0;
+
+    Value execute(uint16_t function);
+};
+
+#endif
@@ -0,0 +1,229 @@
+#include "scan.h"
+#include <algorithm>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SCAN_X86 1
+#include <immintrin.h>
+#else
+#define SCAN_X86 0
+#endif
+
+using namespace std;
+
+// ---------------- scalar ----------------
+static const char* spaceScalar(const char* p, const char* end, LineSkip& lines) {
+    for (; p < end; ++p) {
+        uint8_t cls = charClasses[static_cast<unsigned char>(*p)];
+        if (cls & CC_NEWLINE) {
+            lines.count++;
+            lines.last = p;
+        }
+        else if (!(cls & CC_SPACE)) break;
+    }
+    return p;
+}
+
+static const char* identScalar(const char* p, const char* end) {
+    while (p < end && hasClass(*p, CC_ALPHA | CC_DIGIT)) ++p;
+    return p;
+}
+
+static const char* digitsScalar(const char* p, const char* end) {
+    while (p < end && hasClass(*p, CC_DIGIT)) ++p;
+    return p;
+}
+
+static const char* lineEndScalar(const char* p, const char* end) {
+    while (p < end && *p != '\n') ++p;
+    return p;
+}
+
+#if SCAN_X86
+// Records the newlines among the first `n` lanes of mask `nl`.
+static inline void countLines(LineSkip& lines, const char* block,
+                              uint32_t nl, unsigned n) {
+    if (n < 32) nl &= (1u << n) - 1;
+    if (!nl) return;
+    lines.count += __builtin_popcount(nl);
+    lines.last = block + (31 - __builtin_clz(nl));
+}
+
+// ---------------- SSE2 ----------------
+// Lanes of x that lie in [lo, lo + span], as an unsigned range check.
+static inline __m128i inRange16(__m128i x, char lo, char span) {
+    __m128i t = _mm_sub_epi8(x, _mm_set1_epi8(lo));
+    return _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(span)), t);
+}
+
+static const char* spaceSse2(const char* p, const char* end, LineSkip& lines) {
+    for (; end - p >= 16; p += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i nl = _mm_cmpeq_epi8(x, _mm_set1_epi8('\n'));
+        __m128i ws = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')),
+                         _mm_cmpeq_epi8(x, _mm_set1_epi8('\t'))),
+            _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('\r')), nl));
+
+        uint32_t stop = ~_mm_movemask_epi8(ws) & 0xFFFF;
+        uint32_t lanes = _mm_movemask_epi8(nl);
+        if (stop) {
+            unsigned n = __builtin_ctz(stop);
+            countLines(lines, p, lanes, n);
+            return p + n;
+        }
+        countLines(lines, p, lanes, 16);
+    }
+    return spaceScalar(p, end, lines);
+}
+
+static const char* identSse2(const char* p, const char* end) {
+    for (; end - p >= 16; p += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i lower = _mm_or_si128(x, _mm_set1_epi8(0x20));
+        __m128i ok = _mm_or_si128(
+            _mm_or_si128(inRange16(lower, 'a', 25), inRange16(x, '0', 9)),
+            _mm_cmpeq_epi8(x, _mm_set1_epi8('_')));
+
+        uint32_t stop = ~_mm_movemask_epi8(ok) & 0xFFFF;
+        if (stop) return p + __builtin_ctz(stop);
+    }
+    return identScalar(p, end);
+}
+
+static const char* digitsSse2(const char* p, const char* end) {
+    for (; end - p >= 16; p += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        uint32_t stop = ~_mm_movemask_epi8(inRange16(x, '0', 9)) & 0xFFFF;
+        if (stop) return p + __builtin_ctz(stop);
+    }
+    return digitsScalar(p, end);
+}
+
+static const char* lineEndSse2(const char* p, const char* end) {
+    for (; end - p >= 16; p += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        uint32_t hit = _mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8('\n')));
+        if (hit) return p + __builtin_ctz(hit);
+    }
+    return lineEndScalar(p, end);
+}
+
+// ---------------- AVX2 ----------------
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static inline __m256i inRange32(__m256i x, char lo, char span) {
+    __m256i t = _mm256_sub_epi8(x, _mm256_set1_epi8(lo));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(span)), t);
+}
+
+AVX2 static const char* spaceAvx2(const char* p, const char* end, LineSkip& lines) {
+    for (; end - p >= 32; p += 32) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i nl = _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n'));
+        __m256i ws = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')),
+                            _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\t'))),
+            _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\r')), nl));
+
+        uint32_t stop = ~static_cast<uint32_t>(_mm256_movemask_epi8(ws));
+        uint32_t lanes = static_cast<uint32_t>(_mm256_movemask_epi8(nl));
+        if (stop) {
+            unsigned n = __builtin_ctz(stop);
+            countLines(lines, p, lanes, n);
+            return p + n;
+        }
+        countLines(lines, p, lanes, 32);
+    }
+    return spaceSse2(p, end, lines);
+}
+
+AVX2 static const char* identAvx2(const char* p, const char* end) {
+    for (; end - p >= 32; p += 32) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i lower = _mm256_or_si256(x, _mm256_set1_epi8(0x20));
+        __m256i ok = _mm256_or_si256(
+            _mm256_or_si256(inRange32(lower, 'a', 25), inRange32(x, '0', 9)),
+            _mm256_cmpeq_epi8(x, _mm256_set1_epi8('_')));
+
+        uint32_t stop = ~static_cast<uint32_t>(_mm256_movemask_epi8(ok));
+        if (stop) return p + __builtin_ctz(stop);
+    }
+    return identSse2(p, end);
+}
+
+AVX2 static const char* digitsAvx2(const char* p, const char* end) {
+    for (; end - p >= 32; p += 32) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        uint32_t stop = ~static_cast<uint32_t>(
+            _mm256_movemask_epi8(inRange32(x, '0', 9)));
+        if (stop) return p + __builtin_ctz(stop);
+    }
+    return digitsSse2(p, end);
+}
+
+AVX2 static const char* lineEndAvx2(const char* p, const char* end) {
+    for (; end - p >= 32; p += 32) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        uint32_t hit = static_cast<uint32_t>(
+            _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n'))));
+        if (hit) return p + __builtin_ctz(hit);
+    }
+    return lineEndSse2(p, end);
+}
+
+#undef AVX2
+#endif
+
+
+// ---------------- dispatch ----------------
+static const ScanKernels SCALAR_KERNELS =
+    { spaceScalar, identScalar, digitsScalar, lineEndScalar };
+#if SCAN_X86
+static const ScanKernels SSE2_KERNELS =
+    { spaceSse2, identSse2, digitsSse2, lineEndSse2 };
+static const ScanKernels AVX2_KERNELS =
+    { spaceAvx2, identAvx2, digitsAvx2, lineEndAvx2 };
+#endif
+
+ScanLevel bestScanLevel() {
+#if SCAN_X86
+    // SSE2 is part of x86-64 itself. The explicit init makes this safe
+    // to call from static initializers.
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? ScanLevel::AVX2 : ScanLevel::SSE2;
+#else
+    return ScanLevel::SCALAR;
+#endif
+}
+
+const ScanKernels& scanKernels(ScanLevel level) {
+    level = min(level, bestScanLevel());
+#if SCAN_X86
+    if (level == ScanLevel::AVX2) return AVX2_KERNELS;
+    if (level == ScanLevel::SSE2) return SSE2_KERNELS;
+#endif
+    return SCALAR_KERNELS;
+}
+
+static ScanLevel activeLevel = bestScanLevel();
+
+const ScanKernels& scanKernels() {
+    return scanKernels(activeLevel);
+}
+
+ScanLevel scanLevel() {
+    return activeLevel;
+}
+
+void setScanLevel(ScanLevel level) {
+    activeLevel = min(level, bestScanLevel());
+}
+
+const char* scanLevelName(ScanLevel level) {
+    switch (level) {
+    case ScanLevel::SCALAR: return "scalar";
+    case ScanLevel::SSE2:   return "sse2";
+    case ScanLevel::AVX2:   return "avx2";
+    }
+    return "";
+}
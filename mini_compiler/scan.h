@@ -0,0 +1,71 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+using namespace std;
+
+// ---------------- character classes ----------------
+enum CharClass : uint8_t {
+    CC_SPACE   = 1 << 0,    // ' ', '\t', '\r'
+    CC_NEWLINE = 1 << 1,    // '\n'
+    CC_DIGIT   = 1 << 2,    // '0'..'9'
+    CC_ALPHA   = 1 << 3,    // letters and '_'
+};
+
+constexpr array<uint8_t, 256> makeCharClasses() {
+    array<uint8_t, 256> t{};
+    t[' '] = t['\t'] = t['\r'] = CC_SPACE;
+    t['\n'] = CC_NEWLINE;
+    for (int c = '0'; c <= '9'; ++c) t[c] = CC_DIGIT;
+    for (int c = 'a'; c <= 'z'; ++c) t[c] = t[c - 'a' + 'A'] = CC_ALPHA;
+    t['_'] = CC_ALPHA;
+    return t;
+}
+
+// ASCII only, whatever the locale.
+inline constexpr array<uint8_t, 256> charClasses = makeCharClasses();
+
+inline bool hasClass(char c, uint8_t classes) {
+    return charClasses[static_cast<unsigned char>(c)] & classes;
+}
+
+// ---------------- scanning kernels ----------------
+
+// Newlines crossed by ScanKernels::space.
+struct LineSkip {
+    size_t count = 0;
+    const char* last = nullptr;     // the last '\n' crossed
+};
+
+//
+// Each kernel skips a run of one character class starting at `p` and
+// returns the first byte past it (or `end`). Vector versions look at
+// 16 or 32 bytes per step and never read at or past `end`, so they
+// are safe at the end of an mmap'd file.
+//
+struct ScanKernels {
+    const char* (*space)(const char* p, const char* end, LineSkip& lines);
+    const char* (*ident)(const char* p, const char* end);     // [A-Za-z0-9_]
+    const char* (*digits)(const char* p, const char* end);
+    const char* (*lineEnd)(const char* p, const char* end);   // up to '\n'
+};
+
+enum class ScanLevel { SCALAR, SSE2, AVX2 };
+
+// The widest level this CPU supports.
+ScanLevel bestScanLevel();
+
+// Kernels of `level` (the best supported level at most).
+const ScanKernels& scanKernels(ScanLevel level);
+
+// Kernels new Lexers use; bestScanLevel() unless changed.
+const ScanKernels& scanKernels();
+ScanLevel scanLevel();
+void setScanLevel(ScanLevel level);
+
+const char* scanLevelName(ScanLevel level);
+
+#endif
@@ -1,148 +1,475 @@
 #include "semantic.h"
-#include <stdexcept>
+#include <algorithm>
+#include "threadpool.h"
 
 using namespace std;
 
+SemanticAnalyzer::SemanticAnalyzer(const Interner& names, Diagnostics& diags)
+    : names(names), diags(diags) {}
+
+SemanticAnalyzer::SemanticAnalyzer(const Interner& names, Diagnostics& diags,
+                                   const Signatures* signatures)
+    : names(names), diags(diags), signatures(signatures) {}
+
+string SemanticAnalyzer::nameOf(Symbol sym) const {
+    return string(names.name(sym));
+}
+
 void SemanticAnalyzer::analyze(
     const vector<StmtPtr>& program) {
 
-    symbols.enterScope();
+    begin();
 
     for (auto& stmt : program)
-        analyzeStmt(stmt);
+        analyzeNext(stmt);
 
-    symbols.exitScope();
+    end();
+}
+
+void SemanticAnalyzer::analyze(const vector<StmtPtr>& program,
+                               const Environment& env) {
+    environment = &env;
+    analyze(program);
+    environment = nullptr;
+}
+
+void SemanticAnalyzer::begin() {
+    scopes0 = symbols.scopesEntered();
+    lookups0 = lookups;
+    symbols.enterScope();
 }
 
-void SemanticAnalyzer::analyzeStmt(const StmtPtr& stmt) {
+void SemanticAnalyzer::analyzeNext(const Stmt* stmt) {
+    visitStmt(stmt);
+}
 
-    // ---------------- Variable Declaration ----------------
-    if (auto v = dynamic_pointer_cast<VarDecl>(stmt)) {
-        if (!symbols.declare(v->name, v->type))
-            throw runtime_error(
-                "Variable redeclared: " + v->name);
+void SemanticAnalyzer::end() {
+    symbols.exitScope();
+    if (stats) {
+        stats->scopesEntered += symbols.scopesEntered() - scopes0;
+        stats->symbolLookups += lookups - lookups0;
     }
+}
 
-    // ---------------- Function Declaration ----------------
-    else if (auto f = dynamic_pointer_cast<FunctionDecl>(stmt)) {
+void SemanticAnalyzer::addWork(Work w) {
+    if (!stats) return;
+    stats->scopesEntered += w.scopes;
+    stats->symbolLookups += w.lookups;
+}
 
-        // Register function signature
-        FunctionInfo info;
-        info.returnType = f->returnType;
+// ---------------- Two-phase analysis ----------------
+void SemanticAnalyzer::analyzeTwoPhase(
+    const vector<StmtPtr>& program, size_t threads) {
+
+    // Phase 1: signatures and globals, in program order.
+    Signatures sigs;
+    optional<PhaseTimer> timer;
+    timer.emplace(stats, "signatures");
+    sigs.globals.resize(names.size());
+
+    for (size_t i = 0; i < program.size(); ++i) {
+        if (auto v = nodeAs<const VarDecl>(program[i])) {
+            auto& g = sigs.globals[v->name];
+            if (g.position != Signatures::NONE) {
+                diags.error(v->loc, "Variable redeclared: " + nameOf(v->name));
+                continue;
+            }
+            g = { v->type, static_cast<uint32_t>(i) };
+        }
+        else {
+            collectSignatures(program[i], sigs);
+        }
+    }
 
-        for (auto& p : f->params)
-            info.paramTypes.push_back(p.type);
+    // Phase 2: every other top-level statement on its own. Work is
+    // handed out in contiguous chunks so each worker's symbol table
+    // is reused across many functions; each chunk reports into its
+    // own sink, merged in chunk order afterwards.
+    timer.emplace(stats, "bodies");
+    if (threads != 1 && program.size() > 1) {
+        ThreadPool pool(threads);
+        size_t chunks = min(program.size(), pool.size() * 8);
+        size_t per = (program.size() + chunks - 1) / chunks;
+        vector<Diagnostics> chunkDiags((program.size() + per - 1) / per);
+        vector<Work> chunkWork(chunkDiags.size());
+
+        for (size_t c = 0; c < chunkDiags.size(); ++c) {
+            pool.submit([&, c] {
+                SemanticAnalyzer worker(names, chunkDiags[c], &sigs);
+                worker.checkUnits(program, c * per,
+                                  min(program.size(), (c + 1) * per));
+                chunkWork[c] = worker.work();
+            });
+        }
+        pool.wait();
 
-        if (!symbols.declareFunction(f->name, info))
-            throw runtime_error(
-                "Function redeclared: " + f->name);
+        for (size_t c = 0; c < chunkDiags.size(); ++c) {
+            diags.append(chunkDiags[c]);
+            addWork(chunkWork[c]);
+        }
+    }
+    else {
+        SemanticAnalyzer worker(names, diags, &sigs);
+        worker.checkUnits(program, 0, program.size());
+        addWork(worker.work());
+    }
+}
 
-        // Save previous function context
-        string prevReturn = currentReturnType;
-        bool prevHasReturn = hasReturn;
+// Registers the signature of every function in `stmt`, nested ones
+// included, in declaration order.
+void SemanticAnalyzer::collectSignatures(const Stmt* stmt, Signatures& out) {
+    if (auto f = nodeAs<const FunctionDecl>(stmt)) {
+        if (!out.functions.declareFunction(f->name, signatureOf(f)))
+            diags.error(f->loc, "Function redeclared: " + nameOf(f->name));
+        collectSignatures(f->body, out);
+    }
+    else if (auto b = nodeAs<const BlockStmt>(stmt)) {
+        for (auto s : b->statements)
+            collectSignatures(s, out);
+    }
+}
 
-        currentReturnType = f->returnType;
-        hasReturn = false;
+// Checks top-level statements [begin, end).
+void SemanticAnalyzer::checkUnits(const vector<StmtPtr>& program,
+                                  size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+        if (program[i]->kind == StmtKind::VAR_DECL) continue;
 
-        // Enter function scope
+        unit = static_cast<uint32_t>(i);
         symbols.enterScope();
-        for (auto& p : f->params)
-            symbols.declare(p.name, p.type);
+        visitStmt(program[i]);
+        symbols.exitScope();
+    }
+}
 
-        analyzeStmt(f->body);
+optional<Binding> SemanticAnalyzer::lookupVariable(Symbol name) const {
+    lookups++;
+    auto local = symbols.lookup(name);
+    if (!local && environment) {
+        if (auto type = environment->global(name))
+            return Binding{ *type, 0 };
+    }
+    if (local || !signatures || name >= signatures->globals.size())
+        return local;
+
+    // Globals declared before the statement being checked.
+    auto& g = signatures->globals[name];
+    if (g.position < unit)
+        return Binding{ g.type, 0 };
+    return nullopt;
+}
 
-        symbols.exitScope();
+const FunctionInfo* SemanticAnalyzer::lookupFunction(Symbol name) const {
+    lookups++;
+    if (signatures) return signatures->functions.lookupFunction(name);
 
-        // Enforce return rule
-        if (currentReturnType != "void" && !hasReturn)
-            throw runtime_error(
-                "Function '" + f->name + "' must return a value");
+    const FunctionInfo* f = symbols.lookupFunction(name);
+    if (!f && environment) f = environment->function(name);
+    return f;
+}
+
+FunctionInfo SemanticAnalyzer::signatureOf(const FunctionDecl* f) const {
+    FunctionInfo info;
+    info.returnType = f->returnType;
+
+    for (auto& p : f->params)
+        info.paramTypes.push_back(p.type);
+    return info;
+}
+
+// ---------------- Variable Declaration ----------------
+void SemanticAnalyzer::visitVarDecl(const VarDecl* v) {
+    // A top-level variable clashes with earlier ones outside `program`
+    // too.
+    bool clash = environment && symbols.depth() == 1 &&
+                 environment->global(v->name);
+    if (clash || !symbols.declare(v->name, v->type))
+        diags.error(v->loc, "Variable redeclared: " + nameOf(v->name));
+}
 
-        // Restore context
-        currentReturnType = prevReturn;
-        hasReturn = prevHasReturn;
+// ---------------- Expression Statement ----------------
+void SemanticAnalyzer::visitExprStmt(const ExprStmt* e) {
+    checkExpr(e->expr);
+}
+
+// ---------------- Function Declaration ----------------
+void SemanticAnalyzer::visitFunction(const FunctionDecl* f) {
+
+    // Register function signature (two-phase: already collected). A
+    // redeclared function's body is still checked.
+    if (!signatures) {
+        bool clash = environment && environment->function(f->name);
+        if (clash || !symbols.declareFunction(f->name, signatureOf(f)))
+            diags.error(f->loc, "Function redeclared: " + nameOf(f->name));
     }
 
-    // ---------------- Block ----------------
-    else if (auto b = dynamic_pointer_cast<BlockStmt>(stmt)) {
-        symbols.enterScope();
-        for (auto& s : b->statements)
-            analyzeStmt(s);
-        symbols.exitScope();
+    // Save the enclosing function's context
+    FunctionContext outer = context;
+    context = FunctionContext{ f->returnType, false };
+
+    // Enter function scope
+    symbols.enterScope();
+    for (auto& p : f->params)
+        symbols.declare(p.name, p.type);
+
+    visitBlock(f->body);
+
+    symbols.exitScope();
+
+    // Enforce return rule
+    if (context.returnType != TypeTable::VOID && !context.hasReturn)
+        diags.error(f->loc,
+            "Function '" + nameOf(f->name) + "' must return a value");
+
+    // Restore context
+    context = outer;
+}
+
+// ---------------- Block ----------------
+void SemanticAnalyzer::visitBlock(const BlockStmt* b) {
+    symbols.enterScope();
+    for (auto& s : b->statements)
+        visitStmt(s);
+    symbols.exitScope();
+}
+
+// ---------------- Return Statement ----------------
+void SemanticAnalyzer::visitReturn(const ReturnStmt* r) {
+
+    context.hasReturn = true;
+
+    if (context.returnType == TypeTable::VOID) {
+        if (r->expr) {
+            checkExpr(r->expr);
+            diags.error(r->loc, "Void function should not return a value");
+        }
     }
+    else {
+        if (!r->expr) {
+            diags.error(r->loc, "Non-void function must return a value");
+            return;
+        }
 
-    // ---------------- Return Statement ----------------
-    else if (auto r = dynamic_pointer_cast<ReturnStmt>(stmt)) {
+        TypeId exprType = checkExpr(r->expr);
+        if (exprType != context.returnType && exprType != TypeTable::ERROR)
+            diags.error(r->expr->loc,
+                "Return type mismatch: expected " +
+                types.name(context.returnType) + ", got " +
+                types.name(exprType));
+    }
+}
 
-        hasReturn = true;
+// ---------------- Expressions ----------------
+//
+// Each expression with operands gets a frame on `pending` while they
+// are checked, one at a time; a leaf is checked on the spot. Checks
+// happen in the order a recursive walk would make them: a call's
+// callee before its arguments, each argument's type right after the
+// argument itself, an assignment's target after its value.
+//
+static bool isLeaf(const Expr* e) {
+    return e->kind <= ExprKind::VAR || e->kind == ExprKind::ERROR;
+}
 
-        if (currentReturnType == "void") {
-            if (r->expr)
-                throw runtime_error(
-                    "Void function should not return a value");
+TypeId SemanticAnalyzer::checkExpr(const Expr* e) {
+    size_t base = pending.size();
+    TypeId type = enterExpr(e);
+
+    while (pending.size() > base) {
+        ExprFrame& f = pending.back();
+        if (type != TypeTable::NONE)
+            operandChecked(f, type);
+
+        // Leaf operands are checked in place.
+        const Expr* operand = nullptr;
+        while (f.next < f.count) {
+            operand = f.args ? f.args[f.next] : f.pair[f.next];
+            f.next++;
+            if (!isLeaf(operand)) break;
+            operandChecked(f, leafType(operand));
+            operand = nullptr;
         }
-        else {
-            if (!r->expr)
-                throw runtime_error(
-                    "Non-void function must return a value");
-
-            string exprType = analyzeExpr(r->expr);
-            if (exprType != currentReturnType)
-                throw runtime_error(
-                    "Return type mismatch: expected " +
-                    currentReturnType + ", got " + exprType);
+
+        if (operand) {
+            type = enterExpr(operand);      // may push; `f` is stale now
+            continue;
         }
+        type = leaveExpr(f);
+        pending.pop_back();
     }
+    return type;
 }
 
-string SemanticAnalyzer::analyzeExpr(const ExprPtr& expr) {
+TypeId SemanticAnalyzer::enterExpr(const Expr* e) {
+    switch (e->kind) {
+    case ExprKind::NUMBER:
+    case ExprKind::BOOL:
+    case ExprKind::VAR:
+    case ExprKind::ERROR:
+        return leafType(e);
+
+    case ExprKind::ASSIGN: {
+        auto a = static_cast<const AssignExpr*>(e);
+        auto var = lookupVariable(a->name);
+        pending.push_back({ e, nullptr, { a->value, nullptr }, 1 });
+        if (var) pending.back().result = var->type;
+        return TypeTable::NONE;
+    }
 
-    // ---------------- Variable Expression ----------------
-    if (auto v = dynamic_pointer_cast<VarExpr>(expr)) {
-        if (!symbols.isDeclared(v->name))
-            throw runtime_error(
-                "Undefined variable: " + v->name);
+    case ExprKind::CALL: {
+        auto call = static_cast<const CallExpr*>(e);
+        const FunctionInfo* fn = lookupFunction(call->callee);
+        if (!fn)
+            diags.error(call->loc, "Undefined function: " + nameOf(call->callee));
+        else if (call->args.size() != fn->paramTypes.size())
+            diags.error(call->loc,
+                "Function '" + nameOf(call->callee) +
+                "' called with wrong number of arguments");
+        pending.push_back({ e, call->args.items, {}, call->args.count });
+        ExprFrame& f = pending.back();
+        f.result = fn ? fn->returnType : TypeTable::ERROR;
+        if (fn && call->args.size() == fn->paramTypes.size())
+            f.params = fn->paramTypes.data();
+        return TypeTable::NONE;
+    }
 
-        return symbols.getType(v->name);
+    // Most operators apply to leaves; those need no frame.
+    case ExprKind::BINARY: {
+        auto b = static_cast<const BinaryExpr*>(e);
+        if (isLeaf(b->left) && isLeaf(b->right)) {
+            TypeId left = leafType(b->left);
+            return binaryType(b, left, leafType(b->right));
+        }
+        pending.push_back({ e, nullptr, { b->left, b->right }, 2 });
+        return TypeTable::NONE;
     }
 
-    // ---------------- Binary Expression ----------------
-    else if (auto b = dynamic_pointer_cast<BinaryExpr>(expr)) {
-        string left = analyzeExpr(b->left);
-        string right = analyzeExpr(b->right);
+    case ExprKind::UNARY: {
+        auto u = static_cast<const UnaryExpr*>(e);
+        if (isLeaf(u->expr)) return unaryType(u, leafType(u->expr));
+        pending.push_back({ e, nullptr, { u->expr, nullptr }, 1 });
+        return TypeTable::NONE;
+    }
+    }
+    __builtin_unreachable();
+}
 
-        if (left != "int" || right != "int")
-            throw runtime_error(
-                "Binary operator requires int operands");
+TypeId SemanticAnalyzer::leafType(const Expr* e) {
+    switch (e->kind) {
+    case ExprKind::NUMBER:
+        return TypeTable::INT;
 
-        return "int";
+    case ExprKind::BOOL:
+        return TypeTable::BOOL;
+
+    case ExprKind::VAR: {
+        auto v = static_cast<const VarExpr*>(e);
+        auto var = lookupVariable(v->name);
+        if (!var) {
+            diags.error(v->loc, "Undefined variable: " + nameOf(v->name));
+            return TypeTable::ERROR;
+        }
+        return var->type;
     }
 
-    // ---------------- Function Call ----------------
-    else if (auto call = dynamic_pointer_cast<CallExpr>(expr)) {
+    // Already reported by the parser.
+    default:
+        return TypeTable::ERROR;
+    }
+}
 
-    if (!symbols.hasFunction(call->callee))
-        throw runtime_error(
-            "Undefined function: " + call->callee);
+void SemanticAnalyzer::operandChecked(ExprFrame& f, TypeId type) {
+    if (f.next == 1) f.first = type;
+    f.last = type;
+
+    // Arguments are matched against the parameters as they come.
+    size_t i = f.next - 1;
+    if (f.params && type != f.params[i] && type != TypeTable::ERROR) {
+        auto call = static_cast<const CallExpr*>(f.expr);
+        diags.error(call->args[i]->loc,
+            "Argument type mismatch in call to '" +
+            nameOf(call->callee) + "'");
+    }
+}
+
+TypeId SemanticAnalyzer::leaveExpr(const ExprFrame& f) {
+    switch (f.expr->kind) {
+    case ExprKind::ASSIGN: {
+        auto a = static_cast<const AssignExpr*>(f.expr);
+        TypeId target = f.result;
+        if (target == TypeTable::NONE) {
+            diags.error(a->loc, "Undefined variable: " + nameOf(a->name));
+            return TypeTable::ERROR;
+        }
+
+        if (f.last != target && f.last != TypeTable::ERROR)
+            diags.error(a->loc,
+                "Assignment type mismatch: cannot assign " +
+                types.name(f.last) + " to " + types.name(target) +
+                " '" + nameOf(a->name) + "'");
+        return target;
+    }
 
-    auto fn = symbols.getFunction(call->callee);
+    case ExprKind::BINARY:
+        return binaryType(static_cast<const BinaryExpr*>(f.expr), f.first, f.last);
 
-    if (call->args.size() != fn.paramTypes.size())
-        throw runtime_error(
-            "Function '" + call->callee +
-            "' called with wrong number of arguments");
+    case ExprKind::UNARY:
+        return unaryType(static_cast<const UnaryExpr*>(f.expr), f.last);
 
-    for (size_t i = 0; i < call->args.size(); ++i) {
-        string argType = analyzeExpr(call->args[i]);
-        if (argType != fn.paramTypes[i])
-            throw runtime_error(
-                "Argument type mismatch in call to '" +
-                call->callee + "'");
+    default:
+        return f.result;                // CALL
+    }
+}
+
+// Arithmetic takes ints to an int; comparisons take ints, == and !=
+// two ints or two bools, && and || bools, all to a bool. The result
+// type holds even when an operand is wrong, so one mistake is
+// reported once.
+TypeId SemanticAnalyzer::binaryType(const BinaryExpr* b, TypeId left, TypeId right) {
+    auto is = [](TypeId t, TypeId want) {
+        return t == want || t == TypeTable::ERROR;
+    };
+
+    switch (b->op) {
+    case TokenType::EQ:
+    case TokenType::NEQ: {
+        bool ints = is(left, TypeTable::INT) && is(right, TypeTable::INT);
+        bool bools = is(left, TypeTable::BOOL) && is(right, TypeTable::BOOL);
+        if (!ints && !bools)
+            diags.error(b->loc,
+                "Equality operator requires two int or two bool operands");
+        return TypeTable::BOOL;
     }
 
-    return fn.returnType;
+    case TokenType::LT:
+    case TokenType::GT:
+    case TokenType::LE:
+    case TokenType::GE:
+        if (!is(left, TypeTable::INT) || !is(right, TypeTable::INT))
+            diags.error(b->loc, "Comparison requires int operands");
+        return TypeTable::BOOL;
+
+    case TokenType::AND:
+    case TokenType::OR:
+        if (!is(left, TypeTable::BOOL) || !is(right, TypeTable::BOOL))
+            diags.error(b->loc, "Logical operator requires bool operands");
+        return TypeTable::BOOL;
+
+    default:
+        if (!is(left, TypeTable::INT) || !is(right, TypeTable::INT))
+            diags.error(b->loc, "Binary operator requires int operands");
+        return TypeTable::INT;
+    }
 }
 
+TypeId SemanticAnalyzer::unaryType(const UnaryExpr* u, TypeId operand) {
+    if (u->op == TokenType::NOT) {
+        if (operand != TypeTable::BOOL && operand != TypeTable::ERROR)
+            diags.error(u->loc, "Logical not requires a bool operand");
+        return TypeTable::BOOL;
+    }
 
-    throw runtime_error("Unknown expression type");
+    if (operand != TypeTable::INT && operand != TypeTable::ERROR)
+        diags.error(u->loc, "Unary operator requires an int operand");
+    return TypeTable::INT;
 }
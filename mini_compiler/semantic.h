@@ -1,27 +1,168 @@
 #ifndef SEMANTIC_H
 #define SEMANTIC_H
 
+#include <string>
 #include "ast.h"
+#include "diagnostics.h"
+#include "stats.h"
 #include "symbol.h"
+#include "visitor.h"
 
 using namespace std;
 
-class SemanticAnalyzer {
+//
+// Functions and top-level variables declared before the statements
+// being checked, when those statements are analyzed apart from the
+// rest of their program (incremental re-analysis, incremental.h).
+// The result depends on nothing else, so the implementation can
+// record each query as a dependency.
+//
+class Environment {
 public:
+    virtual const FunctionInfo* function(Symbol name) const = 0;
+    virtual optional<TypeId> global(Symbol name) const = 0;
+
+protected:
+    ~Environment() = default;
+};
+
+//
+// Type checker. Every problem is reported to the Diagnostics sink and
+// checking goes on: an expression in error gets TypeTable::ERROR,
+// which satisfies every check it meets, so each mistake is reported
+// once. Expressions are walked on an explicit stack, so their depth
+// is limited by memory, not by the native stack.
+//
+class SemanticAnalyzer : private StmtVisitor<SemanticAnalyzer> {
+public:
+    // `names` resolves Symbols for error messages.
+    SemanticAnalyzer(const Interner& names, Diagnostics& diags);
+
+    // One pass in program order: a function must be declared before
+    // it is called.
     void analyze(const vector<StmtPtr>& program);
 
+    // analyze() for statements that follow the declarations in `env`:
+    // names not declared by `program` itself are looked up there, and
+    // declaring one that `env` has is a redeclaration.
+    void analyze(const vector<StmtPtr>& program, const Environment& env);
+
+    // analyze() a statement at a time, for callers that free each
+    // top-level statement's AST once it is checked: begin(), then
+    // analyzeNext() on every statement in order, then end().
+    void begin();
+    void analyzeNext(const Stmt* stmt);
+    void end();
+
+    // Two passes. The first collects every function signature (nested
+    // ones included) and every top-level variable into a read-only
+    // table, so calls may come before the callee's declaration. The
+    // second checks each top-level statement, function bodies above
+    // all, independently of the others on up to `threads` threads
+    // (0: one per core); each worker has its own scopes and return
+    // context. A top-level variable is visible to statements after it.
+    //
+    // Diagnostics from the first pass come first, then those of each
+    // statement in program order, whatever the thread count.
+    void analyzeTwoPhase(const vector<StmtPtr>& program, size_t threads = 1);
+
+    // Scopes entered and symbols looked up are added to `stats` at the
+    // end of each analysis; two-phase analysis also times its passes.
+    void setStats(CompileStats* stats) { this->stats = stats; }
+
 private:
+    friend class StmtVisitor<SemanticAnalyzer>;
+
+    // Result of the first two-phase pass, shared read-only by workers.
+    struct Signatures {
+        static constexpr uint32_t NONE = UINT32_MAX;
+
+        struct Global {
+            TypeId type = TypeTable::NONE;
+            uint32_t position = NONE;   // index of its top-level VarDecl
+        };
+
+        SymbolTable functions;          // only the function table is used
+        vector<Global> globals;         // indexed by Symbol
+    };
+
+    // An expression whose operands are being checked.
+    struct ExprFrame {
+        const Expr* expr;
+        const ExprPtr* args;            // CALL's operands; null: `pair`
+        ExprPtr pair[2];                // the other kinds' operands
+        uint32_t count;                 // operands in all
+        uint32_t next = 0;              // operands started
+        TypeId first = TypeTable::NONE; // type of the first one
+        TypeId last = TypeTable::NONE;  // of the latest one
+        TypeId result = TypeTable::NONE;// ASSIGN: the variable's type
+                                        // (NONE: undefined); CALL: the
+                                        // function's return type
+        const TypeId* params = nullptr; // CALL, if the argument count
+                                        // is right: parameter types
+    };
+
+    // The function whose body is being checked.
+    struct FunctionContext {
+        TypeId returnType = TypeTable::VOID;
+        bool hasReturn = false;
+    };
+
+    const Interner& names;
+    Diagnostics& diags;
+    TypeTable types;
     SymbolTable symbols;
+    FunctionContext context;
+    vector<ExprFrame> pending;      // checkExpr()'s stack
+
+    // Two-phase workers only: the shared table, and the top-level
+    // statement being checked.
+    const Signatures* signatures = nullptr;
+    uint32_t unit = 0;
+
+    // analyze(program, env) only.
+    const Environment* environment = nullptr;
+
+    CompileStats* stats = nullptr;
+    mutable uint64_t lookups = 0;   // lookupVariable + lookupFunction
+    uint64_t scopes0 = 0, lookups0 = 0;     // counts at begin()
+
+    // Scopes entered and lookups done by a two-phase worker.
+    struct Work {
+        uint64_t scopes = 0;
+        uint64_t lookups = 0;
+    };
+    Work work() const { return { symbols.scopesEntered(), lookups }; }
+    void addWork(Work w);
+
+    SemanticAnalyzer(const Interner& names, Diagnostics& diags,
+                     const Signatures* signatures);
 
-    // Track current function context
-    string currentFunctionName;
-    string currentReturnType;
-    bool hasReturn = false;
+    void collectSignatures(const Stmt* stmt, Signatures& out);
+    void checkUnits(const vector<StmtPtr>& program, size_t begin, size_t end);
+    optional<Binding> lookupVariable(Symbol name) const;
+    const FunctionInfo* lookupFunction(Symbol name) const;
+    FunctionInfo signatureOf(const FunctionDecl* f) const;
 
-    void analyzeStmt(const StmtPtr& stmt);
-    string analyzeExpr(const ExprPtr& expr);
+    string nameOf(Symbol sym) const;
 
+    // Statements
+    void visitVarDecl(const VarDecl* v);
+    void visitExprStmt(const ExprStmt* e);
+    void visitReturn(const ReturnStmt* r);
+    void visitBlock(const BlockStmt* b);
+    void visitFunction(const FunctionDecl* f);
 
+    // Expressions: checkExpr() returns the type of `e`. The others are
+    // its steps: entering an expression (a leaf's type, or NONE once
+    // its frame is pushed), its operands in turn, and leaving it.
+    TypeId checkExpr(const Expr* e);
+    TypeId enterExpr(const Expr* e);
+    TypeId leafType(const Expr* e);
+    void operandChecked(ExprFrame& f, TypeId type);
+    TypeId leaveExpr(const ExprFrame& f);
+    TypeId binaryType(const BinaryExpr* b, TypeId left, TypeId right);
+    TypeId unaryType(const UnaryExpr* u, TypeId operand);
 };
 
 #endif
@@ -0,0 +1,331 @@
+#include "server.h"
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include "cache.h"
+#include "diagnostics.h"
+#include "incremental.h"
+
+#if SOCKETS_SUPPORTED
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+namespace fs = std::filesystem;
+
+struct CompileServer::Document {
+    mutex lock;                             // held while checking
+    unique_ptr<IncrementalDocument> doc;
+    size_t bytes = 0;                       // source bytes, for the limit
+    uint64_t lastUse = 0;
+};
+
+static bool readFile(const string& path, string& out) {
+    ifstream in(path, ios::binary);
+    if (!in) return false;
+    ostringstream ss;
+    ss << in.rdbuf();
+    out = ss.str();
+    return true;
+}
+
+#if SOCKETS_SUPPORTED
+
+CompileServer::CompileServer(string socketPath, size_t threads,
+                             CompileCache* cache)
+    : socketPath(move(socketPath)), cache(cache), pool(threads) {
+    listener = listenOn(this->socketPath);
+    if (listener < 0)
+        throw runtime_error("cannot listen on " + this->socketPath + ": " +
+                            strerror(errno));
+    if (pipe(wake) < 0) {
+        close(listener);
+        throw runtime_error(string("cannot create pipe: ") + strerror(errno));
+    }
+    for (int fd : wake)
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+CompileServer::~CompileServer() {
+    pool.wait();
+    close(listener);
+    unlink(socketPath.c_str());
+    close(wake[0]);
+    close(wake[1]);
+}
+
+void CompileServer::stop() {
+    stopping = true;
+    char c = 0;
+    (void)!write(wake[1], &c, 1);
+}
+
+void CompileServer::serve() {
+    // [0] the listener, [1] the wake pipe, then idle connections.
+    vector<pollfd> fds{ { listener, POLLIN, 0 }, { wake[0], POLLIN, 0 } };
+
+    while (!stopping) {
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        for (size_t i = 2; i < fds.size();) {
+            if (!fds[i].revents) {
+                ++i;
+                continue;
+            }
+            int fd = fds[i].fd;
+            fds[i] = fds.back();
+            fds.pop_back();
+            pool.submit([this, fd] { serveOne(fd); });
+        }
+
+        if (fds[1].revents) {
+            char drain[64];
+            while (read(wake[0], drain, sizeof drain) > 0) {}
+            lock_guard<mutex> guard(idleLock);
+            for (int fd : returned)
+                fds.push_back({ fd, POLLIN, 0 });
+            returned.clear();
+        }
+
+        if (fds[0].revents) {
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd >= 0) {
+                // A client that stops halfway through a request must not
+                // hold a worker forever.
+                timeval timeout{ 10, 0 };
+                setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+                fcntl(fd, F_SETFD, FD_CLOEXEC);
+                connections++;
+                fds.push_back({ fd, POLLIN, 0 });
+            }
+        }
+    }
+
+    pool.wait();
+    for (size_t i = 2; i < fds.size(); ++i)
+        close(fds[i].fd);
+    lock_guard<mutex> guard(idleLock);
+    for (int fd : returned)
+        close(fd);
+    returned.clear();
+}
+
+// Answers one request on `fd`, then hands the connection back to
+// serve(); a closed or broken connection is closed here.
+void CompileServer::serveOne(int fd) {
+    string payload;
+    if (!receiveFrame(fd, payload)) {
+        close(fd);
+        return;
+    }
+
+    ServerRequest request;
+    ServerResponse response;
+    bool valid = decodeRequest(payload, request);
+    if (valid) {
+        requests++;
+        response = answer(request);
+    }
+    else {
+        response.error = "malformed request";
+    }
+
+    bool sent = sendFrame(fd, encodeResponse(response));
+    if (valid && request.kind == RequestKind::STOP) stop();
+    if (!sent || !valid) {
+        close(fd);
+        return;
+    }
+
+    {
+        lock_guard<mutex> guard(idleLock);
+        returned.push_back(fd);
+    }
+    char c = 0;
+    (void)!write(wake[1], &c, 1);
+}
+
+#else
+
+CompileServer::CompileServer(string socketPath, size_t threads,
+                             CompileCache* cache)
+    : socketPath(move(socketPath)), cache(cache), pool(threads) {
+    throw runtime_error("the compile server needs Unix domain sockets");
+}
+
+CompileServer::~CompileServer() {}
+void CompileServer::stop() {}
+void CompileServer::serve() {}
+void CompileServer::serveOne(int) {}
+
+#endif
+
+ServerResponse CompileServer::answer(const ServerRequest& request) {
+    ServerResponse response;
+    try {
+        switch (request.kind) {
+        case RequestKind::STATUS:
+            response.status = status();
+            break;
+        case RequestKind::STOP:
+            response.status = "stopping\n";
+            break;
+        case RequestKind::COMPILE: {
+            // Opened relative to the client's directory, named as the
+            // client named them.
+            vector<pair<string, string>> paths;
+            for (auto& arg : request.paths) {
+                string open = arg;
+                if (fs::path(arg).is_relative() && !request.directory.empty())
+                    open = (fs::path(request.directory) / arg).string();
+                for (auto& file : collectSources({ open }))
+                    paths.push_back({ file, arg + file.substr(open.size()) });
+            }
+            if (paths.empty()) {
+                response.error = "no *.mc files found";
+                break;
+            }
+
+            files += paths.size();
+            response.results.resize(paths.size());
+            auto one = [&](size_t i) {
+                response.results[i] = compile(paths[i].first, paths[i].second,
+                                              request.options);
+            };
+            if (paths.size() == 1) {
+                one(0);
+                break;
+            }
+
+            // Several files: a pool of their own, as compileBatch()
+            // does; waiting on the shared one would also wait for
+            // every other client's requests.
+            ThreadPool batch(min(paths.size(), pool.size()));
+            for (size_t i = 0; i < paths.size(); ++i)
+                batch.submit([&, i] { one(i); });
+            batch.wait();
+            break;
+        }
+        }
+    }
+    catch (const exception& e) {
+        response = ServerResponse{};
+        response.error = e.what();
+    }
+    return response;
+}
+
+FileResult CompileServer::compile(const string& path, const string& shownAs,
+                                  const Options& requested) {
+    if (!requested.run && !requested.twoPhase)
+        return check(path, shownAs);
+
+    Options opts = requested;
+    opts.cache = cache;
+    return compileFile(path, opts, shownAs);
+}
+
+// Checks `path` through its document, diffing the file against the
+// text the document was last given: one edit spans from the first
+// byte that differs to the last.
+FileResult CompileServer::check(const string& path, const string& shownAs) {
+    FileResult result;
+    result.path = shownAs;
+
+    string source;
+    if (!readFile(path, source)) {
+        result.diagnostics = shownAs + ": cannot open file\n";
+        result.ok = false;
+        return result;
+    }
+
+    shared_ptr<Document> entry = document(path);
+    lock_guard<mutex> guard(entry->lock);
+    try {
+        if (!entry->doc) {
+            entry->doc = make_unique<IncrementalDocument>(source);
+        }
+        else {
+            string old = entry->doc->text();
+            size_t same = min(old.size(), source.size()), head = 0, tail = 0;
+            while (head < same && old[head] == source[head]) head++;
+            while (tail < same - head &&
+                   old[old.size() - 1 - tail] == source[source.size() - 1 - tail])
+                tail++;
+            if (head + tail != old.size() || head + tail != source.size())
+                entry->doc->edit(head, old.size() - head - tail,
+                    string_view(source).substr(head, source.size() - head - tail));
+            documentHits++;
+        }
+    }
+    catch (const exception& e) {
+        entry->doc.reset();
+        result.diagnostics = shownAs + ": error: " + e.what() + "\n";
+        result.ok = false;
+        return result;
+    }
+    resized(path, *entry, source.size());
+
+    Diagnostics diags(shownAs);
+    for (auto& d : entry->doc->diagnostics())
+        diags.report(d.severity, d.loc, d.message);
+    if (diags.hasErrors()) {
+        result.diagnostics = diags.render(source);
+        result.ok = false;
+    }
+    return result;
+}
+
+shared_ptr<CompileServer::Document> CompileServer::document(const string& path) {
+    lock_guard<mutex> guard(documentsLock);
+    auto& entry = documents[path];
+    if (!entry) entry = make_shared<Document>();
+    entry->lastUse = ++useCount;
+    return entry;
+}
+
+// Records `doc`'s new size and drops the least recently used
+// documents while the total is over the limit. One in use by another
+// request stays alive until that request is done.
+void CompileServer::resized(const string& path, Document& doc, size_t bytes) {
+    lock_guard<mutex> guard(documentsLock);
+    auto it = documents.find(path);
+    if (it == documents.end() || it->second.get() != &doc)
+        return;     // already dropped
+    documentBytes += bytes - doc.bytes;
+    doc.bytes = bytes;
+
+    while (documentBytes > DOCUMENT_BYTES && documents.size() > 1) {
+        auto oldest = documents.end();
+        for (auto it = documents.begin(); it != documents.end(); ++it)
+            if (it->second.get() != &doc &&
+                (oldest == documents.end() ||
+                 it->second->lastUse < oldest->second->lastUse))
+                oldest = it;
+        documentBytes -= oldest->second->bytes;
+        documents.erase(oldest);
+    }
+}
+
+string CompileServer::status() {
+    size_t count, bytes;
+    {
+        lock_guard<mutex> guard(documentsLock);
+        count = documents.size();
+        bytes = documentBytes;
+    }
+    return to_string(connections) + " connections, " + to_string(requests) +
+           " requests, " + to_string(files) + " files; " + to_string(count) +
+           " documents (" + to_string(bytes / 1024) + " KB), reused " +
+           to_string(documentHits) + " times\n";
+}
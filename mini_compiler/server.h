@@ -0,0 +1,92 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "driver.h"
+#include "protocol.h"
+#include "threadpool.h"
+
+using namespace std;
+
+//
+// Long-lived compile server (`mini_compiler --server`), answering the
+// requests of thin clients (client.cpp) on a Unix domain socket, so
+// a check costs no process start-up and reuses earlier work:
+//
+//   - the serving thread polls the listening socket and every idle
+//     connection; a connection with a request waiting goes to the
+//     thread pool for exactly one request, then back to the poll set,
+//     so idle clients never hold a worker
+//   - check-only requests (no --run, no --two-phase) go through an
+//     IncrementalDocument per file, kept between requests: a file
+//     checked before is diffed against its last text and only the
+//     changed declarations are reparsed and re-checked. Documents are
+//     dropped least recently used first beyond DOCUMENT_BYTES of
+//     source
+//   - everything else goes through compileFile() (and the on-disk
+//     cache, if one is given)
+//
+// Responses hold exactly what running the compiler directly prints.
+//
+class CompileServer {
+public:
+    // Listens on `socketPath`; throws runtime_error if it cannot.
+    // `threads` serve requests (0: one per core); `cache` may be null.
+    CompileServer(string socketPath, size_t threads, CompileCache* cache);
+
+    // Stops listening, closes every connection and removes the socket.
+    ~CompileServer();
+
+    CompileServer(const CompileServer&) = delete;
+    CompileServer& operator=(const CompileServer&) = delete;
+
+    // Serves until a STOP request or stop(); requests in progress are
+    // finished first.
+    void serve();
+
+    // Callable from any thread, and from a signal handler.
+    void stop();
+
+    // "N connections, N requests, ..." for STATUS requests.
+    string status();
+
+private:
+    struct Document;
+
+    static constexpr size_t DOCUMENT_BYTES = 16u << 20;
+
+    string socketPath;
+    int listener = -1;
+    int wake[2] = { -1, -1 };       // pipe: stop() and finished requests
+    CompileCache* cache;
+    ThreadPool pool;
+    atomic<bool> stopping{ false };
+
+    mutex idleLock;
+    vector<int> returned;           // connections to poll again
+
+    mutex documentsLock;
+    unordered_map<string, shared_ptr<Document>> documents;
+    size_t documentBytes = 0;
+    uint64_t useCount = 0;
+
+    atomic<uint64_t> connections{ 0 }, requests{ 0 }, files{ 0 },
+                     documentHits{ 0 };
+
+    void serveOne(int fd);
+    ServerResponse answer(const ServerRequest& request);
+    FileResult compile(const string& path, const string& shownAs,
+                       const Options& opts);
+    FileResult check(const string& path, const string& shownAs);
+    shared_ptr<Document> document(const string& path);
+    void resized(const string& path, Document& doc, size_t bytes);
+};
+
+#endif
@@ -0,0 +1,282 @@
+#include "stats.h"
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <numeric>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+
+// ---------------- heap accounting ----------------
+static atomic<bool> heapCounting{ false };
+static thread_local HeapCounters heapCounters;
+
+void setHeapCounting(bool on) {
+    heapCounting.store(on, memory_order_relaxed);
+}
+
+const HeapCounters& threadHeap() {
+    return heapCounters;
+}
+
+void* operator new(size_t n) {
+    if (heapCounting.load(memory_order_relaxed)) {
+        heapCounters.allocations++;
+        heapCounters.bytes += n;
+    }
+    if (void* p = malloc(n ? n : 1)) return p;
+    throw bad_alloc();
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+size_t peakRssBytes() {
+#if defined(__unix__) || defined(__APPLE__)
+    rusage usage{};
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#if defined(__APPLE__)
+    return static_cast<size_t>(usage.ru_maxrss);           // bytes
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;    // KB
+#endif
+#else
+    return 0;
+#endif
+}
+
+
+// ---------------- node counts ----------------
+namespace {
+
+// Walks on explicit stacks: expressions nest as deep as the parser
+// allows, which is deeper than the native stack would.
+struct KindCounter {
+    CompileStats& stats;
+    vector<const Stmt*> stmts;
+    vector<const Expr*> exprs;
+    explicit KindCounter(CompileStats& s) : stats(s) {}
+
+    void count(const Stmt* root) {
+        stmts.push_back(root);
+        while (!stmts.empty()) {
+            const Stmt* s = stmts.back();
+            stmts.pop_back();
+            stats.stmtNodes[static_cast<size_t>(s->kind)]++;
+            switch (s->kind) {
+            case StmtKind::EXPR:
+                count(static_cast<const ExprStmt*>(s)->expr);
+                break;
+            case StmtKind::RETURN:
+                if (auto e = static_cast<const ReturnStmt*>(s)->expr) count(e);
+                break;
+            case StmtKind::BLOCK:
+                for (auto c : static_cast<const BlockStmt*>(s)->statements)
+                    stmts.push_back(c);
+                break;
+            case StmtKind::FUNCTION:
+                stmts.push_back(static_cast<const FunctionDecl*>(s)->body);
+                break;
+            case StmtKind::VAR_DECL:
+                break;
+            }
+        }
+    }
+
+    void count(const Expr* root) {
+        exprs.push_back(root);
+        while (!exprs.empty()) {
+            const Expr* e = exprs.back();
+            exprs.pop_back();
+            stats.exprNodes[static_cast<size_t>(e->kind)]++;
+            switch (e->kind) {
+            case ExprKind::ASSIGN:
+                exprs.push_back(static_cast<const AssignExpr*>(e)->value);
+                break;
+            case ExprKind::BINARY:
+                exprs.push_back(static_cast<const BinaryExpr*>(e)->left);
+                exprs.push_back(static_cast<const BinaryExpr*>(e)->right);
+                break;
+            case ExprKind::UNARY:
+                exprs.push_back(static_cast<const UnaryExpr*>(e)->expr);
+                break;
+            case ExprKind::CALL:
+                for (auto a : static_cast<const CallExpr*>(e)->args)
+                    exprs.push_back(a);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+};
+
+const char* const EXPR_KIND_NAMES[EXPR_KINDS] = {
+    "number", "bool", "var", "assign", "binary", "unary", "call", "error"
+};
+const char* const STMT_KIND_NAMES[STMT_KINDS] = {
+    "var_decl", "expr_stmt", "return", "block", "function"
+};
+
+}
+
+void CompileStats::countNodes(const vector<StmtPtr>& program) {
+    for (auto s : program) countNodes(s);
+}
+
+void CompileStats::countNodes(const Stmt* stmt) {
+    KindCounter(*this).count(stmt);
+}
+
+uint64_t CompileStats::nodeCount() const {
+    return accumulate(begin(exprNodes), end(exprNodes), uint64_t(0)) +
+           accumulate(begin(stmtNodes), end(stmtNodes), uint64_t(0));
+}
+
+
+// ---------------- phases ----------------
+size_t CompileStats::enter(const char* name) {
+    int depth = static_cast<int>(open.size());
+
+    // Re-entering a phase under the same parent accumulates into it.
+    size_t from = open.empty() ? 0 : open.back() + 1;
+    for (size_t i = from; i < phaseList.size(); ++i) {
+        if (phaseList[i].depth < depth) break;
+        if (phaseList[i].depth == depth && phaseList[i].name == name) {
+            open.push_back(i);
+            return i;
+        }
+    }
+
+    phaseList.push_back({ name, depth, 0, 0, {} });
+    open.push_back(phaseList.size() - 1);
+    return phaseList.size() - 1;
+}
+
+PhaseTimer::PhaseTimer(CompileStats* stats, const char* name)
+    : stats(stats) {
+    if (!stats) return;
+    index = stats->enter(name);
+    heap0 = threadHeap();
+    start = chrono::steady_clock::now();
+}
+
+PhaseTimer::~PhaseTimer() {
+    if (!stats) return;
+    double secs = chrono::duration<double>(
+        chrono::steady_clock::now() - start).count();
+    const HeapCounters& heap = threadHeap();
+
+    CompileStats::Phase& p = stats->phaseList[index];
+    p.calls++;
+    p.seconds += secs;
+    p.heap.allocations += heap.allocations - heap0.allocations;
+    p.heap.bytes += heap.bytes - heap0.bytes;
+    stats->open.pop_back();
+}
+
+
+// ---------------- reports ----------------
+static void appendf(string& out, const char* fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void appendf(string& out, const char* fmt, ...) {
+    char buf[256];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof buf, fmt, args);
+    va_end(args);
+    out += buf;
+}
+
+string CompileStats::text(const string& title) const {
+    string out = "time report: " + title + "\n";
+
+    double total = 0;
+    for (auto& p : phaseList)
+        if (p.depth == 0) total += p.seconds;
+
+    appendf(out, "  %-24s %10s %7s %12s %14s\n",
+            "phase", "ms", "%", "allocations", "bytes");
+    for (auto& p : phaseList) {
+        string name = string(2 * p.depth, ' ') + p.name;
+        if (p.calls > 1) name += " (x" + to_string(p.calls) + ")";
+        appendf(out, "  %-24s %10.3f %6.1f%% %12llu %14llu\n",
+                name.c_str(), p.seconds * 1000,
+                total > 0 ? 100 * p.seconds / total : 0.0,
+                static_cast<unsigned long long>(p.heap.allocations),
+                static_cast<unsigned long long>(p.heap.bytes));
+    }
+
+    appendf(out, "  source bytes      %llu\n",
+            static_cast<unsigned long long>(sourceBytes));
+    appendf(out, "  tokens            %llu\n",
+            static_cast<unsigned long long>(tokens));
+    appendf(out, "  AST nodes         %llu (%llu arena bytes)\n",
+            static_cast<unsigned long long>(nodeCount()),
+            static_cast<unsigned long long>(astBytes));
+    for (size_t k = 0; k < STMT_KINDS; ++k)
+        if (stmtNodes[k])
+            appendf(out, "    %-15s %llu\n", STMT_KIND_NAMES[k],
+                    static_cast<unsigned long long>(stmtNodes[k]));
+    for (size_t k = 0; k < EXPR_KINDS; ++k)
+        if (exprNodes[k])
+            appendf(out, "    %-15s %llu\n", EXPR_KIND_NAMES[k],
+                    static_cast<unsigned long long>(exprNodes[k]));
+    appendf(out, "  scopes entered    %llu\n",
+            static_cast<unsigned long long>(scopesEntered));
+    appendf(out, "  symbol lookups    %llu\n",
+            static_cast<unsigned long long>(symbolLookups));
+    appendf(out, "  peak RSS          %.1f MB (process)\n",
+            peakRssBytes() / (1024.0 * 1024.0));
+    return out;
+}
+
+// Paths are the only free text; escape what JSON requires.
+static string jsonString(const string& s) {
+    string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') { out += '\\'; out += c; }
+        else if (static_cast<unsigned char>(c) < 0x20) appendf(out, "\\u%04x", c);
+        else out += c;
+    }
+    return out + "\"";
+}
+
+string CompileStats::json(const string& title) const {
+    string out = "{\"file\":" + jsonString(title) + ",\"phases\":[";
+
+    for (size_t i = 0; i < phaseList.size(); ++i) {
+        const Phase& p = phaseList[i];
+        appendf(out, "%s{\"name\":%s,\"depth\":%d,\"calls\":%llu,"
+                "\"seconds\":%.9f,\"allocations\":%llu,\"bytes\":%llu}",
+                i ? "," : "", jsonString(p.name).c_str(), p.depth,
+                static_cast<unsigned long long>(p.calls), p.seconds,
+                static_cast<unsigned long long>(p.heap.allocations),
+                static_cast<unsigned long long>(p.heap.bytes));
+    }
+
+    appendf(out, "],\"source_bytes\":%llu,\"tokens\":%llu,\"ast_nodes\":{",
+            static_cast<unsigned long long>(sourceBytes),
+            static_cast<unsigned long long>(tokens));
+    for (size_t k = 0; k < STMT_KINDS; ++k)
+        appendf(out, "\"%s\":%llu,", STMT_KIND_NAMES[k],
+                static_cast<unsigned long long>(stmtNodes[k]));
+    for (size_t k = 0; k < EXPR_KINDS; ++k)
+        appendf(out, "\"%s\":%llu%s", EXPR_KIND_NAMES[k],
+                static_cast<unsigned long long>(exprNodes[k]),
+                k + 1 < EXPR_KINDS ? "," : "");
+
+    appendf(out, "},\"ast_bytes\":%llu,\"scopes_entered\":%llu,"
+            "\"symbol_lookups\":%llu,\"peak_rss_bytes\":%zu}",
+            static_cast<unsigned long long>(astBytes),
+            static_cast<unsigned long long>(scopesEntered),
+            static_cast<unsigned long long>(symbolLookups),
+            peakRssBytes());
+    return out;
+}
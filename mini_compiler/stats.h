@@ -0,0 +1,101 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "ast.h"
+
+using namespace std;
+
+// ---------------- heap accounting ----------------
+
+// Calls to operator new and bytes requested, per thread.
+struct HeapCounters {
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+};
+
+// The process's operator new (replaced in stats.cpp) counts into the
+// calling thread's HeapCounters while counting is on. It is off by
+// default, leaving one predictable branch per allocation.
+void setHeapCounting(bool on);
+const HeapCounters& threadHeap();
+
+// Peak resident set size of the process so far, in bytes (0 where
+// the OS does not report it).
+size_t peakRssBytes();
+
+
+// ---------------- compile statistics ----------------
+
+//
+// What one compilation spent, phase by phase, -ftime-report style.
+// Passes get a null CompileStats* when reporting is off; PhaseTimer
+// then does nothing, so the only standing cost is a few counter
+// increments in the symbol table and lexer.
+//
+class CompileStats {
+public:
+    // A timed region. Phases nest; entering the same name twice under
+    // the same parent (streaming mode parses and checks one
+    // declaration at a time) adds to the existing entry.
+    struct Phase {
+        string name;
+        int depth = 0;
+        uint64_t calls = 0;
+        double seconds = 0;
+        HeapCounters heap;      // allocated on the timing thread
+    };
+
+    uint64_t tokens = 0;
+    uint64_t exprNodes[EXPR_KINDS] = {};
+    uint64_t stmtNodes[STMT_KINDS] = {};
+    uint64_t astBytes = 0;          // arena bytes, summed over resets
+    uint64_t scopesEntered = 0;
+    uint64_t symbolLookups = 0;     // variable and function lookups
+    uint64_t sourceBytes = 0;
+
+    const vector<Phase>& phases() const { return phaseList; }
+
+    // Adds every node of `program` to the per-kind counts.
+    void countNodes(const vector<StmtPtr>& program);
+    void countNodes(const Stmt* stmt);
+
+    uint64_t nodeCount() const;
+
+    // Human-readable report, headed by `title` (usually the path).
+    string text(const string& title) const;
+
+    // One JSON object; `title` becomes its "file" member.
+    string json(const string& title) const;
+
+private:
+    friend class PhaseTimer;
+
+    vector<Phase> phaseList;
+    vector<size_t> open;            // indices of the phases being timed
+
+    size_t enter(const char* name);
+};
+
+// Times the enclosing scope as phase `name` of `stats`; no-op when
+// `stats` is null.
+class PhaseTimer {
+public:
+    PhaseTimer(CompileStats* stats, const char* name);
+    ~PhaseTimer();
+
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+private:
+    CompileStats* stats;
+    size_t index = 0;
+    chrono::steady_clock::time_point start;
+    HeapCounters heap0;
+};
+
+#endif
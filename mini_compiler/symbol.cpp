@@ -4,47 +4,57 @@
 using namespace std;
 
 void SymbolTable::enterScope() {
-    scopes.push_back({});
+    scopeCount++;
+    scopeStart.push_back(static_cast<uint32_t>(bindings.size()));
 }
 
 void SymbolTable::exitScope() {
-    scopes.pop_back();
-}
+    size_t start = scopeStart.back();
+    scopeStart.pop_back();
 
-bool SymbolTable::declare(const string& name,
-                          const string& type) {
-    auto& current = scopes.back();
-    if (current.count(name)) return false;
-    current[name] = type;
-    return true;
+    while (bindings.size() > start) {
+        const Entry& e = bindings.back();
+        innermost[e.name] = e.shadowed;
+        bindings.pop_back();
+    }
 }
 
-bool SymbolTable::isDeclared(const string& name) const {
-    for (auto it = scopes.rbegin(); it != scopes.rend(); ++it)
-        if (it->count(name)) return true;
-    return false;
+bool SymbolTable::declare(Symbol name,
+                          TypeId type) {
+    if (name >= innermost.size())
+        innermost.resize(name + 1, NONE);
+
+    uint32_t depth = static_cast<uint32_t>(scopeStart.size());
+    int32_t current = innermost[name];
+    if (current != NONE && bindings[current].binding.depth == depth)
+        return false;
+
+    innermost[name] = static_cast<int32_t>(bindings.size());
+    bindings.push_back({ { type, depth }, name, current });
+    return true;
 }
 
-string SymbolTable::getType(const string& name) const {
-    for (auto it = scopes.rbegin(); it != scopes.rend(); ++it)
-        if (it->count(name)) return it->at(name);
-    return "";
+optional<Binding> SymbolTable::lookup(Symbol name) const {
+    if (name >= innermost.size() || innermost[name] == NONE)
+        return nullopt;
+    return bindings[innermost[name]].binding;
 }
 
-bool SymbolTable::declareFunction(const string& name,
+bool SymbolTable::declareFunction(Symbol name,
                                  const FunctionInfo& info) {
-    if (functions.count(name))
+    if (name >= functionIndex.size())
+        functionIndex.resize(name + 1, NONE);
+
+    if (functionIndex[name] != NONE)
         return false;
 
-    functions[name] = info;
+    functionIndex[name] = static_cast<int32_t>(functions.size());
+    functions.push_back(info);
     return true;
 }
 
-bool SymbolTable::hasFunction(const string& name) const {
-    return functions.count(name);
+const FunctionInfo* SymbolTable::lookupFunction(Symbol name) const {
+    if (name >= functionIndex.size() || functionIndex[name] == NONE)
+        return nullptr;
+    return &functions[functionIndex[name]];
 }
-
-FunctionInfo SymbolTable::getFunction(const string& name) const {
-    return functions.at(name);
-}
-
@@ -1,18 +1,35 @@
 #ifndef SYMBOL_H
 #define SYMBOL_H
 
-#include <unordered_map>
+#include <cstdint>
+#include <optional>
 #include <vector>
-#include <string>
+#include "interner.h"
+#include "types.h"
 
 using namespace std;
 
 // Function metadata
 struct FunctionInfo {
-    string returnType;
-    vector<string> paramTypes;
+    TypeId returnType;
+    vector<TypeId> paramTypes;
 };
 
+// What a visible variable name resolves to.
+struct Binding {
+    TypeId type;
+    uint32_t depth;     // scope nesting level it was declared at
+};
+
+//
+// Scoped symbol table built on per-name shadow stacks.
+//
+// Every live declaration is one entry of `bindings`, in declaration
+// order; `innermost[sym]` points at the visible one and each entry
+// links to the declaration it shadows. Lookup is therefore O(1)
+// regardless of nesting depth, and leaving a scope pops exactly the
+// entries declared in it (the undo log), restoring what they shadowed.
+//
 class SymbolTable {
 public:
     // Scope handling
@@ -20,24 +37,41 @@ public:
     void exitScope();
 
     // Variables
-    bool declare(const string& name, const string& type);
-    bool isDeclared(const string& name) const;
-    string getType(const string& name) const;
+    bool declare(Symbol name, TypeId type);
+    optional<Binding> lookup(Symbol name) const;
 
     // Functions (NEW)
-    bool declareFunction(const string& name,
+    bool declareFunction(Symbol name,
                          const FunctionInfo& info);
-    bool hasFunction(const string& name) const;
-    FunctionInfo getFunction(const string& name) const;
+
+    // Null if `name` is not a declared function. The pointer is
+    // invalidated by the next declareFunction.
+    const FunctionInfo* lookupFunction(Symbol name) const;
+
+    // Scopes currently open.
+    size_t depth() const { return scopeStart.size(); }
+
+    // enterScope() calls so far, for compile statistics.
+    uint64_t scopesEntered() const { return scopeCount; }
 
 private:
+    static constexpr int32_t NONE = -1;
+
+    struct Entry {
+        Binding binding;
+        Symbol name;
+        int32_t shadowed;   // previous innermost[name]
+    };
+
     // Variable scopes
-    vector<
-        unordered_map<string, string>
-    > scopes;
+    vector<Entry> bindings;
+    vector<int32_t> innermost;      // indexed by Symbol
+    vector<uint32_t> scopeStart;    // bindings.size() at enterScope
+    uint64_t scopeCount = 0;
 
     // Function table (global)
-    unordered_map<string, FunctionInfo> functions;
+    vector<FunctionInfo> functions;
+    vector<int32_t> functionIndex;  // indexed by Symbol
 };
 
 #endif
@@ -0,0 +1,227 @@
+#include "synth.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+// splitmix64: tiny, and the same sequence on every platform (the
+// <random> distributions are not).
+struct Rng {
+    uint64_t state;
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    size_t below(size_t n) { return n ? next() % n : 0; }
+    bool chance(double p) { return (next() >> 11) * 0x1.0p-53 < p; }
+};
+
+class Generator {
+public:
+    Generator(const SynthShape& shape, string& out)
+        : shape(shape), rng{ shape.seed }, out(out) {
+        for (size_t i = 0; i < max<size_t>(shape.identifiers, 1); ++i)
+            pool.push_back(poolName(i));
+    }
+
+    void function(size_t index) {
+        int params = max(shape.params, 0);
+        arity.push_back(params);
+        current = index;
+
+        out += "int f" + to_string(index) + "(";
+        visible.clear();
+        for (int p = 0; p < params; ++p) {
+            visible.push_back("p" + to_string(p));
+            out += (p ? ", int " : "int ") + visible.back();
+        }
+        out += ") {\n";
+
+        block(0, 1);
+        indent(1);
+        out += "return " + expression(shape.exprDepth) + ";\n}\n\n";
+    }
+
+    void mainFunction() {
+        out += "int main() {\n    int total;\n    total = 0;\n";
+        visible.clear();
+        for (size_t f = 0; f < arity.size(); ++f) {
+            out += "    total = total + f" + to_string(f) + "(";
+            for (int a = 0; a < arity[f]; ++a)
+                out += (a ? ", " : "") + to_string(rng.below(100));
+            out += ");\n";
+        }
+        out += "    return total;\n}\n";
+    }
+
+private:
+    const SynthShape& shape;
+    Rng rng;
+    string& out;
+
+    vector<string> pool;            // local variable names
+    vector<string> visible;         // parameters and locals in scope
+    vector<int> arity;              // of each function generated so far
+    size_t current = 0;
+    string pending;                 // being declared; not yet readable
+
+    // Varied lengths, like real code: a, b, ..., then longer words.
+    static string poolName(size_t i) {
+        static const char* stems[] = {
+            "value", "count", "index", "total", "offset", "result", "tmp",
+            "acc", "delta", "limit",
+        };
+        if (i < 26) return string(1, char('a' + i));
+        i -= 26;
+        return string(stems[i % 10]) + to_string(i / 10);
+    }
+
+    void indent(int level) { out.append(4 * level, ' '); }
+
+    // The body of a function (level 1) or a nested block: simple
+    // statements, with the next level nested half way through.
+    void block(int depth, int level) {
+        size_t scopeStart = visible.size();
+        vector<size_t> declared;        // pool indices in this scope
+
+        int statements = max(shape.statements, 1);
+        for (int s = 0; s < statements; ++s) {
+            if (depth < shape.nesting && s == statements / 2) {
+                indent(level);
+                out += "{\n";
+                block(depth + 1, level + 1);
+                indent(level);
+                out += "}\n";
+            }
+            statement(declared, scopeStart, level);
+        }
+
+        visible.resize(scopeStart);
+    }
+
+    void statement(vector<size_t>& declared, size_t scopeStart, int level) {
+        bool haveLocals = visible.size() > scopeStart;
+        if (declared.size() < pool.size() && (!haveLocals || rng.chance(0.5))) {
+            size_t i = rng.below(pool.size());
+            while (find(declared.begin(), declared.end(), i) != declared.end())
+                i = (i + 1) % pool.size();
+            declared.push_back(i);
+
+            // A shadowed outer variable must not be read on the
+            // right-hand side: it would name the new, unset local.
+            pending = pool[i];
+            indent(level);
+            out += "int " + pending + "; " + pending + " = " +
+                   expression(shape.exprDepth) + ";\n";
+            visible.push_back(pending);
+            pending.clear();
+            return;
+        }
+
+        if (visible.empty()) {
+            indent(level);
+            out += expression(shape.exprDepth) + ";\n";
+            return;
+        }
+        const string& target = visible[rng.below(visible.size())];
+        indent(level);
+        out += target + " = " + expression(shape.exprDepth) + ";\n";
+    }
+
+    // `depth` operators deep: each level wraps the one below in
+    // parentheses next to a single operand, so size grows linearly.
+    string expression(int depth) {
+        if (depth <= 0) return operand();
+
+        string inner = "(" + expression(depth - 1) + ")";
+        switch (rng.below(8)) {
+        case 0: return "-" + inner;
+        case 1: return inner + " / " + to_string(1 + rng.below(9));
+        case 2: case 3: return operand() + " * " + inner;
+        case 4: return inner + " - " + operand();
+        default: return operand() + " + " + inner;
+        }
+    }
+
+    string operand() {
+        size_t callees = min(shape.callees, current);
+        if (current >= shape.callees && callees &&
+            rng.chance(shape.callDensity))
+            return call(rng.below(callees));
+        return atom();
+    }
+
+    string call(size_t callee) {
+        string s = "f" + to_string(callee) + "(";
+        for (int a = 0; a < arity[callee]; ++a)
+            s += (a ? ", " : "") + atom();
+        return s + ")";
+    }
+
+    string atom() {
+        if (!visible.empty() && rng.below(4) != 0) {
+            const string& v = visible[rng.below(visible.size())];
+            if (v != pending) return v;
+        }
+        return to_string(rng.below(1000));
+    }
+};
+
+}
+
+string synthesize(const SynthShape& shape, size_t targetBytes) {
+    string out;
+    if (targetBytes) out.reserve(targetBytes + targetBytes / 8);
+
+    Generator gen(shape, out);
+    for (size_t i = 0; targetBytes ? out.size() < targetBytes
+                                   : i < shape.functions; ++i)
+        gen.function(i);
+    gen.mainFunction();
+    return out;
+}
+
+bool setShapeField(SynthShape& shape, const string& field) {
+    size_t eq = field.find('=');
+    if (eq == string::npos || eq + 1 == field.size()) return false;
+    string key = field.substr(0, eq), value = field.substr(eq + 1);
+    char* end = nullptr;
+
+    if (key == "calls") {
+        double d = strtod(value.c_str(), &end);
+        if (*end || d < 0 || d > 1) return false;
+        shape.callDensity = d;
+        return true;
+    }
+
+    unsigned long long n = strtoull(value.c_str(), &end, 10);
+    if (*end) return false;
+    if (key == "functions") shape.functions = n;
+    else if (key == "params") shape.params = static_cast<int>(n);
+    else if (key == "statements") shape.statements = static_cast<int>(n);
+    else if (key == "nesting") shape.nesting = static_cast<int>(n);
+    else if (key == "expr") shape.exprDepth = static_cast<int>(n);
+    else if (key == "idents") shape.identifiers = n;
+    else if (key == "callees") shape.callees = n;
+    else if (key == "seed") shape.seed = n;
+    else return false;
+    return true;
+}
+
+string describeShape(const SynthShape& shape) {
+    char buf[256];
+    snprintf(buf, sizeof buf, "functions=%zu params=%d statements=%d "
+             "nesting=%d expr=%d calls=%g idents=%zu callees=%zu seed=%llu",
+             shape.functions, shape.params, shape.statements, shape.nesting,
+             shape.exprDepth, shape.callDensity, shape.identifiers,
+             shape.callees, static_cast<unsigned long long>(shape.seed));
+    return buf;
+}
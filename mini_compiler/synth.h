@@ -0,0 +1,45 @@
+#ifndef SYNTH_H
+#define SYNTH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+//
+// Shape of a generated program. Every program is valid: names are
+// declared before use, calls match their callee's arity and divisors
+// are non-zero literals, so each phase (and every backend) does its
+// full work. Generation is deterministic for a given shape.
+//
+struct SynthShape {
+    size_t functions = 200;
+    int params = 2;             // int parameters per function
+    int statements = 4;         // simple statements per block
+    int nesting = 1;            // blocks nested inside each body
+    int exprDepth = 3;          // operator nesting of each expression
+    double callDensity = 0.1;   // chance that an operand is a call
+    size_t identifiers = 32;    // distinct local variable names
+    size_t callees = 16;        // leading functions that make no calls
+    uint64_t seed = 1;
+};
+
+// Generates `shape.functions` functions followed by an
+// `int main()` that calls each of them once and sums the results.
+// With `targetBytes` set, functions are added until the source
+// reaches that size instead.
+//
+// Calls only go to the first `callees` functions, which call nothing
+// themselves, so running main() costs time linear in program size.
+string synthesize(const SynthShape& shape, size_t targetBytes = 0);
+
+// Applies one "key=value" field; the keys are "functions", "params",
+// "statements", "nesting", "expr", "calls", "idents", "callees" and
+// "seed". False if the key is unknown or the value malformed.
+bool setShapeField(SynthShape& shape, const string& field);
+
+// "functions=200 params=2 ...", every field in setShapeField() form.
+string describeShape(const SynthShape& shape);
+
+#endif
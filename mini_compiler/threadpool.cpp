@@ -0,0 +1,114 @@
+#include "threadpool.h"
+
+using namespace std;
+
+// The pool whose worker is running on this thread (if any), and
+// that worker's index.
+static thread_local const ThreadPool* currentPool = nullptr;
+static thread_local size_t currentWorker = 0;
+
+ThreadPool::ThreadPool(size_t threads) {
+    if (threads == 0)
+        threads = max<size_t>(1, thread::hardware_concurrency());
+
+    for (size_t i = 0; i < threads; ++i)
+        workers.push_back(make_unique<Worker>());
+    for (size_t i = 0; i < threads; ++i)
+        workers[i]->th = thread(&ThreadPool::run, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard<mutex> guard(stateLock);
+        stopping = true;
+    }
+    workAvailable.notify_all();
+    for (auto& w : workers)
+        w->th.join();
+}
+
+void ThreadPool::submit(function<void()> task) {
+    size_t target = currentPool == this
+        ? currentWorker
+        : nextVictim.fetch_add(1, memory_order_relaxed) % workers.size();
+
+    // Counted before it is published: a worker may take and finish it
+    // the moment it is in the deque, and must not decrement first. A
+    // worker that sees the count before the task only spins briefly.
+    {
+        lock_guard<mutex> guard(stateLock);
+        queued++;
+        unfinished++;
+    }
+    {
+        lock_guard<mutex> guard(workers[target]->lock);
+        workers[target]->tasks.push_back(move(task));
+    }
+    workAvailable.notify_one();
+}
+
+void ThreadPool::wait() {
+    unique_lock<mutex> guard(stateLock);
+    allDone.wait(guard, [this] { return unfinished == 0; });
+
+    if (firstError) {
+        exception_ptr e = firstError;
+        firstError = nullptr;
+        rethrow_exception(e);
+    }
+}
+
+// Own deque from the back, then the others' from the front.
+bool ThreadPool::take(size_t self, function<void()>& task) {
+    size_t n = workers.size();
+    for (size_t k = 0; k < n; ++k) {
+        Worker& w = *workers[(self + k) % n];
+        lock_guard<mutex> guard(w.lock);
+        if (w.tasks.empty()) continue;
+
+        if (k == 0) {
+            task = move(w.tasks.back());
+            w.tasks.pop_back();
+        }
+        else {
+            task = move(w.tasks.front());
+            w.tasks.pop_front();
+        }
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::run(size_t self) {
+    currentPool = this;
+    currentWorker = self;
+
+    for (;;) {
+        function<void()> task;
+        if (take(self, task)) {
+            {
+                lock_guard<mutex> guard(stateLock);
+                queued--;
+            }
+
+            exception_ptr error;
+            try {
+                task();
+            }
+            catch (...) {
+                error = current_exception();
+            }
+
+            lock_guard<mutex> guard(stateLock);
+            if (error && !firstError) firstError = error;
+            if (--unfinished == 0) allDone.notify_all();
+            continue;
+        }
+
+        // Nothing to take. `queued` only changes under stateLock, so a
+        // task submitted after the scan above is not missed.
+        unique_lock<mutex> guard(stateLock);
+        workAvailable.wait(guard, [this] { return queued > 0 || stopping; });
+        if (stopping && queued == 0) return;
+    }
+}
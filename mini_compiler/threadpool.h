@@ -0,0 +1,64 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+//
+// Fixed-size work-stealing thread pool.
+//
+// Every worker owns a deque: it pushes and pops its own work at the
+// back (newest first, cache-warm) and, when that runs dry, steals
+// from the front of the others' (oldest first). Tasks submitted from
+// outside the pool are dealt round-robin across the deques.
+//
+class ThreadPool {
+public:
+    // 0 means one worker per hardware thread.
+    explicit ThreadPool(size_t threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(function<void()> task);
+
+    // Blocks until every submitted task has finished; rethrows the
+    // first exception a task threw, if any.
+    void wait();
+
+    size_t size() const { return workers.size(); }
+
+private:
+    struct Worker {
+        mutex lock;
+        deque<function<void()>> tasks;
+        thread th;
+    };
+
+    vector<unique_ptr<Worker>> workers;
+    atomic<size_t> nextVictim{0};       // round-robin target for submit()
+
+    mutex stateLock;
+    condition_variable workAvailable;
+    condition_variable allDone;
+    size_t queued = 0;                  // tasks sitting in some deque
+    size_t unfinished = 0;              // submitted but not yet finished
+    bool stopping = false;
+    exception_ptr firstError;
+
+    void run(size_t self);
+    bool take(size_t self, function<void()>& task);
+};
+
+#endif
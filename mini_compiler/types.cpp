@@ -0,0 +1,42 @@
+#include "types.h"
+#include <stdexcept>
+
+using namespace std;
+
+TypeTable::TypeTable() {
+    intern({ TypeKind::BUILTIN, "int", {} });
+    intern({ TypeKind::BUILTIN, "bool", {} });
+    intern({ TypeKind::BUILTIN, "void", {} });
+    intern({ TypeKind::BUILTIN, "<error>", {} });
+}
+
+string TypeTable::keyOf(const TypeInfo& info) {
+    string key(1, char('0' + static_cast<int>(info.kind)));
+    key += info.name;
+    for (TypeId op : info.operands)
+        key += ',' + to_string(op);
+    return key;
+}
+
+TypeId TypeTable::intern(const TypeInfo& info) {
+    string key = keyOf(info);
+
+    auto it = byKey.find(key);
+    if (it != byKey.end())
+        return it->second;
+
+    TypeId id = static_cast<TypeId>(types.size());
+    types.push_back(info);
+    byKey.emplace(move(key), id);
+    return id;
+}
+
+TypeId builtinType(TokenType keyword) {
+    switch (keyword) {
+    case TokenType::INT:  return TypeTable::INT;
+    case TokenType::BOOL: return TypeTable::BOOL;
+    case TokenType::VOID: return TypeTable::VOID;
+    default:
+        throw logic_error("not a type keyword");
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef TYPES_H
+#define TYPES_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "lexer.h"
+
+using namespace std;
+
+// Handle to an entry of a TypeTable. Two types are equal iff their
+// ids are equal.
+using TypeId = uint32_t;
+
+// Only builtins exist today. Compound kinds (function, pointer,
+// struct) get their own entry here and describe themselves through
+// TypeInfo::operands; TypeTable::intern hash-conses them so that
+// structurally equal types share one TypeId.
+enum class TypeKind : uint8_t {
+    BUILTIN
+};
+
+struct TypeInfo {
+    TypeKind kind;
+    string name;
+    vector<TypeId> operands;
+};
+
+class TypeTable {
+public:
+    // Builtins are registered first, in this order, by every table.
+    static constexpr TypeId INT  = 0;
+    static constexpr TypeId BOOL = 1;
+    static constexpr TypeId VOID = 2;
+
+    // Type of an expression that already produced a diagnostic.
+    // Checks involving it are skipped, so one mistake is reported
+    // once instead of at every use.
+    static constexpr TypeId ERROR = 3;
+
+    // "No type" (e.g. lookup of an undeclared name).
+    static constexpr TypeId NONE = UINT32_MAX;
+
+    TypeTable();
+
+    TypeId intern(const TypeInfo& info);
+
+    const TypeInfo& info(TypeId id) const { return types[id]; }
+    const string& name(TypeId id) const { return types[id].name; }
+    size_t size() const { return types.size(); }
+
+private:
+    vector<TypeInfo> types;
+    unordered_map<string, TypeId> byKey;
+
+    static string keyOf(const TypeInfo& info);
+};
+
+// Builtin type named by a type keyword token (INT, BOOL or VOID).
+TypeId builtinType(TokenType keyword);
+
+#endif
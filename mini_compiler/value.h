@@ -0,0 +1,44 @@
+#ifndef VALUE_H
+#define VALUE_H
+
+#include <cstdint>
+#include <stdexcept>
+
+using namespace std;
+
+// Runtime representation of int and bool values in every backend.
+// Bools are 0/1. Arithmetic wraps around (two's complement) instead
+// of being undefined on overflow, so all backends agree bit for bit.
+using Value = int64_t;
+
+inline Value valueAdd(Value a, Value b) {
+    return static_cast<Value>(static_cast<uint64_t>(a) + static_cast<uint64_t>(b));
+}
+
+inline Value valueSub(Value a, Value b) {
+    return static_cast<Value>(static_cast<uint64_t>(a) - static_cast<uint64_t>(b));
+}
+
+inline Value valueMul(Value a, Value b) {
+    return static_cast<Value>(static_cast<uint64_t>(a) * static_cast<uint64_t>(b));
+}
+
+inline Value valueNeg(Value a) {
+    return static_cast<Value>(0 - static_cast<uint64_t>(a));
+}
+
+// Callers must reject b == 0 first.
+inline Value valueDiv(Value a, Value b) {
+    if (b == -1) return valueNeg(a);    // INT64_MIN / -1 would trap
+    return a / b;
+}
+
+// A fault of the program being run, such as a division by zero or a
+// stack overflow. Every engine raises the same one for the same
+// program, so unlike failures of the machine running it (out of
+// memory, no executable pages) it is a result, and may be cached.
+struct RuntimeTrap : runtime_error {
+    using runtime_error::runtime_error;
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef VISITOR_H
+#define VISITOR_H
+
+#include "ast.h"
+
+using namespace std;
+
+//
+// Static (CRTP) dispatch on the node kind tag. A pass derives from
+// ExprVisitor<Pass, R> / StmtVisitor<Pass, R> and defines one visitX
+// member per node kind; visitExpr/visitStmt switch on `kind` and call
+// it directly, with no virtual call or RTTI per node.
+//
+
+template <typename Derived, typename R = void>
+class ExprVisitor {
+public:
+    R visitExpr(const Expr* e) {
+        Derived& d = static_cast<Derived&>(*this);
+
+        switch (e->kind) {
+        case ExprKind::NUMBER: return d.visitNumber(static_cast<const NumberExpr*>(e));
+        case ExprKind::BOOL:   return d.visitBool(static_cast<const BoolExpr*>(e));
+        case ExprKind::VAR:    return d.visitVar(static_cast<const VarExpr*>(e));
+        case ExprKind::ASSIGN: return d.visitAssign(static_cast<const AssignExpr*>(e));
+        case ExprKind::BINARY: return d.visitBinary(static_cast<const BinaryExpr*>(e));
+        case ExprKind::UNARY:  return d.visitUnary(static_cast<const UnaryExpr*>(e));
+        case ExprKind::CALL:   return d.visitCall(static_cast<const CallExpr*>(e));
+        case ExprKind::ERROR:  return d.visitError(static_cast<const ErrorExpr*>(e));
+        }
+        __builtin_unreachable();
+    }
+};
+
+template <typename Derived, typename R = void>
+class StmtVisitor {
+public:
+    R visitStmt(const Stmt* s) {
+        Derived& d = static_cast<Derived&>(*this);
+
+        switch (s->kind) {
+        case StmtKind::VAR_DECL: return d.visitVarDecl(static_cast<const VarDecl*>(s));
+        case StmtKind::EXPR:     return d.visitExprStmt(static_cast<const ExprStmt*>(s));
+        case StmtKind::RETURN:   return d.visitReturn(static_cast<const ReturnStmt*>(s));
+        case StmtKind::BLOCK:    return d.visitBlock(static_cast<const BlockStmt*>(s));
+        case StmtKind::FUNCTION: return d.visitFunction(static_cast<const FunctionDecl*>(s));
+        }
+        __builtin_unreachable();
+    }
+};
+
+#endif
@@ -0,0 +1,214 @@
+#include "vm.h"
+#include <stdexcept>
+
+using namespace std;
+
+// Threaded dispatch (GCC/Clang "labels as values") when available,
+// a plain switch otherwise.
+#if defined(__GNUC__)
+#define VM_COMPUTED_GOTO 1
+#else
+#define VM_COMPUTED_GOTO 0
+#endif
+
+VM::VM(const BytecodeModule& module, size_t stackSlots, size_t maxFrames)
+    : module(module), stack(stackSlots), maxFrames(maxFrames) {
+    frames.reserve(maxFrames);
+}
+
+Value VM::run(uint16_t entry) {
+    if (module.functions.at(entry).arity != 0)
+        throw runtime_error("Entry function must take no arguments");
+
+    globals.assign(module.globalCount, 0);
+    dispatches = 0;
+
+    execute(BytecodeModule::INIT);
+    return execute(entry);
+}
+
+static inline uint16_t readU16(const uint8_t* ip) {
+    return static_cast<uint16_t>(ip[0] | (ip[1] << 8));
+}
+
+Value VM::execute(uint16_t function) {
+    const uint8_t* code = module.code.data();
+    const Value* constants = module.constants.data();
+    const FunctionCode* functions = module.functions.data();
+    Value* globalSlots = globals.data();
+    Value* stackEnd = stack.data() + stack.size();
+
+    const FunctionCode& fn = functions[function];
+    const uint8_t* ip = code + fn.entry;
+    Value* fp = stack.data();
+    Value* sp = fp;
+    uint64_t count = 0;
+
+    if (fp + fn.localCount + fn.maxStack > stackEnd)
+        throw RuntimeTrap("Stack overflow");
+    for (uint16_t i = 0; i < fn.localCount; ++i) *sp++ = 0;
+
+    frames.clear();
+    frames.push_back({ nullptr, fp });
+
+#if VM_COMPUTED_GOTO
+    static void* const labels[] = {
+        &&L_CONST, &&L_LOAD, &&L_STORE, &&L_GLOAD, &&L_GSTORE,
+        &&L_POP, &&L_ADD, &&L_SUB, &&L_MUL, &&L_DIV, &&L_NEG,
+        &&L_EQ, &&L_NE, &&L_LT, &&L_LE, &&L_GT, &&L_GE, &&L_NOT,
+        &&L_JUMP_FALSE_OR_POP, &&L_JUMP_TRUE_OR_POP,
+        &&L_CALL, &&L_RET, &&L_RET_VOID
+    };
+    static_assert(sizeof(labels) / sizeof(labels[0]) ==
+                  static_cast<size_t>(Op::COUNT), "opcode table");
+
+#define VM_CASE(op)   L_##op:
+#define VM_NEXT()     do { ++count; goto *labels[*ip++]; } while (0)
+    VM_NEXT();
+#else
+#define VM_CASE(op)   case Op::op:
+#define VM_NEXT()     continue
+    for (;;) {
+    ++count;
+    switch (static_cast<Op>(*ip++)) {
+#endif
+
+    VM_CASE(CONST) {
+        *sp++ = constants[readU16(ip)];
+        ip += 2;
+        VM_NEXT();
+    }
+    VM_CASE(LOAD) {
+        *sp++ = fp[readU16(ip)];
+        ip += 2;
+        VM_NEXT();
+    }
+    VM_CASE(STORE) {
+        fp[readU16(ip)] = sp[-1];
+        ip += 2;
+        VM_NEXT();
+    }
+    VM_CASE(GLOAD) {
+        *sp++ = globalSlots[readU16(ip)];
+        ip += 2;
+        VM_NEXT();
+    }
+    VM_CASE(GSTORE) {
+        globalSlots[readU16(ip)] = sp[-1];
+        ip += 2;
+        VM_NEXT();
+    }
+    VM_CASE(POP) {
+        --sp;
+        VM_NEXT();
+    }
+    VM_CASE(ADD) {
+        --sp;
+        sp[-1] = valueAdd(sp[-1], sp[0]);
+        VM_NEXT();
+    }
+    VM_CASE(SUB) {
+        --sp;
+        sp[-1] = valueSub(sp[-1], sp[0]);
+        VM_NEXT();
+    }
+    VM_CASE(MUL) {
+        --sp;
+        sp[-1] = valueMul(sp[-1], sp[0]);
+        VM_NEXT();
+    }
+    VM_CASE(DIV) {
+        --sp;
+        if (sp[0] == 0) {
+            dispatches += count;
+            throw RuntimeTrap("Division by zero");
+        }
+        sp[-1] = valueDiv(sp[-1], sp[0]);
+        VM_NEXT();
+    }
+    VM_CASE(NEG) {
+        sp[-1] = valueNeg(sp[-1]);
+        VM_NEXT();
+    }
+    VM_CASE(EQ) { --sp; sp[-1] = sp[-1] == sp[0]; VM_NEXT(); }
+    VM_CASE(NE) { --sp; sp[-1] = sp[-1] != sp[0]; VM_NEXT(); }
+    VM_CASE(LT) { --sp; sp[-1] = sp[-1] < sp[0];  VM_NEXT(); }
+    VM_CASE(LE) { --sp; sp[-1] = sp[-1] <= sp[0]; VM_NEXT(); }
+    VM_CASE(GT) { --sp; sp[-1] = sp[-1] > sp[0];  VM_NEXT(); }
+    VM_CASE(GE) { --sp; sp[-1] = sp[-1] >= sp[0]; VM_NEXT(); }
+    VM_CASE(NOT) {
+        sp[-1] = !sp[-1];
+        VM_NEXT();
+    }
+    VM_CASE(JUMP_FALSE_OR_POP) {
+        if (sp[-1] == 0) ip += readU16(ip);
+        else --sp;
+        ip += 2;
+        VM_NEXT();
+    }
+    VM_CASE(JUMP_TRUE_OR_POP) {
+        if (sp[-1] != 0) ip += readU16(ip);
+        else --sp;
+        ip += 2;
+        VM_NEXT();
+    }
+    VM_CASE(CALL) {
+        const FunctionCode& callee = functions[readU16(ip)];
+        ip += 2;
+
+        Value* newFp = sp - callee.arity;
+        if (frames.size() == maxFrames ||
+            newFp + callee.localCount + callee.maxStack > stackEnd) {
+            dispatches += count;
+            throw RuntimeTrap("Stack overflow");
+        }
+
+        frames.push_back({ ip, fp });
+        fp = newFp;
+        for (uint16_t i = callee.arity; i < callee.localCount; ++i)
+            *sp++ = 0;
+        ip = code + callee.entry;
+        VM_NEXT();
+    }
+    VM_CASE(RET) {
+        Value result = sp[-1];
+        Frame frame = frames.back();
+        frames.pop_back();
+
+        if (!frame.returnIp) {
+            dispatches += count;
+            return result;
+        }
+
+        sp = fp;
+        *sp++ = result;
+        fp = frame.fp;
+        ip = frame.returnIp;
+        VM_NEXT();
+    }
+    VM_CASE(RET_VOID) {
+        Frame frame = frames.back();
+        frames.pop_back();
+
+        if (!frame.returnIp) {
+            dispatches += count;
+            return 0;
+        }
+
+        sp = fp;
+        *sp++ = 0;
+        fp = frame.fp;
+        ip = frame.returnIp;
+        VM_NEXT();
+    }
+
+#if !VM_COMPUTED_GOTO
+    default:
+        throw runtime_error("Invalid opcode");
+    }
+    }
+#endif
+
+#undef VM_CASE
+#undef VM_NEXT
+}
@@ -0,0 +1,44 @@
+#ifndef VM_H
+#define VM_H
+
+#include <cstdint>
+#include <vector>
+#include "bytecode.h"
+
+using namespace std;
+
+//
+// Interpreter for BytecodeModule. All frames share one preallocated
+// value stack: a call's arguments, already pushed by the caller,
+// become the first locals of the callee's frame.
+//
+class VM {
+public:
+    explicit VM(const BytecodeModule& module,
+                size_t stackSlots = 1 << 20,
+                size_t maxFrames = 1 << 16);
+
+    // Runs the initializer, then function `entry` (which must take no
+    // arguments) and returns its result.
+    Value run(uint16_t entry);
+
+    // Instructions executed by the last run().
+    uint64_t dispatchCount() const { return dispatches; }
+
+private:
+    struct Frame {
+        const uint8_t* returnIp;    // null for the outermost frame
+        Value* fp;
+    };
+
+    const BytecodeModule& module;
+    vector<Value> stack;
+    vector<Value> globals;
+    vector<Frame> frames;
+    size_t maxFrames;
+    uint64_t dispatches = 0;
+
+    Value execute(uint16_t function);
+};
+
+#endif
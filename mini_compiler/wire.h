@@ -0,0 +1,58 @@
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+// Little-endian fixed-width fields and length-prefixed strings, for
+// cache entries and the compile server's messages.
+struct ByteWriter {
+    string out;
+
+    void u8(uint8_t v) { out += static_cast<char>(v); }
+    void u32(uint32_t v) { out.append(reinterpret_cast<const char*>(&v), sizeof v); }
+    void u64(uint64_t v) { out.append(reinterpret_cast<const char*>(&v), sizeof v); }
+    void str(string_view s) {
+        u32(static_cast<uint32_t>(s.size()));
+        out += s;
+    }
+};
+
+// Reads past the end set `failed` and yield zeros.
+struct ByteReader {
+    string_view in;
+    size_t pos = 0;
+    bool failed = false;
+
+    bool take(void* dst, size_t n) {
+        if (failed || in.size() - pos < n) {
+            failed = true;
+            return false;
+        }
+        memcpy(dst, in.data() + pos, n);
+        pos += n;
+        return true;
+    }
+    uint8_t u8() { uint8_t v = 0; take(&v, sizeof v); return v; }
+    uint32_t u32() { uint32_t v = 0; take(&v, sizeof v); return v; }
+    uint64_t u64() { uint64_t v = 0; take(&v, sizeof v); return v; }
+    string str() {
+        uint32_t n = u32();
+        if (failed || in.size() - pos < n) {
+            failed = true;
+            return {};
+        }
+        string s(in.substr(pos, n));
+        pos += n;
+        return s;
+    }
+
+    // Everything was read, and nothing more.
+    bool done() const { return !failed && pos == in.size(); }
+};
+
+#endif